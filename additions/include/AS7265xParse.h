@@ -0,0 +1,95 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef AS7265XPARSE_H
+#define AS7265XPARSE_H
+
+#include <glib.h>
+#include <array>
+
+#include "LineFramer.h"
+
+#define AS7265X_CHANNELS 18
+
+/* Readings of every channel, in wavelength order from 410 nm to 940 nm. */
+typedef std::array<guint16, AS7265X_CHANNELS> AS7265xRaw;
+typedef std::array<gfloat, AS7265X_CHANNELS> AS7265xCalibrated;
+
+/* Result of reading one number, in the style of std::from_chars. ptr is one past the last
+* character used, and ok is FALSE, with ptr left at first, if there was no number there.
+*/
+struct NumberResult {
+    const gchar* ptr;
+    gboolean ok;
+};
+
+namespace AS7265xParse {
+
+    /* The wavelength in nm of each field of an ATDATA or ATCDATA reply, in the order the board
+    * sends them: R S T U V W from the AS72651, G H I J K L from the AS72652, A B C D E F from
+    * the AS72653.
+    */
+    constexpr std::array<guint16, AS7265X_CHANNELS> field_wavelength = {
+        610, 680, 730, 760, 810, 860, 560, 585, 645, 705, 900, 940, 410, 435, 460, 485, 510, 535 };
+
+    /* Position in wavelength order of a field. Counts the fields with a shorter wavelength. */
+    constexpr gsize rankOf(gsize field) {
+        gsize rank = 0;
+        for (gsize i = 0; i < AS7265X_CHANNELS; ++i)
+            rank += (field_wavelength[i] < field_wavelength[field]) ? 1 : 0;
+        return rank;
+    }
+
+    /* field_rank[field] is where a reply field goes in the wavelength ordered arrays. */
+    constexpr std::array<guint8, AS7265X_CHANNELS> field_rank = {
+        rankOf(0), rankOf(1), rankOf(2), rankOf(3), rankOf(4), rankOf(5), rankOf(6), rankOf(7), rankOf(8),
+        rankOf(9), rankOf(10), rankOf(11), rankOf(12), rankOf(13), rankOf(14), rankOf(15), rankOf(16), rankOf(17) };
+
+    /* The wavelength in nm of each entry of the wavelength ordered arrays. */
+    constexpr guint16 wavelengthAt(gsize rank) {
+        gsize field = 0;
+        while (field_rank[field] != rank)
+            ++field;
+        return field_wavelength[field];
+    }
+
+    constexpr std::array<guint16, AS7265X_CHANNELS> wavelength = {
+        wavelengthAt(0), wavelengthAt(1), wavelengthAt(2), wavelengthAt(3), wavelengthAt(4), wavelengthAt(5),
+        wavelengthAt(6), wavelengthAt(7), wavelengthAt(8), wavelengthAt(9), wavelengthAt(10), wavelengthAt(11),
+        wavelengthAt(12), wavelengthAt(13), wavelengthAt(14), wavelengthAt(15), wavelengthAt(16), wavelengthAt(17) };
+
+    /* An unsigned decimal integer that fits in 16 bits. */
+    NumberResult parseUnsigned(const gchar* first, const gchar* last, guint16* value);
+
+    /* A decimal number with an optional sign, fraction and exponent, such as -12.5 or 1.25e3.
+    * Hexadecimal, inf and nan are not accepted.
+    */
+    NumberResult parseFloat(const gchar* first, const gchar* last, gfloat* value);
+
+    /* An ATDATA reply, AS7265X_CHANNELS comma separated counts with an optional OK after them.
+    * Nothing is written to raw unless the whole line is good.
+    */
+    gboolean parseRaw(LineView line, AS7265xRaw* raw);
+
+    /* An ATCDATA reply, or a line of an ATBURST, in the same layout as parseRaw. */
+    gboolean parseCalibrated(LineView line, AS7265xCalibrated* calibrated);
+}
+
+#endif //AS7265XPARSE_H
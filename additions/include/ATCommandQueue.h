@@ -0,0 +1,134 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef ATCOMMANDQUEUE_H
+#define ATCOMMANDQUEUE_H
+
+#include <glib.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "LineFramer.h"
+
+class SerialPort;
+
+#define AT_COMMAND_TIMEOUT_MS 500 //From the previous reply, for a command that answers straight away
+#define AT_COMMAND_RETRIES 2
+#define AT_RESYNC_QUIET_MS 50 //Shortest quiet time on the port before commands are sent again
+
+enum ATReplyStatus {
+    AT_REPLY_OK = 0,
+    AT_REPLY_ERROR, //The device answered ERROR on the last try
+    AT_REPLY_MISMATCH, //The line matched to it on the last try had the wrong number of fields
+    AT_REPLY_TIMEOUT //No answer on the last try
+};
+
+/* A reply matched to its command. The line is only valid for the length of the call, and is
+* empty for AT_REPLY_TIMEOUT.
+*/
+struct ATReply {
+    guint tag; //As given to submit, to tell the commands of a batch apart
+    ATReplyStatus status;
+    LineView line;
+    guint tries;
+    gint64 latency; //us from the batch being written to this reply
+    gint64 time; //Monotonic time the line was read from the port, or of the timeout
+    gboolean more; //A streamed line, with more of the stream to come
+};
+
+typedef void (*ATReplyFunc)(const ATReply& reply, gpointer user_data);
+
+struct ATQueueStats {
+    guint64 commands; //Commands submitted
+    guint64 writes; //writev calls, one a batch and one a resend
+    guint64 replies; //Replies matched to a command
+    guint64 streamed; //Lines of streams before their last one
+    guint64 retries; //Commands sent again after an ERROR or a timeout
+    guint64 failures; //Commands that ran out of tries
+    guint64 unmatched; //Lines that came in with no command waiting for them
+    gint64 max_latency; //us, the slowest batch from write to its last reply
+};
+
+/* Sends AT commands to the port without waiting for each reply. Commands are submitted, then
+* flush writes the whole batch back to back in one writev. The device answers each command with
+* one line, in the order they were sent, so replies are matched to commands first in first out.
+* A command can give the number of comma separated fields its reply has, so a lost reply is caught
+* when the next one does not fit. Each command has its own timeout, counted from the reply before
+* it. When a command times out, gets a reply that does not fit, or the device answers ERROR, the
+* queue waits for the port to go quiet, so no late reply can be matched to the wrong command, then
+* sends it and everything after it again.
+*
+* A streamed command answers with any number of lines with its field count, and ends with a line
+* ending in OK. Each line goes to the reply function as it arrives, and the timeout is for each
+* line. Streams are never sent again, as the lines already handed on can not be taken back.
+*/
+class ATCommandQueue {
+public:
+    ATCommandQueue(SerialPort* serial_port);
+    ~ATCommandQueue();
+
+    void submit(const gchar* command, guint tag, guint fields, ATReplyFunc func, gpointer user_data,
+        guint timeout_ms = AT_COMMAND_TIMEOUT_MS, guint retries = AT_COMMAND_RETRIES);
+    void submitStream(const gchar* command, guint tag, guint fields, ATReplyFunc func, gpointer user_data,
+        guint timeout_ms);
+    gint flush(GError** error);
+    gboolean idle() const;
+    ATQueueStats getStats() const;
+
+private:
+    struct ATCommand {
+        std::string command;
+        guint tag;
+        guint fields; //Comma separated fields in the reply, 0 for any
+        ATReplyFunc func;
+        gpointer user_data;
+        guint timeout_ms;
+        guint tries_left;
+        guint tries;
+        gint64 batch_time; //When the write this command went out in was made
+        gboolean stream;
+    };
+
+    SerialPort* serial_port_;
+    std::deque<ATCommand> pending_; //Submitted, not yet written
+    std::deque<ATCommand> in_flight_; //Written, waiting for a reply, oldest first
+    std::vector<const gchar*> lines_; //Kept to save allocating for each write
+    guint timeout_source_;
+    guint resync_source_;
+    guint resync_quiet_ms_; //How long the port has to be quiet before the resync ends
+    ATQueueStats stats_;
+
+    gint writeCommands(std::deque<ATCommand>::iterator first, GError** error);
+    void armTimeout();
+    void disarm(guint* source);
+    gint64 replyTime(ATReplyStatus status) const;
+    void finish(ATReplyStatus status, LineView line);
+    void streamLine(LineView line);
+    void startResync(gsize first_refund);
+    static void replyLineWrapper(LineView line, gpointer user_data);
+    void replyLine(LineView line);
+    static gboolean commandTimeoutWrapper(gpointer user_data);
+    gboolean commandTimeout();
+    static gboolean resyncWrapper(gpointer user_data);
+    gboolean resync();
+};
+
+#endif //ATCOMMANDQUEUE_H
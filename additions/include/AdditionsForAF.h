@@ -2,46 +2,144 @@
 #define ADDITIONSFORAF_H
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <glib.h>
+#include <atomic>
+#include <vector>
 
 #include "cdaf.h"
+#include "FocusInterface.h"
+#include "FocusMetric.h"
+#include "FocusMap.h"
+#include "FocusWorker.h"
+#include "FocusTrace.h"
+#include "LensSettleModel.h"
+#include "FocusMemory.h"
+#include "FocusDriftDetector.h"
+#include "FocusBracket.h"
+
+#define FOCUS_SWEEP_TICK 10 //ms between lens moves while CDAF is sweeping
+#define FOCUS_START_INDEX 280 //Where the lens goes at startup
 
 class ErrorHandler;
 class AdditionsParent;
+class AF_Additions;
+
+/* A CDAF step made on the focus worker, handed to the main loop to carry out. It carries
+* everything the lens move needs, so the main loop never reads the state machine while the
+* worker may be stepping it.
+*/
+struct FocusStep {
+    AF_Additions* self;
+    guint focus_index; //Where CDAF wants the lens
+    guint timeout; //ms CDAF wants between focus frames
+    gboolean scanning;
+    gboolean focussed;
+};
 
-class AF_Additions {
+class AF_Additions : public FocusInterface {
 public:
     AF_Additions(AdditionsParent* additions_parent, ErrorHandler* error_handler);
     ~AF_Additions();
     gint setup(GError** error);
     gboolean focusImageCaptured(GstElement* fsink, GstBuffer* buffer, GstPad* pad, gpointer user_data);
     gboolean setFocusLock();
-    void focusAchieved();
-    void setScanning (gboolean value, guint timeout);
+    void focusAchieved() override;
+    void setScanning (gboolean value, guint timeout) override;
+    void setSweeping (gboolean value) override;
+    void setFocusRoi (gint x, gint y);
     static gboolean releaseFocusLockWrapper(gpointer user_data);
     static gboolean focusTriggerWrapper(gpointer user_data);
-    static gboolean runFocusWrapper(gpointer user_data);
+    static gboolean applyFocusStepWrapper(gpointer user_data);
+    static gboolean sweepFocusWrapper(gpointer user_data);
+    static gboolean applyCalibrationStepWrapper(gpointer user_data);
+    static gboolean startFocusBracketWrapper(gpointer user_data);
+    static gboolean bracketStepWrapper(gpointer user_data);
+    static gboolean bracketCaptureWrapper(gpointer user_data);
+    static gboolean logFocusStatsWrapper(gpointer user_data);
+    void releaseFocusLockAfter(guint interval);
+    void startFocusBracketAfter(guint interval);
+    gboolean focusBracketEnabled() const;
+    guint getLensIndex() const;
+    gfloat getFocussedValue() const;
+    FocusQueueStats getFocusQueueStats() const;
+    FocusStateStats getFocusStateStats(FocusStateId id) const;
+    FocusDriftStats getFocusDriftStats() const;
 
 private:
     CDAF focus_machine_;
     AdditionsParent* additions_parent_;
+    FocusMetric* focus_metric_; //Chosen at setup from the startup settings
+    FocusMap* focus_map_; //Only created when focus map mode is selected
+    GstCaps* focus_caps_; //Caps focus_video_info_ was parsed from
+    GstVideoInfo focus_video_info_;
+    FocusRoi focus_roi_; //In capture frame coordinates
+    FocusRoi focus_crop_; //The window nvvidconv copies out, in capture frame coordinates
+    FocusTrace focus_trace_; //Only opened when a trace file is given at startup
+    FocusWorker focus_worker_; //Metric and CDAF stepping run on this thread
+    LensSettleModel settle_model_; //Waits after lens moves, loaded or calibrated at startup
+    LensSettleCalibration settle_calibration_;
+    FocusMemory focus_memory_; //Where focus was last found, only touched on the focus worker thread
+    gboolean memory_dirty_; //focus_memory_ has locks that are not saved yet
+    gint64 memory_saved_; //When focus_memory_ was last saved, g_get_monotonic_time
+    FocusDriftDetector drift_detector_; //Decides when a held focus is lost, on the focus worker thread
+    FocusBracket focus_bracket_; //Only enabled when a focus bracket is given at startup
+    FocusBracketJob* bracket_job_; //The bracket being captured, nullptr when there is none
+    guint bracket_frame_; //Next frame of bracket_job_ to capture
+    guint bracket_centre_; //Where the lens was focussed when the bracket started
+    gboolean release_pending_; //The focus lock was released while a bracket was being captured
+
+    GMutex sources_mutex_;
+    std::vector<GSource*> sources_; //Callbacks queued on the main loop, removed if this object goes first
 
     gboolean grab_focus_frame_;
-    guint focus_frame_timeout_;
-    gboolean focussed_;
-    gboolean focussing_;
-    gboolean focus_lock_;
-    gboolean scanning_;    
-    gfloat focus_value_;
-    gfloat focussed_value_;
+    //Shared by the main loop, the focus worker and the streaming thread
+    std::atomic<guint> focus_frame_timeout_;
+    std::atomic<gboolean> focussed_;
+    std::atomic<gboolean> focussing_;
+    std::atomic<gboolean> focus_lock_;
+    std::atomic<gboolean> scanning_;
+    std::atomic<gboolean> sweeping_;
+    std::atomic<gint64> focus_clock_offset_; //Pipeline running time to g_get_monotonic_time, us
+    std::atomic<gint64> fresh_after_; //Frames exposed before this, us, were exposed before the lens was ready
+    std::atomic<guint> calibration_index_; //Where the settle calibration wants the lens next
+    gboolean calibrate_settle_; //Measure the lens settle times after the next focus lock
+    guint lens_index_; //Where the main loop last sent the lens
+    std::atomic<gfloat> focus_value_;
+    std::atomic<gfloat> focussed_value_;
     guint resolution_width_;
     guint resolution_height_;
 
     
     gboolean releaseFocusLock(gpointer user_data);
     //gboolean focusImageCaptured(GstElement* fsink, GstBuffer* buffer, GstPad* pad, gpointer user_data);
-    gboolean runFocus(gpointer user_data); //Will need a wrapper as this is a g_idle_add callback
-    gboolean focusTrigger(gpointer user_data); //Will need a wrapper as this is a g_idle_add callback
+    gboolean applyFocusStep(gpointer user_data); //Will need a wrapper as the focus worker queues this through addMainSource
+    gboolean sweepFocus(gpointer user_data); //Will need a wrapper as this is queued after a delay through addMainSource
+    gboolean applyCalibrationStep(gpointer user_data); //Will need a wrapper as the focus worker queues this through addMainSource
+    gboolean startFocusBracket(gpointer user_data); //Will need a wrapper as this is queued after a delay through addMainSource
+    gboolean bracketStep(gpointer user_data); //Will need a wrapper as this is queued idle through addMainSource
+    gboolean bracketCapture(gpointer user_data); //Will need a wrapper as this is queued after a delay through addMainSource
+    gboolean logFocusStats(gpointer user_data); //Will need a wrapper as this repeats through addMainSource
+
+    /* Queue a callback on the main loop from any thread, like g_idle_add or g_timeout_add, and
+    * keep it so the destructor can remove it if it has not run. data defaults to this object.
+    */
+    guint addMainSource(gint priority, guint interval, GSourceFunc func, gpointer data = nullptr,
+        GDestroyNotify notify = nullptr);
+    void removeMainSources();
+
+    /* When a focus frame was exposed, us on the g_get_monotonic_time clock. */
+    gint64 frameTime(GstBuffer* buffer) const;
+
+    /* Write the focus memory if it has changed and FOCUS_MEMORY_SAVE_INTERVAL has passed. */
+    void saveFocusMemory();
+
+    /* Runs on the focus worker thread for each queued focus frame. Measures the frame, checks
+    * for focus drift and steps the CDAF state machine. Only the lens move and the request for
+    * the next frame go back to the main loop, through applyFocusStep.
+    */
+    void processFocusFrame(GstBuffer* buffer, GstVideoInfo* info);
+    gboolean focusTrigger(gpointer user_data); //Will need a wrapper as this is queued on the main loop through addMainSource
 
      /* At the moment trigger_focus_capture simply sets a flag to tell focus_image_captured
     * to process a frame, which will normally result in setting an idleRunFocus callback
@@ -50,12 +148,16 @@ private:
 
     void triggerFocusCapture();
 
-    /* When a frame is set process in focus_image_captured, laplacianMean is called to
-    * calculate the actual focus value of the frame. If the focus is set, then the focus value
-    * has to differ from the set focus value in order to attempt focus again. If the system is 
-    * trying to focus, then the new value is sent straight through to the algorithm.
+    /* When a frame is set process in focus_image_captured, measureFocus is called to
+    * calculate the actual focus value of the frame with the selected focus metric.
+    * If the focus is set, then the focus value has to differ from the set focus value
+    * in order to attempt focus again. If the system is trying to focus, then the new
+    * value is sent straight through to the algorithm.
     */
-    gfloat laplacianMean (GstMapInfo *padinfo);
+    gfloat measureFocus (const LumaPlane& luma);
+
+    /* Keep focus_video_info_ in step with the caps negotiated on the focus sink pad. */
+    gboolean updateFocusVideoInfo(GstPad* pad);
 
 
     /* GstElement *camera is the pipeline. All elements will need to be added to the camera pipeline.
@@ -33,17 +33,22 @@ public:
     AdditionsParent(GMainContext* main_context, gint* width, gint* height,
         TriggerImageCapture trigger_image_capture,
         AdditionsExitCapture additions_exit_capture, FocusValveOpen focus_valve_open,
-        FocusValveClose focus_valve_close, GError** error);
+        FocusValveClose focus_valve_close, FocusCropSet focus_crop_set,
+        const AdditionsSettings* settings, GError** error);
     ~AdditionsParent();
     void runSetupWrapper(gpointer user_data);
     void errorShutdown(GError** error);
     void openFocusValve();
     void closeFocusValve();
+    void setFocusCrop(gint left, gint top, gint right, gint bottom);
     void getResolution(gint* wide, gint* high);
+    const AdditionsSettings& getSettings() const;
+    GMainContext* getMainContext() const;
     gboolean focusImageCapturedWrapper(GstElement* fsink,
     GstBuffer* buffer, GstPad* pad, gpointer user_data);
     void callMeFrom_C();
     static gboolean timeoutTriggerCallback(gpointer user_data);
+    void triggerImageCapture();
 
     //Owned Objects
     ErrorHandler error_handler_;
@@ -66,6 +71,8 @@ private:
     AdditionsExitCapture additions_exit_capture_;
     FocusValveOpen focus_valve_open_;
     FocusValveClose focus_valve_close_; 
+    FocusCropSet focus_crop_set_;
+    AdditionsSettings settings_;
 
     void setup(gpointer user_data);
 };
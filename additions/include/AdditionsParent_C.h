@@ -33,11 +33,55 @@ typedef void (*TriggerImageCapture)();
 
 typedef void (*FocusValveOpen)();
 typedef void (*FocusValveClose)();
+typedef void (*FocusCropSet)(gint left, gint top, gint right, gint bottom);
+
+/*Pixels kept around the focus ROI in the focus crop, so edge pixels still have their real
+* neighbours. Even, so the NV12 chroma planes stay aligned with the crop.
+*/
+#define FOCUS_CROP_MARGIN 2
 
 typedef void (*AdditionsExitCapture)(GError**);
 
 typedef struct AdditionsParent AdditionsParent;
 
+/*Startup choices for the C++ additions. nvgstcapture-1.0 fills these from its command line
+* options and passes them to additions_parent_create, which keeps its own copy.
+*/
+typedef struct AdditionsSettings {
+    gint focus_metric; //A FocusMetricType value
+    gint focus_map_columns; //Focus map grid, 0 to use the single centre ROI
+    gint focus_map_rows;
+    gint focus_map_score; //A FocusMapScore value
+    gint focus_roi_size; //Width and height of the focus ROI, fixed for the run
+    gint focus_search; //A FocusSearchMode, how CDAF finds the peak after the coarse scans
+    gint focus_scan; //A FocusScanMode, how CDAF searches the full range
+    gint focus_sweep_rate; //Focus indices per second when sweeping
+    gint focus_sweep_lag; //ms the lens runs behind the sweep, less half the exposure
+    gchar* focus_trace_file; //Record every focus frame here for focusTraceReplay, NULL for none
+    gchar* focus_settle_file; //Lens settle model to schedule focus frames from, NULL for the CDAF timeouts
+    gboolean focus_settle_calibrate; //Measure the lens settle times after the first lock, into focus_settle_file
+    gchar* focus_memory_file; //Where focus was last found, to start the next search there. NULL to always search the full range
+    gdouble focus_drift_slack; //Noise sigmas a held focus frame has to be off before it counts towards losing focus
+    gdouble focus_drift_threshold; //Noise sigmas of sustained change that lose a held focus
+    gdouble focus_drift_noise_floor; //Smallest focus value noise the drift check assumes, % of the focussed value
+    gint focus_bracket_frames; //Images in a focus bracket on the button press, merged into one. Below 2 for a single image
+    gint focus_bracket_step; //Focus indices between the bracket images
+    gchar* focus_i2c_device; //I2C bus of the focus motor, a device map identifier or a /dev/ path. NULL for camera-0
+    gint focus_stats_interval; //Seconds between logs of the AF counters while running, 0 to only log them at shutdown
+    gint spectral_integration; //AS7265x ATINTTIME, 2.8 ms steps
+    gint spectral_burst_samples; //AS7265x readings averaged on the button press. 0 for a single reading
+    gchar* spectral_device; //Serial port of the AS7265x, a device map identifier or a device path. NULL for USB0
+    gint spectral_log; //0 saves spectral data as text, 1 as text and a binary log, 2 as a binary log only
+} AdditionsSettings;
+
+void additions_settings_init(AdditionsSettings* settings);
+
+/*Size of the frames on the focus branch. The ROI plus its margin, or the whole frame in
+* focus map mode. Used by both sides so the caps and the AF agree.
+*/
+void additions_focus_crop_size(const AdditionsSettings* settings, gint frame_width, gint frame_height,
+gint* crop_width, gint* crop_height);
+
 /*These create and destroy the additions objects. All objects beneath additions_parent are built
 * by the cunstructors (without using 'new' and so should be automatically destroyed when additions
 * parent is destoryed. Cleaning up is done by each object's destructor. Therefore memory management
@@ -45,7 +89,8 @@ typedef struct AdditionsParent AdditionsParent;
 */
 AdditionsParent* additions_parent_create(GMainContext* main_context, gint* width, gint* height,
 TriggerImageCapture trigger_image_capture, AdditionsExitCapture additions_exit_capture,
-FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, GError** error);
+FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, FocusCropSet focus_crop_set,
+const AdditionsSettings* settings, GError** error);
 void additions_parent_destroy(AdditionsParent* obj);
 
 /*These functions are set as GSource callback functions*/
@@ -0,0 +1,67 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSBRACKET_H
+#define FOCUSBRACKET_H
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+#include "FocusStack.h"
+
+#define FOCUS_BRACKET_MAX_FRAMES FOCUS_STACK_MAX_IMAGES
+#define FOCUS_BRACKET_QUALITY "95" //JPEG quality of the merged image
+
+/* A bracket of image files waiting to be merged, and where the merged image goes. */
+struct FocusBracketJob {
+    std::vector<std::string> files;
+    std::string output;
+};
+
+/* The focus bracket capture mode. It plans the lens positions around the converged focus
+* index, and merges the captured images into one all in focus image with FocusStack. Merging
+* a full resolution stack takes seconds, so it runs on its own thread, one stack at a time,
+* and never holds up the main loop. Images are read and written with GdkPixbuf.
+*/
+class FocusBracket {
+public:
+    FocusBracket();
+    ~FocusBracket();
+    gint setup(guint frames, guint step, GError** error);
+
+    gboolean enabled() const;
+    guint frames() const;
+    guint position(guint centre, guint frame) const;
+
+    /* Queue a captured bracket for merging. Takes the job. */
+    void queueMerge(FocusBracketJob* job);
+
+private:
+    guint frames_;
+    guint step_;
+    FocusStack stack_;
+    GThreadPool* merge_queue_;
+
+    gint mergeFiles(const FocusBracketJob& job, GError** error);
+    static void mergeWrapper(gpointer data, gpointer user_data);
+};
+
+#endif //FOCUSBRACKET_H
@@ -0,0 +1,75 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSDRIFTDETECTOR_H
+#define FOCUSDRIFTDETECTOR_H
+
+#include <glib.h>
+#include <atomic>
+
+#define FOCUS_DRIFT_SLACK 1.0          //Default CUSUM slack, noise sigmas a change has to pass to count
+#define FOCUS_DRIFT_THRESHOLD 8.0      //Default CUSUM decision threshold, in noise sigmas
+#define FOCUS_DRIFT_NOISE_FLOOR 2.0    //Default smallest noise sigma, % of the focussed value
+#define FOCUS_DRIFT_WEIGHT 0.1         //Weight of each new frame in the noise and level averages
+#define FOCUS_DRIFT_CLIP 4.0           //Most sigmas one frame can add, so one flash cannot lose focus
+#define FOCUS_DRIFT_SINGLE_FRAME 0.1   //The single frame change that used to lose focus, for counting
+
+struct FocusDriftStats {
+    guint64 frames;   //Held focus frames checked
+    guint64 drifts;   //Times focus was given up
+    guint64 avoided;  //Times a frame passed the old 10% check and the focus value came back
+    gfloat noise;     //Noise sigma in use, in focus value units
+    gfloat level;     //Running average of the held focus value
+};
+
+/* Decides when a held focus has been lost, from the focus values of the held focus frames. A
+* single frame can be thrown out by flicker, splashing water or the LEDs switching, so it takes
+* a sustained change. Two sided CUSUM sums how far each frame is from the focussed value, in
+* noise sigmas less the slack, and focus is lost when either sum passes the threshold. The noise
+* comes from an EWMA of the frame to frame differences, never below the noise floor.
+*/
+class FocusDriftDetector {
+public:
+    FocusDriftDetector();
+    void setSensitivity(gdouble slack, gdouble threshold, gdouble noise_floor);
+    void reset(gfloat focus_value);
+    gboolean update(gfloat focus_value);
+    FocusDriftStats getStats() const;
+
+private:
+    gdouble slack_;
+    gdouble threshold_;
+    gdouble noise_floor_; //Fraction of the focussed value
+    gdouble reference_; //The focussed value
+    gdouble variance_; //EWMA of half the squared frame to frame difference
+    gdouble last_value_;
+    gdouble high_sum_;
+    gdouble low_sum_;
+    gboolean have_last_;
+    gboolean excursion_; //Past the old single frame check since the last frame within it
+
+    std::atomic<guint64> frames_;
+    std::atomic<guint64> drifts_;
+    std::atomic<guint64> avoided_;
+    std::atomic<gfloat> noise_;
+    std::atomic<gfloat> level_;
+};
+
+#endif //FOCUSDRIFTDETECTOR_H
@@ -0,0 +1,45 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSINTERFACE_H
+#define FOCUSINTERFACE_H
+
+#include <glib.h>
+
+/* What the CDAF state machine needs from whoever is running it. AF_Additions implements
+* this on the camera, and the CDAF simulator implements it on a desktop.
+*/
+class FocusInterface {
+public:
+    virtual ~FocusInterface() {}
+
+    /* The state machine has settled on a focus point. */
+    virtual void focusAchieved() = 0;
+
+    /* Whether the state machine is scanning, and how long to wait before the next focus frame. */
+    virtual void setScanning(gboolean value, guint timeout) = 0;
+
+    /* A sweep has started or finished. While sweeping every frame is wanted, and the lens is
+    * moved to CDAF::sweepPosition on a timer rather than after each frame.
+    */
+    virtual void setSweeping(gboolean value) = 0;
+};
+
+#endif //FOCUSINTERFACE_H
@@ -0,0 +1,104 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSKERNELS_H
+#define FOCUSKERNELS_H
+
+#include <glib.h>
+
+/* A read only view of an 8 bit luma plane. The stride is the distance in bytes
+* between the start of two rows, and can be larger than the width when rows are padded.
+*/
+struct LumaPlane {
+    const guint8* data;
+    gint width;
+    gint height;
+    gint stride;
+};
+
+/* The region of a LumaPlane the focus value is calculated over. Pixels just outside
+* the region are used as neighbours where they exist, exactly as cv::Laplacian does
+* when it is given a cropped cv::Mat.
+*/
+struct FocusRoi {
+    gint x;
+    gint y;
+    gint width;
+    gint height;
+};
+
+/* Running totals the focus metrics are built from. What sum and sum_squares hold
+* depends on the kernel, count is the number of samples that went into them.
+*/
+struct FocusMoments {
+    gint64 sum;
+    guint64 sum_squares;
+    guint64 count;
+};
+
+/* The instruction set used to run a kernel. AUTO picks the best one the CPU supports,
+* the others are there so the benchmark can compare paths against each other.
+*/
+enum FocusKernelPath {
+    FOCUS_KERNEL_AUTO = 0,
+    FOCUS_KERNEL_SCALAR,
+    FOCUS_KERNEL_SSE2,
+    FOCUS_KERNEL_AVX2,
+    FOCUS_KERNEL_NEON
+};
+
+namespace FocusKernels {
+
+    /* The fastest path available on this CPU. Resolved once on first use. */
+    FocusKernelPath bestPath();
+
+    /* TRUE when the path was compiled in and the CPU can run it. */
+    gboolean pathAvailable(FocusKernelPath path);
+
+    const gchar* pathName(FocusKernelPath path);
+
+    /* Single pass sum of the saturated 4-neighbour Laplacian over the ROI. This is the
+    * sum cv::Laplacian(roi, dst, CV_16U) followed by cv::sum(dst) would give.
+    */
+    guint64 laplacianSum(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+
+    /* The focus value. Bit identical to cv::mean of the CV_16U Laplacian of the ROI. */
+    gfloat laplacianMean(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+
+    /* Sum and sum of squares of the signed (unsaturated) Laplacian over the ROI. */
+    FocusMoments laplacianMoments(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+
+    /* Sum of the squared 3x3 Sobel gradient, gx^2 + gy^2, in sum_squares. */
+    FocusMoments sobelEnergy(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+
+    /* Sum of squared differences between pixels two columns apart, both inside the ROI. */
+    FocusMoments brennerEnergy(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+
+    /* Sum and sum of squares of the pixel values themselves. */
+    FocusMoments intensityMoments(const LumaPlane& plane, const FocusRoi& roi,
+        FocusKernelPath path = FOCUS_KERNEL_AUTO);
+}
+
+#endif //FOCUSKERNELS_H
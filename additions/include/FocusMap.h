@@ -0,0 +1,77 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSMAP_H
+#define FOCUSMAP_H
+
+#include <glib.h>
+#include <vector>
+
+#include "FocusMetric.h"
+#include "ParallelJobs.h"
+
+/* How the tile values are turned into the single value the CDAF state machine climbs.
+* The numbers are the values taken by the --focus-map-score command line option.
+*/
+enum FocusMapScore {
+    FOCUS_MAP_SCORE_ARGMAX = 0,  //The sharpest tile, wherever it is in the frame
+    FOCUS_MAP_SCORE_WEIGHTED     //All tiles, weighted towards the centre of the frame
+};
+
+/* Splits a frame into a grid of tiles and works out the focus metric of every tile in
+* one pass. The tiles are shared out by ParallelJobs between a GThreadPool and the calling
+* thread, so a full frame grid uses all four of the Nano's cores.
+*/
+class FocusMap {
+public:
+    FocusMap(gint columns, gint rows, FocusMapScore score, gint threads = 4);
+    ~FocusMap();
+    gint setup(GError** error);
+
+    /* Measure every tile of the plane with the metric, and return the combined score. */
+    gfloat compute(const LumaPlane& plane, const FocusMetric& metric);
+
+    gint columns() const { return columns_; }
+    gint rows() const { return rows_; }
+    gint bestTile() const { return best_tile_; }
+    const std::vector<gfloat>& tiles() const { return tile_values_; }
+
+private:
+    gint columns_;
+    gint rows_;
+    FocusMapScore score_;
+    ParallelJobs jobs_;
+    gint best_tile_;
+
+    std::vector<gfloat> tile_values_;
+    std::vector<gfloat> tile_weights_;
+    std::vector<FocusRoi> tile_rois_;
+    gint tile_frame_width_;
+    gint tile_frame_height_;
+
+    //Only valid while compute is running
+    const LumaPlane* plane_;
+    const FocusMetric* metric_;
+
+    void layoutTiles(gint width, gint height);
+    void measureTiles(gint job);
+};
+
+#endif //FOCUSMAP_H
@@ -0,0 +1,58 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSMEMORY_H
+#define FOCUSMEMORY_H
+
+#include <glib.h>
+
+#include "cdaf.h"
+
+#define FOCUS_MEMORY_BIN_WIDTH 25   //Focus indices in each bin of the lock history
+#define FOCUS_MEMORY_BINS ((MAX_FOCUS_INDEX - MIN_FOCUS_INDEX) / FOCUS_MEMORY_BIN_WIDTH + 1)
+#define FOCUS_MEMORY_HISTORY 64     //Locks kept in the history before the older ones are halved away
+#define FOCUS_MEMORY_MIN_SPAN 20    //Narrowest warm start detail scan either side, as SetFocusState uses
+#define FOCUS_MEMORY_MAX_SPAN 80    //Widest, past this a full range search is as quick
+#define FOCUS_MEMORY_SAVE_INTERVAL 10 //s between saves, drift relocks come often and the disk is an SD card
+
+/* Where focus was last found, and a histogram of where it has been found before. The camera
+* images at a nearly fixed working distance, so the next search starts from here instead of the
+* whole range. The spread of the history sets how far either side of the last position to look.
+* It is stored as a GKeyFile so it lasts across reboots.
+*/
+class FocusMemory {
+public:
+    FocusMemory();
+    gint load(const gchar* filename, GError** error);
+    gint save(const gchar* filename, GError** error) const;
+    gboolean valid() const;
+    void remember(guint focus_index, gfloat focus_value);
+    guint focusIndex() const;
+    gfloat focusValue() const;
+    guint span() const;
+
+private:
+    guint focus_index_;
+    gfloat focus_value_;
+    guint history_[FOCUS_MEMORY_BINS]; //Locks in each bin, MIN_FOCUS_INDEX upwards
+    gboolean valid_;
+};
+
+#endif //FOCUSMEMORY_H
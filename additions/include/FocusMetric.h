@@ -0,0 +1,111 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSMETRIC_H
+#define FOCUSMETRIC_H
+
+#include <glib.h>
+
+#include "FocusKernels.h"
+
+/* The sharpness measures the autofocus can run on a focus frame. The numbers are the
+* values taken by the --focus-metric command line option, so do not reorder them.
+*/
+enum FocusMetricType {
+    FOCUS_METRIC_LAPLACIAN_MEAN = 0,
+    FOCUS_METRIC_TENENGRAD,
+    FOCUS_METRIC_BRENNER,
+    FOCUS_METRIC_VARIANCE_OF_LAPLACIAN,
+    FOCUS_METRIC_NORMALIZED_VARIANCE,
+    FOCUS_METRIC_COUNT
+};
+
+/* A focus metric turns a region of a luma plane into a single value which is larger the
+* sharper the image is. The CDAF state machine only compares values from the same metric,
+* so the scale of each metric does not matter.
+*/
+class FocusMetric {
+public:
+    virtual ~FocusMetric() {}
+    virtual gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const = 0;
+    virtual const gchar* name() const = 0;
+
+    /* Create the metric for a type. Unknown types fall back to the Laplacian mean.
+    * The caller owns the returned object.
+    */
+    static FocusMetric* create(FocusMetricType type, FocusKernelPath path = FOCUS_KERNEL_AUTO);
+    static const gchar* typeName(FocusMetricType type);
+};
+
+/* Mean of the saturated Laplacian. The original metric, matching cv::Laplacian(CV_16U) + cv::mean. */
+class LaplacianMeanMetric : public FocusMetric {
+public:
+    LaplacianMeanMetric(FocusKernelPath path) : path_(path) {}
+    gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const override;
+    const gchar* name() const override { return "laplacian-mean"; }
+private:
+    FocusKernelPath path_;
+};
+
+/* Tenengrad, the mean of the squared 3x3 Sobel gradient magnitude. */
+class TenengradMetric : public FocusMetric {
+public:
+    TenengradMetric(FocusKernelPath path) : path_(path) {}
+    gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const override;
+    const gchar* name() const override { return "tenengrad"; }
+private:
+    FocusKernelPath path_;
+};
+
+/* Brenner gradient, the mean squared difference between pixels two columns apart. */
+class BrennerMetric : public FocusMetric {
+public:
+    BrennerMetric(FocusKernelPath path) : path_(path) {}
+    gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const override;
+    const gchar* name() const override { return "brenner"; }
+private:
+    FocusKernelPath path_;
+};
+
+/* Variance of the signed Laplacian. Unlike the Laplacian mean it keeps the negative half
+* of each edge response, which makes it less sensitive to noise in flat, dim scenes.
+*/
+class VarianceOfLaplacianMetric : public FocusMetric {
+public:
+    VarianceOfLaplacianMetric(FocusKernelPath path) : path_(path) {}
+    gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const override;
+    const gchar* name() const override { return "variance-of-laplacian"; }
+private:
+    FocusKernelPath path_;
+};
+
+/* Intensity variance divided by the mean intensity, so a change in scene brightness does not
+* look like a change in focus.
+*/
+class NormalizedVarianceMetric : public FocusMetric {
+public:
+    NormalizedVarianceMetric(FocusKernelPath path) : path_(path) {}
+    gfloat measure(const LumaPlane& plane, const FocusRoi& roi) const override;
+    const gchar* name() const override { return "normalized-variance"; }
+private:
+    FocusKernelPath path_;
+};
+
+#endif //FOCUSMETRIC_H
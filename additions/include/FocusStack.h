@@ -0,0 +1,72 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSSTACK_H
+#define FOCUSSTACK_H
+
+#include <glib.h>
+#include <vector>
+
+#include "ParallelJobs.h"
+
+#define FOCUS_STACK_RADIUS 4        //Sharpness is summed over a (2r+1) square, so flat patches follow their edges
+#define FOCUS_STACK_BAND_ROWS 32    //Rows in each band of the image the threads share out
+#define FOCUS_STACK_MAX_IMAGES 16
+
+/* An 8 bit interleaved RGB or RGBA image. The stride is the distance in bytes between the
+* start of two rows.
+*/
+struct StackImage {
+    guint8* data;
+    gint width;
+    gint height;
+    gint stride;
+    gint channels;
+};
+
+/* Merges a focus bracket, the same view taken at several focus positions, into one image that
+* is in focus everywhere. Each pixel's sharpness in each image is the squared Laplacian of the
+* luma, summed over the square around it. The output pixel is a blend of the images weighted by
+* the square of that sharpness, so the sharpest image wins and the seams between images stay
+* soft. The image is cut into bands of rows that ParallelJobs shares out between a GThreadPool
+* and the calling thread, as it shares out the FocusMap tiles.
+*/
+class FocusStack {
+public:
+    FocusStack(gint threads = 4);
+    ~FocusStack();
+    gint setup(GError** error);
+
+    /* Merge images, all the same size, into output, the same size again. */
+    void merge(const std::vector<StackImage>& images, StackImage& output);
+
+    gint threads() const { return jobs_.threads(); }
+
+private:
+    ParallelJobs jobs_;
+
+    //Only valid while merge is running
+    const std::vector<StackImage>* images_;
+    StackImage* output_;
+
+    void mergeBands(gint job);
+};
+
+#endif //FOCUSSTACK_H
@@ -0,0 +1,98 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSTRACE_H
+#define FOCUSTRACE_H
+
+#include <glib.h>
+#include <stdio.h>
+#include <vector>
+
+#include "cdaf.h"
+
+#define FOCUS_TRACE_MAGIC "CDAFTRC1"
+#define FOCUS_TRACE_VERSION 1
+#define FOCUS_TRACE_TUNING_FIELDS 16
+
+/* What happened to a focus frame. STEP frames were handed to the state machine, HOLD
+* frames only went through the FocusDriftDetector CUSUM check while focus was held. A WARM_START record
+* is not a frame, it holds the CDAF::warmStart position in frame_index, the span in next_index
+* and the remembered focus value.
+*/
+enum FocusTraceEvent {
+    FOCUS_TRACE_STEP = 0,
+    FOCUS_TRACE_HOLD,
+    FOCUS_TRACE_WARM_START
+};
+
+enum FocusTraceFlags {
+    FOCUS_TRACE_FLAG_SCANNING = 1 << 0, //The state machine was scanning after this frame
+    FOCUS_TRACE_FLAG_LOCKED = 1 << 1    //Focus was achieved on this frame
+};
+
+/* The start of a trace file. The tuning is kept so a replay runs the same steps and timeouts.
+* Fields are written in the host byte order, little endian on both the Jetson and a desktop.
+*/
+struct FocusTraceHeader {
+    gchar magic[8];
+    guint32 version;
+    guint32 record_size;
+    gint64 start_time;  //g_get_real_time when the trace was opened, us since the epoch
+    guint32 tuning[FOCUS_TRACE_TUNING_FIELDS]; //CDAFTuning in declaration order
+};
+
+/* One focus frame, 24 bytes. */
+struct FocusTraceRecord {
+    gint64 timestamp;    //When the frame was exposed, us on the g_get_monotonic_time clock
+    gfloat focus_value;
+    guint16 frame_index; //Lens focus index the frame was taken at
+    guint16 next_index;  //Lens focus index asked for after the frame
+    guint16 timeout;     //ms requested before the next focus frame
+    guint8 event;        //FocusTraceEvent
+    guint8 state;        //FocusStateId the frame was handed to
+    guint8 next_state;   //FocusStateId after the frame
+    guint8 flags;        //FocusTraceFlags
+    guint8 reserved[2];
+};
+
+/* Writes a binary trace of every focus frame, so slow focus in the field can be replayed
+* through the state machine on a desktop with the focusTraceReplay tool.
+*/
+class FocusTrace {
+public:
+    FocusTrace();
+    ~FocusTrace();
+    gint open(const gchar* filename, const CDAFTuning& tuning, GError** error);
+    void close();
+    gboolean isOpen() const;
+    void record(const FocusTraceRecord& record);
+    void flush();
+
+    static gint read(const gchar* filename, FocusTraceHeader* header,
+        std::vector<FocusTraceRecord>* records, GError** error);
+    static CDAFTuning headerTuning(const FocusTraceHeader& header);
+    static void packTuning(const CDAFTuning& tuning, FocusTraceHeader* header);
+
+private:
+    FILE* file_;
+    guint64 records_written_;
+};
+
+#endif //FOCUSTRACE_H
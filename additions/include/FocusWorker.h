@@ -0,0 +1,83 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FOCUSWORKER_H
+#define FOCUSWORKER_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib.h>
+#include <atomic>
+#include <functional>
+
+#include "SpscRing.h"
+
+#define FOCUS_RING_SIZE 4
+
+/* A focus frame waiting for the worker. The buffer holds a reference taken on the
+* streaming thread, the video info is the caps it arrived with.
+*/
+struct FocusFrame {
+    GstBuffer* buffer;
+    GstVideoInfo info;
+};
+
+struct FocusQueueStats {
+    guint64 frames_queued;
+    guint64 frames_dropped; //Arrived while the ring was full
+    guint64 frames_processed;
+    guint depth; //Frames waiting right now
+    guint max_depth;
+};
+
+/* The focus analysis thread. The fakesink handoff queues buffer references into a lock
+* free SPSC ring and returns straight away, and this thread takes them off and hands them
+* to the process function, so metric work never holds up the streaming thread or the main
+* loop. If the ring is full the newest frame is dropped and counted.
+*/
+class FocusWorker {
+public:
+    FocusWorker(std::function<void(GstBuffer*, GstVideoInfo*)> process_func);
+    ~FocusWorker();
+    gint setup(GError** error);
+    void stop();
+
+    /* Streaming thread only. Takes its own reference on the buffer. */
+    gboolean queueFrame(GstBuffer* buffer, const GstVideoInfo& info);
+    FocusQueueStats getStats() const;
+
+private:
+    std::function<void(GstBuffer*, GstVideoInfo*)> process_func_;
+    SpscRing<FocusFrame, FOCUS_RING_SIZE> ring_;
+    GThread* thread_;
+    GMutex wake_mutex_; //Only used to sleep when the ring is empty, never to guard the ring
+    GCond wake_cond_;
+    std::atomic<gboolean> running_;
+
+    std::atomic<guint64> frames_queued_;
+    std::atomic<guint64> frames_dropped_;
+    std::atomic<guint64> frames_processed_;
+    std::atomic<guint> max_depth_;
+
+    gpointer run(gpointer user_data);
+    static gpointer runWrapper(gpointer user_data);
+};
+
+#endif //FOCUSWORKER_H
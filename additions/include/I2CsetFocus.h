@@ -22,21 +22,87 @@
 #define I2CSETFOCUS_H
 
 #include <glib.h>
+#include <atomic>
 #include <string>
 
+#include "LensRamp.h"
+#include "VcmDriver.h"
+
+#define FOCUS_REQUEST_NONE (-1) //The request slot is empty
+#define FOCUS_REQUEST_RAMP 0x10000 //Flag in the request slot, ramp to the position instead of jumping
+
 typedef unsigned char u8;
 
 class ErrorHandler;
 
+struct I2CWriteStats {
+    guint64 requests; //Lens positions asked for through requestFocus
+    guint64 coalesced; //Replaced in the slot by a newer position before they were written
+    guint64 writes; //Bus transactions made, synchronous ones included
+    guint64 ramps; //Ramps started
+    guint64 ramps_cut; //Ramps a newer request cut short
+    guint64 failures;
+    gint64 total_time; //us spent in the writes
+    gint64 max_time; //us, the slowest write
+};
+
+/* The VCM focus controller on the camera I2C bus. The chip is FocusVcm, chosen at compile time in
+* VcmDriver.h, and its slave address is bound once at setup.
+* Lens moves asked for with requestFocus go into a single slot that a worker thread writes out,
+* so a slow or stalled bus never holds up the main loop. Only the newest position matters to the
+* lens, so a request that arrives before the last one was written replaces it. setFocus writes
+* straight away and waits for the bus, for the startup position where the error is wanted.
+* requestRamp moves the lens along a raised cosine profile instead of in one jump, so a long
+* move ends without the voice coil ringing. The profile goes out as a timed burst, one position
+* every LENS_RAMP_TICK_MS, and a newer request cuts it short.
+*/
 class CameraI2CDevice {
 public:
     CameraI2CDevice(const std::string& camera_id);
     ~CameraI2CDevice();
     gint setup(GError** error);
+    void setCameraId(const std::string& camera_id);
     gint setFocus(gint range, GError** error);
 
+    /* Queue a lens move for the worker and return. Fails if the last queued write failed. */
+    gint requestFocus(gint range, GError** error);
+
+    /* Queue a ramp from the last requested position. ramp_time is set to how long it takes, ms. */
+    gint requestRamp(gint range, guint* ramp_time, GError** error);
+    I2CWriteStats getStats() const;
+
 private:
     int camera_i2c_fd_;
     std::string camera_id_;
+    GThread* thread_;
+    GMutex bus_mutex_; //Held across taking a request and writing it, so writes keep their order
+    GMutex error_mutex_; //Guards worker_error_, so a ramp holding the bus never blocks requestFocus
+    GMutex wake_mutex_; //Only used to sleep when the slot is empty
+    GCond wake_cond_;
+    std::atomic<gboolean> running_;
+    std::atomic<gint> request_; //The latest wins slot, FOCUS_REQUEST_NONE when empty
+    GError* worker_error_; //The last write the worker could not make, under error_mutex_
+    gint requested_; //The last position asked for, main loop only
+    gint position_; //The last position written, under bus_mutex_
+
+    std::atomic<guint64> requests_;
+    std::atomic<guint64> coalesced_;
+    std::atomic<guint64> writes_;
+    std::atomic<guint64> ramps_;
+    std::atomic<guint64> ramps_cut_;
+    std::atomic<guint64> failures_;
+    std::atomic<gint64> total_time_;
+    std::atomic<gint64> max_time_;
+
+    /* One timed bus transaction. Call with bus_mutex_ held. */
+    gint writeFocus(gint range, GError** error);
+
+    /* Write a ramp as a timed burst. Call with bus_mutex_ held. */
+    gint writeRamp(gint range, GError** error);
+
+    /* Put a request in the slot and wake the worker. */
+    gint queueRequest(gint request, GError** error);
+    gpointer run(gpointer user_data);
+    static gpointer runWrapper(gpointer user_data);
 };
-#endif //I2CSETFOCUS_H
\ No newline at end of file
+#endif //I2CSETFOCUS_H
@@ -0,0 +1,44 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LENSRAMP_H
+#define LENSRAMP_H
+
+#include <glib.h>
+
+#define LENS_RAMP_TICK_MS 1         //ms between the positions of a ramp
+#define LENS_RAMP_MIN_MS 12         //Shortest ramp, a bit over the VCM ringing period
+#define LENS_RAMP_STEPS_PER_MS 20   //Focus indices per ms added to the ramp time for longer moves
+#define LENS_RAMP_MAX_POINTS 64     //Enough for a ramp across the whole focus range
+
+/* The lens position profile CameraI2CDevice::requestRamp writes out. The lens follows half a
+* cosine from one end of the move to the other, so it starts and stops with no jump in speed,
+* which is what sets a voice coil ringing. The simulated lens follows the same profile.
+*/
+namespace LensRamp {
+
+    /* How long a ramp between two positions takes, ms. 0 when from is negative, not known. */
+    guint rampTime(gint from, gint to);
+
+    /* The positions of a ramp, one per LENS_RAMP_TICK_MS, ending on to. Returns how many there are. */
+    guint rampProfile(gint from, gint to, gint* points, guint max_points);
+}
+
+#endif //LENSRAMP_H
@@ -0,0 +1,110 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LENSSETTLEMODEL_H
+#define LENSSETTLEMODEL_H
+
+#include <glib.h>
+#include <atomic>
+
+#define LENS_SETTLE_DISTANCES 8          //Move distances the settle time is measured at
+#define LENS_SETTLE_REPEATS 2            //Times each move is measured, the slowest is kept
+#define LENS_SETTLE_PARK_MS 300          //ms allowed for the lens to settle before a measurement
+#define LENS_SETTLE_WINDOW_MS 500        //ms of frames watched after a move before giving up on it
+#define LENS_SETTLE_STABLE_FRAMES 4      //Frames in a row within the noise band that end a move
+#define LENS_SETTLE_REFERENCE_FRAMES 8   //Frames averaged for the settled focus value
+#define LENS_SETTLE_SLOPE_OFFSET 20      //Focus indices off the peak the lens is measured at
+
+/* Which way a lens move goes. IN is towards MIN_FOCUS_INDEX, the way the CDAF scans run. */
+enum LensMoveDirection {
+    LENS_MOVE_IN = 0,
+    LENS_MOVE_OUT,
+    LENS_MOVE_DIRECTIONS
+};
+
+/* How long the lens takes to settle after a move, by move distance and direction. It gives the
+* wait before the next focus frame, instead of the fixed CDAF timeouts, so a 2 step nudge waits
+* less than a 40 step jump. Until it is calibrated it passes the CDAF timeouts straight through.
+* It is stored as a GKeyFile so one calibration serves every run of the camera.
+*/
+class LensSettleModel {
+public:
+    static const guint distances[LENS_SETTLE_DISTANCES];
+
+    LensSettleModel();
+    gint load(const gchar* filename, GError** error);
+    gint save(const gchar* filename, GError** error) const;
+    gboolean calibrated() const;
+    void setSettleTime(LensMoveDirection direction, guint distance, guint settle_time);
+    void setCalibrated(gboolean value);
+    guint settleTime(guint from_index, guint to_index) const;
+    guint frameWait(guint timeout, guint from_index, guint to_index) const;
+    void print() const;
+
+private:
+    guint settle_time_[LENS_MOVE_DIRECTIONS][LENS_SETTLE_DISTANCES]; //ms
+    gboolean calibrated_;
+};
+
+/* Measures a LensSettleModel on the camera. It is fed every frame while it runs and asks for
+* lens moves. Each move is made from a parked position onto one centre point, just off the focus
+* peak where a lens still moving changes the focus value most. The settle time is how long after
+* the move the first frame was exposed that started a run of frames within the noise of the
+* settled focus value. Frames are only as fine as the frame interval, which is also as fine as
+* the focus frames it schedules.
+*/
+class LensSettleCalibration {
+public:
+    LensSettleCalibration();
+    void start(guint focus_index, guint* next_index);
+    gboolean running() const;
+    gboolean step(gfloat focus_value, gint64 frame_time, guint* next_index);
+    void lensMoved(gint64 move_time);
+    const LensSettleModel& model() const;
+
+private:
+    enum Phase {
+        PHASE_IDLE = 0,
+        PHASE_REFERENCE, //Settled at the centre, measuring the focus value and its noise
+        PHASE_PARK,      //Settling at the start of the next move
+        PHASE_MOVE       //Watching the frames after the move onto the centre
+    };
+
+    gboolean nextMove(guint* next_index);
+    void finish();
+
+    LensSettleModel model_;
+    std::atomic<gint> phase_;
+    std::atomic<gint64> move_time_; //us, G_MAXINT64 while a move is waiting for the main loop
+    guint centre_;
+    guint move_;          //Position in the repeats, directions and distances
+    guint move_start_;    //Where the lens was parked for the current move
+    guint stable_frames_;
+    gdouble settle_;      //ms from the move to the first frame of the current stable run
+    gdouble value_sum_;
+    gdouble value_squares_;
+    guint value_count_;
+    gfloat reference_;    //Settled focus value at the centre
+    gfloat band_;         //How far a frame can be from the reference and count as settled
+    guint measured_[LENS_MOVE_DIRECTIONS][LENS_SETTLE_DISTANCES]; //Slowest settle seen, ms
+    gboolean have_[LENS_MOVE_DIRECTIONS][LENS_SETTLE_DISTANCES];
+};
+
+#endif //LENSSETTLEMODEL_H
@@ -0,0 +1,83 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LINEFRAMER_H
+#define LINEFRAMER_H
+
+#include <glib.h>
+#include <vector>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+typedef std::string_view LineView;
+#else
+#include <experimental/string_view>
+typedef std::experimental::string_view LineView;
+#endif
+
+#define LINE_FRAMER_CAPACITY 256 //Longest line is one less, the AS7265x data lines are about 110
+#define LINE_FEED 0x0A
+#define CARRIAGE_RETURN 0x0D
+
+/* Called with each complete line, without its line ending. The view is only valid for the
+* length of the call, copy anything that has to be kept.
+*/
+typedef void (*LineFunc)(LineView line, gpointer user_data);
+
+struct LineFramerStats {
+    guint64 bytes; //Bytes committed, line endings included
+    guint64 lines; //Lines passed to the consumer, or that would have been with none set
+    guint64 wrapped; //Lines that ran over the end of the ring and were joined to pass on
+    guint64 overflows; //Lines longer than the ring holds, dropped
+    guint64 dropped_bytes; //Bytes of those lines
+};
+
+/* Splits a byte stream into lines ending in LF, CR or CRLF. Bytes are read straight into a ring
+* of fixed size with reserve and commit, and each line is passed on as a view into the ring, so
+* nothing is allocated or copied once it is built. Any number of lines can arrive in one read,
+* and a partial line is kept for the next one. Empty lines are skipped.
+*/
+class LineFramer {
+public:
+    LineFramer(gsize capacity = LINE_FRAMER_CAPACITY);
+
+    void setConsumer(LineFunc func, gpointer user_data);
+    gsize reserve(gchar** write_pos);
+    void commit(gsize length, gint64 read_time = 0);
+    void push(const gchar* data, gsize length);
+    void reset();
+    gint64 lineTime() const;
+    LineFramerStats getStats() const;
+
+private:
+    std::vector<gchar> ring_;
+    std::vector<gchar> joined_; //Only used for a line that wraps around the end of the ring
+    gsize start_; //Ring index of the first byte of the partial line
+    gsize used_; //Bytes in the partial line
+    gboolean discarding_; //Dropping the rest of an overlong line, up to its line ending
+    gint64 read_time_; //Monotonic time of the read being committed, 0 when not given
+    LineFunc func_;
+    gpointer user_data_;
+    LineFramerStats stats_;
+
+    void dispatchLine();
+};
+
+#endif //LINEFRAMER_H
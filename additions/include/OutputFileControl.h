@@ -33,8 +33,17 @@
 #include <cstring>
 #include <memory>
 
+#include "SpectralLog.h"
+
 #define LINE_FEED 0x0A
 
+/* Where the spectral data of each capture is saved. */
+enum OutputLogFormat {
+    OUTPUT_LOG_TEXT = 0, //AS7265x_data_NN.txt only
+    OUTPUT_LOG_BOTH, //The text file and AS7265x_data_NN.bin
+    OUTPUT_LOG_BINARY //AS7265x_data_NN.bin only
+};
+
 class ErrorHandler;
 
 class OutputFileControl {
@@ -46,9 +55,16 @@ public:
     gint writeDataFileTime(GError** error);
     gint writeLineToFile(const std::string& data, GError** error);
     void getImageFileName(char* outfile);  
+    std::string getImagePath(const std::string& suffix) const;
+    void setImageSuffix(const std::string& suffix);
     std::string getNextFilename(GError** error);
     void captureDataTime();
     void setButtonTriggered();
+    void setLogFormat(gint format);
+    SpectralRecord* getRecord();
+    gint writeRecord(GError** error);
+    gint setDeviceInfo(const std::string& hardware, const std::string& software, const std::string& sensors,
+        GError** error);
     
 private:
     ErrorHandler* error_handler_;
@@ -57,9 +73,15 @@ private:
     std::string daily_dir_;
 
     gboolean button_triggered_;
+    std::string image_suffix_; //Added to the next image filename, for the images of a focus bracket
 
     GIOChannel* output_file_channel_;
 
+    gint log_format_; //OutputLogFormat
+    SpectralLog spectral_log_;
+    SpectralRecord record_; //Filled in through the capture, appended by writeRecord
+    gint64 record_start_; //Monotonic time of the button press
+
     void createDailyDir();
     void freeDailyDir();
     void freeDataTime();
@@ -0,0 +1,54 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef PARALLELJOBS_H
+#define PARALLELJOBS_H
+
+#include <glib.h>
+#include <functional>
+
+/* Runs one piece of work split into numbered jobs across a GThreadPool and the calling thread,
+* and waits for them all. Job 0 runs on the calling thread and jobs 1 to threads - 1 on the pool,
+* so the pool has one thread less than asked for. FocusMap shares its tiles and FocusStack its
+* bands out this way, each job taking every threads'th piece.
+*/
+class ParallelJobs {
+public:
+    ParallelJobs(gint threads);
+    ~ParallelJobs();
+    gint setup(GError** error);
+
+    /* Run job(0) to job(threads - 1) and return once they have all finished. */
+    void run(const std::function<void(gint)>& job);
+
+    gint threads() const { return threads_; }
+
+private:
+    gint threads_;
+    GThreadPool* pool_;
+    GMutex mutex_;
+    GCond done_cond_;
+    gint jobs_outstanding_;
+    const std::function<void(gint)>* job_; //Only valid while run is running
+
+    static void workerWrapper(gpointer data, gpointer user_data);
+};
+
+#endif //PARALLELJOBS_H
@@ -32,6 +32,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <string.h>
+#include <poll.h>
 #include <signal.h>
 #include <string>
 #include <pwd.h>
@@ -39,9 +43,9 @@
 #include <map>
 #include <functional>
 
-#define BUFFER_SIZE 256
-#define LINE_FEED 0x0A
-#define CARRIAGE_RETURN 0x0D
+#include "LineFramer.h"
+
+#define SERIAL_WRITE_TIMEOUT_MS 100 //Longest wait for room in the transmit buffer, 1 KB takes 90 ms at 115200 baud
 
 class ErrorHandler;
 
@@ -51,22 +55,24 @@ public:
         guint parity, guint flow_control, ErrorHandler* error_handler);
     ~SerialPort();
 
+    void setDevice(const std::string& port_id);
     gint setup(GError** error);
     gint sendChars(const std::string& string_to_send, GError** error);
-    void setWriteFunc(std::function<void(const std::string&)> func);
-    void unsetWriteFunc(std::function<void(const std::string&)> func);
+    gint sendLines(const std::vector<const gchar*>& lines, GError** error);
+    void setWriteFunc(LineFunc func, gpointer user_data);
+    void unsetWriteFunc();
+    LineFramerStats getStats() const;
+    gint64 lineTime() const;
+    gboolean isOpen() const;
 
 private:
     struct termios termios_save; //Save prior state to restore in closePort()
     GIOChannel* static_channel;
     ErrorHandler* error_handler_;
 
-    gboolean write_func_set_;
+    LineFramer framer_;
+    guint64 reads_; //Reads made from the port, each can hold any number of lines
 
-    std::vector<gchar> buffer_;
-    gchar *buffer_write_pos_;
-    guint in_buffer_position_; 
-    
     guint serial_port_fd_;
     guint callback_handler_in_, callback_handler_err_;
     gboolean callback_activated_;
@@ -79,14 +85,12 @@ private:
     guint flow_control_;          // 0 : None, 1 : Xon/Xoff, 2 : RTS/CTS, 3 : RS485halfduplex
     gboolean disable_port_lock_;
 
-    std::function<void(const std::string&)> writeFunc_;
     static gboolean listenPortStatic(GIOChannel* src, GIOCondition cond, gpointer data);
     gboolean listenPort(GIOChannel* src, GIOCondition cond, gpointer data);
     static gboolean ioErrStatic(GIOChannel* src, GIOCondition cond, gpointer data);
     gboolean ioErr(GIOChannel* src, GIOCondition cond, gpointer data);
     gint configurePort(GError** error);
     void closePort();
-    void writeCharsToFunc(const std::string& output_chars);
 };
 
 #endif  // SERIALIO_H
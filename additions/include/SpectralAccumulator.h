@@ -0,0 +1,127 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPECTRALACCUMULATOR_H
+#define SPECTRALACCUMULATOR_H
+
+#include <glib.h>
+#include <array>
+#include <atomic>
+#include <cmath>
+
+/* A copy of the running statistics of each channel. */
+template<gsize Channels>
+struct SpectralSnapshot {
+    guint64 count; //Samples the statistics are over
+    std::array<gdouble, Channels> mean;
+    std::array<gdouble, Channels> variance; //Sample variance, 0 below two samples
+
+    /* The standard error of a channel mean, the noise left once the samples are averaged. */
+    gdouble standardError(gsize channel) const {
+        return (count > 1) ? std::sqrt(variance[channel] / count) : 0.0;
+    }
+};
+
+/* Running mean and variance of each channel of a stream of spectra, by Welford's method. One
+* thread adds samples, and any thread can take a snapshot without a lock. The adding thread
+* marks an update in progress with an odd sequence number, and a reader that sees the number
+* odd, or changed under it, reads again. Adding never waits on a reader, and readers only
+* repeat while a sample is being added, which is a few hundred nanoseconds.
+*/
+template<gsize Channels>
+class SpectralAccumulator {
+public:
+    SpectralAccumulator() : sequence_(0), count_(0) {
+        for (gsize i = 0; i < Channels; ++i) {
+            mean_[i].store(0.0, std::memory_order_relaxed);
+            m2_[i].store(0.0, std::memory_order_relaxed);
+        }
+    }
+
+    /* Starts again from no samples. Adding thread only. */
+    void reset() {
+        beginWrite();
+        count_.store(0, std::memory_order_relaxed);
+        for (gsize i = 0; i < Channels; ++i) {
+            mean_[i].store(0.0, std::memory_order_relaxed);
+            m2_[i].store(0.0, std::memory_order_relaxed);
+        }
+        endWrite();
+    }
+
+    /* Adds one spectrum of Channels values. Adding thread only. */
+    void add(const gfloat* sample) {
+        guint64 count = count_.load(std::memory_order_relaxed) + 1;
+
+        beginWrite();
+        count_.store(count, std::memory_order_relaxed);
+        for (gsize i = 0; i < Channels; ++i) {
+            gdouble mean = mean_[i].load(std::memory_order_relaxed);
+            gdouble delta = sample[i] - mean;
+
+            mean += delta / count;
+            mean_[i].store(mean, std::memory_order_relaxed);
+            m2_[i].store(m2_[i].load(std::memory_order_relaxed) + delta * (sample[i] - mean),
+                std::memory_order_relaxed);
+        }
+        endWrite();
+    }
+
+    guint64 count() const {
+        return count_.load(std::memory_order_acquire);
+    }
+
+    /* Copies the statistics as they were between two samples. Safe from any thread. */
+    void snapshot(SpectralSnapshot<Channels>* out) const {
+        std::array<gdouble, Channels> m2;
+        guint before, after;
+
+        do {
+            before = sequence_.load(std::memory_order_acquire);
+            out->count = count_.load(std::memory_order_relaxed);
+            for (gsize i = 0; i < Channels; ++i) {
+                out->mean[i] = mean_[i].load(std::memory_order_relaxed);
+                m2[i] = m2_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence_.load(std::memory_order_relaxed);
+        } while ((before & 1) || (before != after));
+
+        for (gsize i = 0; i < Channels; ++i)
+            out->variance[i] = (out->count > 1) ? m2[i] / (out->count - 1) : 0.0;
+    }
+
+private:
+    std::atomic<guint> sequence_; //Odd while a sample is being added
+    std::atomic<guint64> count_;
+    std::array<std::atomic<gdouble>, Channels> mean_;
+    std::array<std::atomic<gdouble>, Channels> m2_; //Sum of squared differences from the mean
+
+    void beginWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+#endif //SPECTRALACCUMULATOR_H
@@ -0,0 +1,135 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPECTRALLOG_H
+#define SPECTRALLOG_H
+
+#include <glib.h>
+#include <stddef.h>
+#include <string>
+
+#include "AS7265xParse.h"
+
+#define SPECTRAL_LOG_MAGIC "AS7265xL" //8 bytes, no terminator in the file
+#define SPECTRAL_LOG_VERSION 1
+#define SPECTRAL_LOG_DEVICES 3 //Temperature sensors
+#define SPECTRAL_LOG_VERSION_LENGTH 32
+#define SPECTRAL_LOG_SENSORS_LENGTH 16
+#define SPECTRAL_LOG_IMAGE_ID_LENGTH 24
+
+/* Which parts of a SpectralRecord were filled in. */
+enum SpectralRecordFlags {
+    SPECTRAL_HAS_TEMPERATURE = 1 << 0,
+    SPECTRAL_HAS_SETTINGS = 1 << 1, //Gain and integration time
+    SPECTRAL_HAS_RAW = 1 << 2,
+    SPECTRAL_HAS_CALIBRATED = 1 << 3,
+    SPECTRAL_HAS_BURST = 1 << 4, //calibrated is a burst mean, with its SD in calibrated_sd
+    SPECTRAL_HAS_FOCUS = 1 << 5
+};
+
+/* The start of a spectral log. Everything in the log is little endian, as the Jetson and
+* desktops are, with every field at its natural alignment, so the file can be mapped and
+* read as these structs with no parsing. Readers check the version, and use header_size and
+* record_size to find the records, so later versions can add fields at the end.
+*/
+struct SpectralLogHeader {
+    gchar magic[8];
+    guint32 version;
+    guint32 header_size;
+    guint32 record_size;
+    guint32 channels;
+    guint16 wavelength[AS7265X_CHANNELS]; //nm of each channel of a record, shortest first
+    guint32 reserved;
+    gchar hardware_version[SPECTRAL_LOG_VERSION_LENGTH]; //ATVERHW reply, NUL terminated
+    gchar software_version[SPECTRAL_LOG_VERSION_LENGTH]; //ATVERSW reply, NUL terminated
+    gchar sensors[SPECTRAL_LOG_SENSORS_LENGTH]; //ATPRES reply, the sensors working, NUL terminated
+};
+
+/* One capture, with its channels in wavelength order. */
+struct SpectralRecord {
+    gint64 capture_time; //us since the epoch, at the button press
+    guint32 sequence; //Records before this one in the log
+    guint32 flags; //SpectralRecordFlags
+    gfloat temperature[SPECTRAL_LOG_DEVICES]; //Degrees C
+    guint16 gain; //ATGAIN setting
+    guint16 integration; //ATINTTIME setting, in 2.8 ms steps
+    guint16 raw[AS7265X_CHANNELS];
+    gfloat calibrated[AS7265X_CHANNELS];
+    gfloat calibrated_sd[AS7265X_CHANNELS]; //Burst only
+    guint32 burst_samples; //Burst only
+    gfloat burst_rate; //Readings/s, burst only
+    gint32 focus_index; //Lens position the image was taken at
+    gfloat focus_value; //Focus value when focus locked
+    guint32 reading_ms; //From the button press to the last of the reading
+    gchar image_id[SPECTRAL_LOG_IMAGE_ID_LENGTH]; //Time of capture the image is named by, NUL terminated
+};
+
+static_assert(sizeof(SpectralLogHeader) == 144, "SpectralLogHeader layout changed");
+static_assert(offsetof(SpectralLogHeader, hardware_version) == 64 && offsetof(SpectralLogHeader, sensors) == 128,
+    "SpectralLogHeader layout changed");
+static_assert(sizeof(SpectralRecord) == 256, "SpectralRecord layout changed");
+static_assert(offsetof(SpectralRecord, raw) == 32 && offsetof(SpectralRecord, calibrated) == 68
+    && offsetof(SpectralRecord, burst_samples) == 212 && offsetof(SpectralRecord, image_id) == 232,
+    "SpectralRecord layout changed");
+static_assert(G_BYTE_ORDER == G_LITTLE_ENDIAN, "The spectral log is little endian");
+
+/* Writes a spectral log. The header goes out when the log is opened, and each record is
+* appended with a single write, with no formatting and no flush.
+*/
+class SpectralLog {
+public:
+    SpectralLog();
+    ~SpectralLog();
+
+    gint open(const std::string& path, GError** error);
+    gint setDeviceInfo(const std::string& hardware, const std::string& software, const std::string& sensors,
+        GError** error);
+    gint append(SpectralRecord* record, GError** error);
+    gboolean isOpen() const;
+    void close();
+
+private:
+    gint fd_;
+    std::string path_;
+    SpectralLogHeader header_;
+    guint32 records_;
+
+    gint writeAt(const void* data, gsize size, off_t offset, GError** error);
+};
+
+/* A spectral log mapped read only. The records are used where they lie in the file. */
+class SpectralLogView {
+public:
+    SpectralLogView();
+    ~SpectralLogView();
+
+    gint open(const std::string& path, GError** error);
+    void close();
+    const SpectralLogHeader& header() const;
+    gsize count() const;
+    const SpectralRecord& record(gsize index) const;
+
+private:
+    const guint8* data_;
+    gsize size_;
+    gsize count_;
+};
+
+#endif //SPECTRALLOG_H
@@ -0,0 +1,79 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <glib.h>
+#include <atomic>
+
+/* Fixed size single producer, single consumer ring. push is only ever called from one
+* thread and pop from one other thread, so neither needs a lock: each side owns one
+* index and publishes it to the other with release/acquire ordering. Capacity must be a
+* power of two. The indices only ever count up and are masked when used, so a full ring
+* holds all Capacity slots.
+*/
+template <typename T, gsize Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : head_(0), tail_(0) {}
+
+    /* Producer side. FALSE if the ring is full, and item is left alone. */
+    gboolean push(const T& item) {
+        const gsize head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == Capacity)
+            return FALSE;
+        slots_[head & (Capacity - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return TRUE;
+    }
+
+    /* Consumer side. FALSE if the ring is empty. */
+    gboolean pop(T& item) {
+        const gsize tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+            return FALSE;
+        item = slots_[tail & (Capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return TRUE;
+    }
+
+    /* Safe from either side, but only a snapshot. */
+    gsize size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    gboolean empty() const { return size() == 0; }
+    static constexpr gsize capacity() { return Capacity; }
+
+private:
+    /* Padding keeps each index on its own cache line so the two threads do not fight over
+    * one line. Padding rather than alignas, as over aligned members would need C++17 new.
+    */
+    std::atomic<gsize> head_;
+    gchar head_padding_[64];
+    std::atomic<gsize> tail_;
+    gchar tail_padding_[64];
+    T slots_[Capacity];
+};
+
+#endif //SPSCRING_H
@@ -27,6 +27,9 @@
 #include "SerialIO.h"
 #include "amsAS7265x.h"
 
+#define SYSCTRL_LIGHTS_OUT_MS 3800 //Flash off after the button press
+#define AS7265X_BURST_START_MS 400 //Burst readings start once the flash has settled
+
 class AdditionsParent;
 class ErrorHandler;
 class OutputFileControl;
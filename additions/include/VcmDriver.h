@@ -0,0 +1,191 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef VCMDRIVER_H
+#define VCMDRIVER_H
+
+#include <glib.h>
+
+/* The voice coil focus motor the build drives. Change this to build for a camera module with
+* another driver chip. It is fixed at compile time so the encoders below inline to a few shifts.
+*/
+#ifndef VCM_CHIP
+#define VCM_CHIP VcmDW9714
+#endif
+
+#define VCM_MAX_MESSAGE 3 //Bytes in the longest I2C message any chip below needs
+
+/* How a chip moves the lens to a new position. DIRECT jumps, LINEAR_SLOPE steps there at the
+* chip's slew rate. Long moves are ramped in software by LensRamp whatever the chip, so none of
+* the chips' own ringing compensation modes are set up.
+*/
+enum VcmMode {
+    VCM_MODE_DIRECT = 0,
+    VCM_MODE_LINEAR_SLOPE
+};
+
+/* The traits of each chip. Focus indices are the 10 bit positions of the DW9714 module the CDAF
+* tuning was made on, chips with finer position codes scale them up. min_index and max_index are
+* the travel the lens module uses, which is less than the chip's code range.
+*/
+
+/* Dongwoon DW9714. The position goes in a two byte command with no register address. The low
+* four bits of the second byte are the slew code, which is only used in linear slope mode.
+*/
+struct VcmDW9714 {
+    static constexpr const gchar* name = "DW9714";
+    static constexpr guint8 address = 0x0C;
+    static constexpr guint code_bits = 10;
+    static constexpr gint min_index = 50;
+    static constexpr gint max_index = 900;
+    static constexpr VcmMode mode = VCM_MODE_DIRECT;
+    static constexpr guint8 slew = 0x0; //Step period code for linear slope mode
+
+    static constexpr gsize encodePosition(guint code, guint8* bytes) {
+        return bytes[0] = (guint8)((code >> 4) & 0x3f),
+            bytes[1] = (guint8)(((code << 4) & 0xf0) | ((mode == VCM_MODE_LINEAR_SLOPE) ? slew : 0)), 2;
+    }
+
+    static constexpr gsize encodeInit(guint8*) { return 0; } //Ready from power on
+};
+
+/* Dongwoon DW9718S. Register based, the 10 bit position is in VCM_CURRENT, 0x02 and 0x03. It
+* powers up from the control register.
+*/
+struct VcmDW9718S {
+    static constexpr const gchar* name = "DW9718S";
+    static constexpr guint8 address = 0x0C;
+    static constexpr guint code_bits = 10;
+    static constexpr gint min_index = 50;
+    static constexpr gint max_index = 900;
+    static constexpr VcmMode mode = VCM_MODE_DIRECT;
+    static constexpr guint8 slew = 0x0;
+
+    static constexpr gsize encodePosition(guint code, guint8* bytes) {
+        return bytes[0] = 0x02, bytes[1] = (guint8)((code >> 8) & 0x03), bytes[2] = (guint8)(code & 0xff), 3;
+    }
+
+    static constexpr gsize encodeInit(guint8* bytes) { //Control register, power down bit clear
+        return bytes[0] = 0x00, bytes[1] = 0x00, 2;
+    }
+};
+
+/* Asahi Kasei AK7375. A 12 bit position, left aligned in the two position registers from 0x00.
+* It wakes up in standby, the control register 0x02 puts it into active mode.
+*/
+struct VcmAK7375 {
+    static constexpr const gchar* name = "AK7375";
+    static constexpr guint8 address = 0x0C;
+    static constexpr guint code_bits = 12;
+    static constexpr gint min_index = 50;
+    static constexpr gint max_index = 900;
+    static constexpr VcmMode mode = VCM_MODE_DIRECT;
+    static constexpr guint8 slew = 0x0;
+
+    static constexpr gsize encodePosition(guint code, guint8* bytes) {
+        return bytes[0] = 0x00, bytes[1] = (guint8)((code >> 4) & 0xff), bytes[2] = (guint8)((code << 4) & 0xf0), 3;
+    }
+
+    static constexpr gsize encodeInit(guint8* bytes) {
+        return bytes[0] = 0x02, bytes[1] = 0x00, 2;
+    }
+};
+
+/* The encoder for one chip. Everything is constexpr, so with the chip fixed at compile time a
+* lens move costs the same as the hand written encoding it replaces.
+*/
+template <typename Chip>
+struct VcmDriver {
+    static constexpr const gchar* name = Chip::name;
+    static constexpr guint8 address = Chip::address;
+    static constexpr gint min_index = Chip::min_index;
+    static constexpr gint max_index = Chip::max_index;
+    static constexpr guint code_max = (1u << Chip::code_bits) - 1;
+
+    /* A focus index as the chip's position code, clamped to the lens module's travel. */
+    static constexpr guint code(gint index) {
+        return (guint)((index < (gint)min_index) ? (gint)min_index : (index > (gint)max_index) ? (gint)max_index : index)
+            << (Chip::code_bits - 10);
+    }
+
+    /* The I2C message that moves the lens to a focus index. Returns its length. */
+    static constexpr gsize encode(gint index, guint8* bytes) {
+        return Chip::encodePosition(code(index), bytes);
+    }
+
+    /* The I2C message that sets the chip up before the first move, 0 bytes if it needs none. */
+    static constexpr gsize encodeInit(guint8* bytes) {
+        return Chip::encodeInit(bytes);
+    }
+};
+
+typedef VcmDriver<VCM_CHIP> FocusVcm;
+
+static_assert(FocusVcm::min_index < FocusVcm::max_index, "VCM lens travel is empty");
+static_assert(FocusVcm::code_max >= 1023u, "VCM position codes are coarser than the focus index");
+
+/* An encoded message packed into one word for the checks below, the length in the top byte and
+* the message bytes below it, first byte highest.
+*/
+constexpr guint32 vcmPack(const guint8* bytes, gsize length) {
+    guint32 packed = (guint32)length << 24;
+    for (gsize i = 0; i < length; i++)
+        packed |= (guint32)bytes[i] << (16 - 8 * i);
+    return packed;
+}
+
+template <typename Chip>
+constexpr guint32 vcmPackedMove(gint index) {
+    guint8 bytes[VCM_MAX_MESSAGE] = {};
+    return vcmPack(bytes, VcmDriver<Chip>::encode(index, bytes));
+}
+
+template <typename Chip>
+constexpr guint32 vcmPackedInit() {
+    guint8 bytes[VCM_MAX_MESSAGE] = {};
+    return vcmPack(bytes, VcmDriver<Chip>::encodeInit(bytes));
+}
+
+/* The split the DW9714 writes were made with before the chip traits. */
+constexpr guint32 vcmLegacyDW9714(gint range) {
+    guint value = ((guint)range << 4) & 0x3ff0;
+    guint8 bytes[2] = { (guint8)((value >> 8) & 0x3f), (guint8)(value & 0xf0) };
+    return vcmPack(bytes, 2);
+}
+
+//The bytes each chip is sent, checked at compile time. Out of range indices clamp to the lens travel.
+static_assert(vcmPackedMove<VcmDW9714>(280) == vcmLegacyDW9714(280), "DW9714 move differs from the old encoding");
+static_assert(vcmPackedMove<VcmDW9714>(777) == vcmLegacyDW9714(777), "DW9714 move differs from the old encoding");
+static_assert(vcmPackedMove<VcmDW9714>(280) == 0x02118000u, "DW9714 move encoding");
+static_assert(vcmPackedMove<VcmDW9714>(0) == 0x02032000u, "DW9714 move below the lens travel");
+static_assert(vcmPackedMove<VcmDW9714>(1023) == 0x02384000u, "DW9714 move above the lens travel");
+static_assert(vcmPackedInit<VcmDW9714>() == 0x00000000u, "DW9714 needs no set up");
+
+static_assert(vcmPackedMove<VcmDW9718S>(280) == 0x03020118u, "DW9718S move encoding");
+static_assert(vcmPackedMove<VcmDW9718S>(0) == 0x03020032u, "DW9718S move below the lens travel");
+static_assert(vcmPackedMove<VcmDW9718S>(1023) == 0x03020384u, "DW9718S move above the lens travel");
+static_assert(vcmPackedInit<VcmDW9718S>() == 0x02000000u, "DW9718S power up");
+
+static_assert(vcmPackedMove<VcmAK7375>(281) == 0x03004640u, "AK7375 move encoding");
+static_assert(vcmPackedMove<VcmAK7375>(0) == 0x03000C80u, "AK7375 move below the lens travel");
+static_assert(vcmPackedMove<VcmAK7375>(1023) == 0x0300E100u, "AK7375 move above the lens travel");
+static_assert(vcmPackedInit<VcmAK7375>() == 0x02020000u, "AK7375 active mode");
+
+#endif //VCMDRIVER_H
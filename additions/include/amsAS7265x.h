@@ -41,14 +41,50 @@
 
 #include "OutputFileControl.h"
 #include "SerialIO.h"
+#include "ATCommandQueue.h"
+#include "AS7265xParse.h"
+#include "SpectralAccumulator.h"
+
+#define AS7265X_DEVICES 3 //Sensors on the board, one temperature each
+#define AS7265X_DATA_TIMEOUT_MS 2500 //ATDATA answers once it has measured, up to two integrations at ATINTTIME=255
+#define AS7265X_INTEGRATION_STEP_US 2800 //ATINTTIME counts in 2.8 ms steps
+#define AS7265X_DEFAULT_INTEGRATION 255
+#define AS7265X_MODE_CONTINUOUS 2 //All channels, two integrations a reading
+#define AS7265X_READING_BYTES 150 //About the length of an ATCDATA line
+#define AS7265X_BAUD 115200
 
 class OutputFileControl;
 class ErrorHandler;
 
+/* Tags for the commands sent to the AS7265x, to tell their replies apart. */
+enum AS7265xCommand {
+    AS7265X_ACK = 0,
+    AS7265X_HARDWARE_VERSION,
+    AS7265X_SOFTWARE_VERSION,
+    AS7265X_SENSORS_PRESENT,
+    AS7265X_MEASURE_MODE,
+    AS7265X_SET_GAIN,
+    AS7265X_SET_INTEGRATION_TIME,
+    AS7265X_SENSOR_TEMP,
+    AS7265X_GAIN,
+    AS7265X_INTEGRATION_TIME,
+    AS7265X_DATA,
+    AS7265X_CALIBRATED_DATA,
+    AS7265X_SET_MEASURE_MODE,
+    AS7265X_BURST,
+    AS7265X_RESTORE_MEASURE_MODE
+};
+
+typedef SpectralSnapshot<AS7265X_CHANNELS> AS7265xSpectrum;
+
 class AS7265xUnit {
 public:
     AS7265xUnit(SerialPort* serial_port, OutputFileControl* file_to_write, ErrorHandler* error_handler);
     ~AS7265xUnit();    
+    void setAcquisition(guint integration, guint burst_samples);
+    gboolean burstEnabled() const;
+    guint burstTime() const;
+    void getSpectrum(AS7265xSpectrum* spectrum) const;
     void getHandshakeData();
     static gboolean getAS7265xDataWrapper(gpointer user_data);
     gboolean getAS7265xData(void);
@@ -57,17 +93,26 @@ private:
     OutputFileControl* output_file_;
     SerialPort* serial_port_;
     ErrorHandler* error_handler_;
+    ATCommandQueue command_queue_;
+
+    guint integration_; //ATINTTIME setting, in AS7265X_INTEGRATION_STEP_US steps
+    guint burst_samples_; //Readings averaged on each capture, 0 for one ATDATA and ATCDATA reading
+    gint measure_mode_; //Mode read at the handshake, put back after each burst. -1 until read
+    SpectralAccumulator<AS7265X_CHANNELS> burst_; //Added to on the main loop, read from anywhere
+    gint64 burst_first_time_; //Read from the port, the first and last readings of the burst
+    gint64 burst_last_time_;
+    guint burst_unparsed_; //Lines of the burst that were not a calibrated reading
 
-    std::vector<std::string> raw_tokens_;
-    std::vector<std::string> calibrated_tokens_;
-    std::vector<int> order_ = { 8, 10, 12, 13, 14, 15, 6, 7, 9, 11, 16, 17, 0, 1, 2, 3, 4, 5 };
-    std::vector<int> channels_ = { 610, 680, 730, 760, 810, 860, 560, 585, 645, 705, 900, 940, 410, 435, 460, 485, 510, 535 };
+    AS7265xRaw raw_; //ATDATA reply waiting for its ATCDATA, in wavelength order
+    gboolean raw_valid_;
+    std::string hardware_version_; //Kept for the spectral log header until the sensors present reply is in
+    std::string software_version_;
 
-    guint sequence_no_;    
-    std::vector<std::string> split(const std::string& s, char delimiter);
-    void runHandshake(GError** error);
-    void runData(GError** error);
-    void handshakeReply(const std::string& output_data);
-    void dataReply(const std::string& output_data);
+    static void replyWrapper(const ATReply& reply, gpointer user_data);
+    void reply(const ATReply& reply);
+    gint handshakeReply(const ATReply& reply, GError** error);
+    gint dataReply(const ATReply& reply, GError** error);
+    gint burstReply(const ATReply& reply, GError** error);
+    gint writeBurst(GError** error);
 };
 #endif
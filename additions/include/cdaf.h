@@ -22,20 +22,23 @@
 #define CDAF_H
 
 
-#define MAX_FOCUS_INDEX 900
-#define MIN_FOCUS_INDEX 50
-#define TRANSIT_STEP    10
+#include "VcmDriver.h"
+
+#define MAX_FOCUS_INDEX ((gint)FocusVcm::max_index) //The lens travel comes from the focus motor driver
+#define MIN_FOCUS_INDEX ((gint)FocusVcm::min_index)
+#define TRANSIT_STEP    0 //0 ramps the lens to a scan start in one move, see CameraI2CDevice::requestRamp
 
 #include <glib.h>
-#include <vector>
+#include <atomic>
 #include "I2CsetFocus.h"
+#include "FocusInterface.h"
 
-/*When you create a pointer to a class, you can get away with the class AF_Additions declaration, and put
-* #include "AdditionsForAF.h" in the source file.
+/*When you create a pointer to a class, you can get away with the class FocusInterface declaration, and put
+* #include "FocusInterface.h" in the source file.
 *When you are storing the actual class object, you need to have #include "I2CsetFocus.h" in the header*/
 
 class ErrorHandler;
-class AF_Additions;
+class FocusTrace;
 class FocusState;
 class StartScanFocusInState;
 class ScanFocusInState;
@@ -48,27 +51,196 @@ class GrabFocusValueState;
 class StartDriftScanningState;
 class ConfirmDriftDirectionState;
 class DriftScanForPeakState;
+class StartConfirmPeakState;
+class ConfirmPeakState;
+class StartSweepState;
+class SweepState;
+class StartBracketScanState;
+class BracketScanState;
+class GoldenSectionState;
+class WarmStartState;
+
+/*Identifies each state, for traces and logging. CDAF::stateName gives the names.*/
+enum FocusStateId {
+    FOCUS_STATE_TRANSIT = 0,
+    FOCUS_STATE_START_SCAN_FOCUS_IN,
+    FOCUS_STATE_SCAN_FOCUS_IN,
+    FOCUS_STATE_START_SCAN_FOCUS_OUT,
+    FOCUS_STATE_SCAN_FOCUS_OUT,
+    FOCUS_STATE_START_DETAIL_SCAN,
+    FOCUS_STATE_DETAIL_SCAN,
+    FOCUS_STATE_SET_FOCUS,
+    FOCUS_STATE_GRAB_FOCUS_VALUE,
+    FOCUS_STATE_START_DRIFT_SCANNING,
+    FOCUS_STATE_CONFIRM_DRIFT_DIRECTION,
+    FOCUS_STATE_DRIFT_SCAN_FOR_PEAK,
+    FOCUS_STATE_START_CONFIRM_PEAK,
+    FOCUS_STATE_CONFIRM_PEAK,
+    FOCUS_STATE_START_SWEEP,
+    FOCUS_STATE_SWEEP,
+    FOCUS_STATE_START_BRACKET_SCAN,
+    FOCUS_STATE_BRACKET_SCAN,
+    FOCUS_STATE_GOLDEN_SECTION,
+    FOCUS_STATE_WARM_START,
+    FOCUS_STATE_COUNT
+};
+
+/*How the peak is found once the coarse scans in and out are done. DETAIL_SCAN walks a fine
+* step scan over the best coarse position, CURVE_FIT fits a Gaussian to the coarse points
+* around it, goes straight to the estimate and checks it with a frame either side.
+*/
+enum FocusSearchMode {
+    FOCUS_SEARCH_DETAIL_SCAN = 0,
+    FOCUS_SEARCH_CURVE_FIT
+};
+
+/*How the full range is searched. STEPPED moves the lens one step per focus frame, scanning in
+* and then out. SWEEP drives the lens in at a constant rate while every frame comes through,
+* and tags each frame with where the lens was when it was exposed. GOLDEN_SECTION scans in with
+* big steps until the focus curve rises, stops once it is past the peak, and narrows down on
+* the peak with a golden section search. It finds the focus point itself, so the FocusSearchMode
+* is not used.
+*/
+enum FocusScanMode {
+    FOCUS_SCAN_STEPPED = 0,
+    FOCUS_SCAN_SWEEP,
+    FOCUS_SCAN_GOLDEN_SECTION,
+    FOCUS_SCAN_COUNT
+};
+
+/*The lens steps and focus frame timeouts the state machine uses. The defaults are the values
+* tuned by hand on the camera. The CDAF simulator builds its own to try others.
+*/
+struct CDAFTuning {
+    guint transitStep = TRANSIT_STEP; //Lens travel per frame when moving to a scan start, 0 for one ramp
+    guint coarseStep = 10;            //Full range scans in and out
+    guint detailStep = 2;             //Detail scan around the coarse peak
+    guint driftStep = 5;              //Following focus drift once focussed
+    guint coarseTimeout = 100;        //ms between focus frames while coarse scanning
+    guint detailTimeout = 150;        //ms between focus frames while detail scanning
+    guint transitTimeout = 250;       //ms between focus frames outside a scan
+    guint settleTimeout = 300;        //ms for the lens to settle on the chosen focus point
+    guint driftTimeout = 150;         //ms between focus frames while following drift
+    guint searchMode = FOCUS_SEARCH_DETAIL_SCAN; //A FocusSearchMode
+    guint confirmStep = 4;            //Curve fit check frames either side of the estimate
+    guint scanMode = FOCUS_SCAN_STEPPED; //A FocusScanMode
+    guint sweepRate = 300;            //Focus indices per second while sweeping
+    guint sweepLag = 0;               //ms the lens runs behind a sweep command, less half the exposure
+    guint bracketStep = 40;           //Golden section bracket scan step while the focus curve is flat
+    guint noiseTolerance = 5;         //% difference between focus values treated as noise
+};
+
+/*Focus values and the lens positions they were measured at, for one scan. The capacity covers
+* every position from MIN_FOCUS_INDEX to MAX_FOCUS_INDEX, the most a scan can visit with a step
+* of 1, so a scan never allocates. Anything past that is dropped and counted, which only happens
+* if a state pushes without clearing between scans.
+*/
+class FocusScanBuffer {
+public:
+    static const guint CAPACITY = MAX_FOCUS_INDEX - MIN_FOCUS_INDEX + 1;
+
+    FocusScanBuffer() : count_(0), dropped_(0) {}
+
+    void clear() { count_ = 0; }
+
+    void push(gfloat value, guint focus_index) {
+        if (count_ == CAPACITY) {
+            ++dropped_;
+            return;
+        }
+        values_[count_] = value;
+        indices_[count_] = focus_index;
+        ++count_;
+    }
+
+    guint size() const { return count_; }
+    guint64 dropped() const { return dropped_; } //Samples dropped since the buffer was made, not reset by clear
+    gfloat value(guint position) const { return values_[position]; }
+    guint index(guint position) const { return indices_[position]; }
+
+    /* Position of the highest value, the first one on a tie. 0 when empty. */
+    guint peak() const {
+        guint best = 0;
+        for (guint i = 1; i < count_; ++i)
+            if (values_[i] > values_[best])
+                best = i;
+        return best;
+    }
+
+    /* Position of the lowest value, the first one on a tie. 0 when empty. */
+    guint lowest() const {
+        guint worst = 0;
+        for (guint i = 1; i < count_; ++i)
+            if (values_[i] < values_[worst])
+                worst = i;
+        return worst;
+    }
+
+private:
+    gfloat values_[CAPACITY];
+    guint indices_[CAPACITY];
+    guint count_;
+    guint64 dropped_;
+};
+
+/*The range the golden section search is narrowing, low to high focus index, and the two points
+* inside it. The peak is always between low and high.
+*/
+struct GoldenBracket {
+    guint low;
+    guint high;
+    guint lower;        //The inner point nearer low
+    guint upper;        //The inner point nearer high
+    gfloat lowerValue;
+    gfloat upperValue;
+    gboolean lowerMeasured;
+    gboolean upperMeasured;
+};
+
+/*Where the state machine has spent its time, for each state.*/
+struct FocusStateStats {
+    guint64 entries; //Times the state machine changed into the state
+    guint64 frames;  //Focus frames handed to the state
+    gint64 time;     //us spent in the state
+    guint64 dropped; //Scan samples the state lost to a full FocusScanBuffer
+};
 
 /*This basically is the algorithm in its entirity. This will need to have a  pointer to its parent  object for get and set 
 functions. This is also where the I2CsetFocus object will need to be */
 class CDAF {
 public:
-    CDAF(AF_Additions* AF_interface, ErrorHandler* error_handler);
+    CDAF(FocusInterface* AF_interface, ErrorHandler* error_handler, const CDAFTuning& tuning = CDAFTuning());
     ~CDAF();
     gint setup(GError** error);
+    void setFocusDevice(const gchar* camera_id);
     void runFocus(gfloat focus_value);
+    void stepFocus(gfloat focus_value, gint64 frame_time);
+    void applyFocus(guint focus_index);
+    guint rampTime() const;
+    void rampNextMove();
     gint setFocus(guint focus_index, GError** error);
-    void changeState(FocusState* newState);
+    void changeState(FocusStateId newState);
     void focusAchieved();
     void setScanning(gboolean value, guint timeout);
+    void setSweeping(gboolean value);
+    gboolean sweeping() const;
+    guint sweepPosition(gint64 time) const;
+    guint frameIndex(gint64 frame_time) const;
+    void setTrace(FocusTrace* trace);
+    void warmStart(guint focus_index, gfloat focus_value, guint span);
+    FocusStateId stateId() const;
+    const gchar* stateName() const;
+    static const gchar* stateName(FocusStateId id);
+    static const gchar* scanModeName(guint mode);
+    FocusStateStats getStateStats(FocusStateId id) const;
 
-    std::vector<float> scanInValues;
-    std::vector<int> scanInIndicies;
+    CDAFTuning tuning;
 
-    std::vector<float> scanOutValues;
-    std::vector<int> scanOutIndicies;
+    FocusScanBuffer scanIn;
+    FocusScanBuffer scanOut;
 
     gfloat focusValue;
+    gint64 frameTime; //When the frame being stepped was exposed, us on the g_get_monotonic_time clock
     guint focusIndex;
     guint focusStep;
     gboolean boundary;
@@ -78,13 +250,32 @@ public:
     guint detailScanMax;
     guint detailScanMin;
     guint chaseFocus;
+    guint peakEstimate;
+    gint64 sweepStart; //frameTime the sweep started from
+    GoldenBracket golden;
+    guint warmIndex; //Where focus was last found, the warm start position
+    gfloat warmValue; //Focus value when focus was last found at the warm start position
+    guint warmProbe; //Focus indices either side of warmIndex that must be less sharp, the edges of the detail scan
+    gboolean warmStarting; //The detail scan is around a remembered position, not a scanned peak
 
 private:
-    AF_Additions* my_AF_interface_;
+    FocusInterface* my_AF_interface_;
     ErrorHandler* error_handler_;
     FocusState* currentState_;
     CameraI2CDevice i2c_focus_controller_;
     FocusState* postTransitState_;
+    FocusTrace* trace_;
+    gboolean scanning_;
+    guint frame_timeout_;
+    gboolean locked_;
+    std::atomic<gboolean> sweeping_; //Read by the main loop while it drives the lens along the sweep
+    std::atomic<gboolean> ramp_pending_; //The next applyFocus ramps the lens instead of jumping. Set on the focus worker
+    guint ramp_time_; //ms the lens move applyFocus last made takes, 0 for a jump
+    FocusStateStats state_stats_[FOCUS_STATE_COUNT];
+    gint64 state_entered_; //When the current state was entered, g_get_monotonic_time
+    guint acquisition_frames_; //Frames stepped since the last focus lock
+    gint64 acquisition_start_; //frameTime of the first of them
+    mutable GMutex stats_mutex_; //The stats are read from the main loop while the worker steps
     
     
     //needs a pointer to it's parent.
@@ -97,66 +288,127 @@ class FocusState {
 public:
     virtual ~FocusState() = default;
     virtual void runFocus(CDAF& cdaf) = 0;
+    virtual FocusStateId id() const = 0;
 };
 
 class TransitState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_TRANSIT; }
 };
 
 class StartScanFocusInState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_SCAN_FOCUS_IN; }
 };
 
 class ScanFocusInState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_SCAN_FOCUS_IN; }
 };
 
 class StartScanFocusOutState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_SCAN_FOCUS_OUT; }
 };
 
 class ScanFocusOutState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_SCAN_FOCUS_OUT; }
 };
 
 class StartDetailScanState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_DETAIL_SCAN; }
 };
 
 class DetailScanState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_DETAIL_SCAN; }
 };
 
 class SetFocusState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_SET_FOCUS; }
 };
 
 class GrabFocusValueState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_GRAB_FOCUS_VALUE; }
 };
 
 class StartDriftScanningState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_DRIFT_SCANNING; }
 };
 
 class ConfirmDriftDirectionState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_CONFIRM_DRIFT_DIRECTION; }
 };
 
 class DriftScanForPeakState : public FocusState {
 public:
     void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_DRIFT_SCAN_FOR_PEAK; }
+};
+
+class StartConfirmPeakState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_CONFIRM_PEAK; }
+};
+
+class ConfirmPeakState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_CONFIRM_PEAK; }
+};
+
+class StartSweepState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_SWEEP; }
+};
+
+class SweepState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_SWEEP; }
+};
+
+class StartBracketScanState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_START_BRACKET_SCAN; }
+};
+
+class BracketScanState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_BRACKET_SCAN; }
+};
+
+class GoldenSectionState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_GOLDEN_SECTION; }
+};
+
+class WarmStartState : public FocusState {
+public:
+    void runFocus(CDAF& cdaf) override;
+    FocusStateId id() const override { return FOCUS_STATE_WARM_START; }
 };
 
 #endif //CDAF_H
\ No newline at end of file
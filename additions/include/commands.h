@@ -45,5 +45,9 @@
 #define LEN_CALIBRATED_DATA_COMMAND 7
 #define AT_SENSOR_TEMP "ATTEMP"
 #define LEN_SENSOR_TEMP_COMMAND 6
+#define AT_SET_MEASURE_MODE "ATTCSMD=" //Followed by the mode, 2 measures all channels continuously
+#define LEN_SET_MEASURE_MODE_COMMAND 8
+#define AT_BURST "ATBURST=" //Followed by a count. Streams that many calibrated readings, one a line, then OK
+#define LEN_BURST_COMMAND 8
 
 #endif //COMMANDS_H
\ No newline at end of file
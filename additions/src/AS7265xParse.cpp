@@ -0,0 +1,182 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AS7265xParse.h"
+
+#define PARSE_MAX_DIGITS 19 //Significant digits that always fit in a guint64
+
+static_assert(AS7265xParse::wavelength[0] == 410 && AS7265xParse::wavelength[AS7265X_CHANNELS - 1] == 940,
+    "AS7265x channel map is not in wavelength order");
+
+//Powers of ten a double holds exactly
+static const gdouble exact_powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline gboolean isDigit(gchar c) {
+    return (guint)(c - '0') < 10;
+}
+
+static inline const gchar* skipSpaces(const gchar* pos, const gchar* last) {
+    while ((pos != last) && (*pos == ' '))
+        ++pos;
+    return pos;
+}
+
+NumberResult AS7265xParse::parseUnsigned(const gchar* first, const gchar* last, guint16* value)
+{
+    const gchar* pos = first;
+    guint32 result = 0;
+
+    while ((pos != last) && isDigit(*pos)) {
+        result = result * 10 + (*pos - '0');
+        if (result > G_MAXUINT16)
+            return { first, FALSE };
+        ++pos;
+    }
+    if (pos == first)
+        return { first, FALSE };
+
+    *value = (guint16)result;
+    return { pos, TRUE };
+}
+
+/**
+* Reads the digits into a whole number and a power of ten, then scales once in double precision.
+* Up to 19 significant digits and powers of ten up to 22 this is exact before the one rounding to
+* float, which covers everything the board sends. Longer numbers lose their extra digits.
+*/
+NumberResult AS7265xParse::parseFloat(const gchar* first, const gchar* last, gfloat* value)
+{
+    const gchar* pos = first;
+    gboolean negative = FALSE;
+    guint64 mantissa = 0;
+    gint digits = 0; //Significant digits in mantissa
+    gint exponent = 0;
+    gboolean any_digit = FALSE;
+    gdouble result;
+
+    if ((pos != last) && ((*pos == '-') || (*pos == '+'))) {
+        negative = (*pos == '-');
+        ++pos;
+    }
+
+    for (; (pos != last) && isDigit(*pos); ++pos) {
+        any_digit = TRUE;
+        if (digits < PARSE_MAX_DIGITS) {
+            mantissa = mantissa * 10 + (*pos - '0');
+            digits += (mantissa != 0) ? 1 : 0;
+        }
+        else
+            exponent++;
+    }
+    if ((pos != last) && (*pos == '.')) {
+        for (++pos; (pos != last) && isDigit(*pos); ++pos) {
+            any_digit = TRUE;
+            if (digits < PARSE_MAX_DIGITS) {
+                mantissa = mantissa * 10 + (*pos - '0');
+                digits += (mantissa != 0) ? 1 : 0;
+                exponent--;
+            }
+        }
+    }
+    if (!any_digit)
+        return { first, FALSE };
+
+    //An exponent only counts if it has digits, otherwise the number ends before the e
+    if ((pos != last) && ((*pos == 'e') || (*pos == 'E'))) {
+        const gchar* exp_pos = pos + 1;
+        gboolean exp_negative = FALSE;
+        gint exp_value = 0;
+
+        if ((exp_pos != last) && ((*exp_pos == '-') || (*exp_pos == '+'))) {
+            exp_negative = (*exp_pos == '-');
+            ++exp_pos;
+        }
+        if ((exp_pos != last) && isDigit(*exp_pos)) {
+            for (; (exp_pos != last) && isDigit(*exp_pos); ++exp_pos)
+                exp_value = MIN(exp_value * 10 + (*exp_pos - '0'), 1000);
+            exponent += exp_negative ? -exp_value : exp_value;
+            pos = exp_pos;
+        }
+    }
+
+    result = (gdouble)mantissa;
+    if (mantissa != 0) {
+        while (exponent > 22) {
+            result *= 1e22;
+            exponent -= 22;
+        }
+        while (exponent < -22) {
+            result /= 1e22;
+            exponent += 22;
+        }
+        result = (exponent < 0) ? result / exact_powers[-exponent] : result * exact_powers[exponent];
+    }
+    if (result > G_MAXFLOAT) //Out of range, as from_chars would say
+        return { first, FALSE };
+
+    *value = (gfloat)(negative ? -result : result);
+    return { pos, TRUE };
+}
+
+/**
+* Reads AS7265X_CHANNELS comma separated numbers into a wavelength ordered array. Spaces are allowed
+* around each number and the line may end in OK, as the board ends its replies.
+*/
+template<typename T, NumberResult (*Parse)(const gchar*, const gchar*, T*)>
+static gboolean parseFields(LineView line, std::array<T, AS7265X_CHANNELS>* out)
+{
+    std::array<T, AS7265X_CHANNELS> values;
+    const gchar* pos = line.data();
+    const gchar* last = line.data() + line.size();
+
+    for (gsize field = 0; field < AS7265X_CHANNELS; ++field) {
+        NumberResult number;
+
+        pos = skipSpaces(pos, last);
+        number = Parse(pos, last, &values[AS7265xParse::field_rank[field]]);
+        if (!number.ok)
+            return FALSE;
+        pos = skipSpaces(number.ptr, last);
+        if (field < AS7265X_CHANNELS - 1) {
+            if ((pos == last) || (*pos != ','))
+                return FALSE;
+            ++pos;
+        }
+    }
+
+    if ((last - pos >= 2) && (pos[0] == 'O') && (pos[1] == 'K'))
+        pos = skipSpaces(pos + 2, last);
+    if (pos != last)
+        return FALSE;
+
+    *out = values;
+    return TRUE;
+}
+
+gboolean AS7265xParse::parseRaw(LineView line, AS7265xRaw* raw)
+{
+    return parseFields<guint16, parseUnsigned>(line, raw);
+}
+
+gboolean AS7265xParse::parseCalibrated(LineView line, AS7265xCalibrated* calibrated)
+{
+    return parseFields<gfloat, parseFloat>(line, calibrated);
+}
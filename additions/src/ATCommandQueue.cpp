@@ -0,0 +1,371 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#include "ATCommandQueue.h"
+#include "SerialIO.h"
+
+/**
+ * Constructs an ATCommandQueue and makes it the handler of every line the port receives.
+ *
+ * @param serial_port : The port the device is on. It does not need to be set up yet.
+ */
+ATCommandQueue::ATCommandQueue(SerialPort* serial_port) : serial_port_(serial_port),
+    timeout_source_(0), resync_source_(0), resync_quiet_ms_(AT_RESYNC_QUIET_MS) {
+
+    memset(&stats_, 0, sizeof(stats_));
+    serial_port_->setWriteFunc(replyLineWrapper, this);
+}
+
+/**
+ * Destructor for ATCommandQueue. Commands still waiting are dropped without a reply.
+ */
+ATCommandQueue::~ATCommandQueue() {
+    disarm(&timeout_source_);
+    disarm(&resync_source_);
+    serial_port_->unsetWriteFunc();
+    g_print("AT command queue: %" G_GUINT64_FORMAT " commands in %" G_GUINT64_FORMAT " writes, %" G_GUINT64_FORMAT
+        " retries, %" G_GUINT64_FORMAT " failed, %" G_GUINT64_FORMAT " unmatched lines, %" G_GUINT64_FORMAT
+        " streamed lines, slowest batch %.1f ms\n", stats_.commands, stats_.writes, stats_.retries, stats_.failures,
+        stats_.unmatched, stats_.streamed, stats_.max_latency / 1000.0);
+}
+
+/**
+* Adds a command to the next batch. Nothing is written until flush.
+*
+* @param command : The command, without a line ending.
+* @param tag : Handed back in the reply.
+* @param fields : Number of comma separated fields in the reply, or 0 to take any line.
+* @param func : Called with the reply, or with the failure once all tries are used.
+* @param user_data : Passed back to func.
+* @param timeout_ms : How long the device can take to answer, from the reply before.
+* @param retries : How many more times to send it after an ERROR or a timeout.
+*/
+void ATCommandQueue::submit(const gchar* command, guint tag, guint fields, ATReplyFunc func, gpointer user_data,
+    guint timeout_ms, guint retries) {
+
+    pending_.push_back({ command, tag, fields, func, user_data, timeout_ms, retries + 1, 0, 0, FALSE });
+    stats_.commands++;
+}
+
+/**
+* Adds a streamed command to the next batch, one that answers with a line for each reading until
+* a line ending in OK. Nothing is written until flush.
+*
+* @param command : The command, without a line ending.
+* @param tag : Handed back with each line.
+* @param fields : Number of comma separated fields in each streamed line.
+* @param func : Called with each line, with more set until the last one.
+* @param user_data : Passed back to func.
+* @param timeout_ms : How long the device can take over each line.
+*/
+void ATCommandQueue::submitStream(const gchar* command, guint tag, guint fields, ATReplyFunc func,
+    gpointer user_data, guint timeout_ms) {
+
+    pending_.push_back({ command, tag, fields, func, user_data, timeout_ms, 1, 0, 0, TRUE });
+    stats_.commands++;
+}
+
+/**
+* Writes every submitted command in one go. They join the end of any commands still waiting
+* for a reply, so a batch can be flushed before the last one is answered.
+*
+* @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+*
+* @return : -1 on error, otherwise 0. The commands of a failed write are dropped without a reply.
+*/
+gint ATCommandQueue::flush(GError** error) {
+    gsize first = in_flight_.size();
+
+    if (pending_.empty() || resync_source_) //A resync sends pending commands when it ends
+        return 0;
+
+    in_flight_.insert(in_flight_.end(), pending_.begin(), pending_.end());
+    pending_.clear();
+    if (writeCommands(in_flight_.begin() + first, error) == -1) {
+        in_flight_.erase(in_flight_.begin() + first, in_flight_.end());
+        return -1;
+    }
+
+    if (first == 0)
+        armTimeout();
+    return 0;
+}
+
+/**
+* TRUE when no command is waiting to be written or answered.
+*/
+gboolean ATCommandQueue::idle() const {
+    return pending_.empty() && in_flight_.empty();
+}
+
+ATQueueStats ATCommandQueue::getStats() const {
+    return stats_;
+}
+
+/**
+* Writes the in flight commands from first to the end, each on its own line, in one writev.
+*
+* @return : -1 on error, otherwise 0.
+*/
+gint ATCommandQueue::writeCommands(std::deque<ATCommand>::iterator first, GError** error) {
+    gint64 now = g_get_monotonic_time();
+
+    lines_.clear();
+    for (auto it = first; it != in_flight_.end(); ++it) {
+        it->tries++;
+        it->tries_left--;
+        it->batch_time = now;
+        lines_.push_back(it->command.c_str());
+    }
+    stats_.writes++;
+
+    return (serial_port_->sendLines(lines_, error) == -1) ? -1 : 0;
+}
+
+/**
+* Starts the timeout of the command at the head of the queue, the one the next reply is for.
+*/
+void ATCommandQueue::armTimeout() {
+    disarm(&timeout_source_);
+    if (!in_flight_.empty())
+        timeout_source_ = g_timeout_add(in_flight_.front().timeout_ms, commandTimeoutWrapper, this);
+}
+
+void ATCommandQueue::disarm(guint* source) {
+    if (*source) {
+        g_source_remove(*source);
+        *source = 0;
+    }
+}
+
+/**
+* Gets when the reply came in. A line is timed from the read it came in on, as several lines of a
+* read are handled one after the other. A timeout has no line, so it is timed now.
+*/
+gint64 ATCommandQueue::replyTime(ATReplyStatus status) const {
+    gint64 time = (status == AT_REPLY_TIMEOUT) ? 0 : serial_port_->lineTime();
+
+    return time ? time : g_get_monotonic_time();
+}
+
+/**
+* Takes the head command off the queue and hands it its reply. The next command's timeout starts
+* first, so the reply function can submit and flush more commands.
+*/
+void ATCommandQueue::finish(ATReplyStatus status, LineView line) {
+    ATCommand command = in_flight_.front();
+    gint64 time = replyTime(status);
+    ATReply reply = { command.tag, status, line, command.tries, time - command.batch_time, time, FALSE };
+
+    in_flight_.pop_front();
+    armTimeout();
+
+    if (status != AT_REPLY_TIMEOUT)
+        stats_.replies++;
+    if (status != AT_REPLY_OK)
+        stats_.failures++;
+    stats_.max_latency = MAX(stats_.max_latency, reply.latency);
+
+    if (command.func)
+        command.func(reply, command.user_data);
+}
+
+/**
+* Hands on a line of the streamed command at the head of the queue. A line ending in OK ends the
+* stream, whether it is the last reading or an OK on its own.
+*/
+void ATCommandQueue::streamLine(LineView line) {
+    ATCommand& head = in_flight_.front();
+    gboolean ends = (line.size() >= 2) && (line.substr(line.size() - 2) == "OK");
+    gboolean fits = ((guint)std::count(line.begin(), line.end(), ',') + 1 == head.fields);
+
+    if (ends)
+        finish(AT_REPLY_OK, line);
+    else if (fits) {
+        gint64 time = replyTime(AT_REPLY_OK);
+        ATReply reply = { head.tag, AT_REPLY_OK, line, head.tries, time - head.batch_time, time, TRUE };
+        ATReplyFunc func = head.func; //The reply function can submit more, which can move head
+        gpointer user_data = head.user_data;
+
+        stats_.streamed++;
+        armTimeout(); //Each line has its own timeout
+        if (func)
+            func(reply, user_data);
+    }
+    else {
+        finish(AT_REPLY_MISMATCH, line);
+        if (!in_flight_.empty())
+            startResync(0);
+    }
+}
+
+/**
+* Stops matching replies and sends everything in flight again once the port has gone quiet. The
+* device answers in order, so once nothing has come in for as long as the slowest command in
+* flight can take, no reply to the old batch is still to come. Only a command that failed uses up
+* a try, the others are only resent because of it.
+*
+* @param first_refund : Index of the first command to give its try back to. 1 when the head failed
+* and is being sent again, 0 when it has been given up on and taken off.
+*/
+void ATCommandQueue::startResync(gsize first_refund) {
+    disarm(&timeout_source_);
+    disarm(&resync_source_);
+    resync_quiet_ms_ = AT_RESYNC_QUIET_MS;
+    for (gsize i = 0; i < in_flight_.size(); ++i) {
+        resync_quiet_ms_ = MAX(resync_quiet_ms_, in_flight_[i].timeout_ms);
+        if (i >= first_refund) {
+            in_flight_[i].tries--;
+            in_flight_[i].tries_left++;
+        }
+    }
+    resync_source_ = g_timeout_add(resync_quiet_ms_, resyncWrapper, this);
+}
+
+/**
+ * CALLBACK FUNCTION. Called by the serial port with each line received. This wrapper reinterprets the
+ * gpointer user_data object into usable pointer for accessing the replyLine method.
+ *
+ * @param line : The line received, without its line ending.
+ * @param user_data : Pointer to this ATCommandQueue object
+ */
+void ATCommandQueue::replyLineWrapper(LineView line, gpointer user_data) {
+    static_cast<ATCommandQueue*>(user_data)->replyLine(line);
+}
+
+/**
+ * CLASS METHOD. Matches a line to the oldest command waiting for a reply.
+ *
+ * @param line : The line received, without its line ending.
+ */
+void ATCommandQueue::replyLine(LineView line) {
+    if (resync_source_) { //Still draining replies to commands that are going to be sent again
+        stats_.unmatched++;
+        disarm(&resync_source_);
+        resync_source_ = g_timeout_add(resync_quiet_ms_, resyncWrapper, this);
+        return;
+    }
+    if (in_flight_.empty()) {
+        stats_.unmatched++;
+        g_debug("AT reply with no command waiting: %.*s", (gint)line.size(), line.data());
+        return;
+    }
+
+    const ATCommand& head = in_flight_.front();
+    gboolean is_error = (line.size() >= 5) && (line.substr(line.size() - 5) == "ERROR");
+
+    if (head.stream && !is_error) {
+        streamLine(line);
+        return;
+    }
+    gboolean mismatch = !is_error && (head.fields > 0)
+        && ((guint)std::count(line.begin(), line.end(), ',') + 1 != head.fields);
+
+    if ((is_error || mismatch) && (head.tries_left > 0)) {
+        g_debug("%s answered %.*s, sending it again", head.command.c_str(), (gint)line.size(), line.data());
+        stats_.retries++;
+        startResync(1);
+    }
+    else if (mismatch) { //The replies after it may be out of step as well
+        finish(AT_REPLY_MISMATCH, line);
+        if (!in_flight_.empty())
+            startResync(0);
+    }
+    else
+        finish(is_error ? AT_REPLY_ERROR : AT_REPLY_OK, line);
+}
+
+/**
+ * CALLBACK FUNCTION. Called when the head command has waited its timeout. This wrapper reinterprets the
+ * gpointer user_data object into usable pointer for accessing the commandTimeout method.
+ *
+ * @param user_data : Pointer to this ATCommandQueue object
+ *
+ * @return : gboolean value passed through from commandTimeout
+ */
+gboolean ATCommandQueue::commandTimeoutWrapper(gpointer user_data) {
+    return static_cast<ATCommandQueue*>(user_data)->commandTimeout();
+}
+
+/**
+ * CLASS METHOD. Sends the head command again, or gives up on it once it is out of tries. As the
+ * reply may only be late, the commands behind it are sent again after a resync either way.
+ *
+ * @return : FALSE, the timeout is armed again for each command.
+ */
+gboolean ATCommandQueue::commandTimeout() {
+    timeout_source_ = 0;
+    if (in_flight_.empty())
+        return FALSE;
+
+    if (in_flight_.front().tries_left > 0) {
+        g_debug("No answer to %s, sending it again", in_flight_.front().command.c_str());
+        stats_.retries++;
+        startResync(1);
+    }
+    else {
+        g_print("No answer to AT command %s after %u tries\n", in_flight_.front().command.c_str(),
+            in_flight_.front().tries);
+        finish(AT_REPLY_TIMEOUT, LineView());
+        if (!in_flight_.empty())
+            startResync(0);
+    }
+    return FALSE;
+}
+
+/**
+ * CALLBACK FUNCTION. Called once the port has been quiet after a failed command. This wrapper reinterprets
+ * the gpointer user_data object into usable pointer for accessing the resync method.
+ *
+ * @param user_data : Pointer to this ATCommandQueue object
+ *
+ * @return : gboolean value passed through from resync
+ */
+gboolean ATCommandQueue::resyncWrapper(gpointer user_data) {
+    return static_cast<ATCommandQueue*>(user_data)->resync();
+}
+
+/**
+ * CLASS METHOD. Sends the commands in flight, and any submitted during the resync, again in one batch.
+ *
+ * @return : FALSE, this only runs once for each resync.
+ */
+gboolean ATCommandQueue::resync() {
+    GError* error = nullptr;
+
+    resync_source_ = 0;
+    in_flight_.insert(in_flight_.end(), pending_.begin(), pending_.end());
+    pending_.clear();
+    if (in_flight_.empty())
+        return FALSE;
+
+    if (writeCommands(in_flight_.begin(), &error) == -1) {
+        g_print("AT commands could not be sent again: %s\n", error->message);
+        g_clear_error(&error);
+        while (!in_flight_.empty())
+            finish(AT_REPLY_TIMEOUT, LineView());
+        return FALSE;
+    }
+    armTimeout();
+    return FALSE;
+}
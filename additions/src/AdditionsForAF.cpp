@@ -20,7 +20,6 @@
 
 #include "AdditionsForAF.h"
 #include "AdditionsParent.h"
-#include "opencv4/opencv2/imgproc.hpp"
 
 /**
  * Constructs an AF_Additions object associated with a specific camera using its identifier.
@@ -30,10 +29,17 @@
  * 
  */
 AF_Additions::AF_Additions(AdditionsParent* additions_parent,ErrorHandler* error_handler):
-grab_focus_frame_(FALSE),focussed_(FALSE), focussing_(FALSE),
-focus_lock_(FALSE), focus_value_(0),focussed_value_(0), focus_frame_timeout_(250),
 focus_machine_(this, error_handler),
-additions_parent_(additions_parent) {
+additions_parent_(additions_parent), focus_metric_(nullptr), focus_map_(nullptr),
+focus_caps_(nullptr), focus_roi_(), focus_crop_(), focus_trace_(),
+focus_worker_(std::bind(&AF_Additions::processFocusFrame, this, std::placeholders::_1, std::placeholders::_2)),
+memory_dirty_(FALSE), memory_saved_(G_MININT64),
+bracket_job_(nullptr), bracket_frame_(0), bracket_centre_(FOCUS_START_INDEX), release_pending_(FALSE),
+grab_focus_frame_(FALSE), focus_frame_timeout_(250), focussed_(FALSE), focussing_(FALSE),
+focus_lock_(FALSE), scanning_(FALSE), sweeping_(FALSE), focus_clock_offset_(0), fresh_after_(G_MININT64),
+calibration_index_(FOCUS_START_INDEX), calibrate_settle_(FALSE), lens_index_(FOCUS_START_INDEX),
+focus_value_(0), focussed_value_(0) {
+    g_mutex_init(&sources_mutex_);
     g_print("...AF addional objects created\n");
 }
 
@@ -41,6 +47,21 @@ additions_parent_(additions_parent) {
  * Destructor for AF_Additions. Logs the shutdown process and cleans up resources.
  */
 AF_Additions::~AF_Additions(){
+    //processFocusFrame uses most of this object, so the worker stops before anything goes, and
+    //no callback still queued on the main loop may run after it
+    focus_worker_.stop();
+    removeMainSources();
+
+    FocusDriftStats drift = drift_detector_.getStats();
+
+    g_print("AF held focus checks: %" G_GUINT64_FORMAT ", focus lost %" G_GUINT64_FORMAT " times, "
+        "%" G_GUINT64_FORMAT " rescans avoided\n", drift.frames, drift.drifts, drift.avoided);
+    if (focus_caps_)
+        gst_caps_unref(focus_caps_);
+    delete bracket_job_;
+    delete focus_map_;
+    delete focus_metric_;
+    g_mutex_clear(&sources_mutex_);
     g_print("AF addional objects removed...\n");
 }
 
@@ -54,14 +75,96 @@ AF_Additions::~AF_Additions(){
  */
 gint AF_Additions::setup(GError** error) {
 
+    gint metric_type = additions_parent_->getSettings().focus_metric;
+
+    if ((metric_type < 0) || (metric_type >= FOCUS_METRIC_COUNT)) {
+        g_print("Unknown focus metric %d, using %s\n", metric_type,
+            FocusMetric::typeName(FOCUS_METRIC_LAPLACIAN_MEAN));
+        metric_type = FOCUS_METRIC_LAPLACIAN_MEAN;
+    }
+    focus_metric_ = FocusMetric::create((FocusMetricType)metric_type);
+    g_print("AF focus metric: %s (%s kernels)\n", focus_metric_->name(),
+        FocusKernels::pathName(FocusKernels::bestPath()));
+
+    const AdditionsSettings& settings = additions_parent_->getSettings();
+    gint frame_width, frame_height;
+
+    additions_parent_->getResolution(&frame_width, &frame_height);
+    additions_focus_crop_size(&settings, frame_width, frame_height, &focus_crop_.width, &focus_crop_.height);
+    focus_roi_.width = MIN(MAX(settings.focus_roi_size, 16) & ~1, frame_width);
+    focus_roi_.height = MIN(MAX(settings.focus_roi_size, 16) & ~1, frame_height);
+
+    if ((settings.focus_map_columns > 0) && (settings.focus_map_rows > 0)) {
+        focus_map_ = new FocusMap(settings.focus_map_columns, settings.focus_map_rows,
+            (settings.focus_map_score == FOCUS_MAP_SCORE_WEIGHTED) ? FOCUS_MAP_SCORE_WEIGHTED : FOCUS_MAP_SCORE_ARGMAX);
+        if ((focus_map_->setup(error)) == -1)
+            return -1; //error is set by the thread pool
+    }
+    setFocusRoi((frame_width - focus_roi_.width) / 2, (frame_height - focus_roi_.height) / 2);
+
+    focus_machine_.tuning.searchMode =
+        (settings.focus_search == FOCUS_SEARCH_CURVE_FIT) ? FOCUS_SEARCH_CURVE_FIT : FOCUS_SEARCH_DETAIL_SCAN;
+    focus_machine_.tuning.scanMode =
+        ((settings.focus_scan >= 0) && (settings.focus_scan < FOCUS_SCAN_COUNT)) ? settings.focus_scan : FOCUS_SCAN_STEPPED;
+    focus_machine_.tuning.sweepRate = MAX(settings.focus_sweep_rate, 1);
+    focus_machine_.tuning.sweepLag = MAX(settings.focus_sweep_lag, 0);
+    g_print("AF full range search: %s\n", CDAF::scanModeName(focus_machine_.tuning.scanMode));
+
+    drift_detector_.setSensitivity(settings.focus_drift_slack, settings.focus_drift_threshold,
+        settings.focus_drift_noise_floor);
+    g_print("AF drift check: %.1f sigma threshold, %.1f sigma slack, %.1f%% noise floor\n",
+        settings.focus_drift_threshold, settings.focus_drift_slack, settings.focus_drift_noise_floor);
+
+    if ((focus_bracket_.setup(MAX(settings.focus_bracket_frames, 0), MAX(settings.focus_bracket_step, 1), error)) == -1)
+        return -1; //error is set by the thread pool
+    if (focus_bracket_.enabled())
+        g_print("AF focus bracket: %u images, %d steps apart\n", focus_bracket_.frames(), settings.focus_bracket_step);
+
+    if (settings.focus_trace_file) {
+        if ((focus_trace_.open(settings.focus_trace_file, focus_machine_.tuning, error)) == -1)
+            return -1; //error is set by the trace
+        focus_machine_.setTrace(&focus_trace_);
+    }
+
+    if (settings.focus_settle_calibrate) {
+        calibrate_settle_ = TRUE;
+        g_print("AF lens settle times will be measured after the first focus lock\n");
+    }
+    else if (settings.focus_settle_file) {
+        if ((settle_model_.load(settings.focus_settle_file, error)) == -1)
+            return -1; //error is set by the key file
+        g_print("AF lens settle model from %s\n", settings.focus_settle_file);
+        settle_model_.print();
+    }
+
+    if ((settings.focus_memory_file) && (g_file_test(settings.focus_memory_file, G_FILE_TEST_EXISTS))) {
+        GError* memory_error = nullptr;
+
+        //A bad memory only costs a full range search, so it does not stop the camera
+        if ((focus_memory_.load(settings.focus_memory_file, &memory_error)) == -1) {
+            g_print("AF focus memory not used: %s\n", memory_error->message);
+            g_error_free(memory_error);
+        }
+    }
+    if (focus_memory_.valid())
+        focus_machine_.warmStart(focus_memory_.focusIndex(), focus_memory_.focusValue(), focus_memory_.span());
+    lens_index_ = focus_machine_.focusIndex;
+
+    if ((focus_worker_.setup(error)) == -1)
+        return -1; //error is set by the thread creation
+
+    if (settings.focus_i2c_device)
+        focus_machine_.setFocusDevice(settings.focus_i2c_device);
     if ((focus_machine_.setup(error)) == -1)
         return -1; //error should be set
 
-    if ((focus_machine_.setFocus(280, error)) == -1) //We set a focus value here
+    if ((focus_machine_.setFocus(lens_index_, error)) == -1) //We set a focus value here
         return -1; //Assume error is already set
 
     triggerFocusCapture(); //Grab a frame to start
-    g_idle_add(focusTriggerWrapper, this);
+    addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, focusTriggerWrapper);
+    if (settings.focus_stats_interval > 0)
+        addMainSource(G_PRIORITY_DEFAULT_IDLE, settings.focus_stats_interval * 1000, logFocusStatsWrapper);
 
     g_print ("AF additions focus controller setup\n"); 
     return 0;
@@ -71,8 +174,36 @@ gint AF_Additions::setup(GError** error) {
 * A public function so that the runFocus algorithm can notify us that focus is set.
 */
 void AF_Additions::focusAchieved() {
-    focussed_value_= focus_value_;
+    focussed_value_ = focus_value_.load();
     focussed_ = TRUE;
+    drift_detector_.reset(focus_value_);
+
+    if (additions_parent_->getSettings().focus_memory_file) {
+        focus_memory_.remember(focus_machine_.focusIndex, focus_value_);
+        memory_dirty_ = TRUE;
+        saveFocusMemory();
+    }
+}
+
+/**
+* Write the focus memory for the next run. Drift relocks can come every few seconds, so the
+* writes are held to one per FOCUS_MEMORY_SAVE_INTERVAL, and the held focus checks write out
+* whatever was held back. Runs on the focus worker thread, like the locks that change it.
+*/
+void AF_Additions::saveFocusMemory() {
+    const gchar* memory_file = additions_parent_->getSettings().focus_memory_file;
+    gint64 now = g_get_monotonic_time();
+    GError* error = nullptr;
+
+    if ((!memory_dirty_) || (now - memory_saved_ < FOCUS_MEMORY_SAVE_INTERVAL * (gint64)G_USEC_PER_SEC))
+        return;
+
+    memory_dirty_ = FALSE;
+    memory_saved_ = now;
+    if ((focus_memory_.save(memory_file, &error)) == -1) {
+        g_print("AF could not save the focus memory: %s\n", error->message);
+        g_error_free(error);
+    }
 }
 
 /**
@@ -83,6 +214,33 @@ gboolean AF_Additions::setFocusLock(){
     focus_lock_ = TRUE;
 }
 
+/**
+* Move the focus ROI, for example onto an animal away from the centre of the frame. The ROI
+* size was fixed at startup, so this only moves the nvvidconv crop window and the focus
+* caps never change. Frames requested after this call are measured at the new position.
+*
+* @param x : Left edge of the ROI in the capture frame, rounded down to even for NV12
+* @param y : Top edge of the ROI in the capture frame, rounded down to even for NV12
+*/
+void AF_Additions::setFocusRoi(gint x, gint y){
+    gint frame_width, frame_height;
+
+    additions_parent_->getResolution(&frame_width, &frame_height);
+
+    focus_roi_.x = CLAMP(x, 0, frame_width - focus_roi_.width) & ~1;
+    focus_roi_.y = CLAMP(y, 0, frame_height - focus_roi_.height) & ~1;
+
+    if (focus_map_)
+        return; //The focus map always gets the whole frame
+
+    //Keep the margin where there is frame to keep, hard against the edge where there is not
+    focus_crop_.x = CLAMP(focus_roi_.x - FOCUS_CROP_MARGIN, 0, frame_width - focus_crop_.width) & ~1;
+    focus_crop_.y = CLAMP(focus_roi_.y - FOCUS_CROP_MARGIN, 0, frame_height - focus_crop_.height) & ~1;
+
+    additions_parent_->setFocusCrop(focus_crop_.x, focus_crop_.y,
+        focus_crop_.x + focus_crop_.width, focus_crop_.y + focus_crop_.height);
+}
+
 /**
 * A public function so that the runFocus algorithm can notify us that it is scanning for focus,
 * and at what interval it would like focus frames.
@@ -92,6 +250,26 @@ void AF_Additions::setScanning(gboolean value, guint timeout){
     focus_frame_timeout_ = timeout;
  }
 
+/**
+* A public function so that the runFocus algorithm can start and stop a sweep. This is called
+* on the focus worker thread. While sweeping the focus valve stays open and the lens is moved
+* along the sweep from a main loop timer. When the sweep ends the valve is shut, and the frames
+* already past it are thrown away, as they were exposed before the lens was sent to the peak.
+*
+* @param value : TRUE when a sweep starts, FALSE when it finishes
+*/
+void AF_Additions::setSweeping(gboolean value){
+    sweeping_ = value;
+    if (value) {
+        additions_parent_->openFocusValve();
+        addMainSource(G_PRIORITY_DEFAULT, FOCUS_SWEEP_TICK, sweepFocusWrapper);
+    }
+    else {
+        additions_parent_->closeFocusValve();
+        fresh_after_ = g_get_monotonic_time();
+    }
+}
+
 /**
 * CALLBACK FUNCTION. Release the focus lock after a g_timeout.This wrapper reinterprets the
 * gpointer user_data object into usable pointer for accessing the setup method in the AdditionsParent class.
@@ -113,22 +291,29 @@ gboolean AF_Additions::releaseFocusLockWrapper(gpointer user_data) {
 gboolean AF_Additions::releaseFocusLock(gpointer user_data)
 {
     AF_Additions* self = static_cast<AF_Additions*>(user_data);
+
+    if (self->bracket_job_) {
+        self->release_pending_ = TRUE; //The last bracket capture releases it
+        return FALSE;
+    }
+    self->release_pending_ = FALSE;
     /*Need to release the focus lock after capturing image*/
     g_print("Releasing Focus Lock\n");
     self->focus_lock_ = FALSE;
     self->focus_value_ = 0;
     self->focussing_ = FALSE;
     if (self->focussed_)
-        g_timeout_add(250, focusTriggerWrapper, this);
+        self->addMainSource(G_PRIORITY_DEFAULT, 250, focusTriggerWrapper);
     else
-        g_idle_add(focusTriggerWrapper, this);
+        self->addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, focusTriggerWrapper);
 
     return FALSE;
 }
 
 /**
  * CALLBACK FUNCTION. Send buffer to focus engine. There is no wrapper function here as this is called from
- * nvgstcapture-1.0 through the focusImageCaptured_C() function.
+ * nvgstcapture-1.0 through the focusImageCaptured_C() function. This runs on the GStreamer streaming
+ * thread, so it only queues a reference to the frame for the focus worker thread and returns.
  * 
  * @param fsink  : image sink
  * @param buffer : gst buffer
@@ -142,83 +327,260 @@ gboolean AF_Additions::focusImageCaptured(GstElement* fsink,
     GstBuffer* buffer, GstPad* pad, gpointer user_data)
 {
     AF_Additions* self = static_cast<AF_Additions*>(user_data);
-    GstMapInfo info;
-    gfloat difference;
+    GstClock* clock = gst_element_get_clock(fsink);
 
-    self->additions_parent_->closeFocusValve();
+    if (clock) { //Buffer timestamps are running time, this puts them on the monotonic clock
+        GstClockTime running_time = gst_clock_get_time(clock) - gst_element_get_base_time(fsink);
+        self->focus_clock_offset_ = g_get_monotonic_time() - (gint64)(running_time / GST_USECOND);
+        gst_object_unref(clock);
+    }
 
-    if (gst_buffer_map(buffer, &info, GST_MAP_READ)) {
-        if (info.size) {            
-            self->focus_value_= laplacianMean(&info);        }
+    if (self->frameTime(buffer) < self->fresh_after_)
+        return TRUE; //Exposed before the lens was ready, the valve stays open for the next frame
 
-        gst_buffer_unmap(buffer, &info);
+    if ((!self->sweeping_) && (!self->settle_calibration_.running()))
+        self->additions_parent_->closeFocusValve();
 
-        if (self->focussed_) {
+    if (!self->updateFocusVideoInfo(pad)) {
+        self->focussing_ = FALSE; //Try again with a later frame
+        self->addMainSource(G_PRIORITY_DEFAULT, 250, self->focusTriggerWrapper);
+        return TRUE;
+    }
+
+    //A full ring means a frame the worker already has will carry the focus loop on
+    self->focus_worker_.queueFrame(buffer, self->focus_video_info_);
+    return TRUE;
+}
 
-            difference = (self->focussed_value_ - self->focus_value_);
-            if (difference < 0)
-                difference = (self->focus_value_ - self->focussed_value_);
+/**
+ * WORKER THREAD. Measure a focus frame and run the focus algorithm on it. The lens move is
+ * marshalled to the main loop so the I2C bus and the focus triggers stay on one thread.
+ *
+ * @param buffer : The focus frame, the worker holds a reference until this returns
+ * @param info : The video info for the caps the frame arrived with
+ */
+void AF_Additions::processFocusFrame(GstBuffer* buffer, GstVideoInfo* info)
+{
+    GstVideoFrame frame;
+    gint64 frame_time = frameTime(buffer);
 
-            //Greater than a 10% difference
-            if (difference >= (0.1 * self->focussed_value_)) {
-                self->focussed_ = FALSE;
-                self->focussing_ = TRUE;
-            }
+    if (frame_time < fresh_after_)
+        return; //Came through the valve during a sweep that has finished
+
+    //gst_video_frame_map uses the GstVideoMeta when there is one, so padded rows are handled
+    if (!gst_video_frame_map(&frame, info, buffer, GST_MAP_READ))
+        return;
+
+    LumaPlane luma = { (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+        GST_VIDEO_FRAME_COMP_WIDTH(&frame, 0), GST_VIDEO_FRAME_COMP_HEIGHT(&frame, 0),
+        GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0) };
+
+    focus_value_= measureFocus(luma);
+
+    gst_video_frame_unmap(&frame);
+
+    if (settle_calibration_.running()) {
+        guint next_index;
+
+        //Every frame goes to the calibration, the main loop moves the lens or finishes it
+        if (settle_calibration_.step(focus_value_, frame_time, &next_index)) {
+            calibration_index_ = next_index;
+            addMainSource(G_PRIORITY_DEFAULT, 0, applyCalibrationStepWrapper);
+        }
+        else if (!settle_calibration_.running()) {
+            addMainSource(G_PRIORITY_DEFAULT, 0, applyCalibrationStepWrapper);
+        }
+        return;
+    }
+
+    if (focussed_) {
+        //Only a sustained change loses focus, not a single frame of flicker or splash
+        if (drift_detector_.update(focus_value_)) {
+            FocusDriftStats drift = drift_detector_.getStats();
+
+            g_print("AF focus lost, focus value %.2f (average %.2f) from %.2f, noise %.2f\n", focus_value_.load(),
+                drift.level, focussed_value_.load(), drift.noise);
+            focussed_ = FALSE;
+            focussing_ = TRUE;
         }
+    }
 
-        //Here we run the focussing state machine when idle
-        if (!self->focussed_) {
-            g_idle_add(self->runFocusWrapper, self);
+    //Here we step the focussing state machine, and hand the lens move to the main loop
+    if (!focussed_) {
+        focus_machine_.stepFocus(focus_value_, frame_time);
+        if (!focus_machine_.sweeping()) { //Mid sweep the lens follows sweepFocus and frames keep coming
+            FocusStep* step = g_new(FocusStep, 1);
+
+            step->self = this;
+            step->focus_index = focus_machine_.focusIndex;
+            step->timeout = focus_frame_timeout_;
+            step->scanning = scanning_;
+            step->focussed = focussed_;
+            addMainSource(G_PRIORITY_DEFAULT, 0, applyFocusStepWrapper, step, g_free);
         }
-        else { //Here we grab another frame to check against our focussed value
-            self->focussing_ = FALSE;
-            self->focus_value_ = 0;
-            g_timeout_add(250, self->focusTriggerWrapper, self);
+    }
+    else { //Here we grab another frame to check against our focussed value
+        if (focus_trace_.isOpen()) {
+            FocusTraceRecord record = {};
+            record.timestamp = frame_time;
+            record.focus_value = focus_value_;
+            record.frame_index = focus_machine_.focusIndex;
+            record.next_index = focus_machine_.focusIndex;
+            record.timeout = 250;
+            record.event = FOCUS_TRACE_HOLD;
+            record.state = record.next_state = focus_machine_.stateId();
+            focus_trace_.record(record);
         }
+        saveFocusMemory();
+        focussing_ = FALSE;
+        focus_value_ = 0;
+        addMainSource(G_PRIORITY_DEFAULT, 250, focusTriggerWrapper);
+    }
+}
 
+/**
+ * When a focus frame was exposed. Buffer timestamps are pipeline running time, focus_clock_offset_
+ * puts them on the g_get_monotonic_time clock the lens moves are timed on.
+ *
+ * @param buffer : The focus frame
+ *
+ * @return : us on the g_get_monotonic_time clock, or now when the frame has no timestamp.
+ */
+gint64 AF_Additions::frameTime(GstBuffer* buffer) const
+{
+    return GST_BUFFER_PTS_IS_VALID(buffer) ?
+        focus_clock_offset_ + (gint64)(GST_BUFFER_PTS(buffer) / GST_USECOND) : g_get_monotonic_time();
+}
+
+/**
+ * A snapshot of the focus worker queue counters.
+ */
+FocusQueueStats AF_Additions::getFocusQueueStats() const {
+    return focus_worker_.getStats();
+}
+
+/**
+ * The held focus drift check counters, including the rescans it avoided.
+ */
+FocusDriftStats AF_Additions::getFocusDriftStats() const {
+    return drift_detector_.getStats();
+}
+
+/**
+ * Time and frames the autofocus state machine has spent in one of its states.
+ */
+FocusStateStats AF_Additions::getFocusStateStats(FocusStateId id) const {
+    return focus_machine_.getStateStats(id);
+}
+
+/**
+* CALLBACK FUNCTION. Log the AF counters. This wrapper reinterprets the gpointer
+* user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*/
+gboolean AF_Additions::logFocusStatsWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->logFocusStats(user_data);
+}
+
+/**
+* CLASS METHOD. Log the focus worker queue, held focus drift and CDAF state counters while the
+* camera runs, every focus_stats_interval seconds, so a dropping queue, a twitchy drift check or a
+* slow state can be seen without stopping the capture. The state counters are taken under the
+* CDAF stats lock. The queue and drift counters are atomic.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*
+* @return : return TRUE so the timeout keeps running.
+*/
+gboolean AF_Additions::logFocusStats(gpointer user_data)
+{
+    AF_Additions* self = static_cast<AF_Additions*>(user_data);
+    FocusQueueStats queue = self->getFocusQueueStats();
+    FocusDriftStats drift = self->getFocusDriftStats();
+
+    g_print("AF focus frames: %" G_GUINT64_FORMAT " queued, %" G_GUINT64_FORMAT " dropped, %" G_GUINT64_FORMAT
+        " processed, %u waiting (most %u)\n", queue.frames_queued, queue.frames_dropped, queue.frames_processed,
+        queue.depth, queue.max_depth);
+    g_print("AF held focus checks: %" G_GUINT64_FORMAT ", focus lost %" G_GUINT64_FORMAT " times, "
+        "%" G_GUINT64_FORMAT " rescans avoided, noise %.2f at %.2f\n", drift.frames, drift.drifts, drift.avoided,
+        drift.noise, drift.level);
+    for (gint id = 0; id < FOCUS_STATE_COUNT; ++id) {
+        FocusStateStats state = self->getFocusStateStats((FocusStateId)id);
+        if (state.frames)
+            g_print("AF %s: %" G_GUINT64_FORMAT " entries, %" G_GUINT64_FORMAT " frames, %.1f s, %" G_GUINT64_FORMAT
+                " scan samples dropped\n", CDAF::stateName((FocusStateId)id), state.entries, state.frames,
+                state.time / 1e6, state.dropped);
     }
     return TRUE;
 }
 
+/**
+* Parse the caps on the focus sink pad into focus_video_info_. The caps only change when
+* the capture resolution does, so they are only parsed again when they differ.
+*
+* @param pad : The fakesink pad the focus frame arrived on
+*
+* @return : FALSE if there are no usable caps and the frame has to be skipped.
+*/
+gboolean AF_Additions::updateFocusVideoInfo(GstPad* pad)
+{
+    GstCaps* caps = gst_pad_get_current_caps(pad);
 
-/****************************************************
- * This is what I'm trying to replicate - From Arducam
- * 
- *   def sobel(img):
- *       img_gray = cv2.cvtColor(img,cv2.COLOR_RGB2GRAY)
- *       img_sobel = cv2.Sobel(img_gray,cv2.CV_16U,1,1)
- *       return cv2.mean(img_sobel)[0]
- *
- *   def laplacian(img):
- *       img_gray = cv2.cvtColor(img,cv2.COLOR_RGB2GRAY)
- *       img_sobel = cv2.Laplacian(img_gray,cv2.CV_16U)
- *       return cv2.mean(img_sobel)[0]
- *****************************************************/
+    if (!caps)
+        return FALSE;
+
+    if (focus_caps_ && gst_caps_is_equal(caps, focus_caps_)) {
+        gst_caps_unref(caps);
+        return TRUE;
+    }
 
+    if (focus_caps_) {
+        gst_caps_unref(focus_caps_);
+        focus_caps_ = nullptr;
+    }
+
+    if (!gst_video_info_from_caps(&focus_video_info_, caps)) {
+        g_print("AF could not read the focus frame caps\n");
+        gst_caps_unref(caps);
+        return FALSE;
+    }
+
+    focus_caps_ = caps; //Keep our reference
+    g_print("AF focus frames %dx%d\n", GST_VIDEO_INFO_WIDTH(&focus_video_info_),
+        GST_VIDEO_INFO_HEIGHT(&focus_video_info_));
+    return TRUE;
+}
 
 /**
-* This  is center of the autofocus system. This takes an image frame and uses a
-* laPlacian function to calculate a focus value.
+* This  is center of the autofocus system. This takes the luma plane of a focus frame and
+* uses the focus metric chosen at startup to calculate a focus value over the focus ROI,
+* or over every tile of the frame in focus map mode. The default Laplacian mean gives the
+* same value as cv::Laplacian(CV_16U) + cv::mean, worked out in one pass by FocusKernels.
+*
+* Normally the frame is just the crop nvvidconv cut out around the ROI, with a margin so
+* the result matches measuring the ROI in the full frame.
 * 
-* @param padinfo : This the frame buffer from the Gstreamer stream.
+* @param luma : The Y plane of the NV12 focus frame, read in place.
 * 
 * @return : The focus value as a floating point number.
 */
-gfloat AF_Additions::laplacianMean (GstMapInfo *padinfo)
+gfloat AF_Additions::measureFocus (const LumaPlane& luma)
 {
-    gint resolution_width, resolution_height,x, y;
+    if (focus_map_)
+        return focus_map_->compute(luma, *focus_metric_);
 
-    additions_parent_->getResolution(&resolution_width, &resolution_height);
+    FocusRoi roi = focus_roi_;
 
-    x = resolution_width/2;
-    y = resolution_height/2;
-
-    cv::Mat frame(cv::Size(resolution_width, resolution_height), CV_8UC1, (char *)padinfo->data, cv::Mat::AUTO_STEP);
-    cv::Mat cropped = frame(cv::Range(y-100,y+100), cv::Range(x-100, x+100));
-    cv::Mat laplacianFrame;
-    cv::Laplacian(cropped, laplacianFrame, CV_16U);
+    if ((luma.width == focus_crop_.width) && (luma.height == focus_crop_.height)) {
+        roi.x -= focus_crop_.x;
+        roi.y -= focus_crop_.y;
+    }
+    else if ((luma.width < roi.x + roi.width) || (luma.height < roi.y + roi.height)) {
+        return 0; //Neither the crop nor a full frame, nothing sensible to measure
+    }
 
-    return (gfloat)cv::mean(laplacianFrame)[0];
+    return focus_metric_->measure(luma, roi);
 }
 
 /**
@@ -259,37 +621,349 @@ gboolean AF_Additions::focusTrigger(gpointer user_data)
 }
 
 /**
-* CALLBACK FUNCTION. Run the AF runFocus state machine in the AF interface after an AF frame has been captured.
-* This wrapper reinterprets the * gpointer user_data object into usable pointer for accessing methods
+* CALLBACK FUNCTION. Move the lens after the focus worker has stepped the AF state machine.
+* This wrapper reinterprets the gpointer user_data object into usable pointer for accessing methods
 * in the AF_Additions class.
 *
+* @param user_data : Standard glib function parameter, used to pass a pointer to the FocusStep the worker made
+*/
+gboolean AF_Additions::applyFocusStepWrapper(gpointer user_data) {
+    return static_cast<FocusStep*>(user_data)->self->applyFocusStep(user_data);
+}
+
+/**
+* CLASS METHOD. Move the lens to the index the focus worker chose, then ask for the next focus
+* frame. Runs on the main loop. Everything the move needs comes in the FocusStep, so nothing is
+* read from the state machine the worker steps. Once the lens settle model is calibrated the wait
+* comes from it, for the distance and direction of this move, instead of the CDAF timeout, and
+* frames exposed before the wait is up are skipped. When the lens has not moved the CDAF timeout
+* is still used. A move CDAF ramps adds the ramp time to the
+* wait. On the first focus lock the settle calibration starts here, if it was asked for.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to the FocusStep the worker made
+*
+* @return : return FALSE will ensure the callback does not run again.
+*/
+gboolean AF_Additions::applyFocusStep(gpointer user_data)
+{
+    const FocusStep* step = static_cast<const FocusStep*>(user_data);
+    AF_Additions* self = step->self;
+    guint from_index = self->lens_index_;
+    guint wait, ramp;
+
+    self->lens_index_ = step->focus_index;
+    self->focus_machine_.applyFocus(self->lens_index_);
+    ramp = self->focus_machine_.rampTime();
+    self->focus_value_ = 0;
+    self->focussing_ = FALSE;
+
+    if ((step->focussed) && (self->calibrate_settle_)) {
+        guint next_index;
+
+        self->calibrate_settle_ = FALSE;
+        self->settle_calibration_.start(self->lens_index_, &next_index);
+        self->calibration_index_ = next_index;
+        self->additions_parent_->openFocusValve();
+        self->addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, self->applyCalibrationStepWrapper);
+        return FALSE;
+    }
+
+    if ((step->focussed) || (step->scanning) || (ramp)) {
+        wait = ramp + self->settle_model_.frameWait(step->timeout, from_index, self->lens_index_);
+        if ((self->settle_model_.calibrated()) || (ramp))
+            self->fresh_after_ = g_get_monotonic_time() + wait * (gint64)1000;
+        self->addMainSource(G_PRIORITY_DEFAULT, wait, self->focusTriggerWrapper);
+    }
+    else
+        self->addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, self->focusTriggerWrapper);
+
+    return FALSE;
+}
+
+/**
+* CALLBACK FUNCTION. Move the lens for the lens settle calibration. This wrapper reinterprets the
+* gpointer user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
 * @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
 */
-gboolean AF_Additions::runFocusWrapper(gpointer user_data) {
-    return reinterpret_cast<AF_Additions*>(user_data)->runFocus(user_data);
+gboolean AF_Additions::applyCalibrationStepWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->applyCalibrationStep(user_data);
 }
 
 /**
-* CLASS METHOD. Run the AF runFocus state machine in the AF interface after an AF frame has been captured.
-* We static cast the user_data pointer to access its methods.
+* CLASS METHOD. Move the lens where the settle calibration asked, and tell it when the move was
+* made. Once the calibration has finished, keep the new model, save it if there is a settle file,
+* put the lens back on the focus point and go back to checking the held focus.
 *
 * @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
 *
-* @return : return FALSE will ensure the timeout does not run again.
+* @return : return FALSE will ensure the callback does not run again.
 */
-gboolean AF_Additions::runFocus(gpointer user_data)
+gboolean AF_Additions::applyCalibrationStep(gpointer user_data)
 {
     AF_Additions* self = static_cast<AF_Additions*>(user_data);
+    const gchar* settle_file = self->additions_parent_->getSettings().focus_settle_file;
+    GError* error = nullptr;
+    guint from_index = self->lens_index_;
+    guint wait;
+
+    if (self->settle_calibration_.running()) {
+        self->lens_index_ = self->calibration_index_;
+        self->focus_machine_.applyFocus(self->lens_index_);
+        self->settle_calibration_.lensMoved(g_get_monotonic_time());
+        return FALSE;
+    }
+
+    self->settle_model_ = self->settle_calibration_.model();
+    self->settle_model_.print();
+    if ((self->settle_model_.calibrated()) && (settle_file)) {
+        if ((self->settle_model_.save(settle_file, &error)) == -1) {
+            g_print("AF could not save the lens settle model: %s\n", error->message);
+            g_error_free(error);
+        }
+        else {
+            g_print("AF lens settle model saved to %s\n", settle_file);
+        }
+    }
 
-    //Need to set this to run the focus algorithm
-    self->focus_machine_.runFocus(self->AF_Additions::focus_value_);
+    self->additions_parent_->closeFocusValve();
+    self->lens_index_ = self->focus_machine_.focusIndex;
+    self->focus_machine_.applyFocus(self->lens_index_);
+    wait = self->settle_model_.frameWait(self->focus_frame_timeout_, from_index, self->lens_index_);
+    self->fresh_after_ = g_get_monotonic_time() + wait * (gint64)1000;
     self->focus_value_ = 0;
     self->focussing_ = FALSE;
+    self->addMainSource(G_PRIORITY_DEFAULT, wait, self->focusTriggerWrapper);
+    return FALSE;
+}
 
-    if ((self->focussed_) || (self->scanning_))
-        g_timeout_add(focus_frame_timeout_, self->focusTriggerWrapper, self);
-    else
-        g_idle_add(self->focusTriggerWrapper, self);
+/**
+* CALLBACK FUNCTION. Move the lens along the sweep. This wrapper reinterprets the gpointer
+* user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*/
+gboolean AF_Additions::sweepFocusWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->sweepFocus(user_data);
+}
+
+/**
+* CLASS METHOD. Put the lens where the sweep has it now, every FOCUS_SWEEP_TICK ms while CDAF is
+* sweeping. This runs on the main loop like applyFocusStep, so the lens move that ends the sweep
+* always comes after the last one of these.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*
+* @return : return FALSE once the sweep has finished, so the timer stops.
+*/
+gboolean AF_Additions::sweepFocus(gpointer user_data)
+{
+    AF_Additions* self = static_cast<AF_Additions*>(user_data);
+
+    if (!self->focus_machine_.sweeping())
+        return FALSE;
+
+    self->lens_index_ = self->focus_machine_.sweepPosition(g_get_monotonic_time());
+    self->focus_machine_.applyFocus(self->lens_index_);
+    return TRUE;
+}
+
+/**
+* Release the focus lock after interval ms, on the main loop.
+*
+* @param interval : ms from now
+*/
+void AF_Additions::releaseFocusLockAfter(guint interval) {
+    addMainSource(G_PRIORITY_DEFAULT, interval, releaseFocusLockWrapper);
+}
+
+/**
+* Start a focus bracket capture after interval ms, on the main loop.
+*
+* @param interval : ms from now
+*/
+void AF_Additions::startFocusBracketAfter(guint interval) {
+    addMainSource(G_PRIORITY_DEFAULT, interval, startFocusBracketWrapper);
+}
+
+/**
+* Queue a callback on the main loop. Callbacks are queued from the focus worker as well as the
+* main loop, so each source is kept, and any still queued are removed by the destructor instead
+* of running on a freed object. Sources that have finished are let go on the next call.
+*
+* @param priority : G_PRIORITY_DEFAULT_IDLE as g_idle_add uses, or G_PRIORITY_DEFAULT
+* @param interval : ms to wait, 0 to run as soon as the main loop gets to it
+* @param func : The callback wrapper
+* @param data : Passed to func, this object when nullptr
+* @param notify : Frees data once the source is gone, or nullptr
+*
+* @return : The source id.
+*/
+guint AF_Additions::addMainSource(gint priority, guint interval, GSourceFunc func, gpointer data,
+    GDestroyNotify notify) {
+    GSource* source = (interval > 0) ? g_timeout_source_new(interval) : g_idle_source_new();
+    guint id;
+
+    g_source_set_priority(source, priority);
+    g_source_set_callback(source, func, data ? data : this, notify);
+
+    g_mutex_lock(&sources_mutex_);
+    for (auto it = sources_.begin(); it != sources_.end();) {
+        if (g_source_is_destroyed(*it)) {
+            g_source_unref(*it);
+            it = sources_.erase(it);
+        }
+        else
+            ++it;
+    }
+    sources_.push_back(source); //Keeps our reference
+    id = g_source_attach(source, additions_parent_->getMainContext());
+    g_mutex_unlock(&sources_mutex_);
+    return id;
+}
+
+/**
+* Remove every callback this object still has queued on the main loop.
+*/
+void AF_Additions::removeMainSources() {
+    g_mutex_lock(&sources_mutex_);
+    for (GSource* source : sources_) {
+        g_source_destroy(source);
+        g_source_unref(source);
+    }
+    sources_.clear();
+    g_mutex_unlock(&sources_mutex_);
+}
+
+/**
+* TRUE when a button press should capture a focus bracket as well as the normal image.
+*/
+gboolean AF_Additions::focusBracketEnabled() const {
+    return focus_bracket_.enabled();
+}
+
+/**
+* Where the lens was last sent, so a capture can be logged with the position it was taken at.
+*/
+guint AF_Additions::getLensIndex() const {
+    return lens_index_;
+}
+
+/**
+* The focus value when focus was last achieved.
+*/
+gfloat AF_Additions::getFocussedValue() const {
+    return focussed_value_;
+}
+
+/**
+* CALLBACK FUNCTION. Start a focus bracket capture. This wrapper reinterprets the gpointer
+* user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*/
+gboolean AF_Additions::startFocusBracketWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->startFocusBracket(user_data);
+}
+
+/**
+* CLASS METHOD. Start capturing a focus bracket around where the lens is focussed now. The focus
+* lock set by the button press keeps CDAF away from the lens until the bracket has been captured.
+* A press while a bracket is still being captured is ignored.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*
+* @return : return FALSE will ensure the timeout does not run again.
+*/
+gboolean AF_Additions::startFocusBracket(gpointer user_data)
+{
+    AF_Additions* self = static_cast<AF_Additions*>(user_data);
+
+    if ((self->bracket_job_) || (!self->focus_bracket_.enabled()))
+        return FALSE;
+
+    self->bracket_centre_ = self->lens_index_;
+    self->bracket_frame_ = 0;
+    self->bracket_job_ = new FocusBracketJob();
+    self->bracket_job_->output = self->additions_parent_->output_file_control_.getImagePath("_stack");
+    g_print("AF focus bracket of %u images around %u started\n", self->focus_bracket_.frames(),
+        self->bracket_centre_);
+    self->addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, self->bracketStepWrapper);
+    return FALSE;
+}
+
+/**
+* CALLBACK FUNCTION. Move the lens to the next bracket position. This wrapper reinterprets the
+* gpointer user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*/
+gboolean AF_Additions::bracketStepWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->bracketStep(user_data);
+}
+
+/**
+* CLASS METHOD. Move the lens to the next bracket position and capture once it has settled. The
+* wait comes from the lens settle model, the same as the focus frames. The move goes through
+* CDAF::applyFocus, which hands it to the CameraI2CDevice write worker with requestFocus like
+* every autofocus move, so the main loop is not held up by the I2C write as it would be by setFocus.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*
+* @return : return FALSE will ensure the callback does not run again.
+*/
+gboolean AF_Additions::bracketStep(gpointer user_data)
+{
+    AF_Additions* self = static_cast<AF_Additions*>(user_data);
+    guint from_index = self->lens_index_;
+
+    self->lens_index_ = self->focus_bracket_.position(self->bracket_centre_, self->bracket_frame_);
+    self->focus_machine_.applyFocus(self->lens_index_);
+    self->addMainSource(G_PRIORITY_DEFAULT, self->settle_model_.frameWait(self->focus_machine_.tuning.settleTimeout,
+        from_index, self->lens_index_), self->bracketCaptureWrapper);
+    return FALSE;
+}
+
+/**
+* CALLBACK FUNCTION. Capture one bracket image. This wrapper reinterprets the gpointer
+* user_data object into usable pointer for accessing methods in the AF_Additions class.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*/
+gboolean AF_Additions::bracketCaptureWrapper(gpointer user_data) {
+    return reinterpret_cast<AF_Additions*>(user_data)->bracketCapture(user_data);
+}
+
+/**
+* CLASS METHOD. Capture the bracket image at this lens position, then move on to the next one.
+* The capture blocks until the image file is written. After the last image the lens goes back to
+* the focus point, the bracket is queued for merging and a focus lock release that came in while
+* the bracket was being captured is carried out.
+*
+* @param user_data : Standard glib function parameter, used to pass a pointer to this AF_Additions object
+*
+* @return : return FALSE will ensure the timeout does not run again.
+*/
+gboolean AF_Additions::bracketCapture(gpointer user_data)
+{
+    AF_Additions* self = static_cast<AF_Additions*>(user_data);
+    gchar* suffix = g_strdup_printf("_f%02u", self->bracket_frame_);
+
+    self->additions_parent_->output_file_control_.setImageSuffix(suffix);
+    self->bracket_job_->files.push_back(self->additions_parent_->output_file_control_.getImagePath(suffix));
+    g_free(suffix);
+    self->additions_parent_->triggerImageCapture();
+
+    if (++self->bracket_frame_ < self->focus_bracket_.frames()) {
+        self->addMainSource(G_PRIORITY_DEFAULT_IDLE, 0, self->bracketStepWrapper);
+        return FALSE;
+    }
 
+    self->lens_index_ = self->bracket_centre_;
+    self->focus_machine_.applyFocus(self->lens_index_);
+    self->focus_bracket_.queueMerge(self->bracket_job_);
+    self->bracket_job_ = nullptr;
+    if (self->release_pending_)
+        self->releaseFocusLock(self);
     return FALSE;
 }
@@ -46,18 +46,23 @@
                                   allow focus frames to pass through.
  * @param focus_valve_close :  A function pointer to an nvgstcapture-1.0 function to
                                   stop focus frames passing through.
+ * @param focus_crop_set :  A function pointer to an nvgstcapture-1.0 function to
+                                  move the focus crop window.
+ * @param settings : The startup settings from the nvgstcapture-1.0 command line. Copied.
  * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
  */
 AdditionsParent::AdditionsParent(GMainContext* main_context, gint* width, gint* height,
     TriggerImageCapture trigger_image_capture, AdditionsExitCapture additions_exit_capture,
-    FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, GError** error) 
-    : main_context_(main_context), width_(width), height_(height), trigger_image_capture_(trigger_image_capture),
-    additions_exit_capture_(additions_exit_capture), focus_valve_open_(focus_valve_open),
-    focus_valve_close_(focus_valve_close), error_(error),
-    error_handler_(this),
+    FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, FocusCropSet focus_crop_set,
+    const AdditionsSettings* settings, GError** error) 
+    : error_handler_(this),
     output_file_control_("/home/New_Data/", &error_handler_), //Need to remove the string from here
     system_control_(main_context, this, &output_file_control_, &error_handler_),
-    af_iface_(this, &error_handler_) {
+    af_iface_(this, &error_handler_),
+    error_(error), width_(width), height_(height), main_context_(main_context),
+    trigger_image_capture_(trigger_image_capture), additions_exit_capture_(additions_exit_capture),
+    focus_valve_open_(focus_valve_open), focus_valve_close_(focus_valve_close), focus_crop_set_(focus_crop_set),
+    settings_(*settings) {
 
 }
 
@@ -103,8 +108,10 @@ void AdditionsParent::setup(gpointer user_data) {
         errorDuringSetup = ((system_control_.setup(&error)) == -1);
     if (!errorDuringSetup)
         errorDuringSetup = ((af_iface_.setup(&error)) == -1);
-    if (!errorDuringSetup)
+    if (!errorDuringSetup) {
+        output_file_control_.setLogFormat(settings_.spectral_log);
         errorDuringSetup = ((output_file_control_.setup(&error)) == -1);
+    }
     if (!errorDuringSetup)
         system_control_.run_ams7265xHandshake();
     else
@@ -152,6 +159,28 @@ void AdditionsParent::closeFocusValve(){
     focus_valve_close_();
 }
 
+/**
+ * The main loop context, for handing work back to the main loop from other threads.
+ *
+ * @return : The GMainContext nvgstcapture-1.0 runs its main loop on
+ */
+GMainContext* AdditionsParent::getMainContext() const {
+    return main_context_;
+}
+
+/**
+ * Move the focus crop window in nvgstcapture-1.0. The crop size is fixed when the pipeline
+ * is built, so this never renegotiates caps. Right and bottom are exclusive pixel coordinates.
+ *
+ * @param left : First column of the crop
+ * @param top : First row of the crop
+ * @param right : Column after the last column of the crop
+ * @param bottom : Row after the last row of the crop
+ */
+void AdditionsParent::setFocusCrop(gint left, gint top, gint right, gint bottom){
+    focus_crop_set_(left, top, right, bottom);
+}
+
 /**
  * Capture the current image capture resolution for use with the C++ additions
  * 
@@ -164,6 +193,15 @@ void AdditionsParent::getResolution(gint* wide, gint* high){
     *high = *height_;
 }
 
+/**
+ * The startup settings the additions were created with.
+ *
+ * @return : A reference to the AdditionsParent copy of the settings
+ */
+const AdditionsSettings& AdditionsParent::getSettings() const {
+    return settings_;
+}
+
 /**
  * Use a function pointer to trigger image capture in nvgstcapture-1.0
  * This function calls the stored function pointer to the base nvgstcapture-1.0
@@ -179,6 +217,14 @@ gboolean AdditionsParent::timeoutTriggerCallback(gpointer user_data) {
     return G_SOURCE_CONTINUE;
 }
 
+/**
+ * Capture one image through the stored nvgstcapture-1.0 function pointer. This blocks until
+ * nvgstcapture-1.0 has written the image file.
+ */
+void AdditionsParent::triggerImageCapture() {
+    trigger_image_capture_();
+}
+
 /**
  * The functions below are made accessible to be called from the C coded nvgstcapture-1.0 main application.
  * These functions provide the main nvgstcapture-1.0 application access to the routines it needs in its operation.
@@ -197,17 +243,76 @@ extern "C" {
     *                            allow focus frames to pass through.
     * @param focus_valve_close :  A function pointer to an nvgstcapture-1.0 function to
     *                             stop focus frames passing through.
+    * @param focus_crop_set :  A function pointer to an nvgstcapture-1.0 function to
+    *                          move the focus crop window.
+    * @param settings : The startup settings from the nvgstcapture-1.0 command line.
     * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
     * 
     * @return : A pointer to an AdditionsParent Object
     */
     AdditionsParent* additions_parent_create(GMainContext* main_context, gint* width, gint* height,
     TriggerImageCapture trigger_image_capture, AdditionsExitCapture additions_exit_capture,
-    FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, GError** error) {
+    FocusValveOpen focus_valve_open, FocusValveClose focus_valve_close, FocusCropSet focus_crop_set,
+    const AdditionsSettings* settings, GError** error) {
         g_print ("\nCreating additional objects\n"); //Log object construction to the terminal
         g_print ("...Additions parent\n");
         return new AdditionsParent(main_context, width, height, trigger_image_capture,
-            additions_exit_capture, focus_valve_open, focus_valve_close, error);
+            additions_exit_capture, focus_valve_open, focus_valve_close, focus_crop_set, settings, error);
+    }
+
+    /**
+    * Interface function to fill AdditionsSettings with the defaults, before the
+    * nvgstcapture-1.0 command line is parsed over them.
+    *
+    * @param settings : The settings struct to initialise
+    */
+    void additions_settings_init(AdditionsSettings* settings) {
+        settings->focus_metric = FOCUS_METRIC_LAPLACIAN_MEAN;
+        settings->focus_map_columns = 0;
+        settings->focus_map_rows = 0;
+        settings->focus_map_score = FOCUS_MAP_SCORE_ARGMAX;
+        settings->focus_roi_size = 200;
+        settings->focus_search = FOCUS_SEARCH_DETAIL_SCAN;
+        settings->focus_scan = FOCUS_SCAN_STEPPED;
+        settings->focus_sweep_rate = 300;
+        settings->focus_sweep_lag = 0;
+        settings->focus_trace_file = NULL;
+        settings->focus_settle_file = NULL;
+        settings->focus_settle_calibrate = FALSE;
+        settings->focus_memory_file = NULL;
+        settings->focus_drift_slack = FOCUS_DRIFT_SLACK;
+        settings->focus_drift_threshold = FOCUS_DRIFT_THRESHOLD;
+        settings->focus_drift_noise_floor = FOCUS_DRIFT_NOISE_FLOOR;
+        settings->focus_bracket_frames = 0;
+        settings->focus_bracket_step = 10;
+        settings->focus_i2c_device = NULL;
+        settings->focus_stats_interval = 0;
+        settings->spectral_integration = 255;
+        settings->spectral_burst_samples = 0;
+        settings->spectral_device = NULL;
+        settings->spectral_log = 0;
+    }
+
+    /**
+    * Interface function giving the size of the frames on the focus branch, so the
+    * nvgstcapture-1.0 caps and the AF additions agree on it.
+    *
+    * @param settings : The startup settings
+    * @param frame_width : The capture width
+    * @param frame_height : The capture height
+    * @param * crop_width : Where to store the focus frame width
+    * @param * crop_height : Where to store the focus frame height
+    */
+    void additions_focus_crop_size(const AdditionsSettings* settings, gint frame_width, gint frame_height,
+        gint* crop_width, gint* crop_height) {
+        if ((settings->focus_map_columns > 0) && (settings->focus_map_rows > 0)) {
+            *crop_width = frame_width;
+            *crop_height = frame_height;
+            return;
+        }
+        gint size = (MAX(settings->focus_roi_size, 16) & ~1) + 2 * FOCUS_CROP_MARGIN;
+        *crop_width = MIN(size, frame_width);
+        *crop_height = MIN(size, frame_height);
     }
 
     /**
@@ -0,0 +1,187 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "FocusBracket.h"
+#include "cdaf.h"
+
+/**
+ * Constructs a FocusBracket with the mode off. Nothing is allocated until setup is called.
+ */
+FocusBracket::FocusBracket() : frames_(0), step_(1), stack_(4), merge_queue_(nullptr) {
+}
+
+/**
+ * Destructor for FocusBracket. A stack still merging is finished first, so its image is saved.
+ */
+FocusBracket::~FocusBracket() {
+    if (merge_queue_)
+        g_thread_pool_free(merge_queue_, FALSE, TRUE);
+}
+
+/**
+ * Set the bracket up, and start the merge thread and the FocusStack threads if the mode is on.
+ *
+ * @param frames : Images in each bracket, below 2 turns the mode off
+ * @param step : Focus indices between the images
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusBracket::setup(guint frames, guint step, GError** error) {
+    frames_ = MIN(frames, FOCUS_BRACKET_MAX_FRAMES);
+    step_ = MAX(step, 1);
+    if (!enabled())
+        return 0;
+
+    if ((stack_.setup(error)) == -1)
+        return -1; //error is set by g_thread_pool_new
+
+    merge_queue_ = g_thread_pool_new(mergeWrapper, this, 1, TRUE, error);
+    if (!merge_queue_)
+        return -1; //error is set by g_thread_pool_new
+
+    g_print("Focus bracket of %u images %u focus indices apart, merged on %d threads\n", frames_, step_,
+        stack_.threads());
+    return 0;
+}
+
+gboolean FocusBracket::enabled() const {
+    return frames_ > 1;
+}
+
+guint FocusBracket::frames() const {
+    return frames_;
+}
+
+/**
+ * Where the lens goes for one image of the bracket. The images are spread evenly either side of
+ * the centre, from the far end in, and clamped to the lens range.
+ *
+ * @param centre : The converged focus index
+ * @param frame : Which image, from 0
+ */
+guint FocusBracket::position(guint centre, guint frame) const {
+    gint offset = ((gint)(frames_ - 1) - 2 * (gint)frame) * (gint)step_ / 2;
+
+    return (guint)CLAMP((gint)centre + offset, MIN_FOCUS_INDEX, MAX_FOCUS_INDEX);
+}
+
+/**
+ * Hand a captured bracket to the merge thread. If the queue will not take it, the images are
+ * still on disk and only the merge is lost.
+ *
+ * @param job : The image files and the merged image name. FocusBracket deletes it.
+ */
+void FocusBracket::queueMerge(FocusBracketJob* job) {
+    GError* error = nullptr;
+
+    if ((!merge_queue_) || (!g_thread_pool_push(merge_queue_, job, &error))) {
+        g_print("Focus stack not merged: %s\n", error ? error->message : "focus bracket mode is off");
+        g_clear_error(&error);
+        delete job;
+    }
+}
+
+/**
+ * Read a bracket, merge it and write the merged image, reporting how long each part took.
+ *
+ * @param job : The image files and the merged image name
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusBracket::mergeFiles(const FocusBracketJob& job, GError** error) {
+    std::vector<GdkPixbuf*> pixbufs;
+    std::vector<StackImage> images;
+    GdkPixbuf* merged = nullptr;
+    gint64 start = g_get_monotonic_time(), loaded, stacked;
+    gint result = -1;
+
+    for (const std::string& file : job.files) {
+        GdkPixbuf* pixbuf = gdk_pixbuf_new_from_file(file.c_str(), error);
+
+        if (!pixbuf)
+            goto done;
+        pixbufs.push_back(pixbuf);
+        if ((gdk_pixbuf_get_bits_per_sample(pixbuf) != 8) || (gdk_pixbuf_get_n_channels(pixbuf) < 3) ||
+            (gdk_pixbuf_get_width(pixbuf) != gdk_pixbuf_get_width(pixbufs.front())) ||
+            (gdk_pixbuf_get_height(pixbuf) != gdk_pixbuf_get_height(pixbufs.front()))) {
+            g_set_error(error, g_quark_from_static_string("focus bracket"), 1,
+                "'%s' does not match the rest of the focus bracket", file.c_str());
+            goto done;
+        }
+        images.push_back({ gdk_pixbuf_get_pixels(pixbuf), gdk_pixbuf_get_width(pixbuf),
+            gdk_pixbuf_get_height(pixbuf), gdk_pixbuf_get_rowstride(pixbuf), gdk_pixbuf_get_n_channels(pixbuf) });
+    }
+    if (images.empty()) {
+        g_set_error(error, g_quark_from_static_string("focus bracket"), 2, "The focus bracket has no images");
+        goto done;
+    }
+    loaded = g_get_monotonic_time();
+
+    merged = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, images.front().width, images.front().height);
+    if (!merged) {
+        g_set_error(error, g_quark_from_static_string("focus bracket"), 3, "No memory for the merged image");
+        goto done;
+    }
+    {
+        StackImage output = { gdk_pixbuf_get_pixels(merged), gdk_pixbuf_get_width(merged),
+            gdk_pixbuf_get_height(merged), gdk_pixbuf_get_rowstride(merged), gdk_pixbuf_get_n_channels(merged) };
+        stack_.merge(images, output);
+    }
+    stacked = g_get_monotonic_time();
+
+    if (!gdk_pixbuf_save(merged, job.output.c_str(), "jpeg", error, "quality", FOCUS_BRACKET_QUALITY, NULL))
+        goto done;
+
+    g_print("Focus stack of %u images %dx%d merged in %.0f ms on %d threads (read %.0f ms, write %.0f ms): %s\n",
+        (guint)images.size(), images.front().width, images.front().height, (stacked - loaded) / 1000.0,
+        stack_.threads(), (loaded - start) / 1000.0, (g_get_monotonic_time() - stacked) / 1000.0,
+        job.output.c_str());
+    result = 0;
+
+done:
+    if (merged)
+        g_object_unref(merged);
+    for (GdkPixbuf* pixbuf : pixbufs)
+        g_object_unref(pixbuf);
+    return result;
+}
+
+/**
+ * CALLBACK FUNCTION. GThreadPool worker for the merge queue. Merge failures are reported and
+ * the camera carries on, the bracket images are already saved.
+ *
+ * @param data : The FocusBracketJob, deleted here
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this FocusBracket object
+ */
+void FocusBracket::mergeWrapper(gpointer data, gpointer user_data) {
+    FocusBracket* self = static_cast<FocusBracket*>(user_data);
+    FocusBracketJob* job = static_cast<FocusBracketJob*>(data);
+    GError* error = nullptr;
+
+    if ((self->mergeFiles(*job, &error)) == -1) {
+        g_print("Focus stack not merged: %s\n", error->message);
+        g_error_free(error);
+    }
+    delete job;
+}
@@ -0,0 +1,114 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+
+#include "FocusDriftDetector.h"
+
+/**
+ * Constructs a FocusDriftDetector with the default sensitivity and no noise measured yet.
+ */
+FocusDriftDetector::FocusDriftDetector() : slack_(FOCUS_DRIFT_SLACK), threshold_(FOCUS_DRIFT_THRESHOLD),
+    noise_floor_(FOCUS_DRIFT_NOISE_FLOOR / 100.0), reference_(0), variance_(0), last_value_(0), high_sum_(0),
+    low_sum_(0), have_last_(FALSE), excursion_(FALSE), frames_(0), drifts_(0), avoided_(0), noise_(0), level_(0) {
+}
+
+/**
+ * @param slack : Noise sigmas a frame has to be from the focussed value before it adds to the sums
+ * @param threshold : Noise sigmas either sum reaches to lose focus. Lower reacts sooner, and to more
+ * @param noise_floor : The smallest noise sigma, as a % of the focussed value
+ */
+void FocusDriftDetector::setSensitivity(gdouble slack, gdouble threshold, gdouble noise_floor) {
+    slack_ = MAX(slack, 0.0);
+    threshold_ = MAX(threshold, 0.0);
+    noise_floor_ = MAX(noise_floor, 0.01) / 100.0;
+}
+
+/**
+ * Start watching a new focus lock. The noise measured so far is kept, it belongs to the
+ * scene and sensor rather than the lock.
+ *
+ * @param focus_value : The focus value at lock
+ */
+void FocusDriftDetector::reset(gfloat focus_value) {
+    reference_ = focus_value;
+    last_value_ = focus_value;
+    have_last_ = TRUE;
+    high_sum_ = 0;
+    low_sum_ = 0;
+    excursion_ = FALSE;
+    level_.store(focus_value);
+}
+
+/**
+ * Check one held focus frame.
+ *
+ * @param focus_value : The frame's focus value
+ *
+ * @return : TRUE when focus has been lost and the search should start again.
+ */
+gboolean FocusDriftDetector::update(gfloat focus_value) {
+    gdouble sigma = MAX(sqrt(variance_), noise_floor_ * reference_);
+    gdouble deviation = (sigma > 0) ? CLAMP((focus_value - reference_) / sigma, -FOCUS_DRIFT_CLIP, FOCUS_DRIFT_CLIP) : 0;
+
+    //Frame to frame differences follow the noise and not a slow drift. They are clipped like the
+    //deviation, so a flash does not open the noise up for the frames after it.
+    if (have_last_) {
+        gdouble difference = CLAMP(focus_value - last_value_, -FOCUS_DRIFT_CLIP * sigma, FOCUS_DRIFT_CLIP * sigma);
+        variance_ += FOCUS_DRIFT_WEIGHT * (difference * difference / 2 - variance_);
+    }
+    last_value_ = focus_value;
+    have_last_ = TRUE;
+
+    high_sum_ = MAX(0.0, high_sum_ + deviation - slack_);
+    low_sum_ = MAX(0.0, low_sum_ - deviation - slack_);
+    frames_++;
+    noise_.store((gfloat)MAX(sqrt(variance_), noise_floor_ * reference_));
+    level_.store((gfloat)(level_.load() + FOCUS_DRIFT_WEIGHT * (focus_value - level_.load())));
+
+    if ((high_sum_ > threshold_) || (low_sum_ > threshold_)) {
+        drifts_++;
+        excursion_ = FALSE;
+        return TRUE;
+    }
+
+    if (fabs(focus_value - reference_) >= FOCUS_DRIFT_SINGLE_FRAME * reference_) {
+        excursion_ = TRUE;
+    }
+    else if (excursion_) {
+        g_debug("Focus value back within %.0f%% of %.2f, rescan avoided", FOCUS_DRIFT_SINGLE_FRAME * 100, reference_);
+        avoided_++;
+        excursion_ = FALSE;
+    }
+    return FALSE;
+}
+
+/**
+ * A snapshot of the detector counters. Safe from any thread.
+ */
+FocusDriftStats FocusDriftDetector::getStats() const {
+    FocusDriftStats stats;
+    stats.frames = frames_.load();
+    stats.drifts = drifts_.load();
+    stats.avoided = avoided_.load();
+    stats.noise = noise_.load();
+    stats.level = level_.load();
+    return stats;
+}
@@ -0,0 +1,827 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FOCUS_KERNELS_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define FOCUS_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include "FocusKernels.h"
+
+/****************************************************
+ * The Laplacian cv::Laplacian uses with ksize = 1 is
+ *
+ *      0  1  0
+ *      1 -4  1
+ *      0  1  0
+ *
+ * With a CV_16U destination every result is saturated, so negative
+ * responses become 0. The largest possible response is 4 * 255 = 1020.
+ * Borders are BORDER_REFLECT_101 (gfedcb|abcdefgh|gfedcba).
+ *****************************************************/
+
+typedef guint64 (*LaplacianRowFunc)(const guint8* up, const guint8* row, const guint8* down, gint count);
+
+/**
+* Mirror a coordinate back inside [0, length) the same way BORDER_REFLECT_101 does.
+*
+* @param p : The coordinate, which may be -1 or length.
+* @param length : The number of pixels along this axis.
+*
+* @return : A valid coordinate.
+*/
+static inline gint reflect101(gint p, gint length)
+{
+    if (length == 1)
+        return 0;
+    if (p < 0)
+        return -p;
+    if (p >= length)
+        return 2 * length - p - 2;
+    return p;
+}
+
+/**
+* Laplacian response of one pixel, saturated to an unsigned 16 bit value.
+*/
+static inline guint laplacianPixel(guint up, guint left, guint centre, guint right, guint down)
+{
+    gint value = (gint)(up + left + right + down) - (gint)(centre << 2);
+    return (value > 0) ? (guint)value : 0;
+}
+
+/**
+* Laplacian response of a pixel in the first or last image column, where one
+* horizontal neighbour has to be reflected.
+*/
+static inline guint edgePixel(const guint8* up, const guint8* row, const guint8* down, gint x, gint width)
+{
+    return laplacianPixel(up[x], row[reflect101(x - 1, width)], row[x], row[reflect101(x + 1, width)], down[x]);
+}
+
+/**
+* Plain C++ row kernel. The pointers are positioned at the first pixel to process, and
+* row[-1] and row[count] must be readable.
+*/
+static guint64 laplacianRowScalar(const guint8* up, const guint8* row, const guint8* down, gint count)
+{
+    guint64 sum = 0;
+    for (gint i = 0; i < count; ++i)
+        sum += laplacianPixel(up[i], row[i - 1], row[i], row[i + 1], down[i]);
+    return sum;
+}
+
+#ifdef FOCUS_KERNELS_X86
+/**
+* SSE2 row kernel, 16 pixels per iteration. The 16 bit saturating subtract gives the
+* same clamp at zero as saturate_cast<ushort>, and madd folds pairs into 32 bit lanes.
+*/
+static guint64 laplacianRowSSE2(const guint8* up, const guint8* row, const guint8* down, gint count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    gint i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i*)(up + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(down + i));
+        __m128i l = _mm_loadu_si128((const __m128i*)(row + i - 1));
+        __m128i r = _mm_loadu_si128((const __m128i*)(row + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(row + i));
+
+        __m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(u, zero), _mm_unpacklo_epi8(d, zero)),
+            _mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero)));
+        __m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero)),
+            _mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero)));
+        __m128i c4_lo = _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2);
+        __m128i c4_hi = _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2);
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_subs_epu16(sum_lo, c4_lo), ones));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_subs_epu16(sum_hi, c4_hi), ones));
+    }
+
+    guint32 lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    guint64 sum = (guint64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    return sum + laplacianRowScalar(up + i, row + i, down + i, count - i);
+}
+
+/**
+* AVX2 row kernel, 32 pixels per iteration. Compiled for AVX2 only in this function so
+* the rest of the file still runs on any x86-64.
+*/
+__attribute__((target("avx2")))
+static guint64 laplacianRowAVX2(const guint8* up, const guint8* row, const guint8* down, gint count)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    gint i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        for (gint half = 0; half < 32; half += 16) {
+            const gint o = i + half;
+            __m256i u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(up + o)));
+            __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(down + o)));
+            __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + o - 1)));
+            __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + o + 1)));
+            __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + o)));
+
+            __m256i sum = _mm256_add_epi16(_mm256_add_epi16(u, d), _mm256_add_epi16(l, r));
+            __m256i lap = _mm256_subs_epu16(sum, _mm256_slli_epi16(c, 2));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lap, ones));
+        }
+    }
+
+    guint32 lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    guint64 sum = 0;
+    for (gint lane = 0; lane < 8; ++lane)
+        sum += lanes[lane];
+
+    return sum + laplacianRowScalar(up + i, row + i, down + i, count - i);
+}
+#endif //FOCUS_KERNELS_X86
+
+#ifdef FOCUS_KERNELS_NEON
+/**
+* NEON row kernel, 16 pixels per iteration. vqsubq_u16 clamps at zero and vpadalq_u16
+* pairwise accumulates into 32 bit lanes.
+*/
+static guint64 laplacianRowNEON(const guint8* up, const guint8* row, const guint8* down, gint count)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    gint i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t u = vld1q_u8(up + i);
+        uint8x16_t d = vld1q_u8(down + i);
+        uint8x16_t l = vld1q_u8(row + i - 1);
+        uint8x16_t r = vld1q_u8(row + i + 1);
+        uint8x16_t c = vld1q_u8(row + i);
+
+        uint16x8_t sum_lo = vaddq_u16(vaddl_u8(vget_low_u8(u), vget_low_u8(d)),
+            vaddl_u8(vget_low_u8(l), vget_low_u8(r)));
+        uint16x8_t sum_hi = vaddq_u16(vaddl_u8(vget_high_u8(u), vget_high_u8(d)),
+            vaddl_u8(vget_high_u8(l), vget_high_u8(r)));
+
+        acc = vpadalq_u16(acc, vqsubq_u16(sum_lo, vshll_n_u8(vget_low_u8(c), 2)));
+        acc = vpadalq_u16(acc, vqsubq_u16(sum_hi, vshll_n_u8(vget_high_u8(c), 2)));
+    }
+
+    guint64 sum = (guint64)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+        vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+
+    return sum + laplacianRowScalar(up + i, row + i, down + i, count - i);
+}
+#endif //FOCUS_KERNELS_NEON
+
+/**
+* Pick the row kernel for a path. Falls back to the scalar kernel if a path is not
+* compiled in for this architecture.
+*/
+static LaplacianRowFunc rowFuncForPath(FocusKernelPath path)
+{
+    switch (path) {
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            return laplacianRowSSE2;
+        case FOCUS_KERNEL_AVX2:
+            return laplacianRowAVX2;
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            return laplacianRowNEON;
+#endif
+        default:
+            return laplacianRowScalar;
+    }
+}
+
+/**
+* Check once which instruction sets this CPU can run.
+*
+* @return : The fastest path available.
+*/
+static FocusKernelPath detectBestPath()
+{
+#ifdef FOCUS_KERNELS_NEON
+    return FOCUS_KERNEL_NEON; //NEON is mandatory on aarch64, so there is nothing to probe
+#elif defined(FOCUS_KERNELS_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return FOCUS_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return FOCUS_KERNEL_SSE2;
+    return FOCUS_KERNEL_SCALAR;
+#else
+    return FOCUS_KERNEL_SCALAR;
+#endif
+}
+
+FocusKernelPath FocusKernels::bestPath()
+{
+    static const FocusKernelPath best = detectBestPath();
+    return best;
+}
+
+gboolean FocusKernels::pathAvailable(FocusKernelPath path)
+{
+    switch (path) {
+        case FOCUS_KERNEL_AUTO:
+        case FOCUS_KERNEL_SCALAR:
+            return TRUE;
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            return (bestPath() == FOCUS_KERNEL_SSE2) || (bestPath() == FOCUS_KERNEL_AVX2);
+        case FOCUS_KERNEL_AVX2:
+            return bestPath() == FOCUS_KERNEL_AVX2;
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            return TRUE;
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+const gchar* FocusKernels::pathName(FocusKernelPath path)
+{
+    switch (path) {
+        case FOCUS_KERNEL_AUTO:   return "auto";
+        case FOCUS_KERNEL_SCALAR: return "scalar";
+        case FOCUS_KERNEL_SSE2:   return "sse2";
+        case FOCUS_KERNEL_AVX2:   return "avx2";
+        case FOCUS_KERNEL_NEON:   return "neon";
+    }
+    return "unknown";
+}
+
+/**
+* Sum the saturated Laplacian over the ROI in a single pass. Interior columns go through
+* the vector row kernel, while the first and last image columns need reflected neighbours
+* and are done one pixel at a time.
+*
+* @param plane : The luma plane holding the frame.
+* @param roi : The region to measure. It must lie inside the plane.
+* @param path : The instruction set to use, FOCUS_KERNEL_AUTO for the best available.
+*
+* @return : The sum of the Laplacian over every ROI pixel.
+*/
+guint64 FocusKernels::laplacianSum(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    if (path == FOCUS_KERNEL_AUTO || !pathAvailable(path))
+        path = bestPath();
+
+    const LaplacianRowFunc rowFunc = rowFuncForPath(path);
+    const gint x_end = roi.x + roi.width;
+    //Columns that have a real neighbour on both sides
+    const gint inner_start = MAX(roi.x, 1);
+    const gint inner_end = MIN(x_end, plane.width - 1);
+    guint64 sum = 0;
+
+    for (gint y = roi.y; y < roi.y + roi.height; ++y) {
+        const guint8* row = plane.data + (gsize)y * plane.stride;
+        const guint8* up = plane.data + (gsize)reflect101(y - 1, plane.height) * plane.stride;
+        const guint8* down = plane.data + (gsize)reflect101(y + 1, plane.height) * plane.stride;
+
+        if (inner_end > inner_start) {
+            sum += rowFunc(up + inner_start, row + inner_start, down + inner_start, inner_end - inner_start);
+            if (roi.x < inner_start)
+                sum += edgePixel(up, row, down, roi.x, plane.width);
+            if (x_end > inner_end)
+                sum += edgePixel(up, row, down, x_end - 1, plane.width);
+        }
+        else { //Only for planes a pixel or two wide
+            for (gint x = roi.x; x < x_end; ++x)
+                sum += edgePixel(up, row, down, x, plane.width);
+        }
+    }
+    return sum;
+}
+
+/**
+* Mean of the Laplacian over the ROI. cv::mean multiplies the sum by the reciprocal
+* of the pixel count rather than dividing, and so do we, to give the same bits.
+*
+* @param plane : The luma plane holding the frame.
+* @param roi : The region to measure.
+* @param path : The instruction set to use, FOCUS_KERNEL_AUTO for the best available.
+*
+* @return : The focus value as a floating point number.
+*/
+gfloat FocusKernels::laplacianMean(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    const gint pixel_count = roi.width * roi.height;
+    if (pixel_count <= 0)
+        return 0;
+
+    return (gfloat)((gdouble)laplacianSum(plane, roi, path) * (1. / pixel_count));
+}
+
+/****************************************************
+ * Kernels for the other focus metrics. These share the
+ * layout of the Laplacian sum above: a vector row kernel
+ * for the interior with a scalar tail, and reflected
+ * scalar pixels at the first and last image columns.
+ *
+ * The 32 bit vector accumulators are folded into 64 bit
+ * totals every FLUSH_ITERATIONS so squares cannot overflow.
+ *****************************************************/
+
+#define FLUSH_ITERATIONS 64
+
+struct RowMoments {
+    gint64 sum;
+    guint64 sum_squares;
+};
+
+typedef void (*NeighbourhoodRowFunc)(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out);
+typedef void (*PlainRowFunc)(const guint8* row, gint count, RowMoments& out);
+
+static inline gint laplacianSigned(gint up, gint left, gint centre, gint right, gint down)
+{
+    return (up + left + right + down) - (centre << 2);
+}
+
+static inline guint sobelPixel(gint up_left, gint up, gint up_right, gint left, gint right,
+    gint down_left, gint down, gint down_right)
+{
+    gint gx = (up_right + 2 * right + down_right) - (up_left + 2 * left + down_left);
+    gint gy = (down_left + 2 * down + down_right) - (up_left + 2 * up + up_right);
+    return (guint)(gx * gx + gy * gy);
+}
+
+static void laplacianMomentsRowScalar(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    for (gint i = 0; i < count; ++i) {
+        gint value = laplacianSigned(up[i], row[i - 1], row[i], row[i + 1], down[i]);
+        out.sum += value;
+        out.sum_squares += (guint64)(value * value);
+    }
+}
+
+static void laplacianMomentsEdge(const guint8* up, const guint8* row, const guint8* down, gint x, gint width, RowMoments& out)
+{
+    gint value = laplacianSigned(up[x], row[reflect101(x - 1, width)], row[x], row[reflect101(x + 1, width)], down[x]);
+    out.sum += value;
+    out.sum_squares += (guint64)(value * value);
+}
+
+static void sobelRowScalar(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    for (gint i = 0; i < count; ++i)
+        out.sum_squares += sobelPixel(up[i - 1], up[i], up[i + 1], row[i - 1], row[i + 1], down[i - 1], down[i], down[i + 1]);
+}
+
+static void sobelEdge(const guint8* up, const guint8* row, const guint8* down, gint x, gint width, RowMoments& out)
+{
+    gint l = reflect101(x - 1, width);
+    gint r = reflect101(x + 1, width);
+    out.sum_squares += sobelPixel(up[l], up[x], up[r], row[l], row[r], down[l], down[x], down[r]);
+}
+
+static void brennerRowScalar(const guint8* row, gint count, RowMoments& out)
+{
+    for (gint i = 0; i + 2 < count; ++i) {
+        gint difference = (gint)row[i + 2] - (gint)row[i];
+        out.sum_squares += (guint64)(difference * difference);
+    }
+}
+
+static void intensityRowScalar(const guint8* row, gint count, RowMoments& out)
+{
+    for (gint i = 0; i < count; ++i) {
+        out.sum += row[i];
+        out.sum_squares += (guint64)row[i] * row[i];
+    }
+}
+
+#ifdef FOCUS_KERNELS_X86
+static inline gint64 sumLanesSigned(__m128i lanes)
+{
+    gint32 values[4];
+    _mm_storeu_si128((__m128i*)values, lanes);
+    return (gint64)values[0] + values[1] + values[2] + values[3];
+}
+
+static inline guint64 sumLanesUnsigned(__m128i lanes)
+{
+    guint32 values[4];
+    _mm_storeu_si128((__m128i*)values, lanes);
+    return (guint64)values[0] + values[1] + values[2] + values[3];
+}
+
+static void laplacianMomentsRowSSE2(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        __m128i acc_sum = _mm_setzero_si128();
+        __m128i acc_squares = _mm_setzero_si128();
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            __m128i u = _mm_loadu_si128((const __m128i*)(up + i));
+            __m128i d = _mm_loadu_si128((const __m128i*)(down + i));
+            __m128i l = _mm_loadu_si128((const __m128i*)(row + i - 1));
+            __m128i r = _mm_loadu_si128((const __m128i*)(row + i + 1));
+            __m128i c = _mm_loadu_si128((const __m128i*)(row + i));
+
+            __m128i lap_lo = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(u, zero), _mm_unpacklo_epi8(d, zero)),
+                _mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero))),
+                _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2));
+            __m128i lap_hi = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero)),
+                _mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero))),
+                _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2));
+
+            acc_sum = _mm_add_epi32(acc_sum, _mm_add_epi32(_mm_madd_epi16(lap_lo, ones), _mm_madd_epi16(lap_hi, ones)));
+            acc_squares = _mm_add_epi32(acc_squares, _mm_add_epi32(_mm_madd_epi16(lap_lo, lap_lo), _mm_madd_epi16(lap_hi, lap_hi)));
+        }
+        out.sum += sumLanesSigned(acc_sum);
+        out.sum_squares += sumLanesUnsigned(acc_squares);
+    }
+    laplacianMomentsRowScalar(up + i, row + i, down + i, count - i, out);
+}
+
+/**
+* One half (8 pixels) of the SSE2 Sobel, returning the 32 bit lanes of gx^2 + gy^2.
+*/
+static inline __m128i sobelHalfSSE2(__m128i ul, __m128i u, __m128i ur, __m128i l, __m128i r,
+    __m128i dl, __m128i d, __m128i dr)
+{
+    __m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(ur, dr), _mm_slli_epi16(r, 1)),
+        _mm_add_epi16(_mm_add_epi16(ul, dl), _mm_slli_epi16(l, 1)));
+    __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(dl, dr), _mm_slli_epi16(d, 1)),
+        _mm_add_epi16(_mm_add_epi16(ul, ur), _mm_slli_epi16(u, 1)));
+    return _mm_add_epi32(_mm_madd_epi16(gx, gx), _mm_madd_epi16(gy, gy));
+}
+
+static void sobelRowSSE2(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        __m128i acc = _mm_setzero_si128();
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            __m128i ul = _mm_loadu_si128((const __m128i*)(up + i - 1));
+            __m128i u = _mm_loadu_si128((const __m128i*)(up + i));
+            __m128i ur = _mm_loadu_si128((const __m128i*)(up + i + 1));
+            __m128i l = _mm_loadu_si128((const __m128i*)(row + i - 1));
+            __m128i r = _mm_loadu_si128((const __m128i*)(row + i + 1));
+            __m128i dl = _mm_loadu_si128((const __m128i*)(down + i - 1));
+            __m128i d = _mm_loadu_si128((const __m128i*)(down + i));
+            __m128i dr = _mm_loadu_si128((const __m128i*)(down + i + 1));
+
+            acc = _mm_add_epi32(acc, sobelHalfSSE2(_mm_unpacklo_epi8(ul, zero), _mm_unpacklo_epi8(u, zero),
+                _mm_unpacklo_epi8(ur, zero), _mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero),
+                _mm_unpacklo_epi8(dl, zero), _mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(dr, zero)));
+            acc = _mm_add_epi32(acc, sobelHalfSSE2(_mm_unpackhi_epi8(ul, zero), _mm_unpackhi_epi8(u, zero),
+                _mm_unpackhi_epi8(ur, zero), _mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero),
+                _mm_unpackhi_epi8(dl, zero), _mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(dr, zero)));
+        }
+        out.sum_squares += sumLanesUnsigned(acc);
+    }
+    sobelRowScalar(up + i, row + i, down + i, count - i, out);
+}
+
+static void brennerRowSSE2(const guint8* row, gint count, RowMoments& out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    gint i = 0;
+
+    while (i + 18 <= count) {
+        __m128i acc = _mm_setzero_si128();
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 18 <= count); ++n, i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(row + i + 2));
+            __m128i d_lo = _mm_sub_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(a, zero));
+            __m128i d_hi = _mm_sub_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(a, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(d_lo, d_lo), _mm_madd_epi16(d_hi, d_hi)));
+        }
+        out.sum_squares += sumLanesUnsigned(acc);
+    }
+    brennerRowScalar(row + i, count - i, out);
+}
+
+static void intensityRowSSE2(const guint8* row, gint count, RowMoments& out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        __m128i acc_sum = _mm_setzero_si128();
+        __m128i acc_squares = _mm_setzero_si128();
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i v_lo = _mm_unpacklo_epi8(v, zero);
+            __m128i v_hi = _mm_unpackhi_epi8(v, zero);
+            acc_sum = _mm_add_epi64(acc_sum, _mm_sad_epu8(v, zero));
+            acc_squares = _mm_add_epi32(acc_squares, _mm_add_epi32(_mm_madd_epi16(v_lo, v_lo), _mm_madd_epi16(v_hi, v_hi)));
+        }
+        guint64 sums[2];
+        _mm_storeu_si128((__m128i*)sums, acc_sum);
+        out.sum += (gint64)(sums[0] + sums[1]);
+        out.sum_squares += sumLanesUnsigned(acc_squares);
+    }
+    intensityRowScalar(row + i, count - i, out);
+}
+#endif //FOCUS_KERNELS_X86
+
+#ifdef FOCUS_KERNELS_NEON
+static inline int16x8_t widenSigned(uint8x8_t value)
+{
+    return vreinterpretq_s16_u16(vmovl_u8(value));
+}
+
+static inline int32x4_t squareAccumulate(int32x4_t acc, int16x8_t value)
+{
+    acc = vmlal_s16(acc, vget_low_s16(value), vget_low_s16(value));
+    return vmlal_s16(acc, vget_high_s16(value), vget_high_s16(value));
+}
+
+static inline gint64 sumLanesSigned(int32x4_t lanes)
+{
+    return (gint64)vgetq_lane_s32(lanes, 0) + vgetq_lane_s32(lanes, 1) +
+        vgetq_lane_s32(lanes, 2) + vgetq_lane_s32(lanes, 3);
+}
+
+static void laplacianMomentsRowNEON(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        int32x4_t acc_sum = vdupq_n_s32(0);
+        int32x4_t acc_squares = vdupq_n_s32(0);
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            uint8x16_t u = vld1q_u8(up + i);
+            uint8x16_t d = vld1q_u8(down + i);
+            uint8x16_t l = vld1q_u8(row + i - 1);
+            uint8x16_t r = vld1q_u8(row + i + 1);
+            uint8x16_t c = vld1q_u8(row + i);
+
+            int16x8_t lap_lo = vsubq_s16(vreinterpretq_s16_u16(vaddq_u16(vaddl_u8(vget_low_u8(u), vget_low_u8(d)),
+                vaddl_u8(vget_low_u8(l), vget_low_u8(r)))), vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(c), 2)));
+            int16x8_t lap_hi = vsubq_s16(vreinterpretq_s16_u16(vaddq_u16(vaddl_u8(vget_high_u8(u), vget_high_u8(d)),
+                vaddl_u8(vget_high_u8(l), vget_high_u8(r)))), vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(c), 2)));
+
+            acc_sum = vpadalq_s16(vpadalq_s16(acc_sum, lap_lo), lap_hi);
+            acc_squares = squareAccumulate(squareAccumulate(acc_squares, lap_lo), lap_hi);
+        }
+        out.sum += sumLanesSigned(acc_sum);
+        out.sum_squares += (guint64)sumLanesSigned(acc_squares);
+    }
+    laplacianMomentsRowScalar(up + i, row + i, down + i, count - i, out);
+}
+
+/**
+* One half (8 pixels) of the NEON Sobel, accumulating gx^2 + gy^2.
+*/
+static inline int32x4_t sobelHalfNEON(int32x4_t acc, int16x8_t ul, int16x8_t u, int16x8_t ur, int16x8_t l,
+    int16x8_t r, int16x8_t dl, int16x8_t d, int16x8_t dr)
+{
+    int16x8_t gx = vsubq_s16(vaddq_s16(vaddq_s16(ur, dr), vshlq_n_s16(r, 1)),
+        vaddq_s16(vaddq_s16(ul, dl), vshlq_n_s16(l, 1)));
+    int16x8_t gy = vsubq_s16(vaddq_s16(vaddq_s16(dl, dr), vshlq_n_s16(d, 1)),
+        vaddq_s16(vaddq_s16(ul, ur), vshlq_n_s16(u, 1)));
+    return squareAccumulate(squareAccumulate(acc, gx), gy);
+}
+
+static void sobelRowNEON(const guint8* up, const guint8* row, const guint8* down, gint count, RowMoments& out)
+{
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        int32x4_t acc = vdupq_n_s32(0);
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            uint8x16_t ul = vld1q_u8(up + i - 1);
+            uint8x16_t u = vld1q_u8(up + i);
+            uint8x16_t ur = vld1q_u8(up + i + 1);
+            uint8x16_t l = vld1q_u8(row + i - 1);
+            uint8x16_t r = vld1q_u8(row + i + 1);
+            uint8x16_t dl = vld1q_u8(down + i - 1);
+            uint8x16_t d = vld1q_u8(down + i);
+            uint8x16_t dr = vld1q_u8(down + i + 1);
+
+            acc = sobelHalfNEON(acc, widenSigned(vget_low_u8(ul)), widenSigned(vget_low_u8(u)),
+                widenSigned(vget_low_u8(ur)), widenSigned(vget_low_u8(l)), widenSigned(vget_low_u8(r)),
+                widenSigned(vget_low_u8(dl)), widenSigned(vget_low_u8(d)), widenSigned(vget_low_u8(dr)));
+            acc = sobelHalfNEON(acc, widenSigned(vget_high_u8(ul)), widenSigned(vget_high_u8(u)),
+                widenSigned(vget_high_u8(ur)), widenSigned(vget_high_u8(l)), widenSigned(vget_high_u8(r)),
+                widenSigned(vget_high_u8(dl)), widenSigned(vget_high_u8(d)), widenSigned(vget_high_u8(dr)));
+        }
+        out.sum_squares += (guint64)sumLanesSigned(acc);
+    }
+    sobelRowScalar(up + i, row + i, down + i, count - i, out);
+}
+
+static void brennerRowNEON(const guint8* row, gint count, RowMoments& out)
+{
+    gint i = 0;
+
+    while (i + 18 <= count) {
+        int32x4_t acc = vdupq_n_s32(0);
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 18 <= count); ++n, i += 16) {
+            uint8x16_t a = vld1q_u8(row + i);
+            uint8x16_t b = vld1q_u8(row + i + 2);
+            //The wrapped unsigned difference is the right signed value once reinterpreted
+            acc = squareAccumulate(acc, vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(b), vget_low_u8(a))));
+            acc = squareAccumulate(acc, vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(b), vget_high_u8(a))));
+        }
+        out.sum_squares += (guint64)sumLanesSigned(acc);
+    }
+    brennerRowScalar(row + i, count - i, out);
+}
+
+static void intensityRowNEON(const guint8* row, gint count, RowMoments& out)
+{
+    gint i = 0;
+
+    while (i + 16 <= count) {
+        uint32x4_t acc_sum = vdupq_n_u32(0);
+        uint32x4_t acc_squares = vdupq_n_u32(0);
+
+        for (gint n = 0; (n < FLUSH_ITERATIONS) && (i + 16 <= count); ++n, i += 16) {
+            uint8x16_t v = vld1q_u8(row + i);
+            uint16x8_t v_lo = vmovl_u8(vget_low_u8(v));
+            uint16x8_t v_hi = vmovl_u8(vget_high_u8(v));
+            acc_sum = vpadalq_u16(acc_sum, vpaddlq_u8(v));
+            acc_squares = vmlal_u16(acc_squares, vget_low_u16(v_lo), vget_low_u16(v_lo));
+            acc_squares = vmlal_u16(acc_squares, vget_high_u16(v_lo), vget_high_u16(v_lo));
+            acc_squares = vmlal_u16(acc_squares, vget_low_u16(v_hi), vget_low_u16(v_hi));
+            acc_squares = vmlal_u16(acc_squares, vget_high_u16(v_hi), vget_high_u16(v_hi));
+        }
+        out.sum += (gint64)vgetq_lane_u32(acc_sum, 0) + vgetq_lane_u32(acc_sum, 1) +
+            vgetq_lane_u32(acc_sum, 2) + vgetq_lane_u32(acc_sum, 3);
+        out.sum_squares += (guint64)vgetq_lane_u32(acc_squares, 0) + vgetq_lane_u32(acc_squares, 1) +
+            vgetq_lane_u32(acc_squares, 2) + vgetq_lane_u32(acc_squares, 3);
+    }
+    intensityRowScalar(row + i, count - i, out);
+}
+#endif //FOCUS_KERNELS_NEON
+
+/**
+* Resolve AUTO and unavailable paths. These kernels have no AVX2 version, so AVX2
+* machines run the SSE2 one.
+*/
+static FocusKernelPath resolveMomentsPath(FocusKernelPath path)
+{
+    if (path == FOCUS_KERNEL_AUTO || !FocusKernels::pathAvailable(path))
+        path = FocusKernels::bestPath();
+    if (path == FOCUS_KERNEL_AVX2)
+        path = FOCUS_KERNEL_SSE2;
+    return path;
+}
+
+/**
+* Run a 3x3 neighbourhood kernel over the ROI, handling the rows above and below and the
+* image edge columns the same way laplacianSum does.
+*/
+static FocusMoments neighbourhoodMoments(const LumaPlane& plane, const FocusRoi& roi,
+    NeighbourhoodRowFunc rowFunc, void (*edgeFunc)(const guint8*, const guint8*, const guint8*, gint, gint, RowMoments&))
+{
+    const gint x_end = roi.x + roi.width;
+    const gint inner_start = MAX(roi.x, 1);
+    const gint inner_end = MIN(x_end, plane.width - 1);
+    RowMoments totals = { 0, 0 };
+
+    for (gint y = roi.y; y < roi.y + roi.height; ++y) {
+        const guint8* row = plane.data + (gsize)y * plane.stride;
+        const guint8* up = plane.data + (gsize)reflect101(y - 1, plane.height) * plane.stride;
+        const guint8* down = plane.data + (gsize)reflect101(y + 1, plane.height) * plane.stride;
+
+        if (inner_end > inner_start) {
+            rowFunc(up + inner_start, row + inner_start, down + inner_start, inner_end - inner_start, totals);
+            if (roi.x < inner_start)
+                edgeFunc(up, row, down, roi.x, plane.width, totals);
+            if (x_end > inner_end)
+                edgeFunc(up, row, down, x_end - 1, plane.width, totals);
+        }
+        else {
+            for (gint x = roi.x; x < x_end; ++x)
+                edgeFunc(up, row, down, x, plane.width, totals);
+        }
+    }
+
+    FocusMoments moments = { totals.sum, totals.sum_squares, (guint64)MAX(roi.width, 0) * MAX(roi.height, 0) };
+    return moments;
+}
+
+/**
+* Run a kernel that only looks along the row, never outside the ROI.
+*/
+static FocusMoments plainMoments(const LumaPlane& plane, const FocusRoi& roi, PlainRowFunc rowFunc)
+{
+    RowMoments totals = { 0, 0 };
+
+    for (gint y = roi.y; y < roi.y + roi.height; ++y)
+        rowFunc(plane.data + (gsize)y * plane.stride + roi.x, roi.width, totals);
+
+    FocusMoments moments = { totals.sum, totals.sum_squares, (guint64)MAX(roi.width, 0) * MAX(roi.height, 0) };
+    return moments;
+}
+
+FocusMoments FocusKernels::laplacianMoments(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    switch (resolveMomentsPath(path)) {
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            return neighbourhoodMoments(plane, roi, laplacianMomentsRowSSE2, laplacianMomentsEdge);
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            return neighbourhoodMoments(plane, roi, laplacianMomentsRowNEON, laplacianMomentsEdge);
+#endif
+        default:
+            return neighbourhoodMoments(plane, roi, laplacianMomentsRowScalar, laplacianMomentsEdge);
+    }
+}
+
+FocusMoments FocusKernels::sobelEnergy(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    switch (resolveMomentsPath(path)) {
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            return neighbourhoodMoments(plane, roi, sobelRowSSE2, sobelEdge);
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            return neighbourhoodMoments(plane, roi, sobelRowNEON, sobelEdge);
+#endif
+        default:
+            return neighbourhoodMoments(plane, roi, sobelRowScalar, sobelEdge);
+    }
+}
+
+FocusMoments FocusKernels::brennerEnergy(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    FocusMoments moments;
+
+    switch (resolveMomentsPath(path)) {
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            moments = plainMoments(plane, roi, brennerRowSSE2);
+            break;
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            moments = plainMoments(plane, roi, brennerRowNEON);
+            break;
+#endif
+        default:
+            moments = plainMoments(plane, roi, brennerRowScalar);
+            break;
+    }
+    //Only pixels with a partner two columns to the right are counted
+    moments.count = (roi.width > 2) ? (guint64)(roi.width - 2) * roi.height : 0;
+    return moments;
+}
+
+FocusMoments FocusKernels::intensityMoments(const LumaPlane& plane, const FocusRoi& roi, FocusKernelPath path)
+{
+    switch (resolveMomentsPath(path)) {
+#ifdef FOCUS_KERNELS_X86
+        case FOCUS_KERNEL_SSE2:
+            return plainMoments(plane, roi, intensityRowSSE2);
+#endif
+#ifdef FOCUS_KERNELS_NEON
+        case FOCUS_KERNEL_NEON:
+            return plainMoments(plane, roi, intensityRowNEON);
+#endif
+        default:
+            return plainMoments(plane, roi, intensityRowScalar);
+    }
+}
@@ -0,0 +1,130 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cmath>
+
+#include "FocusMap.h"
+
+/**
+ * Constructs a FocusMap. Nothing is allocated until setup is called.
+ *
+ * @param columns : Number of tiles across the frame
+ * @param rows : Number of tiles down the frame
+ * @param score : How the tile values are combined into one focus value
+ * @param threads : Threads to spread the tiles over, including the calling thread
+ */
+FocusMap::FocusMap(gint columns, gint rows, FocusMapScore score, gint threads) :
+columns_(MAX(columns, 1)), rows_(MAX(rows, 1)), score_(score), jobs_(threads), best_tile_(0),
+tile_values_(columns_ * rows_, 0), tile_weights_(columns_ * rows_, 1), tile_rois_(columns_ * rows_),
+tile_frame_width_(0), tile_frame_height_(0), plane_(nullptr), metric_(nullptr) {
+    //Gaussian centre weighting. A centre tile counts for about seven times a corner tile on the
+    //default 8x6 grid, rising towards sixteen times as the grid gets finer
+    for (gint row = 0; row < rows_; ++row)
+        for (gint column = 0; column < columns_; ++column) {
+            gdouble dx = (column + 0.5) / columns_ - 0.5;
+            gdouble dy = (row + 0.5) / rows_ - 0.5;
+            tile_weights_[row * columns_ + column] = (gfloat)exp(-(dx * dx + dy * dy) / 0.18);
+        }
+}
+
+/**
+ * Destructor for FocusMap. jobs_ waits for any running workers before freeing the pool.
+ */
+FocusMap::~FocusMap() {
+}
+
+/**
+ * Start the worker threads. The calling thread does one share of the tiles itself, so
+ * the pool has one thread less than requested.
+ *
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusMap::setup(GError** error) {
+    if ((jobs_.setup(error)) == -1)
+        return -1; //error is set by g_thread_pool_new
+    g_print("Focus map %dx%d tiles on %d threads\n", columns_, rows_, jobs_.threads());
+    return 0;
+}
+
+/**
+ * Work out the tile rectangles for a frame size. Tiles cover the whole frame, with any
+ * pixels left over from the division going to the last row and column.
+ */
+void FocusMap::layoutTiles(gint width, gint height) {
+    gint tile_width = width / columns_;
+    gint tile_height = height / rows_;
+
+    for (gint row = 0; row < rows_; ++row)
+        for (gint column = 0; column < columns_; ++column) {
+            FocusRoi& roi = tile_rois_[row * columns_ + column];
+            roi.x = column * tile_width;
+            roi.y = row * tile_height;
+            roi.width = (column == columns_ - 1) ? width - roi.x : tile_width;
+            roi.height = (row == rows_ - 1) ? height - roi.y : tile_height;
+        }
+    tile_frame_width_ = width;
+    tile_frame_height_ = height;
+}
+
+/**
+ * Measure the tiles belonging to one job. Jobs take every threads'th tile, so the busy
+ * centre of the frame is spread over all the threads rather than landing on one.
+ */
+void FocusMap::measureTiles(gint job) {
+    for (gsize tile = job; tile < tile_rois_.size(); tile += jobs_.threads())
+        tile_values_[tile] = metric_->measure(*plane_, tile_rois_[tile]);
+}
+
+/**
+ * Measure every tile of a frame and combine them into one focus value.
+ *
+ * @param plane : The luma plane of the focus frame
+ * @param metric : The focus metric to run on each tile
+ *
+ * @return : The combined score, see FocusMapScore.
+ */
+gfloat FocusMap::compute(const LumaPlane& plane, const FocusMetric& metric) {
+    if ((plane.width != tile_frame_width_) || (plane.height != tile_frame_height_))
+        layoutTiles(plane.width, plane.height);
+
+    plane_ = &plane;
+    metric_ = &metric;
+
+    jobs_.run([this](gint job) { measureTiles(job); });
+
+    plane_ = nullptr;
+    metric_ = nullptr;
+
+    best_tile_ = 0;
+    gdouble weighted_sum = 0;
+    gdouble weight_total = 0;
+    for (gsize tile = 0; tile < tile_values_.size(); ++tile) {
+        if (tile_values_[tile] > tile_values_[best_tile_])
+            best_tile_ = tile;
+        weighted_sum += (gdouble)tile_values_[tile] * tile_weights_[tile];
+        weight_total += tile_weights_[tile];
+    }
+
+    if (score_ == FOCUS_MAP_SCORE_WEIGHTED)
+        return (gfloat)(weighted_sum / weight_total);
+    return tile_values_[best_tile_];
+}
@@ -0,0 +1,162 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+
+#include "FocusMemory.h"
+
+#define FOCUS_MEMORY_GROUP "FocusMemory"
+
+/**
+ * Constructs an empty FocusMemory, which has nothing to warm start from.
+ */
+FocusMemory::FocusMemory() : focus_index_(MIN_FOCUS_INDEX), focus_value_(0), history_(), valid_(FALSE) {
+}
+
+/**
+ * Read a memory saved by an earlier run.
+ *
+ * @param filename : The key file to read
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusMemory::load(const gchar* filename, GError** error) {
+    GKeyFile* key_file = g_key_file_new();
+    gint* history = nullptr;
+    gsize length = 0;
+    GError* key_error = nullptr;
+    gint focus_index;
+    gdouble focus_value;
+    gint result = -1;
+
+    if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, error))
+        goto done;
+
+    focus_index = g_key_file_get_integer(key_file, FOCUS_MEMORY_GROUP, "Index", &key_error);
+    if (!key_error)
+        focus_value = g_key_file_get_double(key_file, FOCUS_MEMORY_GROUP, "Value", &key_error);
+    if (!key_error)
+        history = g_key_file_get_integer_list(key_file, FOCUS_MEMORY_GROUP, "History", &length, &key_error);
+    if (key_error) {
+        g_propagate_error(error, key_error);
+        goto done;
+    }
+
+    if ((focus_index < MIN_FOCUS_INDEX) || (focus_index > MAX_FOCUS_INDEX) || (length != FOCUS_MEMORY_BINS)) {
+        g_set_error(error, g_quark_from_static_string("focus memory"), 1,
+            "'%s' is not a focus memory for this lens range", filename);
+        goto done;
+    }
+
+    focus_index_ = focus_index;
+    focus_value_ = (gfloat)focus_value;
+    for (guint i = 0; i < FOCUS_MEMORY_BINS; ++i)
+        history_[i] = MAX(history[i], 0);
+    valid_ = TRUE;
+    result = 0;
+
+done:
+    g_free(history);
+    g_key_file_free(key_file);
+    return result;
+}
+
+/**
+ * Write the memory to a key file for the next run.
+ *
+ * @param filename : The key file to write, an existing file is replaced
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusMemory::save(const gchar* filename, GError** error) const {
+    GKeyFile* key_file = g_key_file_new();
+    gint history[FOCUS_MEMORY_BINS];
+    gboolean saved;
+
+    for (guint i = 0; i < FOCUS_MEMORY_BINS; ++i)
+        history[i] = history_[i];
+    g_key_file_set_integer(key_file, FOCUS_MEMORY_GROUP, "Index", focus_index_);
+    g_key_file_set_double(key_file, FOCUS_MEMORY_GROUP, "Value", focus_value_);
+    g_key_file_set_integer_list(key_file, FOCUS_MEMORY_GROUP, "History", history, FOCUS_MEMORY_BINS);
+    g_key_file_set_comment(key_file, FOCUS_MEMORY_GROUP, NULL,
+        " Last focus lock, and how many locks there have been in each 25 step bin from the near end", NULL);
+
+    saved = g_key_file_save_to_file(key_file, filename, error);
+    g_key_file_free(key_file);
+    return saved ? 0 : -1;
+}
+
+gboolean FocusMemory::valid() const {
+    return valid_;
+}
+
+/**
+ * Add a focus lock. Once the history holds FOCUS_MEMORY_HISTORY locks every bin is halved, so
+ * old working distances fade out.
+ *
+ * @param focus_index : Where focus locked
+ * @param focus_value : The focus value it locked with
+ */
+void FocusMemory::remember(guint focus_index, gfloat focus_value) {
+    guint total = 0;
+
+    focus_index_ = CLAMP(focus_index, MIN_FOCUS_INDEX, MAX_FOCUS_INDEX);
+    focus_value_ = focus_value;
+    valid_ = TRUE;
+
+    history_[(focus_index_ - MIN_FOCUS_INDEX) / FOCUS_MEMORY_BIN_WIDTH]++;
+    for (guint i = 0; i < FOCUS_MEMORY_BINS; ++i)
+        total += history_[i];
+    if (total > FOCUS_MEMORY_HISTORY)
+        for (guint i = 0; i < FOCUS_MEMORY_BINS; ++i)
+            history_[i] /= 2;
+}
+
+guint FocusMemory::focusIndex() const {
+    return focus_index_;
+}
+
+gfloat FocusMemory::focusValue() const {
+    return focus_value_;
+}
+
+/**
+ * How far either side of the last position a warm start should look. Twice the spread of the
+ * history around the last position, so a rig that has been used at a few working distances
+ * looks wider than one that never moves.
+ *
+ * @return : Focus indices, FOCUS_MEMORY_MIN_SPAN to FOCUS_MEMORY_MAX_SPAN.
+ */
+guint FocusMemory::span() const {
+    gdouble sum = 0, squares = 0;
+
+    for (guint i = 0; i < FOCUS_MEMORY_BINS; ++i) {
+        gdouble offset = MIN_FOCUS_INDEX + (i + 0.5) * FOCUS_MEMORY_BIN_WIDTH - focus_index_;
+
+        sum += history_[i];
+        squares += history_[i] * offset * offset;
+    }
+    if (sum == 0)
+        return FOCUS_MEMORY_MIN_SPAN;
+
+    return CLAMP((guint)lround(2.0 * sqrt(squares / sum)), FOCUS_MEMORY_MIN_SPAN, FOCUS_MEMORY_MAX_SPAN);
+}
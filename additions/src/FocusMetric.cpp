@@ -0,0 +1,106 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "FocusMetric.h"
+
+/**
+* Variance from the totals of a FocusMoments, computed in double so large sums
+* do not lose precision.
+*/
+static gdouble momentsVariance(const FocusMoments& moments)
+{
+    if (moments.count == 0)
+        return 0;
+
+    gdouble mean = (gdouble)moments.sum / moments.count;
+    gdouble variance = (gdouble)moments.sum_squares / moments.count - mean * mean;
+    return (variance > 0) ? variance : 0;
+}
+
+/**
+* Create a focus metric.
+*
+* @param type : The metric to create, normally from the --focus-metric option.
+* @param path : The instruction set the kernels use. AUTO unless benchmarking.
+*
+* @return : A new FocusMetric, owned by the caller.
+*/
+FocusMetric* FocusMetric::create(FocusMetricType type, FocusKernelPath path)
+{
+    switch (type) {
+        case FOCUS_METRIC_TENENGRAD:
+            return new TenengradMetric(path);
+        case FOCUS_METRIC_BRENNER:
+            return new BrennerMetric(path);
+        case FOCUS_METRIC_VARIANCE_OF_LAPLACIAN:
+            return new VarianceOfLaplacianMetric(path);
+        case FOCUS_METRIC_NORMALIZED_VARIANCE:
+            return new NormalizedVarianceMetric(path);
+        case FOCUS_METRIC_LAPLACIAN_MEAN:
+        default:
+            return new LaplacianMeanMetric(path);
+    }
+}
+
+/**
+* The name of a metric type, for logging and the evaluation tool.
+*/
+const gchar* FocusMetric::typeName(FocusMetricType type)
+{
+    switch (type) {
+        case FOCUS_METRIC_LAPLACIAN_MEAN:       return "laplacian-mean";
+        case FOCUS_METRIC_TENENGRAD:            return "tenengrad";
+        case FOCUS_METRIC_BRENNER:              return "brenner";
+        case FOCUS_METRIC_VARIANCE_OF_LAPLACIAN: return "variance-of-laplacian";
+        case FOCUS_METRIC_NORMALIZED_VARIANCE:  return "normalized-variance";
+        default:                                return "unknown";
+    }
+}
+
+gfloat LaplacianMeanMetric::measure(const LumaPlane& plane, const FocusRoi& roi) const
+{
+    return FocusKernels::laplacianMean(plane, roi, path_);
+}
+
+gfloat TenengradMetric::measure(const LumaPlane& plane, const FocusRoi& roi) const
+{
+    FocusMoments moments = FocusKernels::sobelEnergy(plane, roi, path_);
+    return (moments.count) ? (gfloat)((gdouble)moments.sum_squares / moments.count) : 0;
+}
+
+gfloat BrennerMetric::measure(const LumaPlane& plane, const FocusRoi& roi) const
+{
+    FocusMoments moments = FocusKernels::brennerEnergy(plane, roi, path_);
+    return (moments.count) ? (gfloat)((gdouble)moments.sum_squares / moments.count) : 0;
+}
+
+gfloat VarianceOfLaplacianMetric::measure(const LumaPlane& plane, const FocusRoi& roi) const
+{
+    return (gfloat)momentsVariance(FocusKernels::laplacianMoments(plane, roi, path_));
+}
+
+gfloat NormalizedVarianceMetric::measure(const LumaPlane& plane, const FocusRoi& roi) const
+{
+    FocusMoments moments = FocusKernels::intensityMoments(plane, roi, path_);
+
+    if ((moments.count == 0) || (moments.sum == 0))
+        return 0;
+    return (gfloat)(momentsVariance(moments) / ((gdouble)moments.sum / moments.count));
+}
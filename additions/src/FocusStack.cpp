@@ -0,0 +1,171 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "FocusStack.h"
+
+/**
+ * Constructs a FocusStack. Nothing is allocated until setup is called.
+ *
+ * @param threads : Threads to spread the bands over, including the calling thread
+ */
+FocusStack::FocusStack(gint threads) : jobs_(threads), images_(nullptr), output_(nullptr) {
+}
+
+/**
+ * Destructor for FocusStack. jobs_ waits for any running workers before freeing the pool.
+ */
+FocusStack::~FocusStack() {
+}
+
+/**
+ * Start the worker threads. The calling thread merges one share of the bands itself, so
+ * the pool has one thread less than requested.
+ *
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusStack::setup(GError** error) {
+    return jobs_.setup(error); //error is set by g_thread_pool_new
+}
+
+/**
+ * Merge the bands belonging to one job. Jobs take every threads'th band. Each band works out
+ * the sharpness of its own rows, plus FOCUS_STACK_RADIUS rows either side for the square sums,
+ * so the bands never wait on each other.
+ */
+void FocusStack::mergeBands(gint job) {
+    const std::vector<StackImage>& images = *images_;
+    StackImage& output = *output_;
+    const gint width = output.width, height = output.height;
+    const gint count = (gint)images.size();
+    const gint halo_rows = FOCUS_STACK_BAND_ROWS + 2 * FOCUS_STACK_RADIUS;
+    std::vector<gint> luma((halo_rows + 2) * width);
+    std::vector<guint32> energy(halo_rows * width);
+    std::vector<guint32> column_sum(width);
+    std::vector<gfloat> sharpness(count * FOCUS_STACK_BAND_ROWS * width);
+
+    for (gint first = job * FOCUS_STACK_BAND_ROWS; first < height; first += jobs_.threads() * FOCUS_STACK_BAND_ROWS) {
+        const gint last = MIN(first + FOCUS_STACK_BAND_ROWS, height);
+        const gint energy_first = MAX(first - FOCUS_STACK_RADIUS, 0);
+        const gint energy_last = MIN(last + FOCUS_STACK_RADIUS, height);
+        const gint luma_first = MAX(energy_first - 1, 0);
+        const gint luma_last = MIN(energy_last + 1, height);
+
+        for (gint i = 0; i < count; ++i) {
+            const StackImage& image = images[i];
+
+            for (gint y = luma_first; y < luma_last; ++y) {
+                const guint8* pixel = image.data + (gsize)y * image.stride;
+                gint* row = &luma[(y - luma_first) * width];
+                for (gint x = 0; x < width; ++x, pixel += image.channels)
+                    row[x] = (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8;
+            }
+
+            //Squared 4-neighbour Laplacian, then summed along the row. Edges repeat the edge pixel.
+            for (gint y = energy_first; y < energy_last; ++y) {
+                const gint* row = &luma[(y - luma_first) * width];
+                const gint* above = &luma[(MAX(y - 1, 0) - luma_first) * width];
+                const gint* below = &luma[(MIN(y + 1, height - 1) - luma_first) * width];
+                guint32* out = &energy[(y - energy_first) * width];
+                guint32 running = 0;
+
+                for (gint x = 0; x < width; ++x) {
+                    gint laplacian = 4 * row[x] - row[MAX(x - 1, 0)] - row[MIN(x + 1, width - 1)] - above[x] - below[x];
+                    column_sum[x] = (guint32)(laplacian * laplacian);
+                }
+                for (gint x = 0; x < MIN(FOCUS_STACK_RADIUS, width); ++x)
+                    running += column_sum[x];
+                for (gint x = 0; x < width; ++x) {
+                    if (x + FOCUS_STACK_RADIUS < width)
+                        running += column_sum[x + FOCUS_STACK_RADIUS];
+                    if (x - FOCUS_STACK_RADIUS - 1 >= 0)
+                        running -= column_sum[x - FOCUS_STACK_RADIUS - 1];
+                    out[x] = running;
+                }
+            }
+
+            //Then down the columns, for this band's rows only
+            for (gint x = 0; x < width; ++x)
+                column_sum[x] = 0;
+            for (gint y = first - FOCUS_STACK_RADIUS; y < first + FOCUS_STACK_RADIUS; ++y)
+                if ((y >= energy_first) && (y < energy_last))
+                    for (gint x = 0; x < width; ++x)
+                        column_sum[x] += energy[(y - energy_first) * width + x];
+            for (gint y = first; y < last; ++y) {
+                gint add = y + FOCUS_STACK_RADIUS, remove = y - FOCUS_STACK_RADIUS - 1;
+                gfloat* out = &sharpness[(i * FOCUS_STACK_BAND_ROWS + (y - first)) * width];
+
+                if (add < energy_last)
+                    for (gint x = 0; x < width; ++x)
+                        column_sum[x] += energy[(add - energy_first) * width + x];
+                if (remove >= energy_first)
+                    for (gint x = 0; x < width; ++x)
+                        column_sum[x] -= energy[(remove - energy_first) * width + x];
+                for (gint x = 0; x < width; ++x)
+                    out[x] = (gfloat)column_sum[x];
+            }
+        }
+
+        for (gint y = first; y < last; ++y) {
+            guint8* out = output.data + (gsize)y * output.stride;
+
+            for (gint x = 0; x < width; ++x, out += output.channels) {
+                gfloat sum[3] = { 0, 0, 0 }, weight_total = 0;
+
+                for (gint i = 0; i < count; ++i) {
+                    const guint8* pixel = images[i].data + (gsize)y * images[i].stride + (gsize)x * images[i].channels;
+                    gfloat s = sharpness[(i * FOCUS_STACK_BAND_ROWS + (y - first)) * width + x];
+                    gfloat weight = s * s + 1.0f; //Flat everywhere, every image counts the same
+
+                    sum[0] += weight * pixel[0];
+                    sum[1] += weight * pixel[1];
+                    sum[2] += weight * pixel[2];
+                    weight_total += weight;
+                }
+                for (gint c = 0; c < 3; ++c)
+                    out[c] = (guint8)CLAMP((gint)(sum[c] / weight_total + 0.5f), 0, 255);
+                if (output.channels == 4)
+                    out[3] = 255;
+            }
+        }
+    }
+}
+
+/**
+ * Merge a focus bracket into one image. Images past FOCUS_STACK_MAX_IMAGES are left out.
+ *
+ * @param images : The bracket, all the same width and height as output, 3 or 4 channels
+ * @param output : Where the merged image is written, 3 or 4 channels. Alpha is set opaque.
+ */
+void FocusStack::merge(const std::vector<StackImage>& images, StackImage& output) {
+    std::vector<StackImage> used(images.begin(), images.begin() + MIN(images.size(), (gsize)FOCUS_STACK_MAX_IMAGES));
+
+    if (used.empty())
+        return;
+
+    images_ = &used;
+    output_ = &output;
+
+    jobs_.run([this](gint job) { mergeBands(job); });
+
+    images_ = nullptr;
+    output_ = nullptr;
+}
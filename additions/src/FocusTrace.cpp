@@ -0,0 +1,213 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "FocusTrace.h"
+
+static_assert(sizeof(FocusTraceRecord) == 24, "FocusTraceRecord is part of the trace file format");
+static_assert(sizeof(FocusTraceHeader) == 88, "FocusTraceHeader is part of the trace file format");
+
+/**
+ * Constructs a FocusTrace. Nothing is written until open is called.
+ */
+FocusTrace::FocusTrace() : file_(nullptr), records_written_(0) {
+}
+
+/**
+ * Destructor for FocusTrace. Closes the trace if it is still open.
+ */
+FocusTrace::~FocusTrace() {
+    close();
+}
+
+/**
+ * Create the trace file and write its header.
+ *
+ * @param filename : Where to write the trace, an existing file is replaced
+ * @param tuning : The tuning the state machine is running with
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusTrace::open(const gchar* filename, const CDAFTuning& tuning, GError** error) {
+    FocusTraceHeader header = {};
+
+    file_ = fopen(filename, "wb");
+    if (!file_) {
+        g_set_error(error, g_quark_from_static_string("focus trace"), 1,
+            "Failed to create focus trace '%s'", filename);
+        return -1;
+    }
+
+    memcpy(header.magic, FOCUS_TRACE_MAGIC, sizeof(header.magic));
+    header.version = FOCUS_TRACE_VERSION;
+    header.record_size = sizeof(FocusTraceRecord);
+    header.start_time = g_get_real_time();
+    packTuning(tuning, &header);
+
+    if (fwrite(&header, sizeof(header), 1, file_) != 1) {
+        g_set_error(error, g_quark_from_static_string("focus trace"), 2,
+            "Failed to write focus trace '%s'", filename);
+        close();
+        return -1;
+    }
+
+    g_print("Focus trace recording to %s\n", filename);
+    return 0;
+}
+
+/**
+ * Flush and close the trace. Safe to call when it was never opened.
+ */
+void FocusTrace::close() {
+    if (!file_)
+        return;
+
+    fclose(file_);
+    file_ = nullptr;
+    g_print("Focus trace closed, %" G_GUINT64_FORMAT " frames recorded\n", records_written_);
+}
+
+gboolean FocusTrace::isOpen() const {
+    return file_ != nullptr;
+}
+
+/**
+ * Append a focus frame. The write is buffered by stdio, flush pushes it out to the card.
+ *
+ * @param record : The focus frame
+ */
+void FocusTrace::record(const FocusTraceRecord& record) {
+    if (!file_)
+        return;
+
+    if (fwrite(&record, sizeof(record), 1, file_) != 1) {
+        g_print("Focus trace write failed, recording stopped\n");
+        close();
+        return;
+    }
+    ++records_written_;
+}
+
+/**
+ * Push buffered frames to the file, so a crash or power loss keeps everything up to here.
+ */
+void FocusTrace::flush() {
+    if (file_)
+        fflush(file_);
+}
+
+/**
+ * Read a whole trace file. A record cut short at the end, from a trace that was not
+ * closed, is dropped.
+ *
+ * @param filename : The trace file
+ * @param header : Filled with the trace header
+ * @param records : Filled with the focus frames
+ * @param error : Set if the file is not a trace this build can read
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusTrace::read(const gchar* filename, FocusTraceHeader* header,
+    std::vector<FocusTraceRecord>* records, GError** error) {
+    gchar* contents;
+    gsize length;
+
+    if (!g_file_get_contents(filename, &contents, &length, error))
+        return -1;
+
+    if ((length < sizeof(FocusTraceHeader)) ||
+        (memcmp(contents, FOCUS_TRACE_MAGIC, sizeof(header->magic)) != 0)) {
+        g_set_error(error, g_quark_from_static_string("focus trace"), 3,
+            "'%s' is not a focus trace", filename);
+        g_free(contents);
+        return -1;
+    }
+
+    memcpy(header, contents, sizeof(FocusTraceHeader));
+    if ((header->version != FOCUS_TRACE_VERSION) || (header->record_size != sizeof(FocusTraceRecord))) {
+        g_set_error(error, g_quark_from_static_string("focus trace"), 4,
+            "'%s' is focus trace version %u, this build reads version %d", filename,
+            header->version, FOCUS_TRACE_VERSION);
+        g_free(contents);
+        return -1;
+    }
+
+    gsize count = (length - sizeof(FocusTraceHeader)) / sizeof(FocusTraceRecord);
+    records->resize(count);
+    if (count)
+        memcpy(records->data(), contents + sizeof(FocusTraceHeader), count * sizeof(FocusTraceRecord));
+
+    g_free(contents);
+    return 0;
+}
+
+/**
+ * The tuning a trace was recorded with.
+ *
+ * @param header : The trace header
+ */
+CDAFTuning FocusTrace::headerTuning(const FocusTraceHeader& header) {
+    CDAFTuning tuning;
+
+    tuning.transitStep = header.tuning[0];
+    tuning.coarseStep = header.tuning[1];
+    tuning.detailStep = header.tuning[2];
+    tuning.driftStep = header.tuning[3];
+    tuning.coarseTimeout = header.tuning[4];
+    tuning.detailTimeout = header.tuning[5];
+    tuning.transitTimeout = header.tuning[6];
+    tuning.settleTimeout = header.tuning[7];
+    tuning.driftTimeout = header.tuning[8];
+    tuning.searchMode = header.tuning[9];
+    tuning.confirmStep = header.tuning[10];
+    tuning.scanMode = header.tuning[11];
+    tuning.sweepRate = header.tuning[12];
+    tuning.sweepLag = header.tuning[13];
+    tuning.bracketStep = header.tuning[14];
+    tuning.noiseTolerance = header.tuning[15];
+    return tuning;
+}
+
+/**
+ * Write a tuning into a trace header, the reverse of headerTuning.
+ *
+ * @param tuning : The tuning the state machine is running with
+ * @param header : The header to fill in
+ */
+void FocusTrace::packTuning(const CDAFTuning& tuning, FocusTraceHeader* header) {
+    header->tuning[0] = tuning.transitStep;
+    header->tuning[1] = tuning.coarseStep;
+    header->tuning[2] = tuning.detailStep;
+    header->tuning[3] = tuning.driftStep;
+    header->tuning[4] = tuning.coarseTimeout;
+    header->tuning[5] = tuning.detailTimeout;
+    header->tuning[6] = tuning.transitTimeout;
+    header->tuning[7] = tuning.settleTimeout;
+    header->tuning[8] = tuning.driftTimeout;
+    header->tuning[9] = tuning.searchMode;
+    header->tuning[10] = tuning.confirmStep;
+    header->tuning[11] = tuning.scanMode;
+    header->tuning[12] = tuning.sweepRate;
+    header->tuning[13] = tuning.sweepLag;
+    header->tuning[14] = tuning.bracketStep;
+    header->tuning[15] = tuning.noiseTolerance;
+}
@@ -0,0 +1,167 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "FocusWorker.h"
+
+/**
+ * Constructs a FocusWorker. The thread is not started until setup.
+ *
+ * @param process_func : Called on the worker thread for each frame. The buffer reference
+ *                       is released by the worker after it returns.
+ */
+FocusWorker::FocusWorker(std::function<void(GstBuffer*, GstVideoInfo*)> process_func) :
+process_func_(process_func), thread_(nullptr), running_(FALSE), frames_queued_(0),
+frames_dropped_(0), frames_processed_(0), max_depth_(0) {
+    g_mutex_init(&wake_mutex_);
+    g_cond_init(&wake_cond_);
+}
+
+/**
+ * Destructor for FocusWorker. Stops the thread if it is still running and logs the queue counters.
+ */
+FocusWorker::~FocusWorker() {
+    stop();
+
+    g_print("Focus worker stopped: %" G_GUINT64_FORMAT " frames queued, %" G_GUINT64_FORMAT
+        " dropped, max depth %u\n", frames_queued_.load(), frames_dropped_.load(), max_depth_.load());
+    g_cond_clear(&wake_cond_);
+    g_mutex_clear(&wake_mutex_);
+}
+
+/**
+ * Start the focus analysis thread.
+ *
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint FocusWorker::setup(GError** error) {
+    running_ = TRUE;
+    thread_ = g_thread_try_new("focus-worker", runWrapper, this, error);
+    if (!thread_) {
+        running_ = FALSE;
+        return -1; //error is set by g_thread_try_new
+    }
+    g_print("Focus worker thread started, ring of %d frames\n", FOCUS_RING_SIZE);
+    return 0;
+}
+
+/**
+ * Stop the thread and release any frames still queued. Once this returns the process function
+ * is not called again, so the owner can call it before freeing what the process function uses.
+ * Safe to call more than once.
+ */
+void FocusWorker::stop() {
+    if (thread_) {
+        g_mutex_lock(&wake_mutex_);
+        running_ = FALSE;
+        g_cond_signal(&wake_cond_);
+        g_mutex_unlock(&wake_mutex_);
+        g_thread_join(thread_);
+        thread_ = nullptr;
+    }
+
+    FocusFrame frame;
+    while (ring_.pop(frame))
+        gst_buffer_unref(frame.buffer);
+}
+
+/**
+ * Queue a focus frame for the worker. Called on the GStreamer streaming thread, so this only
+ * takes a buffer reference and never waits on the worker.
+ *
+ * @param buffer : The focus frame
+ * @param info : The video info for the caps the frame arrived with
+ *
+ * @return : FALSE if the ring was full and the frame was dropped.
+ */
+gboolean FocusWorker::queueFrame(GstBuffer* buffer, const GstVideoInfo& info) {
+    FocusFrame frame;
+    frame.buffer = gst_buffer_ref(buffer);
+    frame.info = info;
+
+    if (!ring_.push(frame)) {
+        gst_buffer_unref(frame.buffer);
+        ++frames_dropped_;
+        return FALSE;
+    }
+    ++frames_queued_;
+
+    guint depth = (guint)ring_.size();
+    guint max_depth = max_depth_.load(std::memory_order_relaxed);
+    while ((depth > max_depth) && !max_depth_.compare_exchange_weak(max_depth, depth))
+        ;
+
+    //Taking the lock before signalling means the worker cannot miss the wake up
+    g_mutex_lock(&wake_mutex_);
+    g_cond_signal(&wake_cond_);
+    g_mutex_unlock(&wake_mutex_);
+    return TRUE;
+}
+
+/**
+ * A snapshot of the queue counters. Safe from any thread.
+ */
+FocusQueueStats FocusWorker::getStats() const {
+    FocusQueueStats stats;
+    stats.frames_queued = frames_queued_.load();
+    stats.frames_dropped = frames_dropped_.load();
+    stats.frames_processed = frames_processed_.load();
+    stats.depth = (guint)ring_.size();
+    stats.max_depth = max_depth_.load();
+    return stats;
+}
+
+/**
+ * THREAD FUNCTION. This wrapper reinterprets the gpointer user_data object into usable pointer
+ * for accessing the run method in the FocusWorker class.
+ *
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this FocusWorker object
+ */
+gpointer FocusWorker::runWrapper(gpointer user_data) {
+    return reinterpret_cast<FocusWorker*>(user_data)->run(user_data);
+}
+
+/**
+ * CLASS METHOD. The worker loop. Drains the ring, then sleeps until the next frame arrives
+ * or the worker is stopped.
+ *
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this FocusWorker object
+ *
+ * @return : Always nullptr, nobody reads the thread result.
+ */
+gpointer FocusWorker::run(gpointer user_data) {
+    FocusWorker* self = static_cast<FocusWorker*>(user_data);
+    FocusFrame frame;
+
+    while (self->running_) {
+        while (self->ring_.pop(frame)) {
+            self->process_func_(frame.buffer, &frame.info);
+            gst_buffer_unref(frame.buffer);
+            ++self->frames_processed_;
+        }
+
+        g_mutex_lock(&self->wake_mutex_);
+        while (self->running_ && self->ring_.empty())
+            g_cond_wait(&self->wake_cond_, &self->wake_mutex_);
+        g_mutex_unlock(&self->wake_mutex_);
+    }
+    return nullptr;
+}
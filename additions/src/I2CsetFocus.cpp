@@ -24,10 +24,6 @@
 #include <unistd.h>
 #include <linux/i2c-dev.h>
 
-extern "C" { //smbus.h needs to be handled by a C compiler
-    #include <i2c/smbus.h>
-}
-
 #include "I2CsetFocus.h"
 #include "JetsonNanoMaps.h"
 #include "ErrorHandler.h"
@@ -38,24 +34,62 @@ extern "C" { //smbus.h needs to be handled by a C compiler
  * @param camera_id : A string identifier for the camera to be controlled through I2C.
  */
 CameraI2CDevice::CameraI2CDevice(const std::string& camera_id ) : camera_id_(camera_id),
-    camera_i2c_fd_(-1) { // Initialize file descriptor to invalid value
+    camera_i2c_fd_(-1), // Initialize file descriptor to invalid value
+    thread_(nullptr), running_(FALSE), request_(FOCUS_REQUEST_NONE), worker_error_(nullptr),
+    requested_(-1), position_(-1), requests_(0), coalesced_(0), writes_(0), ramps_(0), ramps_cut_(0),
+    failures_(0), total_time_(0), max_time_(0) {
+    g_mutex_init(&bus_mutex_);
+    g_mutex_init(&error_mutex_);
+    g_mutex_init(&wake_mutex_);
+    g_cond_init(&wake_cond_);
     g_print ("...i2c focus controller for %s\n", camera_id_.c_str());  // Log the initialization of I2C controller for the specified camera      
 }
 
 /**
- * Destructor for CameraI2CDevice. Cleans up by closing the I2C device if it's open and logs the shutdown.
+ * Destructor for CameraI2CDevice. Stops the worker, cleans up by closing the I2C device if it's open
+ * and logs the shutdown with the write statistics.
  */
 CameraI2CDevice::~CameraI2CDevice() {
     g_print("Shutting down I2C focus controller for %s\n", camera_id_.c_str());
+    if (thread_) {
+        g_mutex_lock(&wake_mutex_);
+        running_ = FALSE;
+        g_cond_signal(&wake_cond_);
+        g_mutex_unlock(&wake_mutex_);
+        g_thread_join(thread_);
+    }
+
+    I2CWriteStats stats = getStats();
+    g_print("I2C focus writes: %" G_GUINT64_FORMAT " requested, %" G_GUINT64_FORMAT " coalesced, %"
+        G_GUINT64_FORMAT " written, %" G_GUINT64_FORMAT " failed, mean %.0f us, max %" G_GINT64_FORMAT " us, %"
+        G_GUINT64_FORMAT " ramps (%" G_GUINT64_FORMAT " cut short)\n",
+        stats.requests, stats.coalesced, stats.writes, stats.failures,
+        stats.writes ? (gdouble)stats.total_time / stats.writes : 0.0, stats.max_time, stats.ramps, stats.ramps_cut);
+
     if (camera_i2c_fd_ >= 0) { 
         close(camera_i2c_fd_); // Close the file descriptor if it's valid
-
-    g_print("I2C focus controller closed"); // Confirm the I2C controller has been closed
+        g_print("I2C focus controller closed\n"); // Confirm the I2C controller has been closed
     }
+    if (worker_error_)
+        g_error_free(worker_error_);
+    g_cond_clear(&wake_cond_);
+    g_mutex_clear(&wake_mutex_);
+    g_mutex_clear(&error_mutex_);
+    g_mutex_clear(&bus_mutex_);
 }
 
 /**
- * Initializes the I2C device for the specified camera.
+ * Change the camera, or I2C device, the focus motor is on. Only before setup.
+ *
+ * @param camera_id : A device map identifier, or an I2C device path under /dev/
+ */
+void CameraI2CDevice::setCameraId(const std::string& camera_id) {
+    camera_id_ = camera_id;
+}
+
+/**
+ * Initializes the I2C device for the specified camera. The VCM slave address is bound here, once,
+ * and the write worker is started.
  *
  * @param error : Double pointer to a GError structure to allow error information to be passed in and modified.
  * @return gint : Returns 0 on success or -1 on failure, setting the error if an issue occurs.
@@ -75,13 +109,36 @@ gint CameraI2CDevice::setup(GError** error){
         return -1; // Return error if device cannot be opened
     }
 
-    g_print("I2C focus controller %s open on device %s\n", camera_id_.c_str(), camera_device.c_str());
+    if (ioctl(camera_i2c_fd_, I2C_SLAVE, FocusVcm::address) < 0) {
+        g_set_error_literal(error, g_quark_from_static_string("i2c device"), 1,
+         "ioctl(I2CSLAVE) failed in setup");
+        return -1; // Return error if setting the device address fails
+    }
+
+    guint8 bytes[VCM_MAX_MESSAGE];
+    gsize count = FocusVcm::encodeInit(bytes);
+    if ((count) && (write(camera_i2c_fd_, bytes, count) != (ssize_t)count)) {
+        g_set_error(error, g_quark_from_static_string("i2c device"), 1,
+        "I2C write failed setting up the %s focus motor", FocusVcm::name);
+        return -1; // Return error if the chip cannot be woken up
+    }
+
+    running_ = TRUE;
+    thread_ = g_thread_try_new("i2c-focus", runWrapper, this, error);
+    if (!thread_) {
+        running_ = FALSE;
+        return -1; //error is set by g_thread_try_new
+    }
+
+    g_print("I2C focus controller %s open on device %s, %s at 0x%02x\n", camera_id_.c_str(),
+        camera_device.c_str(), FocusVcm::name, FocusVcm::address);
 
     return 0;
 }
 
 /**
- * Sets the focus to a specific range on the camera's I2C device.
+ * Sets the focus to a specific range on the camera's I2C device, and waits for the write. Any
+ * queued request is dropped, as it is older than this one.
  *
  * @param range : Integer specifying the focus range value to set.
  * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
@@ -89,26 +146,212 @@ gint CameraI2CDevice::setup(GError** error){
  *  @return : -1 on error, else 0.
  */
 gint CameraI2CDevice::setFocus(int range, GError** error) {
-    __u8 byte1, byte2; // Define variables for the two parts of the I2C message
-    __s32 res;
-    unsigned int value;
+    gint result;
 
-    value = (range<<4) & 0x3ff0; // Format the range into the expected format for I2C communication
-    byte1 = (value>>8) & 0x3f;  // Extract high byte
-    byte2 = value & 0xf0;    // Extract low byte
+    g_mutex_lock(&bus_mutex_);
+    if ((request_.exchange(FOCUS_REQUEST_NONE)) != FOCUS_REQUEST_NONE)
+        ++coalesced_;
+    result = writeFocus(range, error);
+    g_mutex_unlock(&bus_mutex_);
+    requested_ = range;
+    return result;
+}
 
-    if (ioctl(camera_i2c_fd_, I2C_SLAVE, 0x0C) < 0) {
-        g_set_error_literal(error, g_quark_from_static_string("i2c device"), 1,
-         "ioctl(I2CSLAVE) failed in setFocus");
-        return -1; // Return error if setting the device address fails
+/**
+ * Hand a lens move to the write worker and return straight away. If a move is still waiting in
+ * the slot it is replaced, as the lens only needs the newest position.
+ *
+ * @param range : Integer specifying the focus range value to set.
+ * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+ *
+ *  @return : -1 if the worker could not make an earlier write, else 0.
+ */
+gint CameraI2CDevice::requestFocus(gint range, GError** error) {
+    requested_ = range;
+    return queueRequest(range, error);
+}
+
+/**
+ * Hand a ramp to the write worker and return straight away. The ramp starts from the last
+ * position asked for, or from wherever the worker has got to if it is cut short.
+ *
+ * @param range : Integer specifying the focus range value to ramp to.
+ * @param ramp_time : Set to the ms the ramp takes once the worker starts it
+ * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+ *
+ *  @return : -1 if the worker could not make an earlier write, else 0.
+ */
+gint CameraI2CDevice::requestRamp(gint range, guint* ramp_time, GError** error) {
+    *ramp_time = LensRamp::rampTime(requested_, range);
+    requested_ = range;
+    return queueRequest(range | FOCUS_REQUEST_RAMP, error);
+}
+
+/**
+ * Put a request in the latest wins slot and wake the worker. A failed write the worker has
+ * kept is reported instead.
+ *
+ * @param request : The position, with FOCUS_REQUEST_RAMP for a ramp
+ * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+ *
+ *  @return : -1 if the worker could not make an earlier write, else 0.
+ */
+gint CameraI2CDevice::queueRequest(gint request, GError** error) {
+    GError* worker_error;
+
+    g_mutex_lock(&error_mutex_);
+    worker_error = worker_error_;
+    worker_error_ = nullptr;
+    g_mutex_unlock(&error_mutex_);
+    if (worker_error) {
+        g_propagate_error(error, worker_error);
+        return -1;
     }
 
-    res = i2c_smbus_write_byte_data(camera_i2c_fd_, byte1, byte2);
-    if (res<0) {
+    ++requests_;
+    if ((request_.exchange(request)) != FOCUS_REQUEST_NONE)
+        ++coalesced_;
+
+    //Taking the lock before signalling means the worker cannot miss the wake up
+    g_mutex_lock(&wake_mutex_);
+    g_cond_signal(&wake_cond_);
+    g_mutex_unlock(&wake_mutex_);
+    return 0;
+}
+
+/**
+ * A snapshot of the write statistics. Safe from any thread.
+ */
+I2CWriteStats CameraI2CDevice::getStats() const {
+    I2CWriteStats stats;
+    stats.requests = requests_.load();
+    stats.coalesced = coalesced_.load();
+    stats.writes = writes_.load();
+    stats.ramps = ramps_.load();
+    stats.ramps_cut = ramps_cut_.load();
+    stats.failures = failures_.load();
+    stats.total_time = total_time_.load();
+    stats.max_time = max_time_.load();
+    return stats;
+}
+
+/**
+ * Write a focus position to the VCM and time the transaction.
+ *
+ * @param range : Integer specifying the focus range value to set.
+ * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+ *
+ *  @return : -1 on error, else 0.
+ */
+gint CameraI2CDevice::writeFocus(gint range, GError** error) {
+    guint8 bytes[VCM_MAX_MESSAGE]; // The I2C message in the focus motor chip's format
+    gsize count;
+    ssize_t res;
+    gint64 start, time;
+
+    count = FocusVcm::encode(range, bytes);
+
+    start = g_get_monotonic_time();
+    res = write(camera_i2c_fd_, bytes, count); // The slave address was bound in setup
+    time = g_get_monotonic_time() - start;
+
+    ++writes_;
+    total_time_ += time;
+    gint64 max_time = max_time_.load(std::memory_order_relaxed);
+    while ((time > max_time) && !max_time_.compare_exchange_weak(max_time, time))
+        ;
+
+    if (res != (ssize_t)count) {
+        ++failures_;
         g_set_error_literal(error, g_quark_from_static_string("i2c device"), 1,
         "I2C write failed in setFocus");
         return -1; // Return error if the write operation fails
     }
 
+    position_ = range;
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Write a ramp from the last position written, one position every LENS_RAMP_TICK_MS. The ticks
+ * are kept to the clock the ramp started on, so a slow write does not stretch the ramp. A newer
+ * request in the slot stops it, and the worker goes straight on to that.
+ *
+ * @param range : Integer specifying the focus range value to ramp to.
+ * @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+ *
+ *  @return : -1 on error, else 0.
+ */
+gint CameraI2CDevice::writeRamp(gint range, GError** error) {
+    gint points[LENS_RAMP_MAX_POINTS];
+    guint count = LensRamp::rampProfile(position_, range, points, LENS_RAMP_MAX_POINTS);
+    gint64 start = g_get_monotonic_time();
+
+    ++ramps_;
+    for (guint i = 0; i < count; ++i) {
+        if (i) {
+            gint64 wait = start + (gint64)i * LENS_RAMP_TICK_MS * 1000 - g_get_monotonic_time();
+            if (wait > 0)
+                g_usleep(wait);
+        }
+        if (request_ != FOCUS_REQUEST_NONE) {
+            ++ramps_cut_;
+            return 0;
+        }
+        if ((writeFocus(points[i], error)) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * THREAD FUNCTION. This wrapper reinterprets the gpointer user_data object into usable pointer
+ * for accessing the run method in the CameraI2CDevice class.
+ *
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this CameraI2CDevice object
+ */
+gpointer CameraI2CDevice::runWrapper(gpointer user_data) {
+    return reinterpret_cast<CameraI2CDevice*>(user_data)->run(user_data);
+}
+
+/**
+ * CLASS METHOD. The write worker loop. Writes or ramps to whatever is in the request slot, then sleeps until
+ * the next request arrives or the worker is stopped. A failed write is kept for the next
+ * requestFocus to report.
+ *
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this CameraI2CDevice object
+ *
+ * @return : Always nullptr, nobody reads the thread result.
+ */
+gpointer CameraI2CDevice::run(gpointer user_data) {
+    CameraI2CDevice* self = static_cast<CameraI2CDevice*>(user_data);
+    gint range;
+
+    while (self->running_) {
+        g_mutex_lock(&self->bus_mutex_);
+        range = self->request_.exchange(FOCUS_REQUEST_NONE);
+        if (range != FOCUS_REQUEST_NONE) {
+            GError* error = nullptr;
+            gint result;
+
+            if (range & FOCUS_REQUEST_RAMP)
+                result = self->writeRamp(range & ~FOCUS_REQUEST_RAMP, &error);
+            else
+                result = self->writeFocus(range, &error);
+            if (result == -1) {
+                g_mutex_lock(&self->error_mutex_);
+                if (self->worker_error_)
+                    g_error_free(self->worker_error_);
+                self->worker_error_ = error;
+                g_mutex_unlock(&self->error_mutex_);
+            }
+        }
+        g_mutex_unlock(&self->bus_mutex_);
+
+        g_mutex_lock(&self->wake_mutex_);
+        while (self->running_ && (self->request_ == FOCUS_REQUEST_NONE))
+            g_cond_wait(&self->wake_cond_, &self->wake_mutex_);
+        g_mutex_unlock(&self->wake_mutex_);
+    }
+    return nullptr;
+}
@@ -84,14 +84,19 @@ JetsonNanoDeviceMap::JetsonNanoDeviceMap() {
 }
 
 /**
- * Get the device file based on a simple identifier
+ * Get the device file based on a simple identifier. A device file path is passed straight
+ * through, for boards and carrier boards where the camera bus is not where the map has it,
+ * and for pseudo terminals such as the as7265xEmulator makes, or links to them.
  *
- * @param identifier : The identifier we need a device file for.
+ * @param identifier : The identifier we need a device file for, or an absolute device path
  * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
  *
- * @return : The device file path and name as a string.
+ * @return : The device file path and name as a string, empty on error.
  */
 std::string JetsonNanoDeviceMap::identifierToDevice(const std::string &identifier, GError** error) {
+    if (!identifier.empty() && (identifier[0] == '/'))
+        return identifier;
+
     // Look up the port string using the provided identifier
     auto it = device_map_.find(identifier);
     if (it == device_map_.end()) {
@@ -101,7 +106,7 @@ std::string JetsonNanoDeviceMap::identifierToDevice(const std::string &identifie
             1,                    // Error code
             "Device ID '%s' not available for use",  // Error message
             identifier.c_str());
-        return NULL;
+        return std::string();
     }
 
     // Use the found port string
@@ -0,0 +1,60 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+
+#include "LensRamp.h"
+
+/**
+ * How long a ramp between two positions takes. Short moves get LENS_RAMP_MIN_MS, so the lens
+ * is never pushed faster than it rings, longer ones a little more for the extra travel.
+ *
+ * @param from : Where the lens is, negative if that is not known
+ * @param to : Where the lens is going
+ *
+ * @return : ms from the first position of the ramp to the last, 0 for no move.
+ */
+guint LensRamp::rampTime(gint from, gint to) {
+    guint distance = (guint)ABS(to - from);
+
+    if ((from < 0) || (distance == 0))
+        return 0;
+    return LENS_RAMP_MIN_MS + distance / LENS_RAMP_STEPS_PER_MS;
+}
+
+/**
+ * The positions of a ramp. A move that is not known, or is too short to need one, is a single
+ * position.
+ *
+ * @param from : Where the lens is, negative if that is not known
+ * @param to : Where the lens is going
+ * @param points : Filled with the positions, one per LENS_RAMP_TICK_MS from the start of the ramp
+ * @param max_points : Size of points
+ *
+ * @return : The number of positions, the last is always to.
+ */
+guint LensRamp::rampProfile(gint from, gint to, gint* points, guint max_points) {
+    guint count = MIN(MAX(rampTime(from, to) / LENS_RAMP_TICK_MS, 1), max_points);
+
+    for (guint i = 1; i < count; ++i)
+        points[i - 1] = from + (gint)lround((to - from) * (1.0 - cos(G_PI * i / count)) / 2.0);
+    points[count - 1] = to;
+    return count;
+}
@@ -0,0 +1,384 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+
+#include "LensSettleModel.h"
+#include "cdaf.h"
+
+#define LENS_SETTLE_GROUP "LensSettle"
+#define LENS_SETTLE_NOISE_SIGMAS 3.0   //Noise band around the settled focus value, in standard deviations
+#define LENS_SETTLE_MIN_BAND 0.01      //Narrowest noise band, as a fraction of the settled focus value
+
+const guint LensSettleModel::distances[LENS_SETTLE_DISTANCES] = { 2, 5, 10, 20, 40, 80, 160, 320 };
+
+static const gchar* direction_keys[LENS_MOVE_DIRECTIONS] = { "In", "Out" };
+
+/**
+ * Constructs an uncalibrated LensSettleModel, which passes the CDAF timeouts through.
+ */
+LensSettleModel::LensSettleModel() : settle_time_(), calibrated_(FALSE) {
+}
+
+/**
+ * Read a model saved by a calibration.
+ *
+ * @param filename : The key file to read
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint LensSettleModel::load(const gchar* filename, GError** error) {
+    GKeyFile* key_file = g_key_file_new();
+    gint* values[LENS_MOVE_DIRECTIONS + 1] = {};
+    gsize length = 0;
+    gint result = -1;
+
+    if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, error))
+        goto done;
+
+    values[LENS_MOVE_DIRECTIONS] = g_key_file_get_integer_list(key_file, LENS_SETTLE_GROUP, "Distances",
+        &length, error);
+    if (!values[LENS_MOVE_DIRECTIONS])
+        goto done;
+    for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i) {
+        if ((length != LENS_SETTLE_DISTANCES) || (values[LENS_MOVE_DIRECTIONS][i] != (gint)distances[i])) {
+            g_set_error(error, g_quark_from_static_string("lens settle"), 1,
+                "'%s' was measured at other move distances, calibrate again", filename);
+            goto done;
+        }
+    }
+
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction) {
+        values[direction] = g_key_file_get_integer_list(key_file, LENS_SETTLE_GROUP, direction_keys[direction],
+            &length, error);
+        if (!values[direction])
+            goto done;
+        if (length != LENS_SETTLE_DISTANCES) {
+            g_set_error(error, g_quark_from_static_string("lens settle"), 2,
+                "'%s' has %u %s settle times, not %u", filename, (guint)length, direction_keys[direction],
+                LENS_SETTLE_DISTANCES);
+            goto done;
+        }
+    }
+
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction)
+        for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i)
+            settle_time_[direction][i] = MAX(values[direction][i], 0);
+    calibrated_ = TRUE;
+    result = 0;
+
+done:
+    for (guint i = 0; i <= LENS_MOVE_DIRECTIONS; ++i)
+        g_free(values[i]);
+    g_key_file_free(key_file);
+    return result;
+}
+
+/**
+ * Write the model to a key file, so later runs can load it instead of calibrating.
+ *
+ * @param filename : The key file to write, an existing file is replaced
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint LensSettleModel::save(const gchar* filename, GError** error) const {
+    GKeyFile* key_file = g_key_file_new();
+    gint values[LENS_SETTLE_DISTANCES];
+    gboolean saved;
+
+    for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i)
+        values[i] = distances[i];
+    g_key_file_set_integer_list(key_file, LENS_SETTLE_GROUP, "Distances", values, LENS_SETTLE_DISTANCES);
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction) {
+        for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i)
+            values[i] = settle_time_[direction][i];
+        g_key_file_set_integer_list(key_file, LENS_SETTLE_GROUP, direction_keys[direction], values,
+            LENS_SETTLE_DISTANCES);
+    }
+    g_key_file_set_comment(key_file, LENS_SETTLE_GROUP, NULL,
+        " ms for the lens to settle after a move of each distance, towards and away from the subject", NULL);
+
+    saved = g_key_file_save_to_file(key_file, filename, error);
+    g_key_file_free(key_file);
+    return saved ? 0 : -1;
+}
+
+gboolean LensSettleModel::calibrated() const {
+    return calibrated_;
+}
+
+/**
+ * Set one measured settle time. The model is only used once setCalibrated is called.
+ *
+ * @param direction : Which way the move went
+ * @param distance : Index into distances of the move length
+ * @param settle_time : ms from the move to the first settled frame
+ */
+void LensSettleModel::setSettleTime(LensMoveDirection direction, guint distance, guint settle_time) {
+    settle_time_[direction][distance] = settle_time;
+}
+
+void LensSettleModel::setCalibrated(gboolean value) {
+    calibrated_ = value;
+}
+
+/**
+ * How long a move takes to settle, interpolated between the measured distances. Moves past
+ * the longest distance take as long as it does.
+ *
+ * @param from_index : Where the lens was
+ * @param to_index : Where it was sent
+ *
+ * @return : ms before a frame exposed at to_index is sharp.
+ */
+guint LensSettleModel::settleTime(guint from_index, guint to_index) const {
+    guint distance = (to_index > from_index) ? to_index - from_index : from_index - to_index;
+    const guint* times = settle_time_[(to_index > from_index) ? LENS_MOVE_OUT : LENS_MOVE_IN];
+
+    if (distance == 0)
+        return 0;
+    if (distance <= distances[0])
+        return times[0];
+
+    for (guint i = 1; i < LENS_SETTLE_DISTANCES; ++i) {
+        if (distance <= distances[i]) {
+            gdouble fraction = (gdouble)(distance - distances[i - 1]) / (distances[i] - distances[i - 1]);
+            return (guint)lround(times[i - 1] + fraction * ((gdouble)times[i] - times[i - 1]));
+        }
+    }
+    return times[LENS_SETTLE_DISTANCES - 1];
+}
+
+/**
+ * The wait before the next focus frame after a lens move. The model only knows about moves, so
+ * when the lens is not moving, as while focus is held, the CDAF timeout paces the frames instead
+ * of asking for the next one straight away.
+ *
+ * @param timeout : The timeout the CDAF state machine asked for, used until the model is calibrated
+ * @param from_index : Where the lens was
+ * @param to_index : Where it was sent
+ *
+ * @return : ms to wait.
+ */
+guint LensSettleModel::frameWait(guint timeout, guint from_index, guint to_index) const {
+    guint wait = calibrated_ ? settleTime(from_index, to_index) : 0;
+
+    return wait ? wait : timeout;
+}
+
+/**
+ * Log the settle times, one line per move distance.
+ */
+void LensSettleModel::print() const {
+    g_print("Lens settle times, ms in/out:\n");
+    for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i)
+        g_print("  %3u steps %4u/%u\n", distances[i], settle_time_[LENS_MOVE_IN][i], settle_time_[LENS_MOVE_OUT][i]);
+}
+
+/**
+ * Constructs an idle LensSettleCalibration.
+ */
+LensSettleCalibration::LensSettleCalibration() : model_(), phase_(PHASE_IDLE), move_time_(G_MAXINT64),
+    centre_(MIN_FOCUS_INDEX), move_(0), move_start_(0), stable_frames_(0), settle_(0), value_sum_(0),
+    value_squares_(0), value_count_(0), reference_(0), band_(0), measured_(), have_() {
+}
+
+/**
+ * Start a calibration. The lens goes to the centre point first, to measure the settled focus
+ * value and its noise.
+ *
+ * @param focus_index : Where focus locked, the centre point is just off it towards the middle of the range
+ * @param next_index : Set to the first lens position, pass it to lensMoved once the lens is sent there
+ */
+void LensSettleCalibration::start(guint focus_index, guint* next_index) {
+    if (focus_index < (MIN_FOCUS_INDEX + MAX_FOCUS_INDEX) / 2)
+        centre_ = MIN(focus_index + LENS_SETTLE_SLOPE_OFFSET, MAX_FOCUS_INDEX);
+    else
+        centre_ = MAX(focus_index - LENS_SETTLE_SLOPE_OFFSET, MIN_FOCUS_INDEX);
+
+    model_ = LensSettleModel();
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction) {
+        for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i) {
+            measured_[direction][i] = 0;
+            have_[direction][i] = FALSE;
+        }
+    }
+    value_sum_ = 0;
+    value_squares_ = 0;
+    value_count_ = 0;
+    move_ = 0;
+    move_time_ = G_MAXINT64;
+    phase_ = PHASE_REFERENCE;
+    *next_index = centre_;
+    g_print("Lens settle calibration around %u\n", centre_);
+}
+
+gboolean LensSettleCalibration::running() const {
+    return phase_ != PHASE_IDLE;
+}
+
+/**
+ * The main loop has sent the lens where step or start asked. Frames exposed before this are ignored.
+ *
+ * @param move_time : When the move was made, us on the g_get_monotonic_time clock
+ */
+void LensSettleCalibration::lensMoved(gint64 move_time) {
+    move_time_ = move_time;
+}
+
+/**
+ * Take one frame. Called for every frame while the calibration runs.
+ *
+ * @param focus_value : The focus value of the frame
+ * @param frame_time : When the frame was exposed, us on the g_get_monotonic_time clock
+ * @param next_index : Set to the next lens position when a move is wanted
+ *
+ * @return : TRUE when the lens has to move to next_index. When it is FALSE and running is
+ *           also FALSE the calibration has finished.
+ */
+gboolean LensSettleCalibration::step(gfloat focus_value, gint64 frame_time, guint* next_index) {
+    gint64 move_time = move_time_;
+    gdouble offset;
+
+    if ((phase_ == PHASE_IDLE) || (frame_time < move_time))
+        return FALSE; //Exposed before the last move was made
+    offset = (frame_time - move_time) / 1000.0;
+
+    switch (phase_) {
+    case PHASE_REFERENCE:
+        if (offset < LENS_SETTLE_PARK_MS)
+            return FALSE;
+        value_sum_ += focus_value;
+        value_squares_ += (gdouble)focus_value * focus_value;
+        if (++value_count_ < LENS_SETTLE_REFERENCE_FRAMES)
+            return FALSE;
+
+        reference_ = value_sum_ / value_count_;
+        band_ = MAX(LENS_SETTLE_NOISE_SIGMAS * sqrt(MAX(value_squares_ / value_count_ - reference_ * reference_, 0.0)),
+            LENS_SETTLE_MIN_BAND * reference_);
+        g_debug("Lens settle reference %.2f, band %.2f", reference_, band_);
+        return nextMove(next_index);
+
+    case PHASE_PARK:
+        if (offset < LENS_SETTLE_PARK_MS)
+            return FALSE;
+        stable_frames_ = 0;
+        move_time_ = G_MAXINT64;
+        phase_ = PHASE_MOVE;
+        *next_index = centre_;
+        return TRUE;
+
+    case PHASE_MOVE:
+        if (fabs(focus_value - reference_) <= band_) {
+            if (stable_frames_++ == 0)
+                settle_ = offset;
+        }
+        else {
+            stable_frames_ = 0;
+        }
+
+        if ((stable_frames_ < LENS_SETTLE_STABLE_FRAMES) && (offset < LENS_SETTLE_WINDOW_MS))
+            return FALSE;
+
+        {
+            guint direction = (move_ / LENS_SETTLE_DISTANCES) % LENS_MOVE_DIRECTIONS;
+            guint distance = move_ % LENS_SETTLE_DISTANCES;
+            //Rounded down, a wait of this long still catches the frame that was exposed then
+            guint settle = (stable_frames_ >= LENS_SETTLE_STABLE_FRAMES) ? (guint)floor(settle_) : LENS_SETTLE_WINDOW_MS;
+
+            g_debug("Lens settle %s %u from %u: %u ms", direction_keys[direction], LensSettleModel::distances[distance],
+                move_start_, settle);
+            measured_[direction][distance] = MAX(measured_[direction][distance], settle);
+            have_[direction][distance] = TRUE;
+        }
+        ++move_;
+        return nextMove(next_index);
+
+    default:
+        return FALSE;
+    }
+}
+
+const LensSettleModel& LensSettleCalibration::model() const {
+    return model_;
+}
+
+/**
+ * Park the lens for the next move that fits in the focus range, or finish when there are none left.
+ *
+ * @param next_index : Set to the park position
+ *
+ * @return : TRUE when the lens has to move to next_index.
+ */
+gboolean LensSettleCalibration::nextMove(guint* next_index) {
+    for (; move_ < LENS_SETTLE_REPEATS * LENS_MOVE_DIRECTIONS * LENS_SETTLE_DISTANCES; ++move_) {
+        guint direction = (move_ / LENS_SETTLE_DISTANCES) % LENS_MOVE_DIRECTIONS;
+        gint distance = LensSettleModel::distances[move_ % LENS_SETTLE_DISTANCES];
+        gint start = (direction == LENS_MOVE_IN) ? (gint)centre_ + distance : (gint)centre_ - distance;
+
+        if ((start < MIN_FOCUS_INDEX) || (start > MAX_FOCUS_INDEX))
+            continue; //Too close to the end of the range for this distance
+
+        move_start_ = start;
+        move_time_ = G_MAXINT64;
+        phase_ = PHASE_PARK;
+        *next_index = move_start_;
+        return TRUE;
+    }
+
+    finish();
+    return FALSE;
+}
+
+/**
+ * Build the model from the measurements. A distance that did not fit in the range takes the
+ * settle time of the nearest one that did, and a direction with none takes the other direction's.
+ */
+void LensSettleCalibration::finish() {
+    guint settle[LENS_MOVE_DIRECTIONS][LENS_SETTLE_DISTANCES] = {};
+    gboolean have_direction[LENS_MOVE_DIRECTIONS] = {};
+
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction) {
+        for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i) {
+            guint nearest = i;
+
+            for (guint step = 1; (!have_[direction][nearest]) && (step < LENS_SETTLE_DISTANCES); ++step) {
+                if ((i >= step) && have_[direction][i - step])
+                    nearest = i - step;
+                else if ((i + step < LENS_SETTLE_DISTANCES) && have_[direction][i + step])
+                    nearest = i + step;
+            }
+            settle[direction][i] = measured_[direction][nearest];
+            have_direction[direction] |= have_[direction][nearest];
+        }
+    }
+
+    for (guint direction = 0; direction < LENS_MOVE_DIRECTIONS; ++direction) {
+        guint from = have_direction[direction] ? direction : (direction + 1) % LENS_MOVE_DIRECTIONS;
+
+        for (guint i = 0; i < LENS_SETTLE_DISTANCES; ++i)
+            model_.setSettleTime((LensMoveDirection)direction, i, settle[from][i]);
+    }
+
+    model_.setCalibrated(have_direction[LENS_MOVE_IN] || have_direction[LENS_MOVE_OUT]);
+    phase_ = PHASE_IDLE;
+}
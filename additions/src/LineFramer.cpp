@@ -0,0 +1,175 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "LineFramer.h"
+
+/**
+ * Constructs a LineFramer with a ring of a fixed size. This is the only allocation it makes.
+ *
+ * @param capacity : Size of the ring in bytes. Lines can be up to one byte shorter than this.
+ */
+LineFramer::LineFramer(gsize capacity) : ring_(MAX(capacity, (gsize)2)), joined_(ring_.size()),
+    start_(0), used_(0), discarding_(FALSE), read_time_(0), func_(nullptr), user_data_(nullptr) {
+
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+/**
+* This sets the function each complete line is passed to. Pass nullptr to drop lines.
+*
+* @param func : The line handling function.
+* @param user_data : Passed back to func with each line.
+*/
+void LineFramer::setConsumer(LineFunc func, gpointer user_data) {
+    func_ = func;
+    user_data_ = user_data;
+}
+
+/**
+* Gets the free space at the end of the partial line for the next read to go straight into.
+* It is always at least one byte, and can be less than the total free space when the ring wraps.
+*
+* @param write_pos : Set to where the bytes should be written.
+*
+* @return : Number of bytes that can be written there before calling commit.
+*/
+gsize LineFramer::reserve(gchar** write_pos) {
+    gsize capacity = ring_.size();
+    gsize tail = start_ + used_;
+
+    if (tail >= capacity) {
+        tail -= capacity;
+        *write_pos = &ring_[tail];
+        return start_ - tail;
+    }
+    *write_pos = &ring_[tail];
+    return capacity - tail;
+}
+
+/**
+* Takes in bytes written to the space from reserve. Each line they complete is passed on
+* before this returns.
+*
+* @param length : Number of bytes written, no more than reserve returned.
+* @param read_time : Monotonic time the bytes were read at, handed on through lineTime.
+*/
+void LineFramer::commit(gsize length, gint64 read_time) {
+    gsize capacity = ring_.size();
+
+    read_time_ = read_time;
+    stats_.bytes += length;
+    for (gsize i = 0; i < length; ++i) {
+        gsize pos = start_ + used_;
+        if (pos >= capacity)
+            pos -= capacity;
+        gchar c = ring_[pos];
+
+        if ((c == LINE_FEED) || (c == CARRIAGE_RETURN)) {
+            if (discarding_)
+                discarding_ = FALSE;
+            else if (used_ > 0)
+                dispatchLine();
+            start_ = (pos + 1 == capacity) ? 0 : pos + 1;
+            used_ = 0;
+        }
+        else if (discarding_) {
+            stats_.dropped_bytes++;
+            start_ = (pos + 1 == capacity) ? 0 : pos + 1;
+        }
+        else if (++used_ == capacity) { //No line ending anywhere in the ring
+            stats_.overflows++;
+            stats_.dropped_bytes += used_;
+            start_ = (pos + 1 == capacity) ? 0 : pos + 1;
+            used_ = 0;
+            discarding_ = TRUE;
+            g_debug("Serial line longer than %" G_GSIZE_FORMAT " bytes dropped", capacity - 1);
+        }
+    }
+
+    //Nothing is held, so the next read can use the whole ring without wrapping
+    if (used_ == 0)
+        start_ = 0;
+}
+
+/**
+* Copies bytes in and frames them, for data that has already been read somewhere else.
+*
+* @param data : The bytes to add.
+* @param length : Number of bytes.
+*/
+void LineFramer::push(const gchar* data, gsize length) {
+    while (length > 0) {
+        gchar* write_pos;
+        gsize space = MIN(reserve(&write_pos), length);
+
+        memcpy(write_pos, data, space);
+        commit(space);
+        data += space;
+        length -= space;
+    }
+}
+
+/**
+* Drops any partial line, for a port that has been closed and reopened. The counters are kept.
+*/
+void LineFramer::reset() {
+    start_ = 0;
+    used_ = 0;
+    discarding_ = FALSE;
+}
+
+/**
+* For the line function to find when the line it was passed came in. Lines that arrive in one
+* read all share its time.
+*
+* @return : The read_time given to the commit that completed the line, 0 when none was given.
+*/
+gint64 LineFramer::lineTime() const {
+    return read_time_;
+}
+
+LineFramerStats LineFramer::getStats() const {
+    return stats_;
+}
+
+/**
+* Passes the partial line on as a complete line. A line that runs over the end of the ring
+* is joined into one piece first.
+*/
+void LineFramer::dispatchLine() {
+    gsize capacity = ring_.size();
+    LineView line;
+
+    stats_.lines++;
+    if (start_ + used_ <= capacity)
+        line = LineView(&ring_[start_], used_);
+    else {
+        gsize first = capacity - start_;
+        memcpy(joined_.data(), &ring_[start_], first);
+        memcpy(joined_.data() + first, ring_.data(), used_ - first);
+        line = LineView(joined_.data(), used_);
+        stats_.wrapped++;
+    }
+
+    if (func_)
+        func_(line, user_data_);
+}
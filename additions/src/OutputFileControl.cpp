@@ -35,9 +35,11 @@
  *
  */
 OutputFileControl::OutputFileControl(const std::string& path_root, ErrorHandler* error_handler):
-    path_root_(path_root), output_file_channel_(nullptr), daily_dir_(""),
-    data_time_(""), button_triggered_(FALSE),
-    error_handler_(error_handler) {
+    error_handler_(error_handler), path_root_(path_root), data_time_(""), daily_dir_(""),
+    button_triggered_(FALSE), image_suffix_(""), output_file_channel_(nullptr),
+    log_format_(OUTPUT_LOG_TEXT), record_start_(0) {
+
+        memset(&record_, 0, sizeof(record_));
 
         g_print("...Output file controller\n");
 }
@@ -49,9 +51,12 @@ OutputFileControl::~OutputFileControl() {
     g_print("Shuting down output file controller\n");
     freeDataTime();
     freeDailyDir();
-    // Close the file
-    g_io_channel_shutdown(output_file_channel_, TRUE, NULL);
-    g_io_channel_unref(output_file_channel_);
+    // Close the files
+    if (output_file_channel_ != NULL) {
+        g_io_channel_shutdown(output_file_channel_, TRUE, NULL);
+        g_io_channel_unref(output_file_channel_);
+    }
+    spectral_log_.close();
     g_print("Output file closed\n");
 }
 
@@ -75,20 +80,32 @@ gint OutputFileControl::setup(GError** error) {
    
     file_path << daily_dir_<< next_filename.c_str();
     
-    //Needs more ERROR HANDLING work here for setup
-    // Open the file for writing. If it exists, it is truncated to 0 length.
-    output_file_channel_ = g_io_channel_new_file(file_path.str().c_str(), "w", error);
-
-    // Handle any errors
-    if (output_file_channel_ == NULL) {
-        g_set_error_literal(error, g_quark_from_static_string("Output file control"),1,
-        "Could not open an outuput file channel");
-        return -1;
+    if (log_format_ != OUTPUT_LOG_BINARY) {
+        //Needs more ERROR HANDLING work here for setup
+        // Open the file for writing. If it exists, it is truncated to 0 length.
+        output_file_channel_ = g_io_channel_new_file(file_path.str().c_str(), "w", error);
+
+        // Handle any errors
+        if (output_file_channel_ == NULL) {
+            g_set_error_literal(error, g_quark_from_static_string("Output file control"),1,
+            "Could not open an outuput file channel");
+            return -1;
+        }
     }
 
     g_print("Output file control setup... ");
 
-    g_print ("The output file is: '%s'\n", file_path.str().c_str());
+    if (log_format_ != OUTPUT_LOG_BINARY)
+        g_print ("The output file is: '%s'\n", file_path.str().c_str());
+
+    if (log_format_ != OUTPUT_LOG_TEXT) {
+        std::string log_path = file_path.str();
+        log_path.replace(log_path.size() - 4, 4, ".bin");
+
+        if (spectral_log_.open(log_path, error) == -1)
+            return -1; //Error is set
+        g_print ("The spectral log is: '%s'\n", log_path.c_str());
+    }
     return 0;
 }
 
@@ -104,6 +121,9 @@ gint OutputFileControl::writeLineToFile(const std::string& data, GError** error)
     std::size_t bytes_written = 0;
     std::string data_with_linefeed = data + static_cast<char>(LINE_FEED);
     GIOStatus status;
+
+    if (log_format_ == OUTPUT_LOG_BINARY) //Only the spectral log is kept
+        return 0;
     
     //Check if output_file_channel is empty.
     if (output_file_channel_ == NULL){
@@ -158,8 +178,9 @@ std::string OutputFileControl::getNextFilename(GError **error) {
     while ((dp = readdir(dirp)) != NULL) {
         std::string filename(dp->d_name);
 
-        // Check if the filename starts with "AS7265x_data_" and ends with ".txt"
-        if (filename.rfind("AS7265x_data_", 0) == 0 && filename.substr(filename.size() - 4) == ".txt") {
+        // Check if the filename starts with "AS7265x_data_" and ends with ".txt" or ".bin"
+        if (filename.rfind("AS7265x_data_", 0) == 0 && filename.size() > 17
+            && (filename.substr(filename.size() - 4) == ".txt" || filename.substr(filename.size() - 4) == ".bin")) {
             try {
                 // Get the number part of the filename
                 int num = std::stoi(filename.substr(13, filename.size() - 17));
@@ -196,7 +217,8 @@ std::string OutputFileControl::getNextFilename(GError **error) {
 
 /**
 * Captures the button press time for use in writing to files.
-* The OutputFileControl private class property data_time_ is set by this method.
+* The OutputFileControl private class property data_time_ is set by this method, and a new
+* spectral log record is started for the capture.
 */
 void OutputFileControl::captureDataTime() {
     std::ostringstream temp_string;    
@@ -212,6 +234,11 @@ void OutputFileControl::captureDataTime() {
         << std::setw(2) << std::setfill('0') << tm.tm_sec;
 
     data_time_ = temp_string.str();
+
+    memset(&record_, 0, sizeof(record_));
+    record_.capture_time = g_get_real_time();
+    record_start_ = g_get_monotonic_time();
+    g_strlcpy(record_.image_id, data_time_.c_str(), sizeof(record_.image_id));
 }
 
 /**
@@ -225,6 +252,48 @@ gint OutputFileControl::writeDataFileTime(GError** error) {
     return writeLineToFile(data_time_, error);
 }
 
+/**
+* Selects the files spectral data is saved to. Call before setup.
+* @param format : An OutputLogFormat
+*/
+void OutputFileControl::setLogFormat(gint format) {
+    log_format_ = CLAMP(format, OUTPUT_LOG_TEXT, OUTPUT_LOG_BINARY);
+}
+
+/**
+* The spectral log record of the current capture, for each part of the capture to fill in.
+*/
+SpectralRecord* OutputFileControl::getRecord() {
+    return &record_;
+}
+
+/**
+* Appends the record of the current capture to the spectral log, with the time since the
+* button press. Does nothing when there is no spectral log.
+* @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+* 
+* @return : -1 on error, otherwise 0.
+*/
+gint OutputFileControl::writeRecord(GError** error) {
+
+    if (!spectral_log_.isOpen())
+        return 0;
+
+    record_.reading_ms = (guint32)((g_get_monotonic_time() - record_start_) / 1000);
+    return spectral_log_.append(&record_, error);
+}
+
+/**
+* Saves the AS7265x version strings and working sensors in the spectral log header.
+* @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+* 
+* @return : -1 on error, otherwise 0.
+*/
+gint OutputFileControl::setDeviceInfo(const std::string& hardware, const std::string& software,
+    const std::string& sensors, GError** error) {
+    return spectral_log_.setDeviceInfo(hardware, software, sensors, error);
+}
+
 /**
 * The OutputFileControl private class property button_triggered_ is set by this method.
 * This allows us to track whether image capture was button activated, in which case spectral
@@ -243,10 +312,11 @@ void OutputFileControl::setButtonTriggered() {
 void OutputFileControl::getImageFileName(char* outfile) {
     std::ostringstream temp_string;
 
-    if (button_triggered_){ //Only over write original filename if button triggered
+    if ((button_triggered_) || (!image_suffix_.empty())){ //Only over write original filename if button triggered or bracketing
         button_triggered_ = FALSE; //Button triggered is a one shot deal
         std::memset(outfile, '\0', 100); //Because we know the declaration of outfile is outfile[100]
-        temp_string << daily_dir_ << data_time_ << ".jpg";
+        temp_string << getImagePath(image_suffix_);
+        image_suffix_.clear(); //So is the suffix
 
         //We now know the outfile memory space is full of nulls, so string less than 100 long
         //must be null terminated. This will work for me.
@@ -256,6 +326,23 @@ void OutputFileControl::getImageFileName(char* outfile) {
     }
 }
 
+/**
+* The name a button triggered image gets, with a suffix after the time of capture.
+* @ param suffix : Goes between the time of capture and the .jpg extension
+*/
+std::string OutputFileControl::getImagePath(const std::string& suffix) const {
+    return daily_dir_ + data_time_ + suffix + ".jpg";
+}
+
+/**
+* Sets a suffix for the next image filename, so each image of a focus bracket gets its own name
+* from the same time of capture. Like the button trigger, it only applies to one image.
+* @ param suffix : Goes between the time of capture and the .jpg extension
+*/
+void OutputFileControl::setImageSuffix(const std::string& suffix) {
+    image_suffix_ = suffix;
+}
+
 /**
 * The OutputFileControl private class property data_time_ is cleared by this method.
 */
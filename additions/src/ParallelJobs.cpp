@@ -0,0 +1,115 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "ParallelJobs.h"
+
+/**
+ * Constructs a ParallelJobs. Nothing is allocated until setup is called.
+ *
+ * @param threads : Threads to spread the jobs over, including the calling thread
+ */
+ParallelJobs::ParallelJobs(gint threads) : threads_(MAX(threads, 1)), pool_(nullptr), jobs_outstanding_(0),
+job_(nullptr) {
+    g_mutex_init(&mutex_);
+    g_cond_init(&done_cond_);
+}
+
+/**
+ * Destructor for ParallelJobs. Waits for any running workers before freeing the pool.
+ */
+ParallelJobs::~ParallelJobs() {
+    if (pool_)
+        g_thread_pool_free(pool_, FALSE, TRUE);
+    g_cond_clear(&done_cond_);
+    g_mutex_clear(&mutex_);
+}
+
+/**
+ * Start the worker threads. The calling thread runs job 0 itself, so the pool has one thread
+ * less than requested, and none at all for a single thread.
+ *
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint ParallelJobs::setup(GError** error) {
+    if ((threads_ > 1) && (!pool_)) {
+        pool_ = g_thread_pool_new(workerWrapper, this, threads_ - 1, TRUE, error);
+        if (!pool_)
+            return -1; //error is set by g_thread_pool_new
+    }
+    return 0;
+}
+
+/**
+ * CALLBACK FUNCTION. GThreadPool worker. The job number is pushed offset by one, as
+ * GThreadPool does not accept a NULL data pointer.
+ *
+ * @param data : The job number plus one
+ * @param user_data : Standard glib function parameter, used to pass a pointer to this ParallelJobs object
+ */
+void ParallelJobs::workerWrapper(gpointer data, gpointer user_data) {
+    ParallelJobs* self = static_cast<ParallelJobs*>(user_data);
+
+    (*self->job_)(GPOINTER_TO_INT(data) - 1);
+
+    g_mutex_lock(&self->mutex_);
+    if (--self->jobs_outstanding_ == 0)
+        g_cond_signal(&self->done_cond_);
+    g_mutex_unlock(&self->mutex_);
+}
+
+/**
+ * Run every job, job 0 here and the rest on the pool, and wait for them all. A job the pool
+ * refuses, or every job before setup, runs here instead. Only one run at a time.
+ *
+ * @param job : Called once with each job number, from 0 to threads - 1
+ */
+void ParallelJobs::run(const std::function<void(gint)>& job) {
+    gint pushed = 0;
+
+    job_ = &job;
+    if (pool_) {
+        g_mutex_lock(&mutex_);
+        jobs_outstanding_ = threads_ - 1;
+        g_mutex_unlock(&mutex_);
+
+        for (gint number = 1; number < threads_; ++number)
+            if (g_thread_pool_push(pool_, GINT_TO_POINTER(number + 1), nullptr))
+                ++pushed;
+            else
+                job(number); //Pool refused the job, do it here instead
+    }
+    else {
+        for (gint number = 1; number < threads_; ++number)
+            job(number);
+    }
+
+    job(0);
+
+    if (pool_) {
+        g_mutex_lock(&mutex_);
+        jobs_outstanding_ -= (threads_ - 1) - pushed;
+        while (jobs_outstanding_ > 0)
+            g_cond_wait(&done_cond_, &mutex_);
+        g_mutex_unlock(&mutex_);
+    }
+    job_ = nullptr;
+}
@@ -37,10 +37,9 @@
  */
 SerialPort::SerialPort(const std::string& port_id, guint baud, guint bits, guint stopBits,
     guint parity, guint flowControl, ErrorHandler* error_handler)
-    : port_(port_id), baud_(baud), bits_(bits), stop_bits_(stopBits),parity_(parity),
-    flow_control_(flowControl), serial_port_fd_(-1), callback_activated_(FALSE), buffer_write_pos_(nullptr),
-    in_buffer_position_(0), disable_port_lock_(FALSE), writeFunc_(nullptr), write_func_set_(FALSE),
-    error_handler_(error_handler) { 
+    : error_handler_(error_handler), reads_(0), serial_port_fd_(-1), callback_activated_(FALSE),
+    port_(port_id), baud_(baud), bits_(bits), stop_bits_(stopBits), parity_(parity),
+    flow_control_(flowControl), disable_port_lock_(FALSE) { 
 
     g_print ("...Serial port controller on %s\n", port_id.c_str());
 }
@@ -49,9 +48,28 @@ SerialPort::SerialPort(const std::string& port_id, guint baud, guint bits, guint
  * Destructor for SerialPort. Logs the shutdown process and cleans up resources.
  */
 SerialPort::~SerialPort() {
+    LineFramerStats stats = framer_.getStats();
+
     g_print("Shutting down serial port on %s\n", port_.c_str());   
     closePort();
-    g_print("Serial port closed\n");
+    g_print("Serial port closed. %" G_GUINT64_FORMAT " bytes in %" G_GUINT64_FORMAT " reads, %" G_GUINT64_FORMAT
+        " lines, %" G_GUINT64_FORMAT " overlong lines dropped\n", stats.bytes, reads_, stats.lines, stats.overflows);
+}
+
+/**
+ * Change the device the port is on. Only before setup.
+ *
+ * @param port_id : A device map identifier, or a device path such as a pseudo terminal
+ */
+void SerialPort::setDevice(const std::string& port_id) {
+    port_ = port_id;
+}
+
+/**
+ * FALSE before setup, and once the port has been closed on an error or a hang up.
+ */
+gboolean SerialPort::isOpen() const {
+    return serial_port_fd_ != (guint)-1;
 }
 
 /**
@@ -85,22 +103,35 @@ gint SerialPort::setup(GError** error) {
 
 /**
 * This sets the port incomming data handling function. This can be changed as required.
+* It is called with each line received, without the line ending.
 * 
-* @param func : The data handling function to bind as the write function.
+* @param func : The data handling function to set as the write function.
+* @param user_data : Passed back to func with each line, normally the object that handles it.
 */
-void SerialPort::setWriteFunc(std::function<void(const std::string&)> func) {
-        writeFunc_ = func;
-        write_func_set_ = TRUE;
+void SerialPort::setWriteFunc(LineFunc func, gpointer user_data) {
+        framer_.setConsumer(func, user_data);
 }
 
 /**
-* This unsets the port incomming data handling function. Incomming data will be unhandled.
-* 
-* @param func : Any dummy function, this is a work around. Ulitimately we will have a null pointer.
+* This unsets the port incomming data handling function. Incomming lines will be dropped.
+*/
+void SerialPort::unsetWriteFunc() {
+        framer_.setConsumer(nullptr, nullptr);
+}
+
+/**
+* Gets the byte, line and overflow counts of the data received so far.
 */
-void SerialPort::unsetWriteFunc(std::function<void(const std::string&)> func) {
-        writeFunc_ = nullptr;
-        write_func_set_ = FALSE;
+LineFramerStats SerialPort::getStats() const {
+    return framer_.getStats();
+}
+
+/**
+* Gets when the line being handed to the write function was read from the port, on the monotonic
+* clock. Only meaningful while the write function is running.
+*/
+gint64 SerialPort::lineTime() const {
+    return framer_.lineTime();
 }
 
 /**
@@ -144,14 +175,61 @@ gint SerialPort::sendChars(const std::string& string_to_send, GError** error) {
 }
 
 /**
-* Incommming data handling function called from listenPort.
+* This writes a batch of lines for output in one system call, each followed by a line feed. It goes
+* straight to the port, the io channel is unbuffered so nothing written by sendChars is held back.
 * 
-* @param output_chars : The string to send to the currently bound data handling function.
+* @param lines : The lines for the port to output, without line endings.
+* @param error : Pointer the nvgstcapture-1.0 error struct for error reporting
+* @return : -1 on error, otherwise the number of bytes written.
 */
-void SerialPort::writeCharsToFunc(const std::string& output_chars) {
-    if ((write_func_set_) && (!output_chars.empty())) {    
-        writeFunc_(output_chars);
+gint SerialPort::sendLines(const std::vector<const gchar*>& lines, GError** error) {
+    static const gchar line_feed = LINE_FEED;
+    std::vector<struct iovec> iov;
+    struct iovec* next;
+    gsize remaining;
+    gint bytes_written = 0;
+
+    if ((serial_port_fd_ == -1) || lines.empty()) {
+        g_set_error_literal(error, g_quark_from_static_string("serial device"),1,
+        "No lines to send, or file descriptor closed");
+        return -1;
+    }
+
+    for (const gchar* line : lines) {
+        iov.push_back({ (void*)line, strlen(line) });
+        iov.push_back({ (void*)&line_feed, 1 });
+    }
+    next = iov.data();
+    remaining = iov.size();
+
+    while (remaining > 0) {
+        ssize_t written = writev(serial_port_fd_, next, MIN(remaining, (gsize)IOV_MAX));
+
+        if (written == -1) {
+            struct pollfd out = { (gint)serial_port_fd_, POLLOUT, 0 };
+
+            //The port is non blocking, so wait for room in the transmit buffer
+            if ((errno == EINTR) || ((errno == EAGAIN) && (poll(&out, 1, SERIAL_WRITE_TIMEOUT_MS) == 1)
+                && (out.revents & POLLOUT)))
+                continue;
+            g_set_error(error, g_quark_from_static_string("serial device"),1,
+                "Write to serial device '%s' failed: %s", port_.c_str(), g_strerror(errno));
+            return -1;
+        }
+
+        bytes_written += written;
+        while ((remaining > 0) && ((gsize)written >= next->iov_len)) { //Skip what went out in full
+            written -= next->iov_len;
+            ++next;
+            --remaining;
+        }
+        if (remaining > 0) {
+            next->iov_base = (gchar*)next->iov_base + written;
+            next->iov_len -= written;
+        }
     }
+
+    return bytes_written;
 }
 
 /**
@@ -180,37 +258,47 @@ gboolean SerialPort::listenPortStatic(GIOChannel* src_io_channel, GIOCondition c
 gboolean SerialPort::listenPort(GIOChannel* src_io_channel, GIOCondition cond, gpointer data) {
     SerialPort* self = static_cast<SerialPort*>(data);
     gsize len = 0;
-    gsize buffer_size;
-    gchar last_char;
+    gsize space;
+    gchar* write_pos;
     GError* error = nullptr;
+    gboolean first_read = TRUE;
 
-    self->buffer_.resize(BUFFER_SIZE);
-    buffer_size = self->buffer_.size() - self->in_buffer_position_;
-
-    GIOStatus read_outcome = g_io_channel_read_chars(src_io_channel, self->buffer_.data() + self->in_buffer_position_, buffer_size, &len, &error);
-
-    if (read_outcome == G_IO_STATUS_ERROR){
-        //Assume error is set
-        self->error_handler_->errorHandler(&error);
-
-        return FALSE; //KILL THIS OFF HERE AS WE WILL EXIT ON ERROR
-    }
+    //Read straight into the framer. Keep going while a read fills the space it was given,
+    //as that space can stop short at the end of the ring with more data waiting.
+    do {
+        space = self->framer_.reserve(&write_pos);
+        GIOStatus read_outcome = g_io_channel_read_chars(src_io_channel, write_pos, space, &len, &error);
+        gint64 read_time = g_get_monotonic_time(); //Before any line of it is handled
 
-    if(len > 0) {
-        self->in_buffer_position_ += len;
+        if (read_outcome == G_IO_STATUS_ERROR){
+            //Assume error is set
+            self->error_handler_->errorHandler(&error);
 
-        last_char = self->buffer_[self->in_buffer_position_ - 1];
+            return FALSE; //KILL THIS OFF HERE AS WE WILL EXIT ON ERROR
+        }
 
-        if ((last_char == LINE_FEED) || (last_char == CARRIAGE_RETURN)) { //Trim off the line feed here
-            std::string buffer_to_string(buffer_.begin(), buffer_.begin() + (self->in_buffer_position_ - 1));
+        if (len == 0) {
+            //With VMIN and VTIME at 0 a read with nothing waiting returns 0, which GLib reports as EOF,
+            //so that alone is just the end of the data. The device has only gone, a USB adapter unplugged
+            //or the other end of a pseudo terminal closed, when the watch says so or the read it fired
+            //for had nothing at all. The port would read as ready forever, so close it rather than spin
+            //the main loop.
+            if ((cond & G_IO_HUP) || ((read_outcome == G_IO_STATUS_EOF) && first_read)) {
+                g_set_error(&error, g_quark_from_static_string("serial device"), 1, "Serial device '%s' hung up",
+                    self->port_.c_str());
+                self->closePort();
+                self->error_handler_->errorHandler(&error);
+                return FALSE;
+            }
+            break;
+        }
 
-            writeCharsToFunc(buffer_to_string.c_str()); //These are the reply functions in amsAS7265x.cpp
-            //Handle write errors there.
+        self->reads_++;
+        self->framer_.commit(len, read_time); //Calls the reply functions in amsAS7265x.cpp for each line
+        //Handle write errors there.
+        first_read = FALSE;
+    } while (len == space);
 
-            self->buffer_.clear();
-            self->in_buffer_position_ = 0;
-        }   
-    } 
     return TRUE; //ALWAYS RETRUN TRUE TO KEEP THIS ALIVE
 }
 
@@ -415,11 +503,14 @@ gint SerialPort::configurePort(GError** error) {
 
     if (static_channel)
     {
-        
+        //Reads go straight from the port into the line framer, not through a channel buffer
+        g_io_channel_set_buffered(static_channel, FALSE);
+        framer_.reset();
+
 
         callback_handler_in_ = g_io_add_watch_full(static_channel,
                         G_PRIORITY_HIGH,
-                        G_IO_IN,
+                        (GIOCondition)(G_IO_IN | G_IO_HUP),
                         (GIOFunc)SerialPort::listenPortStatic,
                         this, nullptr);
 
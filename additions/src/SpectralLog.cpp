@@ -0,0 +1,235 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SpectralLog.h"
+
+#define SPECTRAL_LOG_QUARK g_quark_from_static_string("Spectral log")
+
+SpectralLog::SpectralLog(): fd_(-1), path_(""), records_(0) {
+
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, SPECTRAL_LOG_MAGIC, sizeof(header_.magic));
+    header_.version = SPECTRAL_LOG_VERSION;
+    header_.header_size = sizeof(SpectralLogHeader);
+    header_.record_size = sizeof(SpectralRecord);
+    header_.channels = AS7265X_CHANNELS;
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        header_.wavelength[i] = AS7265xParse::wavelength[i];
+}
+
+SpectralLog::~SpectralLog() {
+    close();
+}
+
+/**
+ * Creates the log and writes its header. An existing file at the path is truncated, as
+ * the text output file is.
+ *
+ * @param path : Where to create the log
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint SpectralLog::open(const std::string& path, GError** error) {
+
+    close();
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664);
+    if (fd_ < 0) {
+        g_set_error(error, SPECTRAL_LOG_QUARK, 1, "Could not create spectral log '%s': %s",
+            path.c_str(), g_strerror(errno));
+        return -1;
+    }
+    path_ = path;
+    records_ = 0;
+
+    if (writeAt(&header_, sizeof(header_), 0, error) == -1) {
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Records the version strings and working sensors the AS7265x reported in the header. They are
+ * only known once the handshake is done, after the log was created.
+ *
+ * @param hardware : ATVERHW reply
+ * @param software : ATVERSW reply
+ * @param sensors : ATPRES reply
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint SpectralLog::setDeviceInfo(const std::string& hardware, const std::string& software, const std::string& sensors,
+    GError** error) {
+
+    g_strlcpy(header_.hardware_version, hardware.c_str(), sizeof(header_.hardware_version));
+    g_strlcpy(header_.software_version, software.c_str(), sizeof(header_.software_version));
+    g_strlcpy(header_.sensors, sensors.c_str(), sizeof(header_.sensors));
+    if (fd_ < 0)
+        return 0; //Goes out with the header when the log is opened
+
+    return writeAt(&header_, sizeof(header_), 0, error);
+}
+
+/**
+ * Appends a record to the log. Its sequence is set to its place in the log.
+ *
+ * @param record : The capture to append
+ * @param error : Pointer to the nvgstcapture-1.0 error struct for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint SpectralLog::append(SpectralRecord* record, GError** error) {
+
+    if (fd_ < 0) {
+        g_set_error_literal(error, SPECTRAL_LOG_QUARK, 1, "The spectral log is not open");
+        return -1;
+    }
+
+    record->sequence = records_;
+    off_t offset = (off_t)sizeof(SpectralLogHeader) + (off_t)records_ * sizeof(SpectralRecord);
+    if (writeAt(record, sizeof(SpectralRecord), offset, error) == -1)
+        return -1;
+
+    records_++;
+    return 0;
+}
+
+gboolean SpectralLog::isOpen() const {
+    return fd_ >= 0;
+}
+
+void SpectralLog::close() {
+    if (fd_ < 0)
+        return;
+
+    ::close(fd_);
+    fd_ = -1;
+    g_debug("Spectral log '%s' closed with %u records", path_.c_str(), records_);
+}
+
+/**
+ * Writes the whole of a block at an offset, so a record is never left half written by
+ * a short write.
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint SpectralLog::writeAt(const void* data, gsize size, off_t offset, GError** error) {
+    const guint8* next = static_cast<const guint8*>(data);
+
+    while (size > 0) {
+        ssize_t written = pwrite(fd_, next, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            g_set_error(error, SPECTRAL_LOG_QUARK, 2, "Could not write spectral log '%s': %s",
+                path_.c_str(), g_strerror(errno));
+            return -1;
+        }
+        next += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+SpectralLogView::SpectralLogView(): data_(nullptr), size_(0), count_(0) {
+}
+
+SpectralLogView::~SpectralLogView() {
+    close();
+}
+
+/**
+ * Maps a spectral log. A record still being written when the log is mapped is left out.
+ *
+ * @param path : The log to read
+ * @param error : Pointer to a GError for error reporting
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint SpectralLogView::open(const std::string& path, GError** error) {
+    struct stat st;
+
+    close();
+    gint fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error(error, SPECTRAL_LOG_QUARK, 1, "Could not open spectral log '%s': %s",
+            path.c_str(), g_strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SpectralLogHeader)) {
+        g_set_error(error, SPECTRAL_LOG_QUARK, 3, "'%s' is too short to be a spectral log", path.c_str());
+        ::close(fd);
+        return -1;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); //The mapping keeps the file
+    if (map == MAP_FAILED) {
+        g_set_error(error, SPECTRAL_LOG_QUARK, 1, "Could not map spectral log '%s': %s",
+            path.c_str(), g_strerror(errno));
+        return -1;
+    }
+    data_ = static_cast<const guint8*>(map);
+    size_ = st.st_size;
+
+    const SpectralLogHeader& head = header();
+    if (memcmp(head.magic, SPECTRAL_LOG_MAGIC, sizeof(head.magic)) != 0
+        || head.version != SPECTRAL_LOG_VERSION || head.channels != AS7265X_CHANNELS
+        || head.header_size < sizeof(SpectralLogHeader) || head.record_size < sizeof(SpectralRecord)
+        || head.header_size > size_ || head.header_size % 8 != 0 || head.record_size % 8 != 0) {
+        g_set_error(error, SPECTRAL_LOG_QUARK, 3, "'%s' is not a version %d spectral log",
+            path.c_str(), SPECTRAL_LOG_VERSION);
+        close();
+        return -1;
+    }
+    count_ = (size_ - head.header_size) / head.record_size;
+    return 0;
+}
+
+void SpectralLogView::close() {
+    if (data_ != nullptr)
+        munmap(const_cast<guint8*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    count_ = 0;
+}
+
+const SpectralLogHeader& SpectralLogView::header() const {
+    return *reinterpret_cast<const SpectralLogHeader*>(data_);
+}
+
+gsize SpectralLogView::count() const {
+    return count_;
+}
+
+const SpectralRecord& SpectralLogView::record(gsize index) const {
+    const SpectralLogHeader& head = header();
+    return *reinterpret_cast<const SpectralRecord*>(data_ + head.header_size + index * head.record_size);
+}
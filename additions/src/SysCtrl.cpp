@@ -83,6 +83,8 @@ gint SysCtrl::setup(GError** error) {
 
     gboolean errorDuringSetup = FALSE;
 
+    if (additions_parent_->getSettings().spectral_device)
+        usb0_serial_port_.setDevice(additions_parent_->getSettings().spectral_device);
     if (!errorDuringSetup)
         errorDuringSetup = ((usb0_serial_port_.setup(error)) == -1);
     if (!errorDuringSetup)
@@ -107,6 +109,11 @@ gint SysCtrl::setup(GError** error) {
  * object is already created.
  */
 void SysCtrl::run_ams7265xHandshake() {
+    const AdditionsSettings& settings = additions_parent_->getSettings();
+
+    as7265x_unit_.setAcquisition(settings.spectral_integration, MAX(settings.spectral_burst_samples, 0));
+    if (as7265x_unit_.burstEnabled() && AS7265X_BURST_START_MS + as7265x_unit_.burstTime() > SYSCTRL_LIGHTS_OUT_MS)
+        g_print("AS7265x burst runs past the flash, use fewer readings or a shorter integration\n");
     as7265x_unit_.getHandshakeData();
 }
 
@@ -207,13 +214,21 @@ void SysCtrl::GPIO_InputPinChange() {
     additions_parent_->af_iface_.setFocusLock();
     output_file_control_->setButtonTriggered();
     output_file_control_->captureDataTime();
+    { //The lens is held where it is for the capture
+        SpectralRecord* record = output_file_control_->getRecord();
+
+        record->focus_index = (gint32)additions_parent_->af_iface_.getLensIndex();
+        record->focus_value = additions_parent_->af_iface_.getFocussedValue();
+        record->flags |= SPECTRAL_HAS_FOCUS;
+    }
 
-    g_timeout_add_full(G_PRIORITY_DEFAULT, 3800, GPIO_LightsOutWrapper, this, nullptr);
+    g_timeout_add_full(G_PRIORITY_DEFAULT, SYSCTRL_LIGHTS_OUT_MS, GPIO_LightsOutWrapper, this, nullptr);
     g_timeout_add_full(G_PRIORITY_DEFAULT, 4000, GPIO_AmbientOnWrapper, this, nullptr);
-    g_timeout_add_full(G_PRIORITY_DEFAULT, 4000, additions_parent_->af_iface_.releaseFocusLockWrapper,
-        &additions_parent_->af_iface_, nullptr);
+    additions_parent_->af_iface_.releaseFocusLockAfter(4000);
     g_timeout_add_full(G_PRIORITY_DEFAULT, 200, GPIO_FlashOnWrapper, this, nullptr);
-    g_timeout_add_full(G_PRIORITY_DEFAULT, 3600, as7265x_unit_.getAS7265xDataWrapper,
-    &as7265x_unit_, nullptr);
+    g_timeout_add_full(G_PRIORITY_DEFAULT, as7265x_unit_.burstEnabled() ? AS7265X_BURST_START_MS : 3600,
+        as7265x_unit_.getAS7265xDataWrapper, &as7265x_unit_, nullptr); //A burst starts once the flash is settled
     g_timeout_add_full(G_PRIORITY_DEFAULT, 100, GPIO_LightsOutWrapper, this, nullptr); 
+    if (additions_parent_->af_iface_.focusBracketEnabled()) //Captured while the flash is on
+        additions_parent_->af_iface_.startFocusBracketAfter(300);
 }
\ No newline at end of file
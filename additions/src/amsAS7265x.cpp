@@ -22,6 +22,18 @@
 #include "commands.h"
 #include "ErrorHandler.h"
 
+/* The text of a reply, without the OK the device ends it with. */
+static std::string replyText(LineView line)
+{
+    gsize size = line.size();
+
+    if ((size >= 2) && (line[size - 2] == 'O') && (line[size - 1] == 'K'))
+        size -= 2;
+    while ((size > 0) && (line[size - 1] == ' '))
+        size--;
+    return std::string(line.data(), size);
+}
+
 /**
  * Constructs an AS7265xUnit object configured with specified interfaces for communication and error handling.
  *
@@ -30,10 +42,19 @@
  * @param error_handler : Pointer to an ErrorHandler object for managing error conditions.
  */
 AS7265xUnit::AS7265xUnit(SerialPort* serial_port, OutputFileControl* file_to_write, ErrorHandler* error_handler) :
-    sequence_no_(0), 
     serial_port_(serial_port), 
     output_file_(file_to_write),
-    error_handler_(error_handler)  {
+    error_handler_(error_handler),
+    command_queue_(serial_port),
+    integration_(AS7265X_DEFAULT_INTEGRATION),
+    burst_samples_(0),
+    measure_mode_(-1),
+    burst_first_time_(0),
+    burst_last_time_(0),
+    burst_unparsed_(0),
+    raw_valid_(FALSE),
+    hardware_version_(""),
+    software_version_("")  {
     
     g_print ("...AS7265x communications controller\n");
 }
@@ -46,12 +67,54 @@ AS7265xUnit::~AS7265xUnit(){
     g_print("Nothing to do here\n"); // Indicates no explicit cleanup required (e.g., no dynamic memory allocation)
 };
 
+/**
+ * Sets how readings are taken. Call before the handshake, which sends the integration time.
+ *
+ * @param integration : ATINTTIME setting, 1 to 255 steps of 2.8 ms.
+ * @param burst_samples : Readings to stream and average on each capture, up to 255. 0 takes one
+ * ATDATA and ATCDATA reading as before.
+ */
+void AS7265xUnit::setAcquisition(guint integration, guint burst_samples) {
+    integration_ = CLAMP(integration, 1, 255);
+    burst_samples_ = MIN(burst_samples, 255);
+    if (burst_samples_ > 0)
+        g_print("AS7265x burst of %u readings at %.1f ms integration, about %u ms a capture\n",
+            burst_samples_, integration_ * AS7265X_INTEGRATION_STEP_US / 1000.0, burstTime());
+}
+
+gboolean AS7265xUnit::burstEnabled() const {
+    return burst_samples_ > 0;
+}
+
+/**
+ * Expected length of a burst. Each continuous reading takes two integrations, one for each bank of
+ * channels, and the line then takes AS7265X_READING_BYTES at 10 bits a byte to send.
+ *
+ * @return : The time in ms from sending ATBURST to the last reading.
+ */
+guint AS7265xUnit::burstTime() const {
+    guint reading_us = 2 * integration_ * AS7265X_INTEGRATION_STEP_US;
+    guint transfer_us = (guint)((guint64)AS7265X_READING_BYTES * 10 * G_USEC_PER_SEC / AS7265X_BAUD);
+
+    return (burst_samples_ * MAX(reading_us, transfer_us) + transfer_us) / 1000;
+}
+
+/**
+ * Copies the running mean and variance of the current or last burst. Safe to call from any thread,
+ * it never waits on the readings coming in.
+ *
+ * @param spectrum : Filled with the statistics, in wavelength order.
+ */
+void AS7265xUnit::getSpectrum(AS7265xSpectrum* spectrum) const {
+    burst_.snapshot(spectrum);
+}
+
 /**
  * Retrieves handshake data from the AS7265x device. This function abstracts the interaction process and manages errors.
  * This is a void function becuase there is no way to get a complete handshake before
  * the function returns. Any error will result in shutdown anyway.
  * 
- * @return gboolean : Always returns FALSE indicating a one-time operation per invocation.
+ * The whole handshake is written in one go, and the replies are handled as they come back.
  */
 
 void AS7265xUnit::getHandshakeData() {
@@ -60,9 +123,19 @@ void AS7265xUnit::getHandshakeData() {
     g_print("Setting up AS7265x communications controller\n");
     g_print("Running handshake with AS7265x device...\n");
     
+    command_queue_.submit(AT_ACK, AS7265X_ACK, 1, replyWrapper, this);
+    command_queue_.submit(AT_HARDWARE_VERSION, AS7265X_HARDWARE_VERSION, 0, replyWrapper, this);
+    command_queue_.submit(AT_SOFTWARE_VERSION, AS7265X_SOFTWARE_VERSION, 0, replyWrapper, this);
+    command_queue_.submit(AT_SENSORS_PRESENT, AS7265X_SENSORS_PRESENT, 0, replyWrapper, this);
+    if (burstEnabled()) //To put back after each burst
+        command_queue_.submit(AT_MEASURE_MODE, AS7265X_MEASURE_MODE, 1, replyWrapper, this);
+    command_queue_.submit(AT_SET_GAIN, AS7265X_SET_GAIN, 1, replyWrapper, this);
+    command_queue_.submit((AT_INTEGRATION_TIME "=" + std::to_string(integration_)).c_str(),
+        AS7265X_SET_INTEGRATION_TIME, 1, replyWrapper, this);
+
     //If there is an error in the handshake we'll let the error handler pick it up
-    runHandshake(&error); // Starts the handshake process, passing the error pointer
-    
+    if (command_queue_.flush(&error) == -1)
+        error_handler_->errorHandler(&error);
 }
 
 /**
@@ -77,316 +150,319 @@ gboolean AS7265xUnit::getAS7265xDataWrapper(gpointer user_data){
 
 /**
  * Retrieves data from the AS7265x device. This function abstracts the interaction process and manages errors.
+ * All five commands of a reading are written back to back, so a reading takes about one measurement
+ * plus the time to send the replies, not a round trip for each command.
+ *
+ * In burst mode the device is switched to continuous measurement and streams burst_samples_ calibrated
+ * readings instead. Each is added to a running mean and variance as it arrives, and the averaged
+ * spectrum is written once the burst ends.
  *
  * @return gboolean : Always returns FALSE indicating a one-time operation per invocation.
  */
 gboolean AS7265xUnit::getAS7265xData(void)
 {
     GError* error = nullptr;
-    runData(&error);
+
+    command_queue_.submit(AT_SENSOR_TEMP, AS7265X_SENSOR_TEMP, AS7265X_DEVICES, replyWrapper, this);
+    command_queue_.submit(AT_GAIN, AS7265X_GAIN, 1, replyWrapper, this);
+    command_queue_.submit(AT_INTEGRATION_TIME, AS7265X_INTEGRATION_TIME, 1, replyWrapper, this);
+    if (burstEnabled()) {
+        guint reading_ms = 2 * integration_ * AS7265X_INTEGRATION_STEP_US / 1000;
+
+        command_queue_.submit((AT_SET_MEASURE_MODE + std::to_string(AS7265X_MODE_CONTINUOUS)).c_str(),
+            AS7265X_SET_MEASURE_MODE, 1, replyWrapper, this);
+        command_queue_.submitStream((AT_BURST + std::to_string(burst_samples_)).c_str(), AS7265X_BURST,
+            AS7265X_CHANNELS, replyWrapper, this, AT_COMMAND_TIMEOUT_MS + 2 * reading_ms);
+        if (measure_mode_ >= 0)
+            command_queue_.submit((AT_SET_MEASURE_MODE + std::to_string(measure_mode_)).c_str(),
+                AS7265X_RESTORE_MEASURE_MODE, 1, replyWrapper, this);
+    }
+    else {
+        command_queue_.submit(AT_DATA, AS7265X_DATA, AS7265X_CHANNELS, replyWrapper, this, AS7265X_DATA_TIMEOUT_MS);
+        command_queue_.submit(AT_CALIBRATED_DATA, AS7265X_CALIBRATED_DATA, AS7265X_CHANNELS, replyWrapper, this);
+    }
+
+    if (command_queue_.flush(&error) == -1)
+        error_handler_->errorHandler(&error);
 
     return FALSE;
 }
 
 /**
- * Splits a given string by a delimiter and returns the result as a vector of strings.
+ * CALLBACK FUNCTION. Called by the command queue with the reply to each command. This wrapper reinterprets
+ * the gpointer user_data object into usable pointer for accessing the reply method.
  *
- * @param s : The string to split.
- * @param delimiter : The character used as a delimiter to split the string.
- * @return std::vector<std::string> : A vector containing the split strings.
+ * @param reply : The reply, with the tag of the command it answers.
+ * @param user_data : Pointer to this AS7265xUnit object
  */
-std::vector<std::string> AS7265xUnit::split(const std::string& s, char delimiter)
+void AS7265xUnit::replyWrapper(const ATReply& reply, gpointer user_data)
 {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-    while (std::getline(tokenStream, token, delimiter))
-    {
-        tokens.push_back(token);
-    }
-    return tokens;
+    static_cast<AS7265xUnit*>(user_data)->reply(reply);
 }
 
 /**
- * Conducts a multi-step handshake procedure with the AS7265x device, handling different commands in sequence.
+ * CLASS METHOD. Handles the reply to a handshake or data command. A command that failed after all its
+ * retries, or a reply that can not be saved, goes to the error handler.
  *
- * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
+ * @param reply : The reply, with the tag of the command it answers.
  */
-void AS7265xUnit::runHandshake(GError** error)
+void AS7265xUnit::reply(const ATReply& reply)
 {
-    std::string command;
-
-    switch (sequence_no_)
-    {
-        case 0:
-            command = AT_ACK;       
-            serial_port_->setWriteFunc(std::bind(&AS7265xUnit::handshakeReply, this, std::placeholders::_1));
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;
-            break;
-
-        case 1:
-            command = AT_HARDWARE_VERSION;
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;
-            break;
-        
-        case 2:
-            command = AT_SOFTWARE_VERSION;
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;
-            break;
-
-        case 3:
-            command = AT_SENSORS_PRESENT;
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;            
-            break;
-
-        case 4:
-            command = AT_SET_GAIN;
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;            
-            break;
-
-        case 5:
-            command = AT_SET_INTEGRATION_TIME;
-            if ((serial_port_->sendChars(command.c_str(), error)) == -1)
-                goto error;
-            break;
-
-        case 9:
-            goto error;
+    GError* error = nullptr;
+    gint ret_val;
+
+    if (reply.status != AT_REPLY_OK) {
+        g_set_error(&error, g_quark_from_static_string("AS7265x"), 1, "AS7265x command %u %s after %u tries",
+            reply.tag, (reply.status == AT_REPLY_TIMEOUT) ? "got no answer" : "got a bad answer", reply.tries);
+        raw_valid_ = FALSE;
+        burst_first_time_ = 0; //A cut short burst is not written, the next one starts afresh
+        burst_unparsed_ = 0;
+        error_handler_->errorHandler(&error);
+        return;
     }
 
-    return;
-
-    error:
-
-    error_handler_->errorHandler(error);
+    if (reply.tag <= AS7265X_SET_INTEGRATION_TIME)
+        ret_val = handshakeReply(reply, &error);
+    else
+        ret_val = dataReply(reply, &error);
 
+    if (ret_val == -1)
+        error_handler_->errorHandler(&error);
 }
 
 /**
- * Conducts a multi-step data retrieval procedure with the AS7265x device, handling different commands in sequence.
+ * Saves the reply to a handshake command.
  *
+ * @param reply : The reply, with the tag of the command it answers.
  * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
- */
-void AS7265xUnit::runData(GError** error)
-{
-    switch (sequence_no_)
-    {
-        case 0:
-            serial_port_->setWriteFunc(std::bind(&AS7265xUnit::dataReply, this, std::placeholders::_1));
-            if ((serial_port_->sendChars(AT_SENSOR_TEMP, error)) == -1)
-                goto error;          
-            break;
-    
-        case 1:
-            if ((serial_port_->sendChars(AT_GAIN, error)) == -1)
-                goto error;         
-            break;
-    
-        case 2:
-            if ((serial_port_->sendChars(AT_INTEGRATION_TIME, error)) == -1)
-                goto error;           
-            break;
-        
-        case 3:
-            if ((serial_port_->sendChars(AT_DATA, error)) == -1)
-                goto error;         
-            break;
-
-        case 4:
-            if ((serial_port_->sendChars(AT_CALIBRATED_DATA, error)) == -1)
-                goto error;       
-            break;
-
-        case 9: goto error;
-
-    }
-
-    return;
-
-    error:
-
-    error_handler_->errorHandler(error);
-}
-
-/**
- * Conducts a multi-step handshake procedure with the AS7265x device, handling different commands in sequence.
  *
- * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
+ * @return : -1 on error, otherwise 0.
  */
-void AS7265xUnit::handshakeReply(const std::string& output_data)
-{   GError* error = nullptr;
+gint AS7265xUnit::handshakeReply(const ATReply& reply, GError** error)
+{
+    LineView output_data = reply.line;
     std::ostringstream temp_data;   
     
-    g_print("%s\n", output_data.c_str());
-    switch(sequence_no_)
+    g_print("%.*s\n", (gint)output_data.size(), output_data.data());
+    switch(reply.tag)
     {
-        case 0:            
-            temp_data << output_data.substr(0, output_data.size());
-            sequence_no_++;
-            runHandshake(&error);
-            break;
-    
-        case 1:            
-            temp_data << "AS7265x Hardware Version," << output_data.substr(0, output_data.size());
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            sequence_no_++;
-            runHandshake(&error);
+        case AS7265X_HARDWARE_VERSION:
+            hardware_version_ = replyText(output_data);
+            temp_data << "AS7265x Hardware Version," << output_data;
             break;
 
-        case 2:
-            temp_data << "AS7265x Sofware Version," << output_data.substr(0, output_data.size());
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            sequence_no_++;
-            runHandshake(&error);
+        case AS7265X_SOFTWARE_VERSION:
+            software_version_ = replyText(output_data);
+            temp_data << "AS7265x Sofware Version," << output_data;
             break;
 
-        case 3:      
-            temp_data << "Sensors working," << output_data.substr(0, output_data.size() );
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            sequence_no_++;
-            runHandshake(&error);            
+        case AS7265X_SENSORS_PRESENT: //Last of the device details
+            if (output_file_->setDeviceInfo(hardware_version_, software_version_, replyText(output_data), error) == -1)
+                return -1;
+            temp_data << "Sensors working," << output_data;
             break;
-        case 4: //This is reply to ATGAIN=X command. Only receive an OK - nothing to save                
-            sequence_no_++;
-            runHandshake(&error);           
-            break;
-        case 5:  //This is reply to ATINTTIME=X command. Only receive an OK - nothing to save    
-            sequence_no_=0; //Reset sequence for next shot
-            serial_port_->unsetWriteFunc(std::bind(&AS7265xUnit::handshakeReply, this, std::placeholders::_1));
 
-            //This will add a blank line at the end.
-            if (output_file_->writeLineToFile("\n", &error) == -1)
-                goto error;
-            break;
+        case AS7265X_MEASURE_MODE: //Nothing to save, kept to put back after each burst
+            measure_mode_ = (gint)g_ascii_strtoll(std::string(output_data.data(), output_data.size()).c_str(), nullptr, 10);
+            return 0;
+
+        case AS7265X_SET_INTEGRATION_TIME: //Last of the handshake. This will add a blank line at the end.
+            return output_file_->writeLineToFile("\n", error);
+
+        default: //AT, ATGAIN=X and ATINTTIME=X only receive an OK - nothing to save
+            return 0;
     }
 
-    return;
-    
-    error:
-    sequence_no_= 9; //Use this number to deal with errors
-    serial_port_->unsetWriteFunc(std::bind(&AS7265xUnit::handshakeReply, this, std::placeholders::_1));
-    runHandshake(&error);
+    return output_file_->writeLineToFile(temp_data.str(), error);
 }
 
 /**
- * Conducts a multi-step command sequence with the AS7265x to acquire spectral readings from the device.
+ * Saves the reply to a data command. The channel table is written once the calibrated data is in.
  *
+ * @param reply : The reply, with the tag of the command it answers.
  * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
+ *
+ * @return : -1 on error, otherwise 0.
  */
-void AS7265xUnit::dataReply (const std::string& output_data)
+gint AS7265xUnit::dataReply(const ATReply& reply, GError** error)
 {
+    LineView output_data = reply.line;
     std::ostringstream temp_data;
-    GError* error = nullptr;
 
-    switch(sequence_no_)
+    switch(reply.tag)
     {
-        case 0:
+        case AS7265X_SENSOR_TEMP:
         {
             int temp_sensor = 1;
-            std::istringstream ss(output_data);
+            std::istringstream ss(std::string(output_data.data(), output_data.size()));
             std::string token;
+            SpectralRecord* record = output_file_->getRecord();
 
             //Start each new entry with the file time
-            if (output_file_->writeDataFileTime(&error) == -1)
-                goto error;
+            if (output_file_->writeDataFileTime(error) == -1)
+                return -1;
 
             //This writes each temperature sensor value to a new line in the file
             while (std::getline(ss, token, ',')) {
 
                 std::ostringstream oss;
                 oss << "Temp Sensor " << temp_sensor << "," << token;
-                if (output_file_->writeLineToFile(oss.str(), &error) == -1){
-                    goto error;
-                    break;
-                }
+                if (output_file_->writeLineToFile(oss.str(), error) == -1)
+                    return -1;
+                if (temp_sensor <= SPECTRAL_LOG_DEVICES)
+                    record->temperature[temp_sensor - 1] = (gfloat)g_ascii_strtod(token.c_str(), nullptr);
                 temp_sensor++;
             }
-
-            sequence_no_++;
-            runData(&error);
-            break;
+            record->flags |= SPECTRAL_HAS_TEMPERATURE;
+            return 0;
         }
         
-        case 1:
-        {
+        case AS7265X_GAIN:
+            output_file_->getRecord()->gain = (guint16)g_ascii_strtoll(replyText(output_data).c_str(), nullptr, 10);
             temp_data << "Sensor Gain," << output_data.substr(0, output_data.size() - 2);
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            sequence_no_++;
-            runData(&error);
-            break;
-        }
+            return output_file_->writeLineToFile(temp_data.str(), error);
         
-        case 2:
+        case AS7265X_INTEGRATION_TIME:
         {
+            SpectralRecord* record = output_file_->getRecord();
+
+            record->integration = (guint16)g_ascii_strtoll(replyText(output_data).c_str(), nullptr, 10);
+            record->flags |= SPECTRAL_HAS_SETTINGS; //Gain is answered first
             temp_data << "Sensor Integration Time," << output_data.substr(0, output_data.size() - 2);
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            sequence_no_++;
-            runData(&error);
-            break;
+            return output_file_->writeLineToFile(temp_data.str(), error);
         }
     
-        case 3:
-        {
-            temp_data << "Channel, Raw Data, Calibrated Data";
-            if (output_file_->writeLineToFile(temp_data.str(), &error) == -1)
-                goto error;
-            raw_tokens_ = split(output_data, ',');
-            sequence_no_++;
-            runData(&error);
-            break;
-        }    
+        case AS7265X_DATA:
+            raw_valid_ = AS7265xParse::parseRaw(output_data, &raw_);
+            return output_file_->writeLineToFile("Channel, Raw Data, Calibrated Data", error);
 
-        case 4:
+        case AS7265X_CALIBRATED_DATA:
         {
-            gboolean error_detected = FALSE;
-            
-            calibrated_tokens_ = split(output_data, ',');
-            serial_port_->unsetWriteFunc(std::bind(&AS7265xUnit::dataReply, this, std::placeholders::_1));
-            sequence_no_= 0;
-
-            //Organise and write out the channel data in order
-            for (gint i = 0; i < order_.size(); ++i) {
-                gint index = order_[i];
-                temp_data << channels_[index] << "," << raw_tokens_[index] << "," << calibrated_tokens_[index];
-                if ((output_file_->writeLineToFile(temp_data.str(), &error)) == -1){
-                    error_detected = TRUE;
-                    break;
-                }
-                temp_data.str(""); //Clear the temp buffer for re-use
+            AS7265xCalibrated calibrated;
+            gchar line[64];
+            SpectralRecord* record = output_file_->getRecord();
+
+            if (!raw_valid_ || !AS7265xParse::parseCalibrated(output_data, &calibrated)) {
+                g_set_error(error, g_quark_from_static_string("AS7265x"), 1,
+                    "AS7265x reading is not %d %s channels", AS7265X_CHANNELS, raw_valid_ ? "calibrated" : "raw");
+                raw_valid_ = FALSE;
+                return -1;
             }
-
-            raw_tokens_.clear();
-            calibrated_tokens_.clear();
-
-            if (!error_detected){//Clear buffers for next time
-               if ((output_file_->writeLineToFile(temp_data.str(), &error)) == -1) //Add blank line below data readout
-                goto error;
+            raw_valid_ = FALSE;
+            g_debug("AS7265x reading took %.0f ms", reply.latency / 1000.0);
+
+            //Both readings are already in wavelength order
+            for (gsize i = 0; i < AS7265X_CHANNELS; ++i) {
+                g_snprintf(line, sizeof(line), "%u,%u,%.7g", AS7265xParse::wavelength[i], raw_[i], calibrated[i]);
+                if ((output_file_->writeLineToFile(line, error)) == -1)
+                    return -1;
             }
-            else
-                goto error;
 
-            break;
+            //Add blank line below data readout
+            if (output_file_->writeLineToFile("", error) == -1)
+                return -1;
 
-            /*Channel order: 9, 11, 13, 14, 15, 16, 7, 8, 10, 12, 17, 18, 1, 2, 3, 4, 5, 6
-            * Channel order indexes: 8, 10, 12, 13, 14, 15, 6, 7, 9, 11, 16, 17, 0, 1, 2, 3, 4, 5
-            * Channel labels: 610, 680, 730, 760, 810, 860, 560, 585, 645, 705, 900, 940, 410, 435, 460, 485, 510, 535*/
+            std::copy(raw_.begin(), raw_.end(), record->raw);
+            std::copy(calibrated.begin(), calibrated.end(), record->calibrated);
+            record->flags |= SPECTRAL_HAS_RAW | SPECTRAL_HAS_CALIBRATED;
+            return output_file_->writeRecord(error);
         }
+
+        case AS7265X_BURST:
+            return burstReply(reply, error);
+
+        default: //ATTCSMD=X only receives an OK - nothing to save
+            return 0;
+    }
+}
+
+/**
+ * Handles a line of a burst. Each reading is added to the running statistics as it arrives, timed
+ * from when it was read from the port. The first line of a burst starts them again, and the last
+ * writes them out. A line that does not parse is counted and left out.
+ *
+ * @param reply : A streamed line of the burst, or its closing OK.
+ * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint AS7265xUnit::burstReply(const ATReply& reply, GError** error)
+{
+    AS7265xCalibrated values;
+
+    if (burst_first_time_ == 0)
+        burst_.reset();
+
+    if (AS7265xParse::parseCalibrated(reply.line, &values)) {
+        burst_.add(values.data());
+        if (burst_first_time_ == 0)
+            burst_first_time_ = reply.time;
+        burst_last_time_ = reply.time;
+    }
+    else if (reply.line != "OK") { //An OK on its own only ends the burst
+        burst_unparsed_++;
+        g_debug("AS7265x burst line not parsed: %.*s", (gint)reply.line.size(), reply.line.data());
     }
 
-    return;
+    return reply.more ? 0 : writeBurst(error);
+}
 
-    error:
-    sequence_no_= 9; //I'll use this number to deal with an error
-    serial_port_->unsetWriteFunc(std::bind(&AS7265xUnit::dataReply, this, std::placeholders::_1));
-    runData(&error);
-}
\ No newline at end of file
+/**
+ * Writes the averaged spectrum of a finished burst in wavelength order, with the spread of each channel
+ * and how fast the readings came in.
+ *
+ * @param error : Pointer to a GError pointer, allowing error information to be updated and passed back.
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint AS7265xUnit::writeBurst(GError** error)
+{
+    AS7265xSpectrum spectrum;
+    std::ostringstream temp_data;
+    SpectralRecord* record = output_file_->getRecord();
+    gdouble elapsed = (burst_last_time_ - burst_first_time_) / (gdouble)G_USEC_PER_SEC;
+    gdouble rate;
+    guint unparsed = burst_unparsed_;
+
+    burst_.snapshot(&spectrum);
+    burst_first_time_ = 0;
+    burst_unparsed_ = 0;
+    if (spectrum.count == 0) {
+        g_set_error(error, g_quark_from_static_string("AS7265x"), 1, "AS7265x burst ended with no readings, %u lines not parsed",
+            unparsed);
+        return -1;
+    }
+
+    //Readings after the first, over the time between the first and the last
+    rate = (elapsed > 0.0) ? (spectrum.count - 1) / elapsed : 0.0;
+    g_print("AS7265x burst: %" G_GUINT64_FORMAT " readings, %u lines not parsed, %.2f readings/s at %.1f ms integration\n",
+        spectrum.count, unparsed, rate, integration_ * AS7265X_INTEGRATION_STEP_US / 1000.0);
+
+    temp_data << "Burst Readings," << spectrum.count;
+    if (output_file_->writeLineToFile(temp_data.str(), error) == -1)
+        return -1;
+    temp_data.str("");
+    temp_data << "Burst Rate," << rate;
+    if (output_file_->writeLineToFile(temp_data.str(), error) == -1)
+        return -1;
+    if (output_file_->writeLineToFile("Channel, Calibrated Mean, Calibrated SD, Standard Error", error) == -1)
+        return -1;
+
+    for (gsize i = 0; i < AS7265X_CHANNELS; ++i) {
+        temp_data.str("");
+        temp_data << AS7265xParse::wavelength[i] << "," << spectrum.mean[i] << "," << std::sqrt(spectrum.variance[i])
+            << "," << spectrum.standardError(i);
+        if (output_file_->writeLineToFile(temp_data.str(), error) == -1)
+            return -1;
+        record->calibrated[i] = (gfloat)spectrum.mean[i];
+        record->calibrated_sd[i] = (gfloat)std::sqrt(spectrum.variance[i]);
+    }
+
+    if (output_file_->writeLineToFile("", error) == -1) //Add blank line below data readout
+        return -1;
+
+    record->burst_samples = (guint32)spectrum.count;
+    record->burst_rate = (gfloat)rate;
+    record->flags |= SPECTRAL_HAS_CALIBRATED | SPECTRAL_HAS_BURST;
+    return output_file_->writeRecord(error);
+}
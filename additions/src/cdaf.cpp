@@ -18,12 +18,86 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
-#include <algorithm> // for std::max_element and std::min_element
 #include <cmath>
 
 #include "cdaf.h"
-#include "AdditionsForAF.h"
+#include "FocusInterface.h"
 #include "ErrorHandler.h"
+#include "FocusTrace.h"
+
+/* The states hold no data of their own, everything they work on lives in CDAF, so one
+* instance of each is shared by every CDAF and a transition is just a table lookup.
+*/
+static TransitState transit_state;
+static StartScanFocusInState start_scan_focus_in_state;
+static ScanFocusInState scan_focus_in_state;
+static StartScanFocusOutState start_scan_focus_out_state;
+static ScanFocusOutState scan_focus_out_state;
+static StartDetailScanState start_detail_scan_state;
+static DetailScanState detail_scan_state;
+static SetFocusState set_focus_state;
+static GrabFocusValueState grab_focus_value_state;
+static StartDriftScanningState start_drift_scanning_state;
+static ConfirmDriftDirectionState confirm_drift_direction_state;
+static DriftScanForPeakState drift_scan_for_peak_state;
+static StartConfirmPeakState start_confirm_peak_state;
+static ConfirmPeakState confirm_peak_state;
+static StartSweepState start_sweep_state;
+static SweepState sweep_state;
+static StartBracketScanState start_bracket_scan_state;
+static BracketScanState bracket_scan_state;
+static GoldenSectionState golden_section_state;
+static WarmStartState warm_start_state;
+
+static FocusState* const focus_states[FOCUS_STATE_COUNT] = {
+    &transit_state,
+    &start_scan_focus_in_state,
+    &scan_focus_in_state,
+    &start_scan_focus_out_state,
+    &scan_focus_out_state,
+    &start_detail_scan_state,
+    &detail_scan_state,
+    &set_focus_state,
+    &grab_focus_value_state,
+    &start_drift_scanning_state,
+    &confirm_drift_direction_state,
+    &drift_scan_for_peak_state,
+    &start_confirm_peak_state,
+    &confirm_peak_state,
+    &start_sweep_state,
+    &sweep_state,
+    &start_bracket_scan_state,
+    &bracket_scan_state,
+    &golden_section_state,
+    &warm_start_state,
+};
+
+#define STATE_BIT(id) (1u << (id))
+
+/* The states each state is allowed to change to, indexed by FocusStateId. */
+static const guint32 focus_transitions[FOCUS_STATE_COUNT] = {
+    STATE_BIT(FOCUS_STATE_START_DETAIL_SCAN) | STATE_BIT(FOCUS_STATE_START_SCAN_FOCUS_IN) | STATE_BIT(FOCUS_STATE_START_SWEEP) |
+        STATE_BIT(FOCUS_STATE_START_BRACKET_SCAN), //Transit
+    STATE_BIT(FOCUS_STATE_SCAN_FOCUS_IN), //StartScanFocusIn
+    STATE_BIT(FOCUS_STATE_START_SCAN_FOCUS_OUT), //ScanFocusIn
+    STATE_BIT(FOCUS_STATE_SCAN_FOCUS_OUT), //StartScanFocusOut
+    STATE_BIT(FOCUS_STATE_TRANSIT) | STATE_BIT(FOCUS_STATE_START_CONFIRM_PEAK), //ScanFocusOut
+    STATE_BIT(FOCUS_STATE_DETAIL_SCAN), //StartDetailScan
+    STATE_BIT(FOCUS_STATE_SET_FOCUS), //DetailScan
+    STATE_BIT(FOCUS_STATE_GRAB_FOCUS_VALUE) | STATE_BIT(FOCUS_STATE_TRANSIT) | STATE_BIT(FOCUS_STATE_START_DETAIL_SCAN), //SetFocus
+    STATE_BIT(FOCUS_STATE_START_DRIFT_SCANNING), //GrabFocusValue
+    STATE_BIT(FOCUS_STATE_CONFIRM_DRIFT_DIRECTION), //StartDriftScanning
+    STATE_BIT(FOCUS_STATE_DRIFT_SCAN_FOR_PEAK) | STATE_BIT(FOCUS_STATE_TRANSIT), //ConfirmDriftDirection
+    STATE_BIT(FOCUS_STATE_TRANSIT) | STATE_BIT(FOCUS_STATE_GRAB_FOCUS_VALUE), //DriftScanForPeak
+    STATE_BIT(FOCUS_STATE_CONFIRM_PEAK), //StartConfirmPeak
+    STATE_BIT(FOCUS_STATE_GRAB_FOCUS_VALUE) | STATE_BIT(FOCUS_STATE_START_DETAIL_SCAN), //ConfirmPeak
+    STATE_BIT(FOCUS_STATE_SWEEP), //StartSweep
+    STATE_BIT(FOCUS_STATE_START_DETAIL_SCAN) | STATE_BIT(FOCUS_STATE_START_CONFIRM_PEAK), //Sweep
+    STATE_BIT(FOCUS_STATE_BRACKET_SCAN), //StartBracketScan
+    STATE_BIT(FOCUS_STATE_GOLDEN_SECTION) | STATE_BIT(FOCUS_STATE_START_SCAN_FOCUS_IN), //BracketScan
+    STATE_BIT(FOCUS_STATE_GRAB_FOCUS_VALUE), //GoldenSection
+    STATE_BIT(FOCUS_STATE_GRAB_FOCUS_VALUE) | STATE_BIT(FOCUS_STATE_START_DETAIL_SCAN), //WarmStart
+};
 
 /**
  * Constructs a CDAF object associated with a specific camera. This class
@@ -31,16 +105,27 @@
  *
  * @param * AF_interface : Pointer to the overhead AF_Interface object
  * @param * error_handler : Pointer to the application's error_handler object
+ * @param tuning : Lens steps and focus frame timeouts, the hand tuned defaults unless given
  */
-CDAF::CDAF(AF_Additions* AF_interface, ErrorHandler* error_handler) : 
+CDAF::CDAF(FocusInterface* AF_interface, ErrorHandler* error_handler, const CDAFTuning& tuning) : 
+    tuning(tuning),
+    frameTime(0),
+    focusIndex(280),
+    transitToDetail(FALSE),
+    movingFocusIn(TRUE),
+    transitTo(MAX_FOCUS_INDEX),
+    chaseFocus(0), peakEstimate(0), sweepStart(0),
+    golden(), warmIndex(0), warmValue(0), warmProbe(0), warmStarting(FALSE),
     my_AF_interface_(AF_interface),
     error_handler_(error_handler),
+    currentState_(&transit_state),
     i2c_focus_controller_("camera-0"),
-    currentState_(new TransitState()),
-    transitTo(MAX_FOCUS_INDEX),
-    transitToDetail(FALSE),
-    focusIndex(280), chaseFocus(0), movingFocusIn(TRUE) {
+    trace_(nullptr), scanning_(FALSE), frame_timeout_(0), locked_(FALSE), sweeping_(FALSE),
+    ramp_pending_(FALSE), ramp_time_(0),
+    state_stats_(), state_entered_(g_get_monotonic_time()), acquisition_frames_(0), acquisition_start_(0) {
 
+    g_mutex_init(&stats_mutex_);
+    state_stats_[FOCUS_STATE_TRANSIT].entries = 1;
     g_print ("...autofocus CDAF control algorithm\n"); 
 }
 
@@ -48,8 +133,14 @@ CDAF::CDAF(AF_Additions* AF_interface, ErrorHandler* error_handler) :
  * Destructor for CDAF. Cleans up by closing the I2C device if it's open and logs the shutdown.
  */
 CDAF::~CDAF(){
-    if(currentState_) 
-            delete currentState_;
+    for (gint id = 0; id < FOCUS_STATE_COUNT; ++id) {
+        FocusStateStats stats = getStateStats((FocusStateId)id);
+        if (stats.frames)
+            g_print("CDAF %s: %" G_GUINT64_FORMAT " entries, %" G_GUINT64_FORMAT " frames, %.1f s, %"
+                G_GUINT64_FORMAT " scan samples dropped\n", stateName((FocusStateId)id), stats.entries, stats.frames,
+                stats.time / 1e6, stats.dropped);
+    }
+    g_mutex_clear(&stats_mutex_);
      g_print("CDAF autofocus algorithm shutdown...\n");
 }
 
@@ -65,6 +156,15 @@ gint CDAF::setup(GError** error){
     return i2c_focus_controller_.setup(error);
 }
 
+/**
+ * Put the focus motor on another camera or I2C bus than camera-0. Only before setup.
+ *
+ * @param camera_id : A device map identifier, or an I2C device path under /dev/
+ */
+void CDAF::setFocusDevice(const gchar* camera_id) {
+    i2c_focus_controller_.setCameraId(camera_id);
+}
+
 /**
  * Calls the i2c focus interface to set the camera to the focus point in focus_index.
  *
@@ -79,9 +179,14 @@ gint CDAF::setFocus(guint focus_index, GError** error) {
 
 /**
  * This runs the focusAchieved method of the AF_Interface class
- * to signal that focus has been achieved.
+ * to signal that focus has been achieved. Frames and time from the start of the search
+ * are logged the same way for every scan mode, so they can be compared on the camera.
  */
 void CDAF::focusAchieved(){
+    g_print("CDAF focus locked at %u, %u frames in %.1f s\n", focusIndex, acquisition_frames_,
+        (frameTime - acquisition_start_) / 1e6);
+    acquisition_frames_ = 0;
+    locked_ = TRUE;
     my_AF_interface_->focusAchieved();
 }
 
@@ -92,65 +197,442 @@ void CDAF::focusAchieved(){
  * @param timeout : How long to wait between grabbing focus frames.
  */
 void CDAF::setScanning(gboolean value, guint timeout){
+    scanning_ = value;
+    frame_timeout_ = timeout;
     my_AF_interface_->setScanning(value, timeout);
 }
 
+/**
+ * Tell the AF_Interface a sweep has started or finished. While it is sweeping, the interface
+ * lets every frame through and moves the lens to sweepPosition on its own clock.
+ *
+ * @param value : TRUE while the lens should follow the sweep
+ */
+void CDAF::setSweeping(gboolean value){
+    sweeping_ = value;
+    my_AF_interface_->setSweeping(value);
+}
+
+/**
+ * TRUE while the lens is following a sweep. Safe to call from any thread.
+ */
+gboolean CDAF::sweeping() const {
+    return sweeping_;
+}
+
+/**
+ * Where the sweep has the lens at a moment in time. It starts at MAX_FOCUS_INDEX at
+ * sweepStart and moves in at tuning.sweepRate until it reaches MIN_FOCUS_INDEX.
+ *
+ * @param time : us on the g_get_monotonic_time clock, the same clock as frameTime
+ */
+guint CDAF::sweepPosition(gint64 time) const {
+    if (time <= sweepStart)
+        return MAX_FOCUS_INDEX;
+
+    gint64 travel = (time - sweepStart) * tuning.sweepRate / G_USEC_PER_SEC;
+    return (travel >= MAX_FOCUS_INDEX - MIN_FOCUS_INDEX) ? MIN_FOCUS_INDEX : MAX_FOCUS_INDEX - (guint)travel;
+}
+
+/**
+ * Where the lens was for a frame about to be stepped. That is focusIndex, unless the lens
+ * was moving along a sweep when the frame was exposed.
+ *
+ * @param frame_time : When the frame was exposed, us on the g_get_monotonic_time clock
+ */
+guint CDAF::frameIndex(gint64 frame_time) const {
+    if (!sweeping_)
+        return focusIndex;
+    return sweepPosition(frame_time - (gint64)tuning.sweepLag * 1000);
+}
+
+/**
+ * Record every step of the state machine to a focus trace. The trace is owned by the
+ * caller and must outlive the state machine, or be detached by passing nullptr.
+ *
+ * @param trace : An open FocusTrace, or nullptr to stop recording
+ */
+void CDAF::setTrace(FocusTrace* trace){
+    trace_ = trace;
+}
+
+/**
+ * The current state, for traces and the CDAF simulator.
+ */
+FocusStateId CDAF::stateId() const {
+    return currentState_->id();
+}
+
+/**
+ * The name of the current state, for logging and the CDAF simulator.
+ */
+const gchar* CDAF::stateName() const {
+    return stateName(currentState_->id());
+}
+
+/**
+ * The name of a state, as used in the CHANGING STATE TO messages.
+ *
+ * @param id : The state
+ */
+const gchar* CDAF::stateName(FocusStateId id) {
+    static const gchar* names[FOCUS_STATE_COUNT] = {
+        "Transit",
+        "StartScanFocusIn",
+        "ScanFocusIn",
+        "StartScanFocusOut",
+        "ScanFocusOut",
+        "StartDetailScan",
+        "DetailScan",
+        "SetFocus",
+        "GrabFocusValue",
+        "StartDriftScanning",
+        "ConfirmDriftDirection",
+        "DriftScanForPeak",
+        "StartConfirmPeak",
+        "ConfirmPeak",
+        "StartSweep",
+        "Sweep",
+        "StartBracketScan",
+        "BracketScan",
+        "GoldenSection",
+        "WarmStart",
+    };
+
+    return ((id >= 0) && (id < FOCUS_STATE_COUNT)) ? names[id] : "Unknown";
+}
+
+/**
+ * The name of a FocusScanMode, for logging and the tools.
+ *
+ * @param mode : A FocusScanMode
+ */
+const gchar* CDAF::scanModeName(guint mode) {
+    static const gchar* names[FOCUS_SCAN_COUNT] = {
+        "stepped scan",
+        "sweep",
+        "golden section",
+    };
+
+    return (mode < FOCUS_SCAN_COUNT) ? names[mode] : "unknown";
+}
+
 /***runFocus Finite State Machine beneath this line**********/
 
+#define FIT_HALF_WIDTH 2 //Coarse points either side of the best one that go into the curve fit
+#define CONFIRM_TOLERANCE 0.05 //How much sharper a check frame has to be to reject the estimate
+#define GOLDEN_RATIO 0.618034  //Each golden section step keeps this much of the bracket
+#define WARM_START_MATCH 0.1   //As the AF_Additions drift check, a warm start frame this close to the remembered value is in focus
+#define WARM_START_MIN_PEAK 0.5 //A warm start detail scan peak below this much of the remembered value is not the subject
+
+/**
+* Fit a curve to the coarse scan points around the best one and return its peak. The scans
+* in and out visit the same lens positions, so the two values at each position are averaged
+* first. A Gaussian is fitted as a least squares parabola through the log of the values,
+* or a plain parabola if any value is not positive.
+*
+* @param cdaf : The state machine, with both coarse scans in scanIn and scanOut
+* @param peak : Set to the estimated peak focus index
+*
+* @return : FALSE when the best point is at the end of the range or the fit has no
+* maximum between the outer points, so the detail scan has to find the peak instead.
+*/
+static gboolean fitCoarsePeak(const CDAF& cdaf, gdouble* peak) {
+    const FocusScanBuffer& scan = cdaf.scanIn;
+    guint count = scan.size();
+    guint best = 0;
+    gdouble best_value = 0;
+    gdouble x[2 * FIT_HALF_WIDTH + 1], y[2 * FIT_HALF_WIDTH + 1];
+    gboolean positive = TRUE;
+
+    auto averaged = [&cdaf, &scan](guint position) {
+        for (guint i = 0; i < cdaf.scanOut.size(); ++i)
+            if (cdaf.scanOut.index(i) == scan.index(position))
+                return (scan.value(position) + cdaf.scanOut.value(i)) / 2.0;
+        return (gdouble)scan.value(position);
+    };
+
+    for (guint i = 0; i < count; ++i) {
+        gdouble value = averaged(i);
+        if ((i == 0) || (value > best_value)) {
+            best = i;
+            best_value = value;
+        }
+    }
+    if ((best < FIT_HALF_WIDTH) || (best + FIT_HALF_WIDTH >= count))
+        return FALSE;
+
+    for (gint i = 0; i <= 2 * FIT_HALF_WIDTH; ++i) {
+        //Centred on the best point so the normal equations stay well conditioned
+        x[i] = (gdouble)scan.index(best - FIT_HALF_WIDTH + i) - scan.index(best);
+        y[i] = averaged(best - FIT_HALF_WIDTH + i);
+        positive = positive && (y[i] > 0);
+    }
+    for (gint i = 0; positive && (i <= 2 * FIT_HALF_WIDTH); ++i)
+        y[i] = log(y[i]);
+
+    //Least squares y = a x^2 + b x + c, from the normal equations by Cramer's rule
+    gdouble s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0, t0 = 0, t1 = 0, t2 = 0;
+    for (gint i = 0; i <= 2 * FIT_HALF_WIDTH; ++i) {
+        gdouble xx = x[i] * x[i];
+        s0 += 1; s1 += x[i]; s2 += xx; s3 += xx * x[i]; s4 += xx * xx;
+        t0 += y[i]; t1 += x[i] * y[i]; t2 += xx * y[i];
+    }
+    gdouble det = s4 * (s2 * s0 - s1 * s1) - s3 * (s3 * s0 - s1 * s2) + s2 * (s3 * s1 - s2 * s2);
+    if (fabs(det) < 1e-12)
+        return FALSE;
+    gdouble a = (t2 * (s2 * s0 - s1 * s1) - s3 * (t1 * s0 - s1 * t0) + s2 * (t1 * s1 - s2 * t0)) / det;
+    gdouble b = (s4 * (t1 * s0 - s1 * t0) - t2 * (s3 * s0 - s1 * s2) + s2 * (s3 * t0 - t1 * s2)) / det;
+
+    if (a >= 0)
+        return FALSE; //No maximum
+    gdouble vertex = -b / (2 * a);
+    if ((vertex < MIN(x[0], x[2 * FIT_HALF_WIDTH])) || (vertex > MAX(x[0], x[2 * FIT_HALF_WIDTH])))
+        return FALSE;
+
+    *peak = CLAMP(scan.index(best) + vertex, (gdouble)MIN_FOCUS_INDEX, (gdouble)MAX_FOCUS_INDEX);
+    return TRUE;
+}
+
+/**
+* With the curve fit search turned on, fit the coarse points and send the lens straight to
+* the estimate, the settle timeout covering the long lens move.
+*
+* @param cdaf : The state machine, at the end of its coarse scans
+*
+* @return : FALSE when the curve fit is off or failed, and the detail scan has to find the peak.
+*/
+static gboolean startCurveFitPeak(CDAF& cdaf) {
+    gdouble estimate;
+
+    if ((cdaf.tuning.searchMode != FOCUS_SEARCH_CURVE_FIT) || (!fitCoarsePeak(cdaf, &estimate)))
+        return FALSE;
+
+    g_debug("Curve fit peak at %.1f", estimate);
+    cdaf.peakEstimate = (guint)lround(estimate);
+    cdaf.focusIndex = cdaf.peakEstimate;
+    cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout);
+    /*CHANGE STATE HERE StartConfirmPeakState */
+    cdaf.changeState(FOCUS_STATE_START_CONFIRM_PEAK);
+    return TRUE;
+}
+
 /**
 * Sets the currentState pointer as a critical function of the runFocus 
-* Finite State Machine.
+* Finite State Machine. Changes that are not in the transition table are
+* warned about, as they mean a state has been edited without the table.
 * 
 * @param newState : The state to switch the state machine to.
 */
-void CDAF::changeState(FocusState* newState) {
-    delete currentState_;
-    currentState_ = newState;
-    g_print("AF CHANGED STATE\n");
+void CDAF::changeState(FocusStateId newState) {
+    FocusStateId oldState = currentState_->id();
+    gint64 now = g_get_monotonic_time();
+
+    if (!(focus_transitions[oldState] & STATE_BIT(newState)))
+        g_warning("CDAF transition %s to %s is not in the table", stateName(oldState), stateName(newState));
+
+    //getStateStats reads the current state under the lock, so it changes with the stats
+    g_mutex_lock(&stats_mutex_);
+    state_stats_[oldState].time += now - state_entered_;
+    state_stats_[newState].entries++;
+    state_entered_ = now;
+    currentState_ = focus_states[newState];
+    g_mutex_unlock(&stats_mutex_);
+
+    g_debug("CDAF changed state to %s", stateName(newState));
+}
+
+/**
+* Time, frames and dropped scan samples of a state since the state machine started. Safe to call
+* from any thread, the time includes the current visit if it is the current state.
+*
+* @param id : The state
+*/
+FocusStateStats CDAF::getStateStats(FocusStateId id) const {
+    FocusStateStats stats;
+
+    g_mutex_lock(&stats_mutex_);
+    stats = state_stats_[id];
+    if (currentState_->id() == id)
+        stats.time += g_get_monotonic_time() - state_entered_;
+    g_mutex_unlock(&stats_mutex_);
+    return stats;
 }
 
 /**
 * Entry point to run the runFocus statemachine. This uses the currentState_ property
-* to point to the active state machine class.
+* to point to the active state machine class, then moves the lens.
 *
 * @param focus_value : The most recently acquired focus value from the laPlacian algorithm.
 */
 void CDAF::runFocus(gfloat focus_value) {
-    GError* error = nullptr;
+    stepFocus(focus_value, g_get_monotonic_time());
+    applyFocus(focusIndex);
+}
+
+/**
+* Run one step of the state machine without touching the lens. The AF focus worker thread
+* calls this, and hands the new focusIndex to the main loop for applyFocus.
+*
+* @param focus_value : The most recently acquired focus value from the laPlacian algorithm.
+* @param frame_time : When the frame was exposed, us on the g_get_monotonic_time clock
+*/
+void CDAF::stepFocus(gfloat focus_value, gint64 frame_time) {
+    FocusStateId state = currentState_->id();
+
+    frameTime = frame_time;
+    focusIndex = frameIndex(frame_time); //States always see the lens position of their frame
+    if (acquisition_frames_++ == 0)
+        acquisition_start_ = frame_time;
+
+    guint frame_index = focusIndex;
+    guint64 dropped = scanIn.dropped() + scanOut.dropped();
+
     focusValue = focus_value; //Give the focus machine the latest focus value to work with
+    locked_ = FALSE;
     currentState_->runFocus(*this);
-    if ((i2c_focus_controller_.setFocus(focusIndex, &error)) == -1)
+
+    dropped = scanIn.dropped() + scanOut.dropped() - dropped;
+    if (dropped && (state_stats_[state].dropped == 0))
+        g_print("CDAF %s scan is past %u samples, the rest are dropped\n", stateName(state), FocusScanBuffer::CAPACITY);
+    g_mutex_lock(&stats_mutex_);
+    state_stats_[state].frames++;
+    state_stats_[state].dropped += dropped;
+    g_mutex_unlock(&stats_mutex_);
+
+    if (trace_) {
+        FocusTraceRecord record = {};
+        record.timestamp = frame_time;
+        record.focus_value = focus_value;
+        record.frame_index = frame_index;
+        record.next_index = focusIndex;
+        record.timeout = frame_timeout_;
+        record.event = FOCUS_TRACE_STEP;
+        record.state = state;
+        record.next_state = currentState_->id();
+        record.flags = (scanning_ ? FOCUS_TRACE_FLAG_SCANNING : 0) | (locked_ ? FOCUS_TRACE_FLAG_LOCKED : 0);
+        trace_->record(record);
+        if (locked_)
+            trace_->flush(); //Keep everything up to each lock if the camera loses power
+    }
+}
+
+/**
+* Start from where focus was last found instead of searching the whole range. Call this before
+* the first frame, with the lens already at focus_index. If the first frame is as sharp as it was
+* last time and frames either side are less sharp, that is the focus point. Otherwise a detail
+* scan searches focus_index +/- span and the full range search only runs if that finds no peak.
+*
+* @param focus_index : Where focus was last found
+* @param focus_value : The focus value it was found with
+* @param span : Focus indices either side of focus_index the detail scan covers
+*/
+void CDAF::warmStart(guint focus_index, gfloat focus_value, guint span) {
+    focusIndex = CLAMP(focus_index, MIN_FOCUS_INDEX, MAX_FOCUS_INDEX);
+    detailScanMax = MIN(focusIndex + span, MAX_FOCUS_INDEX);
+    detailScanMin = MAX(focusIndex, MIN_FOCUS_INDEX + span) - span;
+    warmIndex = focusIndex;
+    warmValue = focus_value;
+    warmProbe = MAX(span, 1);
+    warmStarting = TRUE;
+    scanIn.clear();
+
+    g_mutex_lock(&stats_mutex_);
+    state_stats_[currentState_->id()].entries--;
+    state_stats_[FOCUS_STATE_WARM_START].entries++;
+    g_mutex_unlock(&stats_mutex_);
+    currentState_ = &warm_start_state;
+
+    if (trace_) {
+        FocusTraceRecord record = {};
+        record.timestamp = g_get_monotonic_time();
+        record.focus_value = focus_value;
+        record.frame_index = focusIndex;
+        record.next_index = span;
+        record.event = FOCUS_TRACE_WARM_START;
+        record.state = record.next_state = FOCUS_STATE_WARM_START;
+        trace_->record(record);
+    }
+    g_print("CDAF warm start at %u, focus value %.2f, +/- %u\n", focusIndex, focus_value, span);
+}
+
+/**
+* Move the lens to a focus index chosen by stepFocus. The I2C write is queued for the focus
+* controller's worker, so this never waits on the bus. A failed write is reported here on the
+* next move.
+*
+* @param focus_index : The focus point to set the lens to
+*/
+void CDAF::applyFocus(guint focus_index) {
+    GError* error = nullptr;
+    gint result;
+
+    if (ramp_pending_.exchange(FALSE)) {
+        result = i2c_focus_controller_.requestRamp(focus_index, &ramp_time_, &error);
+    }
+    else {
+        ramp_time_ = 0;
+        result = i2c_focus_controller_.requestFocus(focus_index, &error);
+    }
+    if (result == -1)
         error_handler_->errorHandler(&error);
 }
 
+/**
+* How long the lens move applyFocus last made takes to reach its focus index. A ramp takes a few
+* tens of ms, which has to be waited out on top of the settle time. A jump is 0.
+*
+* @return : ms from the applyFocus call until the lens has its target
+*/
+guint CDAF::rampTime() const {
+    return ramp_time_;
+}
+
+/**
+* Make the next applyFocus ramp the lens to its focus index instead of jumping there.
+*/
+void CDAF::rampNextMove() {
+    ramp_pending_ = TRUE;
+}
+
 /**
 * The TransitState class smoothly transitions the camera lens to its next
-* scanning start point.
+* scanning start point. With a transitStep of 0 the lens ramps the whole way in one move, written
+* out by the I2C worker, otherwise it moves transitStep per focus frame.
 */
 void TransitState::runFocus(CDAF & cdaf) {
     //This sets the parameters to start scanning in
     gint travelRemaining = cdaf.transitTo - cdaf.focusIndex;
-    cdaf.setScanning(FALSE, 250);
+    cdaf.setScanning(FALSE, cdaf.tuning.transitTimeout);
+
+    if ((cdaf.tuning.transitStep == 0) && (travelRemaining != 0))
+        cdaf.rampNextMove();
 
-    if (std::abs(travelRemaining) > TRANSIT_STEP){
-        g_print("TRAVEL REMAINING :%d\n", travelRemaining);
+    if ((cdaf.tuning.transitStep) && (std::abs(travelRemaining) > (gint)cdaf.tuning.transitStep)){
+        g_debug("Travel remaining: %d", travelRemaining);
         if (travelRemaining > 0)
-            cdaf.focusIndex = cdaf.focusIndex + TRANSIT_STEP;
+            cdaf.focusIndex = cdaf.focusIndex + cdaf.tuning.transitStep;
         else
-            cdaf.focusIndex = cdaf.focusIndex - TRANSIT_STEP;
+            cdaf.focusIndex = cdaf.focusIndex - cdaf.tuning.transitStep;
     }
     else{
         cdaf.focusIndex = cdaf.transitTo;
 
         if(cdaf.transitToDetail) {
             /*CHANGE STATE HERE StartDetailScanState*/
-            g_print("CHANGING STATE TO: StartDetailScan\n");
-            cdaf.changeState(new StartDetailScanState());
+            cdaf.changeState(FOCUS_STATE_START_DETAIL_SCAN);
+        }
+        else if (cdaf.tuning.scanMode == FOCUS_SCAN_SWEEP) {
+            /*CHANGE STATE HERE StartSweepState*/
+            cdaf.changeState(FOCUS_STATE_START_SWEEP);
+        }
+        else if (cdaf.tuning.scanMode == FOCUS_SCAN_GOLDEN_SECTION) {
+            /*CHANGE STATE HERE StartBracketScanState*/
+            cdaf.changeState(FOCUS_STATE_START_BRACKET_SCAN);
         }
         else {  
             /*CHANGE STATE HERE StartScanFocusInState*/
-            g_print("CHANGING STATE TO: StartScanFocusIn\n");
-            cdaf.changeState(new StartScanFocusInState());
+            cdaf.changeState(FOCUS_STATE_START_SCAN_FOCUS_IN);
         }  
     }  
 }
@@ -160,16 +642,14 @@ void TransitState::runFocus(CDAF & cdaf) {
 */
 void StartScanFocusInState::runFocus(CDAF & cdaf) {
     //This sets the parameters to start scanning in
-    cdaf.scanInValues.clear();
-    cdaf.scanInIndicies.clear();
-    cdaf.focusStep = 10;
+    cdaf.scanIn.clear();
+    cdaf.focusStep = cdaf.tuning.coarseStep;
     cdaf.focusIndex = MAX_FOCUS_INDEX;
     cdaf.boundary = FALSE;
-    cdaf.setScanning(TRUE, 100);
+    cdaf.setScanning(TRUE, cdaf.tuning.coarseTimeout);
     
     /*CHANGE STATE HERE ScanFocusInState*/
-    g_print("CHANGING STATE TO: ScanFocusIn\n");
-    cdaf.changeState(new ScanFocusInState());
+    cdaf.changeState(FOCUS_STATE_SCAN_FOCUS_IN);
     
 }
 
@@ -178,16 +658,14 @@ void StartScanFocusInState::runFocus(CDAF & cdaf) {
 */
 void ScanFocusInState::runFocus(CDAF & cdaf) {
     
-    cdaf.scanInValues.push_back(cdaf.focusValue);
-    cdaf.scanInIndicies.push_back(cdaf.focusIndex);
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
 
     if (!cdaf.boundary){
         cdaf.focusIndex = (cdaf.focusIndex - cdaf.focusStep);
     }
     else {
         /*CHANGE STATE HERE StartScanFocusOutState */
-        g_print("CHANGING STATE TO: StartScanFocusOut\n");
-        cdaf.changeState(new StartScanFocusOutState());
+        cdaf.changeState(FOCUS_STATE_START_SCAN_FOCUS_OUT);
         cdaf.focusIndex = MIN_FOCUS_INDEX;
     }
 
@@ -202,16 +680,14 @@ void ScanFocusInState::runFocus(CDAF & cdaf) {
 */
 void StartScanFocusOutState::runFocus(CDAF & cdaf) {
      //This sets the parameters to start scanning in
-    cdaf.scanOutValues.clear();
-    cdaf.scanOutIndicies.clear();
-    cdaf.focusStep = 10;
+    cdaf.scanOut.clear();
+    cdaf.focusStep = cdaf.tuning.coarseStep;
     cdaf.focusIndex = MIN_FOCUS_INDEX;
     cdaf.boundary = FALSE;
-    cdaf.setScanning(TRUE, 100);
+    cdaf.setScanning(TRUE, cdaf.tuning.coarseTimeout);
 
     /*CHANGE STATE HERE ScanFocusOutState*/
-    g_print("CHANGING STATE TO: ScanFocusOut\n");
-    cdaf.changeState(new ScanFocusOutState());
+    cdaf.changeState(FOCUS_STATE_SCAN_FOCUS_OUT);
 }
 
 /**
@@ -219,26 +695,25 @@ void StartScanFocusOutState::runFocus(CDAF & cdaf) {
 */
 void ScanFocusOutState::runFocus(CDAF & cdaf) {
     
-    cdaf.scanOutValues.push_back(cdaf.focusValue);
-    cdaf.scanOutIndicies.push_back(cdaf.focusIndex);
+    cdaf.scanOut.push(cdaf.focusValue, cdaf.focusIndex);
 
     if (!cdaf.boundary){
         cdaf.focusIndex = (cdaf.focusIndex + cdaf.focusStep);
     }
     else {
-        auto max_it = std::max_element(cdaf.scanInValues.begin(), cdaf.scanInValues.end());
-        guint scanInMax = std::distance(cdaf.scanInValues.begin(), max_it);
-        auto max_it1 = std::max_element(cdaf.scanOutValues.begin(), cdaf.scanOutValues.end());
-        guint scanOutMax = std::distance(cdaf.scanOutValues.begin(), max_it1);
+        guint scanInMax = cdaf.scanIn.peak();
+        guint scanOutMax = cdaf.scanOut.peak();
 
-        cdaf.detailScanMax = cdaf.scanInIndicies[scanInMax] + 10;
-        cdaf.detailScanMin = cdaf.scanOutIndicies[scanOutMax] - 10;
+        cdaf.detailScanMax = cdaf.scanIn.index(scanInMax) + 10;
+        cdaf.detailScanMin = cdaf.scanOut.index(scanOutMax) - 10;
 
         cdaf.transitTo = cdaf.detailScanMax;
         cdaf.transitToDetail = TRUE;
+
+        if (startCurveFitPeak(cdaf))
+            return;
         /*CHANGE STATE HERE TransitState */
-        g_print("CHANGING STATE TO: Transit\n");
-        cdaf.changeState(new TransitState());
+        cdaf.changeState(FOCUS_STATE_TRANSIT);
         cdaf.focusIndex = MAX_FOCUS_INDEX;
     }
 
@@ -254,20 +729,15 @@ void ScanFocusOutState::runFocus(CDAF & cdaf) {
 */
 void StartDetailScanState::runFocus(CDAF & cdaf) {
     
-    cdaf.scanInValues.clear();
-    cdaf.scanInIndicies.clear();
-    cdaf.scanOutValues.clear();
-    cdaf.scanOutIndicies.clear();
-    cdaf.focusStep = 2;
+    cdaf.scanIn.clear();
+    cdaf.scanOut.clear();
+    cdaf.focusStep = cdaf.tuning.detailStep;
     cdaf.focusIndex = cdaf.detailScanMax;
     cdaf.boundary = FALSE;
-    cdaf.setScanning(TRUE, 150);
+    cdaf.setScanning(TRUE, cdaf.tuning.detailTimeout);
 
     /*CHANGE STATE HERE DetailScanState*/
-    g_print("CHANGING STATE TO: DetailScan\n");
-    cdaf.changeState(new DetailScanState());
-
-    //g_print("END SCAN FOCUS SET\n");
+    cdaf.changeState(FOCUS_STATE_DETAIL_SCAN);
 }
 
 /**
@@ -277,8 +747,7 @@ void StartDetailScanState::runFocus(CDAF & cdaf) {
 */
 void DetailScanState::runFocus(CDAF & cdaf) {
     
-    cdaf.scanInValues.push_back(cdaf.focusValue);
-    cdaf.scanInIndicies.push_back(cdaf.focusIndex);
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
 
     if (!cdaf.boundary){
         cdaf.focusIndex = (cdaf.focusIndex - cdaf.focusStep);
@@ -286,8 +755,7 @@ void DetailScanState::runFocus(CDAF & cdaf) {
     else {
         //now we have a focus value
         /*CHANGE STATE HERE SetFocusState*/
-        g_print("CHANGING STATE TO: SetFocus\n");
-        cdaf.changeState(new SetFocusState());
+        cdaf.changeState(FOCUS_STATE_SET_FOCUS);
         cdaf.focusIndex = cdaf.detailScanMin;
     }
 
@@ -302,29 +770,45 @@ void DetailScanState::runFocus(CDAF & cdaf) {
 */
 void SetFocusState::runFocus(CDAF & cdaf) {
 
-    auto max_it = std::max_element(cdaf.scanInValues.begin(), cdaf.scanInValues.end());
-    guint index = std::distance(cdaf.scanInValues.begin(), max_it);
+    guint index = cdaf.scanIn.peak();
+
+    g_debug("Detail scan peak at %u (0 - %u)", index, cdaf.scanIn.size() - 1);
 
-    g_print("INDEX: %d (0 - %d)\n", index, (int)(cdaf.scanInValues.size()-1));
+    if (cdaf.warmStarting) {
+        gfloat tolerance = cdaf.tuning.noiseTolerance / 100.0f;
+
+        cdaf.warmStarting = FALSE;
+        //Flat within the noise, or a bump nothing like as sharp as last time: the subject is not near where it was
+        if ((cdaf.scanIn.value(index) <= cdaf.scanIn.value(cdaf.scanIn.lowest()) * (1.0f + 2.0f * tolerance)) ||
+            (cdaf.scanIn.value(index) < WARM_START_MIN_PEAK * cdaf.warmValue)) {
+            g_print("CDAF no focus peak near the warm start, searching the full range\n");
+            cdaf.chaseFocus = 0;
+            cdaf.transitToDetail = FALSE;
+            cdaf.transitTo = MAX_FOCUS_INDEX;
+            /*CHANGE STATE HERE TransitState*/
+            cdaf.changeState(FOCUS_STATE_TRANSIT);
+            return;
+        }
+    }
 
     //if the maximum was the first or last element of the vector array
-    if ((index == 0) || (index == (cdaf.scanInValues.size()-1))){
+    if ((index == 0) || (index == (cdaf.scanIn.size()-1))){
         cdaf.chaseFocus++;
 
         if (index == 0){
-            cdaf.detailScanMax = cdaf.scanInIndicies[index] + 40;
-            cdaf.detailScanMin = cdaf.scanInIndicies[index];
+            cdaf.detailScanMax = cdaf.scanIn.index(index) + 40;
+            cdaf.detailScanMin = cdaf.scanIn.index(index);
         }
         else {
-            cdaf.detailScanMax = cdaf.scanInIndicies[index];
-            cdaf.detailScanMin = cdaf.scanInIndicies[index] - 40;
+            cdaf.detailScanMax = cdaf.scanIn.index(index);
+            cdaf.detailScanMin = cdaf.scanIn.index(index) - 40;
         }
 
     }
     else{
         cdaf.chaseFocus = 0;
-        cdaf.detailScanMax = cdaf.scanInIndicies[index] + 20;
-        cdaf.detailScanMin = cdaf.scanInIndicies[index] - 20;
+        cdaf.detailScanMax = cdaf.scanIn.index(index) + 20;
+        cdaf.detailScanMin = cdaf.scanIn.index(index) - 20;
     } 
 
     if (cdaf.detailScanMax > MAX_FOCUS_INDEX)
@@ -332,26 +816,23 @@ void SetFocusState::runFocus(CDAF & cdaf) {
     if (cdaf.detailScanMin < MIN_FOCUS_INDEX)
         cdaf.detailScanMin = MIN_FOCUS_INDEX;
    
-    cdaf.focusIndex = cdaf.scanInIndicies[index];
+    cdaf.focusIndex = cdaf.scanIn.index(index);
 
     if (cdaf.chaseFocus == 0){
-        cdaf.setScanning(TRUE, 300); //Nice long timeout here
+        cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //Nice long timeout here
         /*CHANGE STATE HERE GrabFocusValueState*/
-        g_print("CHANGING STATE TO: GrabFocusValue\n");
-        cdaf.changeState(new GrabFocusValueState());
+        cdaf.changeState(FOCUS_STATE_GRAB_FOCUS_VALUE);
     }
     else if (cdaf.chaseFocus > 2){
         cdaf.chaseFocus = 0;
         cdaf.transitToDetail = FALSE;
         cdaf.transitTo = MAX_FOCUS_INDEX;
         /*CHANGE STATE HERE TransitState*/
-        g_print("CHANGING STATE TO: Transit\n");
-        cdaf.changeState(new TransitState());
+        cdaf.changeState(FOCUS_STATE_TRANSIT);
     }
     else {
         /*CHANGE STATE HERE StartDetailScanState*/
-        g_print("CHANGING STATE TO: StartDetailScan\n");
-        cdaf.changeState(new StartDetailScanState());
+        cdaf.changeState(FOCUS_STATE_START_DETAIL_SCAN);
     }    
           
 }
@@ -362,12 +843,11 @@ void SetFocusState::runFocus(CDAF & cdaf) {
 */
 void GrabFocusValueState::runFocus(CDAF & cdaf) {
     //Don't change the index, just grab the value
-    g_print ("cdaf.focusValue: %f", cdaf.focusValue);
+    g_debug("Focus value at lock: %f", cdaf.focusValue);
     cdaf.focusAchieved();
-    cdaf.setScanning(FALSE, 250);
+    cdaf.setScanning(FALSE, cdaf.tuning.transitTimeout);
     /*CHANGE STATE HERE StartDriftScanningState*/
-    g_print("CHANGING STATE TO: StartDriftScanning\n");
-    cdaf.changeState(new StartDriftScanningState());
+    cdaf.changeState(FOCUS_STATE_START_DRIFT_SCANNING);
 }
 
 /**
@@ -375,18 +855,15 @@ void GrabFocusValueState::runFocus(CDAF & cdaf) {
 * becomes out of focus.
 */
 void StartDriftScanningState::runFocus(CDAF & cdaf) {
-    cdaf.scanInValues.clear();
-    cdaf.scanInIndicies.clear();
-    cdaf.scanOutValues.clear();
-    cdaf.scanOutIndicies.clear();
-    cdaf.focusStep = 5;
+    cdaf.scanIn.clear();
+    cdaf.scanOut.clear();
+    cdaf.focusStep = cdaf.tuning.driftStep;
     cdaf.boundary = FALSE;
     cdaf.movingFocusIn = TRUE;
-    cdaf.setScanning(TRUE, 150);
+    cdaf.setScanning(TRUE, cdaf.tuning.driftTimeout);
 
     /*CHANGE STATE HERE ConfirmDriftDirectionState*/
-    g_print("CHANGING STATE TO: ConfirmDriftDirection\n");
-    cdaf.changeState(new ConfirmDriftDirectionState());
+    cdaf.changeState(FOCUS_STATE_CONFIRM_DRIFT_DIRECTION);
 
 }
 
@@ -397,22 +874,17 @@ void StartDriftScanningState::runFocus(CDAF & cdaf) {
 void ConfirmDriftDirectionState::runFocus(CDAF & cdaf) {
     //If direction is worsening, then throw away array start
     //fresh in scan for peak. If improving keep going until a peak is found
-    cdaf.scanInValues.push_back(cdaf.focusValue);
-    cdaf.scanInIndicies.push_back(cdaf.focusIndex);
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
 
-    auto max_it = std::max_element(cdaf.scanInValues.begin(), cdaf.scanInValues.end());
-    gboolean max_at_start = ((std::distance(cdaf.scanInValues.begin(), max_it)) <= 2);
-    guint index = std::distance(max_it, cdaf.scanInValues.end());
+    gboolean max_at_start = (cdaf.scanIn.peak() <= 2);
 
-    if (cdaf.scanInValues.size() >= 5 ){
+    if (cdaf.scanIn.size() >= 5 ){
         if (max_at_start){ //we are going in the wrong direction
             cdaf.movingFocusIn = FALSE;
-            cdaf.scanInValues.clear();
-            cdaf.scanInIndicies.clear();
+            cdaf.scanIn.clear();
         }
         /*CHANGE STATE HERE DriftScanForPeakState*/
-        g_print("CHANGING STATE TO: DriftScanForPeak\n");
-        cdaf.changeState(new DriftScanForPeakState());
+        cdaf.changeState(FOCUS_STATE_DRIFT_SCAN_FOR_PEAK);
     }
 
     cdaf.focusIndex = cdaf.focusIndex - cdaf.focusStep;
@@ -421,8 +893,7 @@ void ConfirmDriftDirectionState::runFocus(CDAF & cdaf) {
         cdaf.transitToDetail = FALSE; //Now we do a full scan
         cdaf.transitTo = MAX_FOCUS_INDEX;
         /*CHANGE STATE HERE TransitState*/
-        g_print("CHANGING STATE TO: Transit\n");
-        cdaf.changeState(new TransitState());
+        cdaf.changeState(FOCUS_STATE_TRANSIT);
     }
 }
 
@@ -432,11 +903,10 @@ void ConfirmDriftDirectionState::runFocus(CDAF & cdaf) {
 */
 void DriftScanForPeakState::runFocus(CDAF & cdaf) {
     
-    cdaf.scanInValues.push_back(cdaf.focusValue);
-    cdaf.scanInIndicies.push_back(cdaf.focusIndex);
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
 
-    auto max_it = std::max_element(cdaf.scanInValues.begin(), cdaf.scanInValues.end());
-    guint index = std::distance(max_it, cdaf.scanInValues.end());
+    guint peak = cdaf.scanIn.peak();
+    guint index = cdaf.scanIn.size() - peak; //Frames since the peak, counting the peak
 
     if (index < 5){ //then we have not gone past a peak yet
          //give up at some point
@@ -454,21 +924,291 @@ void DriftScanForPeakState::runFocus(CDAF & cdaf) {
                 cdaf.focusIndex = MAX_FOCUS_INDEX;
             }
         }
-        if ((cdaf.scanInValues.size() > 50) || (cdaf.boundary)){ //These are the give up conditions
+        if ((cdaf.scanIn.size() > 50) || (cdaf.boundary)){ //These are the give up conditions
             cdaf.transitToDetail = FALSE; //Now we do a full scan
             cdaf.transitTo = MAX_FOCUS_INDEX;
             /*CHANGE STATE HERE TransitState*/
-            g_print("CHANGING STATE TO: Transit\n");
-            cdaf.changeState(new TransitState());
+            cdaf.changeState(FOCUS_STATE_TRANSIT);
         }
     }
     else{ //we have a peak lets call it focussed
-        index = std::distance(cdaf.scanInValues.begin(), max_it); 
-        cdaf.focusIndex = cdaf.scanInIndicies[index];
-        cdaf.setScanning(TRUE, 300); //Nice long timeout here 
+        cdaf.focusIndex = cdaf.scanIn.index(peak);
+        cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //Nice long timeout here 
         /*CHANGE STATE HERE GrabFocusValueState*/
-        g_print("CHANGING STATE TO: GrabFocusValue\n");
-        cdaf.changeState(new GrabFocusValueState());
+        cdaf.changeState(FOCUS_STATE_GRAB_FOCUS_VALUE);
+    }
+
+}
+
+/**
+* The StartConfirmPeakState class takes the frame at the curve fit estimate, then moves
+* to one side of it for the first check frame.
+*/
+void StartConfirmPeakState::runFocus(CDAF & cdaf) {
+    cdaf.scanIn.clear();
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+    cdaf.focusIndex = MAX(cdaf.peakEstimate, MIN_FOCUS_INDEX + cdaf.tuning.confirmStep) - cdaf.tuning.confirmStep;
+    cdaf.setScanning(TRUE, cdaf.tuning.detailTimeout);
+
+    /*CHANGE STATE HERE ConfirmPeakState*/
+    cdaf.changeState(FOCUS_STATE_CONFIRM_PEAK);
+}
+
+/**
+* The ConfirmPeakState class takes a frame either side of the curve fit estimate. Unless
+* one side is clearly sharper than the estimate, by more than CONFIRM_TOLERANCE so frame
+* noise does not throw a good estimate away, the estimate is the focus point. Otherwise
+* the detail scan takes over around the sharper side.
+*/
+void ConfirmPeakState::runFocus(CDAF & cdaf) {
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+
+    if (cdaf.scanIn.size() < 3) {
+        cdaf.focusIndex = MIN(cdaf.peakEstimate + cdaf.tuning.confirmStep, MAX_FOCUS_INDEX);
+        return;
+    }
+
+    guint best = cdaf.scanIn.peak();
+    if ((best == 0) || (cdaf.scanIn.value(best) <= cdaf.scanIn.value(0) * (1.0 + CONFIRM_TOLERANCE))) {
+        cdaf.focusIndex = cdaf.peakEstimate;
+        cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //Nice long timeout here
+        /*CHANGE STATE HERE GrabFocusValueState*/
+        cdaf.changeState(FOCUS_STATE_GRAB_FOCUS_VALUE);
+    }
+    else {
+        g_debug("Curve fit peak not confirmed, detail scan around %u", cdaf.scanIn.index(best));
+        cdaf.detailScanMax = MIN(cdaf.scanIn.index(best) + 20, MAX_FOCUS_INDEX);
+        cdaf.detailScanMin = MAX(cdaf.scanIn.index(best), MIN_FOCUS_INDEX + 20) - 20;
+        /*CHANGE STATE HERE StartDetailScanState*/
+        cdaf.changeState(FOCUS_STATE_START_DETAIL_SCAN);
+    }
+}
+
+/**
+* The StartSweepState class takes the frame at the top of the range and starts the lens
+* sweeping in from there. Every frame from now on comes through as fast as the camera runs.
+*/
+void StartSweepState::runFocus(CDAF & cdaf) {
+    cdaf.scanIn.clear();
+    cdaf.scanOut.clear();
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+    cdaf.sweepStart = cdaf.frameTime;
+    cdaf.setScanning(TRUE, 0);
+    cdaf.setSweeping(TRUE);
+
+    /*CHANGE STATE HERE SweepState*/
+    cdaf.changeState(FOCUS_STATE_SWEEP);
+}
+
+/**
+* The SweepState class builds the focus curve from frames taken while the lens moves. stepFocus
+* has already set focusIndex to where the lens was for this frame. Once a frame is past the
+* bottom of the range the lens goes straight back to the peak, either to the curve fit
+* estimate or to the top of a detail scan between the frames either side of the best one.
+*/
+void SweepState::runFocus(CDAF & cdaf) {
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+
+    if (cdaf.focusIndex > MIN_FOCUS_INDEX)
+        return;
+
+    cdaf.setSweeping(FALSE);
+
+    guint peak = cdaf.scanIn.peak();
+    cdaf.detailScanMax = cdaf.scanIn.index((peak > 0) ? peak - 1 : peak);
+    cdaf.detailScanMin = cdaf.scanIn.index((peak + 1 < cdaf.scanIn.size()) ? peak + 1 : peak);
+    g_debug("Sweep of %u frames peaked at %u", cdaf.scanIn.size(), cdaf.scanIn.index(peak));
+
+    if (startCurveFitPeak(cdaf))
+        return;
+
+    cdaf.focusIndex = cdaf.detailScanMax;
+    cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //Nice long timeout here
+    /*CHANGE STATE HERE StartDetailScanState*/
+    cdaf.changeState(FOCUS_STATE_START_DETAIL_SCAN);
+}
+
+/**
+* The StartBracketScanState class prepares settings to scan in from the top of the range with
+* the big bracket step, looking for where the focus curve rises.
+*/
+void StartBracketScanState::runFocus(CDAF & cdaf) {
+    cdaf.scanIn.clear();
+    cdaf.focusStep = cdaf.tuning.bracketStep;
+    cdaf.focusIndex = MAX_FOCUS_INDEX;
+    cdaf.boundary = FALSE;
+    cdaf.setScanning(TRUE, cdaf.tuning.coarseTimeout);
+
+    /*CHANGE STATE HERE BracketScanState*/
+    cdaf.changeState(FOCUS_STATE_BRACKET_SCAN);
+}
+
+/**
+* The BracketScanState class scans in with an adaptive step. While the focus curve is flat,
+* within the noise tolerance of the lowest value so far, it takes big bracket steps. Once it
+* rises it drops to the coarse step, and once two frames in a row are clearly down from the
+* best, the scan is past the peak and stops. The frames either side of the best one bracket
+* the peak for the golden section search. A scan that is still flat at the end of the range has
+* no peak above the noise for the golden section search to find, and falls back to the coarse
+* scan in and out.
+*/
+void BracketScanState::runFocus(CDAF & cdaf) {
+    gfloat tolerance = cdaf.tuning.noiseTolerance / 100.0f;
+    guint peak, count, lowest;
+    gboolean rising, past_peak;
+
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+    peak = cdaf.scanIn.peak();
+    count = cdaf.scanIn.size();
+    lowest = cdaf.scanIn.lowest();
+
+    rising = (cdaf.scanIn.value(peak) > cdaf.scanIn.value(lowest) * (1.0f + 2.0f * tolerance));
+    past_peak = rising && (peak + 2 < count) &&
+        (cdaf.scanIn.value(count - 1) < cdaf.scanIn.value(peak) * (1.0f - tolerance)) &&
+        (cdaf.scanIn.value(count - 2) < cdaf.scanIn.value(peak) * (1.0f - tolerance));
+
+    if (cdaf.boundary && !rising) {
+        g_print("CDAF bracket scan flat over %u frames, falling back to the coarse scan\n", count);
+        cdaf.focusIndex = MAX_FOCUS_INDEX;
+        cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //The whole range to travel back
+        /*CHANGE STATE HERE StartScanFocusInState*/
+        cdaf.changeState(FOCUS_STATE_START_SCAN_FOCUS_IN);
+        return;
+    }
+
+    if (past_peak || cdaf.boundary) {
+        GoldenBracket& golden = cdaf.golden;
+
+        golden.high = cdaf.scanIn.index((peak > 0) ? peak - 1 : peak);
+        golden.low = cdaf.scanIn.index((peak + 1 < count) ? peak + 1 : peak);
+        golden.lower = golden.high - (guint)lround(GOLDEN_RATIO * (golden.high - golden.low));
+        golden.upper = golden.low + (guint)lround(GOLDEN_RATIO * (golden.high - golden.low));
+        golden.lowerMeasured = FALSE;
+        golden.upperMeasured = FALSE;
+        g_debug("Bracket scan of %u frames, peak between %u and %u", count, golden.low, golden.high);
+
+        cdaf.focusIndex = golden.lower;
+        cdaf.setScanning(TRUE, cdaf.tuning.detailTimeout);
+        /*CHANGE STATE HERE GoldenSectionState*/
+        cdaf.changeState(FOCUS_STATE_GOLDEN_SECTION);
+        return;
+    }
+
+    cdaf.focusStep = rising ? cdaf.tuning.coarseStep : cdaf.tuning.bracketStep;
+    if (cdaf.focusIndex <= MIN_FOCUS_INDEX + cdaf.focusStep) {
+        cdaf.boundary = TRUE;
+        cdaf.focusIndex = MIN_FOCUS_INDEX;
+    }
+    else {
+        cdaf.focusIndex = cdaf.focusIndex - cdaf.focusStep;
+    }
+}
+
+/**
+* The GoldenSectionState class narrows the bracket around the peak, one frame per step, by
+* dropping the side of the bracket beyond the weaker inner point. It stops when the bracket is
+* down to two detail steps, or when the two inner points are within the noise tolerance of each
+* other, as another step would only be comparing noise. The peak is then between them.
+*/
+void GoldenSectionState::runFocus(CDAF & cdaf) {
+    GoldenBracket& golden = cdaf.golden;
+    gfloat tolerance = cdaf.tuning.noiseTolerance / 100.0f;
+    guint focus;
+
+    if ((!golden.lowerMeasured) && (cdaf.focusIndex == golden.lower)) {
+        golden.lowerValue = cdaf.focusValue;
+        golden.lowerMeasured = TRUE;
+    }
+    else {
+        golden.upperValue = cdaf.focusValue;
+        golden.upperMeasured = TRUE;
     }
 
+    if (!golden.upperMeasured) {
+        cdaf.focusIndex = golden.upper;
+        return;
+    }
+    if (!golden.lowerMeasured) {
+        cdaf.focusIndex = golden.lower;
+        return;
+    }
+
+    if (fabsf(golden.lowerValue - golden.upperValue) <= tolerance * MAX(golden.lowerValue, golden.upperValue)) {
+        focus = (golden.lower + golden.upper + 1) / 2;
+    }
+    else {
+        if (golden.lowerValue > golden.upperValue) {
+            golden.high = golden.upper;
+            golden.upper = golden.lower;
+            golden.upperValue = golden.lowerValue;
+            golden.lower = golden.high - (guint)lround(GOLDEN_RATIO * (golden.high - golden.low));
+            golden.lowerMeasured = FALSE;
+        }
+        else {
+            golden.low = golden.lower;
+            golden.lower = golden.upper;
+            golden.lowerValue = golden.upperValue;
+            golden.upper = golden.low + (guint)lround(GOLDEN_RATIO * (golden.high - golden.low));
+            golden.upperMeasured = FALSE;
+        }
+
+        if ((golden.high - golden.low > 2 * cdaf.tuning.detailStep) && (golden.lower < golden.upper)) {
+            cdaf.focusIndex = golden.lowerMeasured ? golden.upper : golden.lower;
+            return;
+        }
+        focus = golden.lowerMeasured ? golden.lower : golden.upper; //The best point measured
+    }
+
+    g_debug("Golden section peak at %u, bracket %u to %u", focus, golden.low, golden.high);
+    cdaf.focusIndex = focus;
+    cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout); //Nice long timeout here
+    /*CHANGE STATE HERE GrabFocusValueState*/
+    cdaf.changeState(FOCUS_STATE_GRAB_FOCUS_VALUE);
+}
+
+/**
+* The WarmStartState class checks the position focus was last found at. The first frame there has
+* to be within WARM_START_MATCH of the focus value it was found with, then a frame warmProbe
+* either side has to be less sharp by more than the noise. A flat, featureless curve can match
+* on value alone, the probes make sure it is a peak. If it is, the subject has not moved and
+* focus locks back at the position. Otherwise a detail scan searches around it, and
+* SetFocusState falls back to the full range search if the scan is flat.
+*/
+void WarmStartState::runFocus(CDAF & cdaf) {
+    gfloat tolerance = cdaf.tuning.noiseTolerance / 100.0f;
+    gboolean matched = TRUE;
+
+    cdaf.scanIn.push(cdaf.focusValue, cdaf.focusIndex);
+    switch (cdaf.scanIn.size()) {
+    case 1:
+        matched = (fabsf(cdaf.focusValue - cdaf.warmValue) < WARM_START_MATCH * cdaf.warmValue);
+        cdaf.focusIndex = MIN(cdaf.warmIndex + cdaf.warmProbe, MAX_FOCUS_INDEX);
+        cdaf.setScanning(TRUE, cdaf.tuning.detailTimeout);
+        break;
+    case 2:
+        cdaf.focusIndex = MAX(cdaf.warmIndex, MIN_FOCUS_INDEX + cdaf.warmProbe) - cdaf.warmProbe;
+        cdaf.setScanning(TRUE, cdaf.tuning.detailTimeout);
+        break;
+    default:
+        matched = (cdaf.scanIn.value(0) > MAX(cdaf.scanIn.value(1), cdaf.scanIn.value(2)) * (1.0f + tolerance));
+        if (matched) {
+            g_debug("Warm start peak at %u confirmed, %.2f against %.2f and %.2f", cdaf.warmIndex,
+                cdaf.scanIn.value(0), cdaf.scanIn.value(1), cdaf.scanIn.value(2));
+            cdaf.warmStarting = FALSE;
+            cdaf.focusIndex = cdaf.warmIndex;
+            cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout);
+            /*CHANGE STATE HERE GrabFocusValueState*/
+            cdaf.changeState(FOCUS_STATE_GRAB_FOCUS_VALUE);
+            return;
+        }
+        break;
+    }
+    if (matched)
+        return;
+
+    g_debug("Warm start at %u is not the focus peak, detail scan", cdaf.warmIndex);
+    cdaf.focusIndex = cdaf.detailScanMax;
+    cdaf.setScanning(TRUE, cdaf.tuning.settleTimeout);
+    /*CHANGE STATE HERE StartDetailScanState*/
+    cdaf.changeState(FOCUS_STATE_START_DETAIL_SCAN);
 }
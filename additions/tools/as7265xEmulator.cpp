@@ -0,0 +1,405 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * AS7265x board emulator and serial path benchmark.
+ *
+ * Usage: as7265xEmulator [OPTION...]   (as7265xEmulator --help lists them)
+ *
+ * Puts an emulated AS7265x board (tools/sim/AS7265xSim) behind a pseudo
+ * terminal and prints its path. Run nvgstcapture-1.0 with
+ * --spectral-device=PATH to use it in place of the board on /dev/ttyUSB0.
+ * --link=PATH also makes a fixed symbolic link to it.
+ *
+ * With --bench it drives the emulator from this process over the real
+ * SerialPort, line framer, AT command queue and reading parser instead.
+ * For each integration time it times captures made of the same batch the
+ * camera sends on a button press, and a burst of continuous readings, and
+ * reports both against what the board's timing allows. Faults can be
+ * injected in either mode: garbled lines, dropped replies, stalls, lines
+ * sent in small pieces, and a hang up after a number of commands.
+ *****************************************************/
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "AS7265xSim.h"
+#include "AS7265xParse.h"
+#include "ATCommandQueue.h"
+#include "SerialIO.h"
+#include "ErrorHandler.h"
+
+#define BENCH_BAUD 115200
+#define BENCH_MARGIN_MS 500 //Added to the timeout of commands that wait on a reading
+
+enum BenchTag {
+    BENCH_SETUP = 0,
+    BENCH_TEMP,
+    BENCH_GAIN,
+    BENCH_INTEGRATION,
+    BENCH_DATA,
+    BENCH_CALIBRATED_DATA,
+    BENCH_CONTINUOUS,
+    BENCH_BURST,
+    BENCH_ONE_SHOT
+};
+
+enum BenchPhase {
+    PHASE_SETUP = 0,
+    PHASE_CAPTURE,
+    PHASE_BURST,
+    PHASE_DONE
+};
+
+struct BenchResult {
+    std::vector<gdouble> latencies; //ms for each capture
+    guint captures_failed;
+    guint burst_readings;
+    gdouble burst_rate; //Readings/s
+    guint bad_lines; //Replies the parser turned down
+};
+
+struct BenchRun {
+    ATCommandQueue* queue;
+    GMainLoop* loop;
+    std::vector<guint> integrations;
+    gsize integration_index;
+    guint gain;
+    guint captures;
+    guint burst;
+    BenchPhase phase;
+    guint captures_done;
+    guint outstanding; //Commands of the batch still to finish
+    gboolean batch_failed;
+    gint64 batch_start;
+    gint64 burst_first;
+    gint64 burst_last;
+    std::vector<BenchResult> results;
+    gboolean aborted;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void quitSignal(gint)
+{
+    quit = 1;
+}
+
+static guint readingMs(guint integration)
+{
+    return 2 * integration * AS7265X_SIM_STEP_US / 1000;
+}
+
+static void submitBatch(BenchRun* run);
+
+static gboolean nextBatch(gpointer user_data)
+{
+    submitBatch(static_cast<BenchRun*>(user_data));
+    return FALSE;
+}
+
+/**
+* Called with every reply. Checks readings parse, times the batch, and moves on once it is done.
+*/
+static void benchReply(const ATReply& reply, gpointer user_data)
+{
+    BenchRun* run = static_cast<BenchRun*>(user_data);
+    BenchResult& result = run->results.back();
+    gint64 now = reply.time; //When the line was read, as the camera times its bursts
+
+    if (reply.status != AT_REPLY_OK)
+        run->batch_failed = TRUE;
+    else if (reply.tag == BENCH_DATA) {
+        AS7265xRaw raw;
+        if (!AS7265xParse::parseRaw(reply.line, &raw))
+            result.bad_lines++;
+    }
+    else if ((reply.tag == BENCH_CALIBRATED_DATA) || ((reply.tag == BENCH_BURST) && reply.more)) {
+        AS7265xCalibrated calibrated;
+        if (!AS7265xParse::parseCalibrated(reply.line, &calibrated))
+            result.bad_lines++;
+        else if (reply.tag == BENCH_BURST) {
+            if (result.burst_readings++ == 0)
+                run->burst_first = now;
+            run->burst_last = now;
+        }
+    }
+
+    if (reply.more || (--run->outstanding > 0))
+        return;
+
+    //Batch done
+    if (run->phase == PHASE_CAPTURE) {
+        if (run->batch_failed)
+            result.captures_failed++;
+        else
+            result.latencies.push_back((now - run->batch_start) / 1000.0);
+        if (++run->captures_done == run->captures)
+            run->phase = PHASE_BURST;
+    }
+    else if (run->phase == PHASE_BURST) {
+        if (result.burst_readings > 1)
+            result.burst_rate = (result.burst_readings - 1) * (gdouble)G_USEC_PER_SEC / (run->burst_last - run->burst_first);
+        run->integration_index++;
+        run->phase = (run->integration_index < run->integrations.size()) ? PHASE_SETUP : PHASE_DONE;
+    }
+    else
+        run->phase = PHASE_CAPTURE;
+
+    g_idle_add(nextBatch, run);
+}
+
+static void submit(BenchRun* run, const std::string& command, BenchTag tag, guint fields, guint timeout_ms = AT_COMMAND_TIMEOUT_MS)
+{
+    run->queue->submit(command.c_str(), tag, fields, benchReply, run, timeout_ms);
+    run->outstanding++;
+}
+
+static void submitBatch(BenchRun* run)
+{
+    GError* error = nullptr;
+    guint integration;
+    guint reading_ms;
+
+    if (run->phase == PHASE_DONE) {
+        g_main_loop_quit(run->loop);
+        return;
+    }
+
+    integration = run->integrations[run->integration_index];
+    reading_ms = readingMs(integration);
+    run->outstanding = 0;
+    run->batch_failed = FALSE;
+
+    switch (run->phase) {
+        case PHASE_SETUP:
+            run->results.push_back(BenchResult());
+            run->captures_done = 0;
+            submit(run, "ATTCSMD=3", BENCH_SETUP, 1);
+            submit(run, "ATGAIN=" + std::to_string(run->gain), BENCH_SETUP, 1);
+            submit(run, "ATINTTIME=" + std::to_string(integration), BENCH_SETUP, 1);
+            break;
+
+        case PHASE_CAPTURE: //The batch AS7265xUnit::getAS7265xData sends
+            submit(run, "ATTEMP", BENCH_TEMP, 3);
+            submit(run, "ATGAIN", BENCH_GAIN, 1);
+            submit(run, "ATINTTIME", BENCH_INTEGRATION, 1);
+            submit(run, "ATDATA", BENCH_DATA, AS7265X_CHANNELS, reading_ms + BENCH_MARGIN_MS);
+            submit(run, "ATCDATA", BENCH_CALIBRATED_DATA, AS7265X_CHANNELS);
+            break;
+
+        default:
+            submit(run, "ATTCSMD=2", BENCH_CONTINUOUS, 1);
+            run->queue->submitStream(("ATBURST=" + std::to_string(run->burst)).c_str(), BENCH_BURST, AS7265X_CHANNELS,
+                benchReply, run, 2 * reading_ms + BENCH_MARGIN_MS);
+            run->outstanding++;
+            submit(run, "ATTCSMD=3", BENCH_ONE_SHOT, 1);
+            break;
+    }
+
+    run->batch_start = g_get_monotonic_time();
+    if (run->queue->flush(&error) == -1) {
+        g_printerr("Stopping, %s\n", error->message);
+        g_error_free(error);
+        run->aborted = TRUE;
+        g_main_loop_quit(run->loop);
+    }
+}
+
+/**
+* Lines a capture sends back, for the time they take on the wire.
+*/
+static gdouble captureTransferMs(guint baud)
+{
+    const gsize bytes = 10 + 4 + 6 + 18 * 5 + 3 + 18 * 7 + 3 + 5 * 2;
+
+    return bytes * 10 * 1000.0 / baud;
+}
+
+static gint runBench(AS7265xSim* sim, const std::vector<guint>& integrations, guint gain, guint captures,
+    guint burst, guint baud)
+{
+    ErrorHandler error_handler(nullptr);
+    GError* error = nullptr;
+    gboolean passed = TRUE;
+
+    SerialPort port(sim->slavePath(), BENCH_BAUD, 8, 1, 0, 0, &error_handler);
+    if (port.setup(&error) == -1) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    BenchRun run = {};
+    ATCommandQueue queue(&port);
+    run.queue = &queue;
+    run.loop = g_main_loop_new(nullptr, FALSE);
+    run.integrations = integrations;
+    run.gain = gain;
+    run.captures = captures;
+    run.burst = burst;
+    run.phase = PHASE_SETUP;
+
+    sim->start();
+    submitBatch(&run);
+    g_main_loop_run(run.loop);
+    g_main_loop_unref(run.loop);
+    sim->stop();
+
+    g_print("\n%9s %9s %20s %9s %20s %6s %6s\n", "ATINTTIME", "reading", "capture mean/max", "expected",
+        "burst readings/s", "failed", "bad");
+    for (gsize i = 0; i < run.results.size(); ++i) {
+        const BenchResult& result = run.results[i];
+        guint reading_ms = readingMs(integrations[i]);
+        gdouble mean = 0.0;
+        gdouble max = 0.0;
+
+        for (gdouble latency : result.latencies) {
+            mean += latency / result.latencies.size();
+            max = MAX(max, latency);
+        }
+        g_print("%9u %6u ms %8.1f/%7.1f ms %6.1f ms %9.2f of %6.2f %6u %6u\n", integrations[i], reading_ms, mean, max,
+            reading_ms + captureTransferMs(baud), result.burst_rate, 1000.0 / reading_ms, result.captures_failed,
+            result.bad_lines);
+        passed = passed && (result.captures_failed == 0) && (result.bad_lines == 0)
+            && (result.burst_readings == burst);
+    }
+
+    ATQueueStats queue_stats = queue.getStats();
+    LineFramerStats framer_stats = port.getStats();
+    AS7265xSimStats sim_stats = sim->getStats();
+    g_print("\nEmulator: %" G_GUINT64_FORMAT " commands, %" G_GUINT64_FORMAT " lines sent, %" G_GUINT64_FORMAT
+        " garbled, %" G_GUINT64_FORMAT " dropped, %" G_GUINT64_FORMAT " stalled%s\n", sim_stats.commands,
+        sim_stats.replies, sim_stats.garbled, sim_stats.dropped, sim_stats.stalled,
+        sim_stats.disconnected ? ", hung up" : "");
+    g_print("Host: %" G_GUINT64_FORMAT " lines in %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT
+        " retries, %" G_GUINT64_FORMAT " commands failed, %" G_GUINT64_FORMAT " unmatched lines\n",
+        framer_stats.lines, framer_stats.bytes, queue_stats.retries, queue_stats.failures, queue_stats.unmatched);
+
+    //With faults injected the run only has to get through, every failure has to be reported
+    if (sim_stats.garbled || sim_stats.dropped || sim_stats.stalled || sim_stats.disconnected)
+        passed = !run.aborted || sim_stats.disconnected;
+    g_print("%s\n", passed ? "ok" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    GError* error = nullptr;
+    gint baud = BENCH_BAUD;
+    gchar* link = nullptr;
+    gdouble garble = 0.0, drop = 0.0, stall = 0.0;
+    gint stall_ms = 1000;
+    gboolean split = FALSE;
+    gint disconnect_after = 0;
+    gint seed = 1;
+    gboolean bench = FALSE;
+    gint integration = 0;
+    gint gain = 0;
+    gint captures = 5;
+    gint burst = 20;
+
+    GOptionEntry entries[] = {
+        {"baud", 0, 0, G_OPTION_ARG_INT, &baud, "Rate the replies are paced at, 10 bits a byte [115200]", "BAUD"},
+        {"link", 0, 0, G_OPTION_ARG_FILENAME, &link, "Also make a symbolic link to the pseudo terminal here", "PATH"},
+        {"garble", 0, 0, G_OPTION_ARG_DOUBLE, &garble, "Percent of lines with a byte changed, dropped or doubled", "PCT"},
+        {"drop", 0, 0, G_OPTION_ARG_DOUBLE, &drop, "Percent of commands never answered", "PCT"},
+        {"stall", 0, 0, G_OPTION_ARG_DOUBLE, &stall, "Percent of lines held back before they are sent", "PCT"},
+        {"stall-ms", 0, 0, G_OPTION_ARG_INT, &stall_ms, "How long a stalled line is held back [1000]", "MS"},
+        {"split", 0, 0, G_OPTION_ARG_NONE, &split, "Send lines in pieces of 1 to 16 bytes", nullptr},
+        {"disconnect-after", 0, 0, G_OPTION_ARG_INT, &disconnect_after, "Hang up after this many commands", "N"},
+        {"seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed for the noise and the faults [1]", "N"},
+        {"bench", 0, 0, G_OPTION_ARG_NONE, &bench, "Benchmark the serial path against the emulator and exit", nullptr},
+        {"integration", 0, 0, G_OPTION_ARG_INT, &integration, "Bench one ATINTTIME only, instead of 10, 36, 100 and 255", "N"},
+        {"gain", 0, 0, G_OPTION_ARG_INT, &gain, "ATGAIN for the bench, 0 to 3 [0]", "N"},
+        {"captures", 0, 0, G_OPTION_ARG_INT, &captures, "Captures timed at each integration time [5]", "N"},
+        {"burst", 0, 0, G_OPTION_ARG_INT, &burst, "Readings in the burst at each integration time [20]", "N"},
+        {nullptr}
+    };
+
+    GOptionContext* context = g_option_context_new("- emulate an AS7265x board on a pseudo terminal");
+    g_option_context_add_main_entries(context, entries, nullptr);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    AS7265xSimFaults faults = {};
+    faults.garble = CLAMP(garble, 0.0, 100.0) / 100.0;
+    faults.drop = CLAMP(drop, 0.0, 100.0) / 100.0;
+    faults.stall = CLAMP(stall, 0.0, 100.0) / 100.0;
+    faults.stall_ms = MAX(stall_ms, 0);
+    faults.split = split;
+    faults.disconnect_after = MAX(disconnect_after, 0);
+    faults.seed = seed;
+
+    AS7265xSim sim(MAX(baud, 300));
+    sim.setFaults(faults);
+    if (sim.open(&error) == -1) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    if (bench) {
+        std::vector<guint> integrations = { 10, 36, 100, 255 };
+        if (integration > 0)
+            integrations = { (guint)CLAMP(integration, 1, 255) };
+        g_print("AS7265x emulator on %s, %d baud, gain %d, %d captures and a %d reading burst at each integration time\n",
+            sim.slavePath().c_str(), MAX(baud, 300), CLAMP(gain, 0, 3), MAX(captures, 1), CLAMP(burst, 1, 255));
+        return runBench(&sim, integrations, CLAMP(gain, 0, 3), MAX(captures, 1), CLAMP(burst, 1, 255), MAX(baud, 300));
+    }
+
+    if (link) {
+        unlink(link);
+        if (symlink(sim.slavePath().c_str(), link) == -1) {
+            g_printerr("Can not link '%s' to %s: %s\n", link, sim.slavePath().c_str(), g_strerror(errno));
+            g_free(link);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, quitSignal);
+    signal(SIGTERM, quitSignal);
+    sim.start();
+    g_print("AS7265x emulator on %s. Run nvgstcapture-1.0 with --spectral-device=%s, ctrl-C to stop\n",
+        sim.slavePath().c_str(), link ? link : sim.slavePath().c_str());
+    while (!quit && !sim.getStats().disconnected)
+        g_usleep(100000);
+    sim.stop();
+
+    AS7265xSimStats stats = sim.getStats();
+    g_print("\n%" G_GUINT64_FORMAT " commands, %" G_GUINT64_FORMAT " lines sent, %" G_GUINT64_FORMAT " readings, %"
+        G_GUINT64_FORMAT " ERROR replies, %" G_GUINT64_FORMAT " garbled, %" G_GUINT64_FORMAT " dropped, %"
+        G_GUINT64_FORMAT " stalled%s\n", stats.commands, stats.replies, stats.readings, stats.errors, stats.garbled,
+        stats.dropped, stats.stalled, stats.disconnected ? ", hung up" : "");
+    if (link) {
+        unlink(link);
+        g_free(link);
+    }
+    return 0;
+}
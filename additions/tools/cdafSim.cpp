@@ -0,0 +1,910 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Lens and optics simulator for the CDAF autofocus state machine.
+ *
+ * Usage: cdafSim [OPTION...]   (cdafSim --help lists them)
+ *
+ * The real CDAF state machine is linked against a desktop CameraI2CDevice
+ * (tools/sim) so every focus index it writes moves a simulated voice coil
+ * instead of the Arducam lens. The simulation follows AF_Additions: a focus
+ * frame is requested, exposed on the next frame boundary, measured, fed to
+ * stepFocus, and the lens move is applied before the next frame is requested
+ * after the timeout the state machine asked for. While CDAF sweeps, every
+ * frame is measured and the lens follows the sweep every SWEEP_TICK_MS.
+ * With a lens settle model the wait after a lens move comes from the model
+ * instead of the timeout, and --settle-calibrate measures the model on the
+ * simulated lens first, the way AF_Additions does after the first lock.
+ *
+ *   VCM      - a second order model, so the lens takes time to settle and
+ *              rings past its target when it is lightly damped
+ *   optics   - each scene layer is sharp at one focus index and is blurred
+ *              by a Gaussian that grows with the lens distance from it,
+ *              plus smear when the lens moves during the exposure
+ *   scenes   - texture, dim underwater silt, a textured subject in front of
+ *              a background, bars, and optionally a recorded 8 bit PGM
+ *
+ * For each scene and subject distance it reports frames and time to first
+ * focus lock, the lens error at lock, the furthest the VCM rang past a target,
+ * and how many full and detail rescans the state machine made. After lock it
+ * keeps running for the hold time to count spurious drift rescans, or to
+ * time the refocus when the subject is moved with --move-by.
+ *****************************************************/
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cdaf.h"
+#include "ErrorHandler.h"
+#include "FocusDriftDetector.h"
+#include "FocusMemory.h"
+#include "FocusMetric.h"
+#include "LensSettleModel.h"
+#include "LensSim.h"
+
+#define FRAME_WIDTH 320
+#define FRAME_HEIGHT 240
+#define ROI_SIZE 200
+#define MAX_BLUR_SIGMA 12.0f
+#define BLUR_QUANTUM 4    //Blurred layers are cached in quarter pixel sigma steps
+#define START_FOCUS_INDEX 280 //AF_Additions::setup puts the lens here
+#define DRIFT_RECHECK_MS 250  //AF_Additions rechecks a held focus at this interval
+#define NOISE_FRAMES 4        //Frames of sensor noise drawn up front, read from a random offset
+#define SWEEP_TICK_MS 10      //AF_Additions moves the lens along a sweep at this interval
+#define FLICKER_RANGE 0.4     //A flickered frame's focus value is off by up to this fraction
+
+/**
+* The simulation settings, filled in from the command line.
+*/
+struct SimOptions {
+    CDAFTuning tuning;
+    gdouble frame_interval = 1000.0 / 30.0; //ms, 30 fps capture
+    gdouble exposure = 10.0;                //ms
+    gdouble latency = 5.0;                  //ms from the end of the frame to the focus value
+    gdouble vcm_settle = 25.0;              //ms for a step to settle within 2%
+    gdouble vcm_damping = 0.5;              //1 is critically damped, lower rings
+    gdouble blur_rate = 0.04;               //sigma in pixels per focus index out of focus
+    gdouble depth_of_field = 3.0;           //focus indices either side that stay sharp
+    gdouble hold = 3000.0;                  //ms to keep running after the first lock
+    gint move_by = 0;                       //focus indices the subject moves half way through the hold
+    gdouble flicker = 0;                    //% of held focus frames thrown out by flicker or splashing
+    gdouble drift_slack = FOCUS_DRIFT_SLACK;
+    gdouble drift_threshold = FOCUS_DRIFT_THRESHOLD;
+    gdouble drift_noise_floor = FOCUS_DRIFT_NOISE_FLOOR;
+    gdouble duration = 120000.0;            //ms before a run is given up
+    gint metric = FOCUS_METRIC_LAPLACIAN_MEAN;
+    LensSettleModel settle_model;           //Frame waits after lens moves, the CDAF timeouts until calibrated
+    gboolean verbose = FALSE;
+};
+
+/**
+* Second order voice coil model. CDAF writes a target, the lens accelerates towards it,
+* and with damping below 1 overshoots and rings before it settles.
+*/
+class Vcm {
+public:
+    Vcm(const SimOptions& options, gdouble position) :
+        omega_(4.0 / (options.vcm_damping * options.vcm_settle)), damping_(options.vcm_damping),
+        position_(position), velocity_(0), target_(position), time_(0), overshoot_(0) {
+    }
+
+    void moveTo(gdouble time, gint focus_index) {
+        advanceTo(time);
+        target_ = focus_index;
+        travel_direction_ = (target_ > position_) ? 1 : -1;
+    }
+
+    gdouble positionAt(gdouble time) {
+        advanceTo(time);
+        return position_;
+    }
+
+    gdouble overshoot() const { return overshoot_; }
+
+private:
+    void advanceTo(gdouble time) {
+        const gdouble dt = 0.05;
+        while (time_ + dt <= time) {
+            gdouble acceleration = omega_ * omega_ * (target_ - position_) - 2.0 * damping_ * omega_ * velocity_;
+            velocity_ += acceleration * dt;
+            position_ += velocity_ * dt;
+            time_ += dt;
+            overshoot_ = MAX(overshoot_, travel_direction_ * (position_ - target_));
+        }
+    }
+
+    gdouble omega_;
+    gdouble damping_;
+    gdouble position_;
+    gdouble velocity_;
+    gdouble target_;
+    gdouble time_;
+    gdouble overshoot_;
+    gint travel_direction_ = 1;
+};
+
+/**
+* One depth plane of a scene. Pixels are premultiplied by alpha, so a layer that
+* only covers part of the frame blurs into the layers behind it.
+*/
+struct SceneLayer {
+    std::vector<gfloat> pixels;
+    std::vector<gfloat> alpha;
+    gint depth_offset; //Focus index relative to the subject
+    std::map<gint, std::vector<gfloat>> blurred_pixels;
+    std::map<gint, std::vector<gfloat>> blurred_alpha;
+};
+
+struct Scene {
+    std::string name;
+    std::vector<SceneLayer> layers; //Front to back, the subject first
+    gfloat noise_sigma;
+};
+
+/**
+* Separable Gaussian blur with clamped edges.
+*/
+static std::vector<gfloat> gaussianBlur(const std::vector<gfloat>& source, gfloat sigma)
+{
+    if (sigma < 0.05f)
+        return source;
+
+    gint radius = (gint)ceilf(3.0f * sigma);
+    std::vector<gfloat> weights(2 * radius + 1);
+    gfloat total = 0;
+    for (gint i = -radius; i <= radius; ++i)
+        total += weights[i + radius] = expf(-(gfloat)(i * i) / (2.0f * sigma * sigma));
+    for (auto& weight : weights)
+        weight /= total;
+
+    std::vector<gfloat> horizontal(source.size());
+    std::vector<gfloat> result(source.size());
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x) {
+            gfloat value = 0;
+            for (gint i = -radius; i <= radius; ++i)
+                value += weights[i + radius] * source[y * FRAME_WIDTH + CLAMP(x + i, 0, FRAME_WIDTH - 1)];
+            horizontal[y * FRAME_WIDTH + x] = value;
+        }
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x) {
+            gfloat value = 0;
+            for (gint i = -radius; i <= radius; ++i)
+                value += weights[i + radius] * horizontal[CLAMP(y + i, 0, FRAME_HEIGHT - 1) * FRAME_WIDTH + x];
+            result[y * FRAME_WIDTH + x] = value;
+        }
+    return result;
+}
+
+static SceneLayer makeLayer(const std::vector<gfloat>& pixels, gint depth_offset)
+{
+    SceneLayer layer;
+    layer.pixels = pixels;
+    layer.alpha.assign(pixels.size(), 1.0f);
+    layer.depth_offset = depth_offset;
+    return layer;
+}
+
+static std::vector<gfloat> makeTexturePixels(guint seed)
+{
+    std::vector<gfloat> pixels(FRAME_WIDTH * FRAME_HEIGHT);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<gfloat> dist(20, 235);
+
+    for (auto& pixel : pixels)
+        pixel = dist(rng);
+    return pixels;
+}
+
+static Scene makeTexture()
+{
+    Scene scene = { "texture", {}, 1.5f };
+    scene.layers.push_back(makeLayer(makeTexturePixels(42), 0));
+    return scene;
+}
+
+/**
+* Dim, hazy and low in contrast: soft blobs a few grey levels above a sloping
+* background, like silt on the bottom of the tank, with plenty of sensor noise.
+*/
+static Scene makeUnderwater()
+{
+    Scene scene = { "underwater", {}, 3.0f };
+    std::vector<gfloat> pixels(FRAME_WIDTH * FRAME_HEIGHT);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<gfloat> position(0, 1);
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            pixels[y * FRAME_WIDTH + x] = 60.0f + 20.0f * y / FRAME_HEIGHT;
+
+    for (gint blob = 0; blob < 400; ++blob) {
+        gfloat cx = position(rng) * FRAME_WIDTH;
+        gfloat cy = position(rng) * FRAME_HEIGHT;
+        gfloat radius = 1.0f + position(rng) * 3.0f;
+        gfloat level = 6.0f + position(rng) * 10.0f;
+
+        for (gint y = MAX(0, (gint)(cy - radius)); y <= MIN(FRAME_HEIGHT - 1, (gint)(cy + radius)); ++y)
+            for (gint x = MAX(0, (gint)(cx - radius)); x <= MIN(FRAME_WIDTH - 1, (gint)(cx + radius)); ++x)
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= radius * radius)
+                    pixels[y * FRAME_WIDTH + x] += level;
+    }
+    scene.layers.push_back(makeLayer(pixels, 0));
+    return scene;
+}
+
+/**
+* A textured disc filling most of the ROI, in front of a high contrast background
+* further away. A metric that favours the background pulls focus off the subject.
+*/
+static Scene makeTwoPlane()
+{
+    Scene scene = { "two-plane", {}, 1.5f };
+    std::vector<gfloat> background(FRAME_WIDTH * FRAME_HEIGHT);
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            background[y * FRAME_WIDTH + x] = (((x / 4) + (y / 4)) & 1) ? 200.0f : 50.0f;
+
+    SceneLayer subject = makeLayer(makeTexturePixels(3), 0);
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x) {
+            gint dx = x - FRAME_WIDTH / 2;
+            gint dy = y - FRAME_HEIGHT / 2;
+            gfloat alpha = ((dx * dx + dy * dy) <= (80 * 80)) ? 1.0f : 0.0f;
+            subject.alpha[y * FRAME_WIDTH + x] = alpha;
+            subject.pixels[y * FRAME_WIDTH + x] *= alpha;
+        }
+
+    scene.layers.push_back(subject);
+    scene.layers.push_back(makeLayer(background, -150));
+    return scene;
+}
+
+static Scene makeBars()
+{
+    Scene scene = { "bars", {}, 1.5f };
+    std::vector<gfloat> pixels(FRAME_WIDTH * FRAME_HEIGHT);
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            pixels[y * FRAME_WIDTH + x] = (((x / 6) + (y / 24)) & 1) ? 180.0f : 70.0f;
+    scene.layers.push_back(makeLayer(pixels, 0));
+    return scene;
+}
+
+/**
+* Load a recorded 8 bit binary PGM (P5) as a single plane scene, scaled to the
+* simulation frame size by nearest neighbour.
+*
+* @return : FALSE with error set if the file can not be read.
+*/
+static gboolean loadPgm(const gchar* filename, Scene* scene, GError** error)
+{
+    gchar* contents;
+    gsize length;
+    gint width = 0, height = 0, max_value = 0, consumed = 0;
+
+    if (!g_file_get_contents(filename, &contents, &length, error))
+        return FALSE;
+
+    if ((sscanf(contents, "P5 %d %d %d%n", &width, &height, &max_value, &consumed) != 3) ||
+        (max_value != 255) || (width <= 0) || (height <= 0) ||
+        ((gsize)consumed + 1 + (gsize)width * height > length)) {
+        g_set_error(error, g_quark_from_static_string("cdafSim"), 1,
+            "'%s' is not an 8 bit binary PGM", filename);
+        g_free(contents);
+        return FALSE;
+    }
+
+    const guint8* data = (const guint8*)contents + consumed + 1;
+    std::vector<gfloat> pixels(FRAME_WIDTH * FRAME_HEIGHT);
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            pixels[y * FRAME_WIDTH + x] = data[(y * height / FRAME_HEIGHT) * width + (x * width / FRAME_WIDTH)];
+
+    gchar* name = g_path_get_basename(filename);
+    scene->name = name;
+    scene->layers.clear();
+    scene->layers.push_back(makeLayer(pixels, 0));
+    scene->noise_sigma = 1.5f;
+    g_free(name);
+    g_free(contents);
+    return TRUE;
+}
+
+/**
+* Render the focus frame the camera would capture with the lens moving from
+* lens_start to lens_end during the exposure, then add sensor noise. Drawing
+* Gaussian noise per pixel costs more than the rest of the simulation, so the
+* noise comes from a bank drawn once, starting at a random offset each frame.
+*/
+static void renderFrame(Scene& scene, const SimOptions& options, gint subject_index,
+    gdouble lens_start, gdouble lens_end, const std::vector<gfloat>& noise, std::mt19937& rng,
+    std::vector<guint8>& frame)
+{
+    std::vector<gfloat> composite(FRAME_WIDTH * FRAME_HEIGHT, 0.0f);
+    std::vector<gfloat> coverage(FRAME_WIDTH * FRAME_HEIGHT, 0.0f); //Alpha already laid down in front
+    gsize offset = std::uniform_int_distribution<gsize>(0, noise.size() - 1)(rng);
+    gdouble lens = (lens_start + lens_end) / 2;
+    gdouble smear = options.blur_rate * fabs(lens_end - lens_start) / 2;
+
+    for (SceneLayer& layer : scene.layers) {
+        gdouble defocus = MAX(0.0, fabs(lens - (subject_index + layer.depth_offset)) - options.depth_of_field);
+        gdouble sigma = MIN(sqrt(pow(options.blur_rate * defocus, 2) + smear * smear), (gdouble)MAX_BLUR_SIGMA);
+        gint key = (gint)lround(sigma * BLUR_QUANTUM);
+
+        if (!layer.blurred_pixels.count(key)) {
+            layer.blurred_pixels[key] = gaussianBlur(layer.pixels, (gfloat)key / BLUR_QUANTUM);
+            layer.blurred_alpha[key] = gaussianBlur(layer.alpha, (gfloat)key / BLUR_QUANTUM);
+        }
+        const std::vector<gfloat>& pixels = layer.blurred_pixels[key];
+        const std::vector<gfloat>& alpha = layer.blurred_alpha[key];
+
+        for (gsize p = 0; p < composite.size(); ++p) {
+            composite[p] += (1.0f - coverage[p]) * pixels[p];
+            coverage[p] += (1.0f - coverage[p]) * alpha[p];
+        }
+    }
+
+    frame.resize(composite.size());
+    for (gsize p = 0; p < composite.size(); ++p)
+        frame[p] = (guint8)CLAMP(lroundf(composite[p] + scene.noise_sigma * noise[(offset + p) % noise.size()]), 0, 255);
+}
+
+/**
+* What one run measured.
+*/
+struct SimResult {
+    gboolean locked = FALSE;
+    gint frames_to_focus = 0;
+    gdouble time_to_focus = 0;     //ms
+    gint focus_error = 0;          //focus indices between the lens and the subject at lock
+    gfloat focus_value = 0;        //focus value at lock, what AF_Additions puts in the focus memory
+    gdouble overshoot = 0;         //furthest the VCM went past a target, in focus indices
+    gint full_rescans = 0;         //full range scans after the first
+    gint detail_rescans = 0;       //detail scans after the first
+    gint drift_rescans = 0;        //times a held focus was given up during the hold
+    gint avoided_rescans = 0;      //times the old single frame 10% check would have given it up
+    gint refocus_frames = 0;       //frames from the subject moving to the next lock
+    gdouble refocus_time = -1;     //ms from the subject moving to the next lock, -1 if it never did
+    gint final_error = 0;          //focus indices between the lens and the subject at the end
+};
+
+/**
+* Stands in for AF_Additions. It gets the same focusAchieved and setScanning calls from
+* CDAF and runs the same drift check, on a simulated clock instead of the GLib main loop.
+*/
+class SimulatedCamera : public FocusInterface {
+public:
+    SimulatedCamera(Scene& scene, const SimOptions& options, gint subject_index, guint seed,
+        guint start_index = START_FOCUS_INDEX) :
+        scene_(scene), options_(options), subject_index_(subject_index), rng_(seed),
+        vcm_(options, start_index), now_(0), focussed_(FALSE), scanning_(FALSE), sweeping_(FALSE),
+        next_tick_(0), ramp_start_(0), ramp_next_(0), focus_frame_timeout_(0), lens_index_(start_index), focus_value_(0),
+        focussed_value_(0), lock_count_(0) {
+        std::normal_distribution<gfloat> noise(0, 1);
+
+        drift_detector_.setSensitivity(options.drift_slack, options.drift_threshold, options.drift_noise_floor);
+
+        noise_.resize(NOISE_FRAMES * FRAME_WIDTH * FRAME_HEIGHT);
+        for (auto& sample : noise_)
+            sample = noise(rng_);
+    }
+
+    void focusAchieved() override {
+        focussed_value_ = focus_value_;
+        focussed_ = TRUE;
+        drift_detector_.reset(focus_value_);
+        ++lock_count_;
+    }
+
+    void setScanning(gboolean value, guint timeout) override {
+        scanning_ = value;
+        focus_frame_timeout_ = timeout;
+    }
+
+    void setSweeping(gboolean value) override {
+        sweeping_ = value;
+        next_tick_ = now_; //The first sweep tick follows the step that started it
+    }
+
+    SimResult run(const FocusMemory* memory = nullptr);
+    LensSettleModel calibrateSettle();
+
+private:
+    static void lensMovedWrapper(gint focus_index, gpointer user_data);
+    void lensMoved(gint focus_index);
+    static void lensRampWrapper(const gint* points, guint count, gpointer user_data);
+    void lensRamp(const gint* points, guint count);
+    gdouble sweepLensTo(const CDAF& focus_machine, gdouble time);
+
+    Scene& scene_;
+    const SimOptions& options_;
+    gint subject_index_;
+    std::mt19937 rng_;
+    std::vector<gfloat> noise_; //Unit Gaussian sensor noise
+    Vcm vcm_;
+    gdouble now_;
+    gboolean focussed_;
+    gboolean scanning_;
+    gboolean sweeping_;
+    gdouble next_tick_;
+    std::vector<gint> ramp_; //Ramp positions still to reach the lens, one per LENS_RAMP_TICK_MS
+    gdouble ramp_start_; //When the first of them was written
+    guint ramp_next_;
+    guint focus_frame_timeout_;
+    guint lens_index_; //Where the lens was last sent
+    gfloat focus_value_;
+    gfloat focussed_value_;
+    gint lock_count_;
+    FocusDriftDetector drift_detector_;
+};
+
+/**
+* CALLBACK FUNCTION. CDAF::applyFocus has written a focus index to the simulated CameraI2CDevice.
+*/
+void SimulatedCamera::lensMovedWrapper(gint focus_index, gpointer user_data)
+{
+    static_cast<SimulatedCamera*>(user_data)->lensMoved(focus_index);
+}
+
+void SimulatedCamera::lensMoved(gint focus_index)
+{
+    for (; (ramp_next_ < ramp_.size()) && (ramp_start_ + ramp_next_ * LENS_RAMP_TICK_MS <= now_); ++ramp_next_)
+        vcm_.moveTo(ramp_start_ + ramp_next_ * LENS_RAMP_TICK_MS, ramp_[ramp_next_]);
+    ramp_.clear(); //A newer move cuts a ramp short, as on the I2C worker
+    vcm_.moveTo(now_, focus_index);
+    lens_index_ = focus_index;
+}
+
+/**
+* CALLBACK FUNCTION. CDAF::applyFocus has asked the simulated CameraI2CDevice for a ramp.
+*/
+void SimulatedCamera::lensRampWrapper(const gint* points, guint count, gpointer user_data)
+{
+    static_cast<SimulatedCamera*>(user_data)->lensRamp(points, count);
+}
+
+void SimulatedCamera::lensRamp(const gint* points, guint count)
+{
+    ramp_.assign(points, points + count);
+    ramp_start_ = now_;
+    ramp_next_ = 0;
+    lens_index_ = points[count - 1];
+}
+
+/**
+* The lens position at a time, with every sweep tick and ramp position up to then applied first,
+* as AF_Additions::sweepFocus and the I2C worker would have.
+*/
+gdouble SimulatedCamera::sweepLensTo(const CDAF& focus_machine, gdouble time)
+{
+    for (; sweeping_ && (next_tick_ <= time); next_tick_ += SWEEP_TICK_MS)
+        vcm_.moveTo(next_tick_, focus_machine.sweepPosition((gint64)(next_tick_ * 1000)));
+    for (; (ramp_next_ < ramp_.size()) && (ramp_start_ + ramp_next_ * LENS_RAMP_TICK_MS <= time); ++ramp_next_)
+        vcm_.moveTo(ramp_start_ + ramp_next_ * LENS_RAMP_TICK_MS, ramp_[ramp_next_]);
+    return vcm_.positionAt(time);
+}
+
+/**
+* Run the focus loop until it locks, then for the hold time after that. With a focus memory
+* the camera must have been made with the lens at its focus index, and CDAF warm starts there.
+*/
+SimResult SimulatedCamera::run(const FocusMemory* memory)
+{
+    SimResult result;
+    ErrorHandler error_handler(nullptr);
+    CDAF focus_machine(this, &error_handler, options_.tuning);
+    std::unique_ptr<FocusMetric> metric(FocusMetric::create((FocusMetricType)options_.metric));
+    const FocusRoi roi = { (FRAME_WIDTH - ROI_SIZE) / 2, (FRAME_HEIGHT - ROI_SIZE) / 2, ROI_SIZE, ROI_SIZE };
+    std::vector<guint8> frame;
+    FocusStateId last_state = focus_machine.stateId();
+    gint full_scans = 0, detail_scans = 0, frames = 0, move_frame = 0;
+    gdouble next_trigger = 0, end_time = options_.duration, move_time = -1, exposure_start = 0;
+
+    LensSim::setMoveHandler(lensMovedWrapper, this);
+    LensSim::setRampHandler(lensRampWrapper, this);
+    if ((memory) && (memory->valid()))
+        focus_machine.warmStart(memory->focusIndex(), memory->focusValue(), memory->span());
+    focus_machine.setFocus(lens_index_, nullptr); //As AF_Additions::setup, so the first ramp knows where it starts
+
+    while (now_ < end_time) {
+        //The valve opens at the trigger, the next frame to start exposing is the focus frame.
+        //While sweeping the valve stays open and every frame comes through.
+        if (sweeping_)
+            exposure_start += options_.frame_interval;
+        else
+            exposure_start = ceil(next_trigger / options_.frame_interval) * options_.frame_interval;
+        gdouble lens_start = sweepLensTo(focus_machine, exposure_start);
+        gdouble lens_end = sweepLensTo(focus_machine, exposure_start + options_.exposure);
+
+        renderFrame(scene_, options_, subject_index_, lens_start, lens_end, noise_, rng_, frame);
+        now_ = exposure_start + options_.frame_interval + options_.latency;
+        ++frames;
+
+        LumaPlane plane = { frame.data(), FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH };
+        focus_value_ = metric->measure(plane, roi);
+
+        //Flicker only hits the held focus frames, so the searches stay comparable
+        if ((focussed_) && (std::uniform_real_distribution<gdouble>(0, 100)(rng_) < options_.flicker))
+            focus_value_ *= 1.0f + std::uniform_real_distribution<gfloat>(-FLICKER_RANGE, FLICKER_RANGE)(rng_);
+
+        //From here on this is AF_Additions::processFocusFrame
+        if (focussed_) {
+            if (drift_detector_.update(focus_value_)) {
+                focussed_ = FALSE;
+                if (move_time < 0)
+                    ++result.drift_rescans;
+            }
+        }
+
+        if (!focussed_) {
+            gint locks = lock_count_;
+            guint from_index = lens_index_;
+            guint ramp = 0;
+
+            focus_machine.stepFocus(focus_value_, (gint64)(exposure_start * 1000));
+            if (!sweeping_) {
+                focus_machine.applyFocus(focus_machine.focusIndex);
+                ramp = focus_machine.rampTime();
+            }
+
+            FocusStateId state = focus_machine.stateId();
+            if ((state != last_state) &&
+                ((state == FOCUS_STATE_START_SCAN_FOCUS_IN) || (state == FOCUS_STATE_START_SWEEP) ||
+                (state == FOCUS_STATE_START_BRACKET_SCAN)))
+                ++full_scans;
+            if ((state != last_state) && (state == FOCUS_STATE_START_DETAIL_SCAN))
+                ++detail_scans;
+            last_state = state;
+
+            if (lock_count_ > locks) {
+                gint error = (gint)focus_machine.focusIndex - subject_index_;
+
+                if (!result.locked) {
+                    result.locked = TRUE;
+                    result.frames_to_focus = frames;
+                    result.time_to_focus = now_;
+                    result.focus_error = error;
+                    result.focus_value = focussed_value_;
+                    end_time = now_ + options_.hold;
+                }
+                else if ((move_time >= 0) && (result.refocus_time < 0)) {
+                    result.refocus_frames = frames - move_frame;
+                    result.refocus_time = now_ - move_time;
+                }
+            }
+            next_trigger = (focussed_ || scanning_ || ramp) ?
+                now_ + ramp + options_.settle_model.frameWait(focus_frame_timeout_, from_index, lens_index_) : now_;
+        }
+        else {
+            next_trigger = now_ + DRIFT_RECHECK_MS;
+        }
+
+        //Half way through the hold the subject moves, if asked to
+        if (result.locked && (options_.move_by != 0) && (move_time < 0) &&
+            (now_ >= end_time - options_.hold / 2)) {
+            subject_index_ = CLAMP(subject_index_ + options_.move_by, MIN_FOCUS_INDEX, MAX_FOCUS_INDEX);
+            move_time = now_;
+            move_frame = frames;
+            end_time = MAX(end_time, now_ + options_.duration / 2);
+        }
+        if ((move_time >= 0) && (result.refocus_time >= 0))
+            break;
+    }
+
+    LensSim::setMoveHandler(nullptr, nullptr);
+    LensSim::setRampHandler(nullptr, nullptr);
+
+    result.overshoot = vcm_.overshoot();
+    result.avoided_rescans = (gint)drift_detector_.getStats().avoided;
+    result.full_rescans = MAX(full_scans - 1, 0);
+    result.detail_rescans = MAX(detail_scans - 1, 0);
+    result.final_error = (gint)focus_machine.focusIndex - subject_index_;
+    return result;
+}
+
+/**
+* Measure a lens settle model on the simulated lens, as AF_Additions does on the camera after
+* the first focus lock. The subject is taken as focussed, every frame goes to the calibration
+* and the lens moves as soon as it asks.
+*/
+LensSettleModel SimulatedCamera::calibrateSettle()
+{
+    LensSettleCalibration calibration;
+    std::unique_ptr<FocusMetric> metric(FocusMetric::create((FocusMetricType)options_.metric));
+    const FocusRoi roi = { (FRAME_WIDTH - ROI_SIZE) / 2, (FRAME_HEIGHT - ROI_SIZE) / 2, ROI_SIZE, ROI_SIZE };
+    std::vector<guint8> frame;
+    gdouble exposure_start = now_;
+    guint next_index;
+
+    calibration.start(subject_index_, &next_index);
+    vcm_.moveTo(now_, next_index);
+    calibration.lensMoved((gint64)(now_ * 1000));
+
+    while (calibration.running()) {
+        gdouble lens_start = vcm_.positionAt(exposure_start);
+        gdouble lens_end = vcm_.positionAt(exposure_start + options_.exposure);
+
+        renderFrame(scene_, options_, subject_index_, lens_start, lens_end, noise_, rng_, frame);
+        now_ = exposure_start + options_.frame_interval + options_.latency;
+
+        LumaPlane plane = { frame.data(), FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH };
+        if (calibration.step(metric->measure(plane, roi), (gint64)(exposure_start * 1000), &next_index)) {
+            vcm_.moveTo(now_, next_index);
+            calibration.lensMoved((gint64)(now_ * 1000));
+        }
+        exposure_start += options_.frame_interval;
+    }
+
+    return calibration.model();
+}
+
+static void quietPrint(const gchar*)
+{
+}
+
+static void printResult(const gchar* label, gint subject, const SimResult& result, const SimOptions& options)
+{
+    g_print("%-12s %7d %7d %9.0f %6d %9.1f %6d %6d %6d", label, subject,
+        result.frames_to_focus, result.time_to_focus, result.focus_error, result.overshoot,
+        result.full_rescans, result.detail_rescans, result.drift_rescans);
+    if (options.move_by == 0)
+        g_print("\n");
+    else if (result.refocus_time < 0)
+        g_print(" %10s\n", "never");
+    else
+        g_print(" %10.0f\n", result.refocus_time);
+}
+
+int main(int argc, char* argv[])
+{
+    SimOptions options;
+    gint transit_step = options.tuning.transitStep, coarse_step = options.tuning.coarseStep;
+    gint detail_step = options.tuning.detailStep, drift_step = options.tuning.driftStep;
+    gint coarse_timeout = options.tuning.coarseTimeout, detail_timeout = options.tuning.detailTimeout;
+    gint transit_timeout = options.tuning.transitTimeout, settle_timeout = options.tuning.settleTimeout;
+    gint drift_timeout = options.tuning.driftTimeout;
+    gint search_mode = options.tuning.searchMode, confirm_step = options.tuning.confirmStep;
+    gint scan_mode = options.tuning.scanMode, sweep_rate = options.tuning.sweepRate;
+    gint sweep_lag = options.tuning.sweepLag, bracket_step = options.tuning.bracketStep;
+    gint noise_tolerance = options.tuning.noiseTolerance;
+    gchar* scene_file = nullptr;
+    gchar* settle_file = nullptr;
+    gboolean settle_calibrate = FALSE;
+    gboolean warm_start = FALSE;
+    gint warm_offset = 0;
+    GError* error = nullptr;
+
+    GOptionEntry entries[] = {
+        {"transit-step", 0, 0, G_OPTION_ARG_INT, &transit_step, "Lens travel per frame between scans, 0 ramps there in one move", "N"},
+        {"coarse-step", 0, 0, G_OPTION_ARG_INT, &coarse_step, "Full range scan step", "N"},
+        {"detail-step", 0, 0, G_OPTION_ARG_INT, &detail_step, "Detail scan step", "N"},
+        {"drift-step", 0, 0, G_OPTION_ARG_INT, &drift_step, "Drift following step", "N"},
+        {"coarse-timeout", 0, 0, G_OPTION_ARG_INT, &coarse_timeout, "ms between frames on a full range scan", "MS"},
+        {"detail-timeout", 0, 0, G_OPTION_ARG_INT, &detail_timeout, "ms between frames on a detail scan", "MS"},
+        {"transit-timeout", 0, 0, G_OPTION_ARG_INT, &transit_timeout, "ms between frames outside a scan", "MS"},
+        {"settle-timeout", 0, 0, G_OPTION_ARG_INT, &settle_timeout, "ms allowed to settle on the focus point", "MS"},
+        {"drift-timeout", 0, 0, G_OPTION_ARG_INT, &drift_timeout, "ms between frames following drift", "MS"},
+        {"search", 0, 0, G_OPTION_ARG_INT, &search_mode, "Peak search, (0): detail scan (1): curve fit", "N"},
+        {"confirm-step", 0, 0, G_OPTION_ARG_INT, &confirm_step, "Curve fit check frame offset", "N"},
+        {"scan", 0, 0, G_OPTION_ARG_INT, &scan_mode, "Full range search, (0): stepped (1): sweep (2): golden section", "N"},
+        {"sweep-rate", 0, 0, G_OPTION_ARG_INT, &sweep_rate, "Focus indices per second when sweeping", "N"},
+        {"sweep-lag", 0, 0, G_OPTION_ARG_INT, &sweep_lag, "ms the lens lags the sweep, less half the exposure", "MS"},
+        {"bracket-step", 0, 0, G_OPTION_ARG_INT, &bracket_step, "Golden section bracket scan step on a flat curve", "N"},
+        {"noise-tolerance", 0, 0, G_OPTION_ARG_INT, &noise_tolerance, "% focus value difference golden section treats as noise", "PCT"},
+        {"settle", 0, 0, G_OPTION_ARG_FILENAME, &settle_file, "Lens settle model to wait for after each move, as nvgstcapture-1.0 --focus-settle", "FILE"},
+        {"settle-calibrate", 0, 0, G_OPTION_ARG_NONE, &settle_calibrate, "Measure the lens settle model on the simulated lens first, saved to --settle", nullptr},
+        {"frame-interval", 0, 0, G_OPTION_ARG_DOUBLE, &options.frame_interval, "ms between camera frames", "MS"},
+        {"exposure", 0, 0, G_OPTION_ARG_DOUBLE, &options.exposure, "Exposure time in ms", "MS"},
+        {"latency", 0, 0, G_OPTION_ARG_DOUBLE, &options.latency, "ms from end of frame to focus value", "MS"},
+        {"vcm-settle", 0, 0, G_OPTION_ARG_DOUBLE, &options.vcm_settle, "VCM 2% settling time in ms", "MS"},
+        {"vcm-damping", 0, 0, G_OPTION_ARG_DOUBLE, &options.vcm_damping, "VCM damping ratio, below 1 rings", "Z"},
+        {"blur-rate", 0, 0, G_OPTION_ARG_DOUBLE, &options.blur_rate, "Blur sigma in pixels per focus index", "R"},
+        {"depth-of-field", 0, 0, G_OPTION_ARG_DOUBLE, &options.depth_of_field, "Focus indices either side that are sharp", "N"},
+        {"hold", 0, 0, G_OPTION_ARG_DOUBLE, &options.hold, "ms to keep running after focus locks", "MS"},
+        {"warm-start", 0, 0, G_OPTION_ARG_NONE, &warm_start, "Follow each run with a warm start from where it locked", nullptr},
+        {"warm-offset", 0, 0, G_OPTION_ARG_INT, &warm_offset, "Move the subject by N focus indices before the warm start", "N"},
+        {"flicker", 0, 0, G_OPTION_ARG_DOUBLE, &options.flicker, "% of held focus frames thrown out by flicker or splashing", "PCT"},
+        {"drift-threshold", 0, 0, G_OPTION_ARG_DOUBLE, &options.drift_threshold, "Sustained drift that loses focus, as nvgstcapture-1.0 --focus-drift-threshold", "SIGMA"},
+        {"drift-slack", 0, 0, G_OPTION_ARG_DOUBLE, &options.drift_slack, "Drift check slack, as nvgstcapture-1.0 --focus-drift-slack", "SIGMA"},
+        {"drift-noise-floor", 0, 0, G_OPTION_ARG_DOUBLE, &options.drift_noise_floor, "Drift check noise floor, as nvgstcapture-1.0 --focus-drift-noise-floor", "PCT"},
+        {"move-by", 0, 0, G_OPTION_ARG_INT, &options.move_by, "Move the subject by N focus indices during the hold", "N"},
+        {"duration", 0, 0, G_OPTION_ARG_DOUBLE, &options.duration, "ms before a run is given up", "MS"},
+        {"focus-metric", 0, 0, G_OPTION_ARG_INT, &options.metric, "Focus metric, as nvgstcapture-1.0 --focus-metric", "N"},
+        {"scene-file", 0, 0, G_OPTION_ARG_FILENAME, &scene_file, "Also run a recorded 8 bit binary PGM", "FILE"},
+        {"verbose", 'v', 0, G_OPTION_ARG_NONE, &options.verbose, "Show the state machine output", nullptr},
+        {nullptr, 0, 0, G_OPTION_ARG_NONE, nullptr, nullptr, nullptr}
+    };
+
+    GOptionContext* context = g_option_context_new("- simulate CDAF autofocus convergence");
+    g_option_context_add_main_entries(context, entries, nullptr);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    options.tuning.transitStep = MAX(transit_step, 0);
+    options.tuning.coarseStep = MAX(coarse_step, 1);
+    options.tuning.detailStep = MAX(detail_step, 1);
+    options.tuning.driftStep = MAX(drift_step, 1);
+    options.tuning.coarseTimeout = MAX(coarse_timeout, 0);
+    options.tuning.detailTimeout = MAX(detail_timeout, 0);
+    options.tuning.transitTimeout = MAX(transit_timeout, 0);
+    options.tuning.settleTimeout = MAX(settle_timeout, 0);
+    options.tuning.driftTimeout = MAX(drift_timeout, 0);
+    options.tuning.searchMode = (search_mode == FOCUS_SEARCH_CURVE_FIT) ? FOCUS_SEARCH_CURVE_FIT : FOCUS_SEARCH_DETAIL_SCAN;
+    options.tuning.confirmStep = MAX(confirm_step, 1);
+    options.tuning.scanMode = ((scan_mode >= 0) && (scan_mode < FOCUS_SCAN_COUNT)) ? scan_mode : FOCUS_SCAN_STEPPED;
+    options.tuning.sweepRate = MAX(sweep_rate, 1);
+    options.tuning.sweepLag = MAX(sweep_lag, 0);
+    options.tuning.bracketStep = MAX(bracket_step, 1);
+    options.tuning.noiseTolerance = MAX(noise_tolerance, 0);
+    options.vcm_damping = CLAMP(options.vcm_damping, 0.05, 2.0);
+    options.vcm_settle = MAX(options.vcm_settle, 1.0);
+    if ((options.metric < 0) || (options.metric >= FOCUS_METRIC_COUNT))
+        options.metric = FOCUS_METRIC_LAPLACIAN_MEAN;
+
+    std::vector<Scene> scenes = { makeTexture(), makeUnderwater(), makeTwoPlane(), makeBars() };
+    if (scene_file) {
+        Scene recorded;
+        if (!loadPgm(scene_file, &recorded, &error)) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            g_free(scene_file);
+            return 1;
+        }
+        scenes.push_back(recorded);
+        g_free(scene_file);
+    }
+
+    if (settle_calibrate) {
+        SimulatedCamera camera(scenes.front(), options, 450, 0);
+        GPrintFunc print_handler = options.verbose ? nullptr : g_set_print_handler(quietPrint);
+
+        options.settle_model = camera.calibrateSettle();
+        if (!options.verbose)
+            g_set_print_handler(print_handler);
+        if ((settle_file) && ((options.settle_model.save(settle_file, &error)) == -1)) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            g_free(settle_file);
+            return 1;
+        }
+    }
+    else if ((settle_file) && ((options.settle_model.load(settle_file, &error)) == -1)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_free(settle_file);
+        return 1;
+    }
+    g_free(settle_file);
+
+    const gint subjects[] = { 150, 450, 750 };
+    gint runs = 0, locked = 0, total_frames = 0, total_rescans = 0, total_drift = 0, total_avoided = 0, worst_error = 0;
+    gdouble total_time = 0, total_error = 0;
+    gint warm_runs = 0, warm_locked = 0, warm_frames = 0;
+    gdouble warm_time = 0, warm_error = 0;
+
+    g_print("Steps %u/%u/%u/%u (transit/coarse/detail/drift), timeouts %u/%u/%u/%u/%u ms "
+        "(coarse/detail/transit/settle/drift)\n", options.tuning.transitStep, options.tuning.coarseStep,
+        options.tuning.detailStep, options.tuning.driftStep, options.tuning.coarseTimeout,
+        options.tuning.detailTimeout, options.tuning.transitTimeout, options.tuning.settleTimeout,
+        options.tuning.driftTimeout);
+    if (options.tuning.scanMode == FOCUS_SCAN_SWEEP)
+        g_print("Full range: sweep at %u indices/s, %u ms lag\n", options.tuning.sweepRate, options.tuning.sweepLag);
+    else if (options.tuning.scanMode == FOCUS_SCAN_GOLDEN_SECTION)
+        g_print("Full range: golden section, %u bracket step, %u%% noise tolerance\n", options.tuning.bracketStep,
+            options.tuning.noiseTolerance);
+    else
+        g_print("Full range: stepped scans in and out\n");
+    if (options.tuning.scanMode != FOCUS_SCAN_GOLDEN_SECTION)
+        g_print("Peak search: %s\n", (options.tuning.searchMode == FOCUS_SEARCH_CURVE_FIT) ? "curve fit" : "detail scan");
+    g_print("VCM settle %.1f ms damping %.2f, %.1f ms frames, %s\n", options.vcm_settle,
+        options.vcm_damping, options.frame_interval, FocusMetric::typeName((FocusMetricType)options.metric));
+    g_print("Drift check %.1f sigma threshold, %.1f sigma slack, %.1f%% noise floor, %.0f%% of held frames flicker\n",
+        options.drift_threshold, options.drift_slack, options.drift_noise_floor, options.flicker);
+    if (options.settle_model.calibrated())
+        options.settle_model.print();
+    if (warm_start)
+        g_print("Warm start from each lock, subject moved by %d\n", warm_offset);
+    g_print("\n");
+    g_print("%-12s %7s %7s %9s %6s %9s %6s %6s %6s %10s\n", "scene", "subject", "frames", "time ms",
+        "error", "overshoot", "full", "detail", "drift", options.move_by ? "refocus ms" : "");
+
+    for (Scene& scene : scenes) {
+        for (gint subject : subjects) {
+            SimulatedCamera camera(scene, options, subject, (guint)(runs + 1));
+            GPrintFunc print_handler = options.verbose ? nullptr : g_set_print_handler(quietPrint);
+            SimResult result = camera.run();
+            if (!options.verbose)
+                g_set_print_handler(print_handler);
+
+            ++runs;
+            if (!result.locked) {
+                g_print("%-12s %7d %7s\n", scene.name.c_str(), subject, "no lock");
+                continue;
+            }
+
+            ++locked;
+            total_frames += result.frames_to_focus;
+            total_time += result.time_to_focus;
+            total_error += abs(result.focus_error);
+            total_rescans += result.full_rescans + result.detail_rescans;
+            total_drift += result.drift_rescans;
+            total_avoided += result.avoided_rescans;
+            worst_error = MAX(worst_error, abs(result.focus_error));
+
+            printResult(scene.name.c_str(), subject, result, options);
+
+            if (!warm_start)
+                continue;
+
+            //As the next run of nvgstcapture-1.0 would, start from the focus memory of this one
+            FocusMemory memory;
+            gint warm_subject = CLAMP(subject + warm_offset, MIN_FOCUS_INDEX, MAX_FOCUS_INDEX);
+
+            memory.remember(subject + result.focus_error, result.focus_value);
+            SimulatedCamera warm_camera(scene, options, warm_subject, (guint)(runs + 1000), memory.focusIndex());
+            print_handler = options.verbose ? nullptr : g_set_print_handler(quietPrint);
+            SimResult warm_result = warm_camera.run(&memory);
+            if (!options.verbose)
+                g_set_print_handler(print_handler);
+
+            ++warm_runs;
+            if (!warm_result.locked) {
+                g_print("%-12s %7d %7s\n", "  warm start", warm_subject, "no lock");
+                continue;
+            }
+
+            ++warm_locked;
+            warm_frames += warm_result.frames_to_focus;
+            warm_time += warm_result.time_to_focus;
+            warm_error += abs(warm_result.focus_error);
+            printResult("  warm start", warm_subject, warm_result, options);
+        }
+    }
+
+    g_print("\n%d of %d runs locked", locked, runs);
+    if (locked)
+        g_print(": mean %.1f frames, %.0f ms, |error| %.1f (worst %d), %d rescans, %d drift rescans (%d avoided)",
+            (gdouble)total_frames / locked, total_time / locked, total_error / locked, worst_error,
+            total_rescans, total_drift, total_avoided);
+    g_print("\n");
+    if (warm_start) {
+        g_print("%d of %d warm starts locked", warm_locked, warm_runs);
+        if (warm_locked)
+            g_print(": mean %.1f frames, %.0f ms, |error| %.1f", (gdouble)warm_frames / warm_locked,
+                warm_time / warm_locked, warm_error / warm_locked);
+        g_print("\n");
+    }
+    return ((locked == runs) && (warm_locked == warm_runs)) ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Microbenchmark for the fused Laplacian focus kernel.
+ *
+ * Usage: focusKernelBench [frame_width frame_height [iterations]]
+ *
+ * Times each kernel path on a 200x200 centre crop (what AF_Additions uses),
+ * a 512x512 centre crop and the full frame, and checks every path returns
+ * the same sum. Build with -DFOCUS_BENCH_WITH_OPENCV and link opencv_core and
+ * opencv_imgproc to also time the original cv::Laplacian + cv::mean path and
+ * confirm the fused result is bit identical to it.
+ *****************************************************/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "FocusKernels.h"
+
+#ifdef FOCUS_BENCH_WITH_OPENCV
+#include "opencv4/opencv2/imgproc.hpp"
+#endif
+
+/**
+* Fill a frame with a blurred random texture so the Laplacian has both signs.
+*/
+static void fillFrame(std::vector<guint8>& frame, gint width, gint height)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<gint> dist(0, 255);
+
+    for (auto& pixel : frame)
+        pixel = (guint8)dist(rng);
+
+    for (gint y = 0; y < height; ++y)  //Light horizontal smoothing for realistic gradients
+        for (gint x = 1; x < width; ++x)
+            frame[(gsize)y * width + x] = (guint8)((frame[(gsize)y * width + x] + frame[(gsize)y * width + x - 1]) / 2);
+}
+
+static FocusRoi centreRoi(gint frame_width, gint frame_height, gint size)
+{
+    FocusRoi roi;
+    roi.width = MIN(size, frame_width);
+    roi.height = MIN(size, frame_height);
+    roi.x = (frame_width - roi.width) / 2;
+    roi.y = (frame_height - roi.height) / 2;
+    return roi;
+}
+
+int main(int argc, char* argv[])
+{
+    gint width = (argc > 2) ? atoi(argv[1]) : 1920;
+    gint height = (argc > 2) ? atoi(argv[2]) : 1080;
+    gint iterations = (argc > 3) ? atoi(argv[3]) : 200;
+    gboolean all_match = TRUE;
+
+    std::vector<guint8> frame((gsize)width * height);
+    fillFrame(frame, width, height);
+    LumaPlane plane = { frame.data(), width, height, width };
+
+    const FocusRoi rois[] = { centreRoi(width, height, 200), centreRoi(width, height, 512),
+        { 0, 0, width, height } };
+    const FocusKernelPath paths[] = { FOCUS_KERNEL_SCALAR, FOCUS_KERNEL_SSE2, FOCUS_KERNEL_AVX2, FOCUS_KERNEL_NEON };
+
+    g_print("Frame %dx%d, %d iterations, best path: %s\n", width, height, iterations,
+        FocusKernels::pathName(FocusKernels::bestPath()));
+
+    for (const FocusRoi& roi : rois) {
+        const gdouble pixels = (gdouble)roi.width * roi.height;
+        const guint64 reference = FocusKernels::laplacianSum(plane, roi, FOCUS_KERNEL_SCALAR);
+        const gfloat reference_mean = FocusKernels::laplacianMean(plane, roi, FOCUS_KERNEL_SCALAR);
+
+        g_print("\nROI %dx%d at (%d,%d) focus value %f\n", roi.width, roi.height, roi.x, roi.y, reference_mean);
+
+        for (FocusKernelPath path : paths) {
+            if (!FocusKernels::pathAvailable(path))
+                continue;
+
+            volatile guint64 sink = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (gint i = 0; i < iterations; ++i)
+                sink = sink + FocusKernels::laplacianSum(plane, roi, path);
+            auto stop = std::chrono::steady_clock::now();
+
+            const gdouble ns = std::chrono::duration<gdouble, std::nano>(stop - start).count() / iterations;
+            const gboolean match = (FocusKernels::laplacianSum(plane, roi, path) == reference);
+            all_match = all_match && match;
+
+            g_print("  %-8s %10.1f us/frame %7.3f ns/pixel %s\n", FocusKernels::pathName(path),
+                ns / 1000.0, ns / pixels, match ? "" : "MISMATCH");
+        }
+
+#ifdef FOCUS_BENCH_WITH_OPENCV
+        cv::Mat cv_frame(cv::Size(width, height), CV_8UC1, frame.data(), cv::Mat::AUTO_STEP);
+        cv::Mat cropped = cv_frame(cv::Range(roi.y, roi.y + roi.height), cv::Range(roi.x, roi.x + roi.width));
+        gfloat cv_mean = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (gint i = 0; i < iterations; ++i) {
+            cv::Mat laplacianFrame;
+            cv::Laplacian(cropped, laplacianFrame, CV_16U);
+            cv_mean = (gfloat)cv::mean(laplacianFrame)[0];
+        }
+        auto stop = std::chrono::steady_clock::now();
+
+        const gdouble ns = std::chrono::duration<gdouble, std::nano>(stop - start).count() / iterations;
+        const gboolean identical = (std::memcmp(&cv_mean, &reference_mean, sizeof(gfloat)) == 0);
+        all_match = all_match && identical;
+
+        g_print("  %-8s %10.1f us/frame %7.3f ns/pixel %s\n", "opencv", ns / 1000.0, ns / pixels,
+            identical ? "bit identical" : "MISMATCH");
+#endif
+    }
+
+    return all_match ? 0 : 1;
+}
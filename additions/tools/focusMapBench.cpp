@@ -0,0 +1,120 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Benchmark for the tiled focus map.
+ *
+ * Usage: focusMapBench [frame_width frame_height [columns rows [iterations]]]
+ *
+ * Computes a full frame focus map with every focus metric on 1 to 4 threads
+ * and reports the mean and worst time per frame against the 33.3 ms frame
+ * interval at 30 fps. The tile values from each thread count are checked
+ * against the single threaded map.
+ *****************************************************/
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "FocusMap.h"
+
+#define FRAME_INTERVAL_MS (1000.0 / 30.0)
+
+/**
+* Fill a frame with a blurred random texture so every tile has some detail.
+*/
+static void fillFrame(std::vector<guint8>& frame, gint width, gint height)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<gint> dist(0, 255);
+
+    for (auto& pixel : frame)
+        pixel = (guint8)dist(rng);
+
+    for (gint y = 0; y < height; ++y)  //Light horizontal smoothing for realistic gradients
+        for (gint x = 1; x < width; ++x)
+            frame[(gsize)y * width + x] = (guint8)((frame[(gsize)y * width + x] + frame[(gsize)y * width + x - 1]) / 2);
+}
+
+int main(int argc, char* argv[])
+{
+    gint width = (argc > 2) ? atoi(argv[1]) : 1920;
+    gint height = (argc > 2) ? atoi(argv[2]) : 1080;
+    gint columns = (argc > 4) ? atoi(argv[3]) : 8;
+    gint rows = (argc > 4) ? atoi(argv[4]) : 6;
+    gint iterations = (argc > 5) ? atoi(argv[5]) : 50;
+    gboolean all_match = TRUE;
+    gboolean all_fit = TRUE;
+
+    std::vector<guint8> frame((gsize)width * height);
+    fillFrame(frame, width, height);
+    LumaPlane plane = { frame.data(), width, height, width };
+
+    g_print("Frame %dx%d, %dx%d tiles, %d iterations, best path: %s, budget %.1f ms\n", width, height,
+        columns, rows, iterations, FocusKernels::pathName(FocusKernels::bestPath()), FRAME_INTERVAL_MS);
+
+    for (gint type = 0; type < FOCUS_METRIC_COUNT; ++type) {
+        std::unique_ptr<FocusMetric> metric(FocusMetric::create((FocusMetricType)type));
+        std::vector<gfloat> reference;
+
+        g_print("\n%s\n", metric->name());
+
+        for (gint threads = 1; threads <= 4; ++threads) {
+            FocusMap map(columns, rows, FOCUS_MAP_SCORE_ARGMAX, threads);
+            GError* error = nullptr;
+
+            if ((map.setup(&error)) == -1) {
+                g_print("Could not start the thread pool: %s\n", error->message);
+                g_error_free(error);
+                return 1;
+            }
+
+            gdouble total_ms = 0;
+            gdouble worst_ms = 0;
+            for (gint i = 0; i < iterations; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                map.compute(plane, *metric);
+                auto end = std::chrono::steady_clock::now();
+                gdouble ms = std::chrono::duration<gdouble, std::milli>(end - start).count();
+                total_ms += ms;
+                worst_ms = MAX(worst_ms, ms);
+            }
+
+            if (threads == 1)
+                reference = map.tiles();
+            else if (map.tiles() != reference) {
+                g_print("  MISMATCH against the single threaded map\n");
+                all_match = FALSE;
+            }
+
+            gboolean fits = worst_ms < FRAME_INTERVAL_MS;
+            if (threads == 4)
+                all_fit = all_fit && fits;
+            g_print("  %d thread%s  mean %7.2f ms  worst %7.2f ms  %s\n", threads, (threads == 1) ? " " : "s",
+                total_ms / iterations, worst_ms, fits ? "fits in one frame" : "TOO SLOW for 30 fps");
+        }
+    }
+
+    g_print("\n%s\n", all_fit ? "Every metric fits in one frame interval on 4 threads"
+        : "Some metrics do not fit in one frame interval on 4 threads");
+    return all_match ? 0 : 1;
+}
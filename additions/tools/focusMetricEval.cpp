@@ -0,0 +1,245 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Offline evaluation of the focus metrics on synthetic defocus stacks.
+ *
+ * Usage: focusMetricEval [stack_size [iterations]]
+ *
+ * Each scene is blurred with a Gaussian whose sigma grows with the distance
+ * from the true focus position, then fresh sensor noise is added to every
+ * frame, as it would be on the camera. Every metric is run over the stack on
+ * the same 200x200 centre crop AF_Additions uses and scored for:
+ *
+ *   peak ratio  - best value over worst value, how clearly focus stands out
+ *   peak error  - stack positions between the best value and true focus
+ *   maxima      - local maxima in the curve, 1 means the hill climb cannot
+ *                 get stuck on a false peak
+ *   ns/pixel    - time per ROI pixel on the best kernel path
+ *
+ * It also checks each vector path gives the same value as the scalar path.
+ *****************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "FocusMetric.h"
+
+#define FRAME_WIDTH 320
+#define FRAME_HEIGHT 240
+#define ROI_SIZE 200
+
+/**
+* A synthetic scene, kept as floats so the blur does not pile up rounding errors.
+*/
+struct Scene {
+    const gchar* name;
+    std::vector<gfloat> pixels;
+    gfloat noise_sigma;
+};
+
+static Scene makeTexture()
+{
+    Scene scene = { "texture", std::vector<gfloat>(FRAME_WIDTH * FRAME_HEIGHT), 1.5f };
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<gfloat> dist(20, 235);
+
+    for (auto& pixel : scene.pixels)
+        pixel = dist(rng);
+    return scene;
+}
+
+/**
+* Dim, hazy and low in contrast: soft blobs a few grey levels above a sloping
+* background, like silt on the bottom of the tank, with plenty of sensor noise.
+*/
+static Scene makeUnderwater()
+{
+    Scene scene = { "underwater", std::vector<gfloat>(FRAME_WIDTH * FRAME_HEIGHT), 3.0f };
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<gfloat> position(0, 1);
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            scene.pixels[y * FRAME_WIDTH + x] = 60.0f + 20.0f * y / FRAME_HEIGHT;
+
+    for (gint blob = 0; blob < 400; ++blob) {
+        gfloat cx = position(rng) * FRAME_WIDTH;
+        gfloat cy = position(rng) * FRAME_HEIGHT;
+        gfloat radius = 1.0f + position(rng) * 3.0f;
+        gfloat level = 6.0f + position(rng) * 10.0f;
+
+        for (gint y = MAX(0, (gint)(cy - radius)); y <= MIN(FRAME_HEIGHT - 1, (gint)(cy + radius)); ++y)
+            for (gint x = MAX(0, (gint)(cx - radius)); x <= MIN(FRAME_WIDTH - 1, (gint)(cx + radius)); ++x)
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= radius * radius)
+                    scene.pixels[y * FRAME_WIDTH + x] += level;
+    }
+    return scene;
+}
+
+static Scene makeBars()
+{
+    Scene scene = { "bars", std::vector<gfloat>(FRAME_WIDTH * FRAME_HEIGHT), 1.5f };
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x)
+            scene.pixels[y * FRAME_WIDTH + x] = (((x / 6) + (y / 24)) & 1) ? 180.0f : 70.0f;
+    return scene;
+}
+
+/**
+* Separable Gaussian blur with clamped edges.
+*/
+static std::vector<gfloat> gaussianBlur(const std::vector<gfloat>& source, gfloat sigma)
+{
+    if (sigma < 0.05f)
+        return source;
+
+    gint radius = (gint)ceilf(3.0f * sigma);
+    std::vector<gfloat> weights(2 * radius + 1);
+    gfloat total = 0;
+    for (gint i = -radius; i <= radius; ++i)
+        total += weights[i + radius] = expf(-(gfloat)(i * i) / (2.0f * sigma * sigma));
+    for (auto& weight : weights)
+        weight /= total;
+
+    std::vector<gfloat> horizontal(source.size());
+    std::vector<gfloat> result(source.size());
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x) {
+            gfloat value = 0;
+            for (gint i = -radius; i <= radius; ++i)
+                value += weights[i + radius] * source[y * FRAME_WIDTH + CLAMP(x + i, 0, FRAME_WIDTH - 1)];
+            horizontal[y * FRAME_WIDTH + x] = value;
+        }
+
+    for (gint y = 0; y < FRAME_HEIGHT; ++y)
+        for (gint x = 0; x < FRAME_WIDTH; ++x) {
+            gfloat value = 0;
+            for (gint i = -radius; i <= radius; ++i)
+                value += weights[i + radius] * horizontal[CLAMP(y + i, 0, FRAME_HEIGHT - 1) * FRAME_WIDTH + x];
+            result[y * FRAME_WIDTH + x] = value;
+        }
+    return result;
+}
+
+/**
+* Build the defocus stack for a scene. Frame i is blurred by how far it is from true_focus.
+*/
+static std::vector<std::vector<guint8>> makeStack(const Scene& scene, gint stack_size, gint true_focus)
+{
+    std::vector<std::vector<guint8>> stack;
+    std::mt19937 rng(99);
+    std::normal_distribution<gfloat> noise(0, scene.noise_sigma);
+
+    for (gint i = 0; i < stack_size; ++i) {
+        std::vector<gfloat> blurred = gaussianBlur(scene.pixels, 0.6f * abs(i - true_focus));
+        std::vector<guint8> frame(blurred.size());
+
+        for (gsize p = 0; p < blurred.size(); ++p)
+            frame[p] = (guint8)CLAMP(lroundf(blurred[p] + noise(rng)), 0, 255);
+        stack.push_back(frame);
+    }
+    return stack;
+}
+
+static gint countLocalMaxima(const std::vector<gfloat>& curve)
+{
+    gint maxima = 0;
+    for (gsize i = 0; i < curve.size(); ++i) {
+        gboolean above_left = (i == 0) || (curve[i] > curve[i - 1]);
+        gboolean above_right = (i + 1 == curve.size()) || (curve[i] > curve[i + 1]);
+        if (above_left && above_right)
+            ++maxima;
+    }
+    return maxima;
+}
+
+int main(int argc, char* argv[])
+{
+    gint stack_size = (argc > 1) ? atoi(argv[1]) : 21;
+    gint iterations = (argc > 2) ? atoi(argv[2]) : 500;
+    gint true_focus = (stack_size * 2) / 3; //Off centre so a metric biased to the middle shows up
+    gboolean all_match = TRUE;
+
+    const FocusRoi roi = { (FRAME_WIDTH - ROI_SIZE) / 2, (FRAME_HEIGHT - ROI_SIZE) / 2, ROI_SIZE, ROI_SIZE };
+    const FocusKernelPath paths[] = { FOCUS_KERNEL_SSE2, FOCUS_KERNEL_AVX2, FOCUS_KERNEL_NEON };
+    const Scene scenes[] = { makeTexture(), makeUnderwater(), makeBars() };
+
+    g_print("Stack of %d frames %dx%d, true focus at %d, ROI %dx%d, best path: %s\n", stack_size,
+        FRAME_WIDTH, FRAME_HEIGHT, true_focus, ROI_SIZE, ROI_SIZE, FocusKernels::pathName(FocusKernels::bestPath()));
+
+    for (const Scene& scene : scenes) {
+        std::vector<std::vector<guint8>> stack = makeStack(scene, stack_size, true_focus);
+
+        g_print("\nScene: %s\n", scene.name);
+        g_print("  %-22s %10s %10s %7s %9s\n", "metric", "peak ratio", "peak error", "maxima", "ns/pixel");
+
+        for (gint type = 0; type < FOCUS_METRIC_COUNT; ++type) {
+            std::unique_ptr<FocusMetric> metric(FocusMetric::create((FocusMetricType)type));
+            std::unique_ptr<FocusMetric> scalar(FocusMetric::create((FocusMetricType)type, FOCUS_KERNEL_SCALAR));
+            std::vector<gfloat> curve;
+
+            for (const auto& frame : stack) {
+                LumaPlane plane = { frame.data(), FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH };
+                gfloat reference = scalar->measure(plane, roi);
+
+                for (FocusKernelPath path : paths) {
+                    if (!FocusKernels::pathAvailable(path))
+                        continue;
+                    std::unique_ptr<FocusMetric> vector(FocusMetric::create((FocusMetricType)type, path));
+                    if (vector->measure(plane, roi) != reference) {
+                        g_print("  MISMATCH %s %s\n", metric->name(), FocusKernels::pathName(path));
+                        all_match = FALSE;
+                    }
+                }
+                curve.push_back(reference);
+            }
+
+            gint peak = 0;
+            gfloat lowest = curve[0];
+            for (gint i = 0; i < stack_size; ++i) {
+                if (curve[i] > curve[peak])
+                    peak = i;
+                lowest = MIN(lowest, curve[i]);
+            }
+
+            LumaPlane sharpest = { stack[true_focus].data(), FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH };
+            volatile gfloat sink = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (gint i = 0; i < iterations; ++i)
+                sink = sink + metric->measure(sharpest, roi);
+            auto end = std::chrono::steady_clock::now();
+            gdouble ns = std::chrono::duration<gdouble, std::nano>(end - start).count();
+
+            g_print("  %-22s %10.2f %10d %7d %9.3f\n", metric->name(),
+                (lowest > 0) ? curve[peak] / lowest : INFINITY, abs(peak - true_focus),
+                countLocalMaxima(curve), ns / ((gdouble)iterations * ROI_SIZE * ROI_SIZE));
+        }
+    }
+
+    g_print("\n%s\n", all_match ? "All kernel paths match the scalar path" : "Kernel paths DISAGREE");
+    return all_match ? 0 : 1;
+}
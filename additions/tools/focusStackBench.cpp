@@ -0,0 +1,168 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Benchmark for the focus stacking merge.
+ *
+ * Usage: focusStackBench [width height [images [iterations]]]
+ *
+ * Builds a synthetic focus bracket of a textured scene whose depth runs
+ * from the left edge to the right, so each image is only in focus in its
+ * own strip. Merges it on 1 to 4 threads and reports the mean time per
+ * stack. The merged images from each thread count are checked against the
+ * single threaded merge, and the error of the merge against the all in
+ * focus scene is compared with the best single image of the bracket.
+ *****************************************************/
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "FocusStack.h"
+
+#define BENCH_CHANNELS 3
+
+/**
+* Box blur an interleaved image in place, horizontally then vertically.
+*/
+static void boxBlur(std::vector<guint8>& image, gint width, gint height, gint radius)
+{
+    std::vector<guint8> line(MAX(width, height) * BENCH_CHANNELS);
+
+    if (radius <= 0)
+        return;
+    for (gint y = 0; y < height; ++y) {
+        guint8* row = &image[(gsize)y * width * BENCH_CHANNELS];
+        for (gint x = 0; x < width; ++x)
+            for (gint c = 0; c < BENCH_CHANNELS; ++c) {
+                gint sum = 0;
+                for (gint k = -radius; k <= radius; ++k)
+                    sum += row[CLAMP(x + k, 0, width - 1) * BENCH_CHANNELS + c];
+                line[x * BENCH_CHANNELS + c] = (guint8)(sum / (2 * radius + 1));
+            }
+        std::copy(line.begin(), line.begin() + width * BENCH_CHANNELS, row);
+    }
+    for (gint x = 0; x < width; ++x) {
+        for (gint y = 0; y < height; ++y)
+            for (gint c = 0; c < BENCH_CHANNELS; ++c) {
+                gint sum = 0;
+                for (gint k = -radius; k <= radius; ++k)
+                    sum += image[((gsize)CLAMP(y + k, 0, height - 1) * width + x) * BENCH_CHANNELS + c];
+                line[y * BENCH_CHANNELS + c] = (guint8)(sum / (2 * radius + 1));
+            }
+        for (gint y = 0; y < height; ++y)
+            for (gint c = 0; c < BENCH_CHANNELS; ++c)
+                image[((gsize)y * width + x) * BENCH_CHANNELS + c] = line[y * BENCH_CHANNELS + c];
+    }
+}
+
+/**
+* Mean absolute difference per sample between two images of the same size.
+*/
+static gdouble meanError(const std::vector<guint8>& a, const std::vector<guint8>& b)
+{
+    guint64 total = 0;
+
+    for (gsize i = 0; i < a.size(); ++i)
+        total += ABS((gint)a[i] - (gint)b[i]);
+    return (gdouble)total / a.size();
+}
+
+int main(int argc, char* argv[])
+{
+    gint width = (argc > 2) ? atoi(argv[1]) : 1920;
+    gint height = (argc > 2) ? atoi(argv[2]) : 1080;
+    gint count = (argc > 3) ? CLAMP(atoi(argv[3]), 2, FOCUS_STACK_MAX_IMAGES) : 5;
+    gint iterations = (argc > 4) ? atoi(argv[4]) : 5;
+    gsize size = (gsize)width * height * BENCH_CHANNELS;
+    gboolean all_match = TRUE;
+
+    //The all in focus scene, a random texture lightly smoothed so it has realistic gradients
+    std::vector<guint8> scene(size);
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<gint> dist(0, 255);
+    for (auto& sample : scene)
+        sample = (guint8)dist(rng);
+    boxBlur(scene, width, height, 1);
+
+    //Blurred copies of the scene, one per whole step of defocus
+    std::vector<std::vector<guint8>> blurred(count, scene);
+    for (gint step = 1; step < count; ++step)
+        boxBlur(blurred[step], width, height, 2 * step);
+
+    //Image k of the bracket is in focus in strip k, and more out of focus the further a strip is from it
+    std::vector<std::vector<guint8>> bracket(count, std::vector<guint8>(size));
+    std::vector<StackImage> images;
+    for (gint k = 0; k < count; ++k) {
+        for (gint y = 0; y < height; ++y)
+            for (gint x = 0; x < width; ++x) {
+                gint defocus = ABS((x * count) / width - k);
+                gsize offset = ((gsize)y * width + x) * BENCH_CHANNELS;
+                for (gint c = 0; c < BENCH_CHANNELS; ++c)
+                    bracket[k][offset + c] = blurred[defocus][offset + c];
+            }
+        images.push_back({ bracket[k].data(), width, height, width * BENCH_CHANNELS, BENCH_CHANNELS });
+    }
+
+    gdouble best_single = G_MAXDOUBLE;
+    for (gint k = 0; k < count; ++k)
+        best_single = MIN(best_single, meanError(bracket[k], scene));
+
+    g_print("Stack of %d images %dx%d, %d iterations\n", count, width, height, iterations);
+
+    std::vector<guint8> reference;
+    gdouble merged_error = 0;
+    for (gint threads = 1; threads <= 4; ++threads) {
+        FocusStack stack(threads);
+        GError* error = nullptr;
+        std::vector<guint8> merged(size);
+        StackImage output = { merged.data(), width, height, width * BENCH_CHANNELS, BENCH_CHANNELS };
+
+        if ((stack.setup(&error)) == -1) {
+            g_print("Could not start the thread pool: %s\n", error->message);
+            g_error_free(error);
+            return 1;
+        }
+
+        gdouble total_ms = 0;
+        for (gint i = 0; i < iterations; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            stack.merge(images, output);
+            auto end = std::chrono::steady_clock::now();
+            total_ms += std::chrono::duration<gdouble, std::milli>(end - start).count();
+        }
+
+        if (threads == 1) {
+            reference = merged;
+            merged_error = meanError(merged, scene);
+        }
+        else if (merged != reference) {
+            g_print("  MISMATCH against the single threaded merge\n");
+            all_match = FALSE;
+        }
+        g_print("  %d thread%s  mean %8.1f ms per stack\n", threads, (threads == 1) ? " " : "s",
+            total_ms / MAX(iterations, 1));
+    }
+
+    g_print("\nMean error against the all in focus scene: merged %.2f, best single image %.2f\n",
+        merged_error, best_single);
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,413 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Replay a focus trace recorded on the camera with --focus-trace.
+ *
+ * Usage: focusTraceReplay [OPTION...] TRACE   (focusTraceReplay --help lists them)
+ *
+ *   summary      - every focus acquisition in the trace, from the first
+ *                  frame or the frame that broke a held focus, to the lock:
+ *                  frames, time, full and detail scans and where it locked
+ *   replay       - the recorded focus values are fed back through the CDAF
+ *                  state machine with the recorded tuning. Each step has to
+ *                  ask for the same lens position and state as it did on the
+ *                  camera, otherwise the state machine has changed behaviour
+ *   what if      - the first acquisition is run again with any tuning given
+ *                  on the command line. Focus values for lens positions the
+ *                  camera never visited are interpolated from the ones it did,
+ *                  and frame times use the overhead measured in the trace. A
+ *                  sweep takes a frame every --frame-interval ms
+ *
+ * Exits with 1 if the replay does not match the recording.
+ *****************************************************/
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "cdaf.h"
+#include "ErrorHandler.h"
+#include "FocusTrace.h"
+
+#define MAX_WHAT_IF_FRAMES 5000
+
+/**
+* Stands in for AF_Additions, just remembering what CDAF asked for.
+*/
+class ReplayInterface : public FocusInterface {
+public:
+    ReplayInterface() : locked(FALSE), scanning(FALSE), sweeping(FALSE), timeout(0) {}
+
+    void focusAchieved() override { locked = TRUE; }
+
+    void setScanning(gboolean value, guint frame_timeout) override {
+        scanning = value;
+        timeout = frame_timeout;
+    }
+
+    void setSweeping(gboolean value) override { sweeping = value; }
+
+    gboolean locked;
+    gboolean scanning;
+    gboolean sweeping;
+    guint timeout;
+};
+
+/**
+* A run of frames from the start of a search to the focus lock.
+*/
+struct Acquisition {
+    gsize first;   //Record index of the first frame
+    gsize lock;    //Record index of the frame that locked, or records.size() if it never did
+    gint full_scans;
+    gint detail_scans;
+};
+
+/**
+* TRUE when the state machine has just started a full range search, stepped or swept.
+*/
+static gboolean startedFullScan(FocusStateId state, FocusStateId next_state)
+{
+    return (next_state != state) &&
+        ((next_state == FOCUS_STATE_START_SCAN_FOCUS_IN) || (next_state == FOCUS_STATE_START_SWEEP) ||
+        (next_state == FOCUS_STATE_START_BRACKET_SCAN));
+}
+
+/**
+* How long the camera waited after this frame before asking for the next one, in ms.
+*/
+static guint requestedWait(const FocusTraceRecord& record)
+{
+    if (record.event == FOCUS_TRACE_HOLD)
+        return record.timeout;
+    return (record.flags & (FOCUS_TRACE_FLAG_SCANNING | FOCUS_TRACE_FLAG_LOCKED)) ? record.timeout : 0;
+}
+
+/**
+* The median time from requesting a focus frame to having its focus value, in ms. This is
+* the frame capture, the wait for the frame boundary and the measurement.
+*/
+static gdouble frameOverhead(const std::vector<FocusTraceRecord>& records)
+{
+    std::vector<gdouble> overheads;
+
+    for (gsize i = 1; i < records.size(); ++i) {
+        if ((records[i - 1].event == FOCUS_TRACE_WARM_START) || (records[i].event == FOCUS_TRACE_WARM_START))
+            continue; //Not a frame, and recorded at setup before the first one was asked for
+        gdouble gap = (records[i].timestamp - records[i - 1].timestamp) / 1000.0;
+        gdouble overhead = gap - requestedWait(records[i - 1]);
+        if (overhead > 0)
+            overheads.push_back(overhead);
+    }
+    if (overheads.empty())
+        return 50.0; //About a frame and a half at 30 fps
+
+    std::nth_element(overheads.begin(), overheads.begin() + overheads.size() / 2, overheads.end());
+    return overheads[overheads.size() / 2];
+}
+
+static std::vector<Acquisition> findAcquisitions(const std::vector<FocusTraceRecord>& records)
+{
+    std::vector<Acquisition> acquisitions;
+    gboolean searching = FALSE;
+
+    for (gsize i = 0; i < records.size(); ++i) {
+        const FocusTraceRecord& record = records[i];
+
+        if (record.event != FOCUS_TRACE_STEP)
+            continue;
+        if (!searching) {
+            acquisitions.push_back({ i, records.size(), 0, 0 });
+            searching = TRUE;
+        }
+        Acquisition& acquisition = acquisitions.back();
+        if (startedFullScan((FocusStateId)record.state, (FocusStateId)record.next_state))
+            ++acquisition.full_scans;
+        if ((record.next_state != record.state) && (record.next_state == FOCUS_STATE_START_DETAIL_SCAN))
+            ++acquisition.detail_scans;
+        if (record.flags & FOCUS_TRACE_FLAG_LOCKED) {
+            acquisition.lock = i;
+            searching = FALSE;
+        }
+    }
+    return acquisitions;
+}
+
+/**
+* Feed every recorded focus value back through the state machine and check it makes the
+* same moves. The findings go in report, the state machine output is not wanted with them.
+*
+* @return : The number of steps that did not match.
+*/
+static gint replay(const std::vector<FocusTraceRecord>& records, const CDAFTuning& tuning, gboolean verbose,
+    GString* report)
+{
+    ReplayInterface camera;
+    ErrorHandler error_handler(nullptr);
+    CDAF focus_machine(&camera, &error_handler, tuning);
+    gint steps = 0, mismatches = 0;
+
+    for (gsize i = 0; i < records.size(); ++i) {
+        const FocusTraceRecord& record = records[i];
+
+        if (record.event == FOCUS_TRACE_WARM_START)
+            focus_machine.warmStart(record.frame_index, record.focus_value, record.next_index);
+        if (record.event != FOCUS_TRACE_STEP)
+            continue;
+
+        guint frame_index = focus_machine.frameIndex(record.timestamp);
+        FocusStateId state = focus_machine.stateId();
+        camera.locked = FALSE;
+        focus_machine.stepFocus(record.focus_value, record.timestamp);
+        ++steps;
+
+        gboolean match = (frame_index == record.frame_index) && (state == record.state) &&
+            (focus_machine.focusIndex == record.next_index) && (focus_machine.stateId() == record.next_state) &&
+            (camera.locked == ((record.flags & FOCUS_TRACE_FLAG_LOCKED) != 0));
+
+        if (!match && ((mismatches++ < 5) || verbose))
+            g_string_append_printf(report, "  frame %" G_GSIZE_FORMAT ": recorded %s %u -> %s %u, replayed %s %u -> %s %u\n", i,
+                CDAF::stateName((FocusStateId)record.state), record.frame_index,
+                CDAF::stateName((FocusStateId)record.next_state), record.next_index,
+                CDAF::stateName(state), frame_index, focus_machine.stateName(), focus_machine.focusIndex);
+    }
+
+    g_string_append_printf(report, "Replay: %d of %d steps match the recording\n", steps - mismatches, steps);
+    return mismatches;
+}
+
+/**
+* The focus value at a lens position, interpolated between the nearest positions the
+* camera measured during the acquisition. Repeat visits to a position are averaged.
+*/
+static gfloat lookupValue(const std::map<guint, std::pair<gdouble, gint>>& curve, guint index)
+{
+    auto above = curve.lower_bound(index);
+
+    if (above == curve.end())
+        return (gfloat)(curve.rbegin()->second.first / curve.rbegin()->second.second);
+    if ((above->first == index) || (above == curve.begin()))
+        return (gfloat)(above->second.first / above->second.second);
+
+    auto below = std::prev(above);
+    gdouble low = below->second.first / below->second.second;
+    gdouble high = above->second.first / above->second.second;
+    return (gfloat)(low + (high - low) * (index - below->first) / (above->first - below->first));
+}
+
+/**
+* Run the first acquisition again with a different tuning, on the focus curve it recorded.
+* When the recording warm started, so does the replay.
+*/
+static void whatIf(const std::vector<FocusTraceRecord>& records, const Acquisition& acquisition,
+    const FocusTraceRecord* warm_start, const CDAFTuning& tuning, gdouble overhead, gdouble frame_interval,
+    GString* report)
+{
+    std::map<guint, std::pair<gdouble, gint>> curve;
+    gsize last = MIN(acquisition.lock, records.size() - 1);
+
+    for (gsize i = acquisition.first; i <= last; ++i) {
+        auto& point = curve[records[i].frame_index];
+        point.first += records[i].focus_value;
+        ++point.second;
+    }
+
+    ReplayInterface camera;
+    ErrorHandler error_handler(nullptr);
+    CDAF focus_machine(&camera, &error_handler, tuning);
+    gdouble time = 0, wait = 0;
+    gint frames = 0, full_scans = 0, detail_scans = 0;
+
+    if (warm_start)
+        focus_machine.warmStart(warm_start->frame_index, warm_start->focus_value, warm_start->next_index);
+    focus_machine.setFocus(focus_machine.focusIndex, nullptr); //As AF_Additions::setup, so the first ramp knows where it starts
+
+    while (!camera.locked && (frames < MAX_WHAT_IF_FRAMES)) {
+        FocusStateId state = focus_machine.stateId();
+        guint lens = focus_machine.focusIndex;
+
+        if (camera.sweeping) { //Every frame comes through, taken wherever the sweep has the lens
+            time += frame_interval;
+            lens = focus_machine.sweepPosition((gint64)(time * 1000));
+        }
+        else {
+            time += wait + overhead;
+        }
+        focus_machine.stepFocus(lookupValue(curve, lens), (gint64)(time * 1000));
+        ++frames;
+        if (!camera.sweeping)
+            focus_machine.applyFocus(focus_machine.focusIndex); //Only to learn how long a ramp takes
+        wait = (camera.scanning || camera.locked || focus_machine.rampTime()) ?
+            focus_machine.rampTime() + camera.timeout : 0;
+
+        if (startedFullScan(state, focus_machine.stateId()))
+            ++full_scans;
+        if ((focus_machine.stateId() != state) && (focus_machine.stateId() == FOCUS_STATE_START_DETAIL_SCAN))
+            ++detail_scans;
+    }
+
+    g_string_append_printf(report, "What if: steps %u/%u/%u/%u (transit/coarse/detail/drift), timeouts %u/%u/%u/%u/%u ms, "
+        "%s, %s, %.1f ms frame overhead\n", tuning.transitStep, tuning.coarseStep, tuning.detailStep, tuning.driftStep,
+        tuning.coarseTimeout, tuning.detailTimeout, tuning.transitTimeout, tuning.settleTimeout,
+        tuning.driftTimeout, CDAF::scanModeName(tuning.scanMode),
+        (tuning.searchMode == FOCUS_SEARCH_CURVE_FIT) ? "curve fit" : "detail scan", overhead);
+
+    if (acquisition.lock < records.size()) {
+        const FocusTraceRecord& lock = records[acquisition.lock];
+        g_string_append_printf(report, "  recorded %5" G_GSIZE_FORMAT " frames %8.0f ms, locked at %u\n",
+            acquisition.lock - acquisition.first + 1,
+            (lock.timestamp - records[acquisition.first].timestamp) / 1000.0 + overhead, lock.next_index);
+    }
+    if (camera.locked)
+        g_string_append_printf(report, "  replayed %5d frames %8.0f ms, locked at %u, %d full and %d detail scans\n",
+            frames, time, focus_machine.focusIndex, full_scans, detail_scans);
+    else
+        g_string_append_printf(report, "  replayed %5d frames without a lock\n", frames);
+}
+
+static void quietPrint(const gchar*)
+{
+}
+
+int main(int argc, char* argv[])
+{
+    gint transit_step = -1, coarse_step = -1, detail_step = -1, drift_step = -1;
+    gint coarse_timeout = -1, detail_timeout = -1, transit_timeout = -1, settle_timeout = -1, drift_timeout = -1;
+    gint search_mode = -1, confirm_step = -1, scan_mode = -1, sweep_rate = -1, sweep_lag = -1;
+    gint bracket_step = -1, noise_tolerance = -1;
+    gdouble frame_interval = 1000.0 / 30.0;
+    gboolean verbose = FALSE;
+    GError* error = nullptr;
+    FocusTraceHeader header;
+    std::vector<FocusTraceRecord> records;
+
+    GOptionEntry entries[] = {
+        {"transit-step", 0, 0, G_OPTION_ARG_INT, &transit_step, "What if: lens travel per frame between scans, 0 ramps there in one move", "N"},
+        {"coarse-step", 0, 0, G_OPTION_ARG_INT, &coarse_step, "What if: full range scan step", "N"},
+        {"detail-step", 0, 0, G_OPTION_ARG_INT, &detail_step, "What if: detail scan step", "N"},
+        {"drift-step", 0, 0, G_OPTION_ARG_INT, &drift_step, "What if: drift following step", "N"},
+        {"coarse-timeout", 0, 0, G_OPTION_ARG_INT, &coarse_timeout, "What if: ms between frames on a full range scan", "MS"},
+        {"detail-timeout", 0, 0, G_OPTION_ARG_INT, &detail_timeout, "What if: ms between frames on a detail scan", "MS"},
+        {"transit-timeout", 0, 0, G_OPTION_ARG_INT, &transit_timeout, "What if: ms between frames outside a scan", "MS"},
+        {"settle-timeout", 0, 0, G_OPTION_ARG_INT, &settle_timeout, "What if: ms allowed to settle on the focus point", "MS"},
+        {"drift-timeout", 0, 0, G_OPTION_ARG_INT, &drift_timeout, "What if: ms between frames following drift", "MS"},
+        {"search", 0, 0, G_OPTION_ARG_INT, &search_mode, "What if: peak search, (0): detail scan (1): curve fit", "N"},
+        {"confirm-step", 0, 0, G_OPTION_ARG_INT, &confirm_step, "What if: curve fit check frame offset", "N"},
+        {"scan", 0, 0, G_OPTION_ARG_INT, &scan_mode, "What if: full range search, (0): stepped (1): sweep (2): golden section", "N"},
+        {"sweep-rate", 0, 0, G_OPTION_ARG_INT, &sweep_rate, "What if: focus indices per second when sweeping", "N"},
+        {"sweep-lag", 0, 0, G_OPTION_ARG_INT, &sweep_lag, "What if: ms the lens lags the sweep", "MS"},
+        {"bracket-step", 0, 0, G_OPTION_ARG_INT, &bracket_step, "What if: golden section bracket scan step", "N"},
+        {"noise-tolerance", 0, 0, G_OPTION_ARG_INT, &noise_tolerance, "What if: % focus value difference treated as noise", "PCT"},
+        {"frame-interval", 0, 0, G_OPTION_ARG_DOUBLE, &frame_interval, "What if: ms between camera frames while sweeping", "MS"},
+        {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Show every mismatch and the state machine output", nullptr},
+        {nullptr, 0, 0, G_OPTION_ARG_NONE, nullptr, nullptr, nullptr}
+    };
+
+    GOptionContext* context = g_option_context_new("TRACE - replay a recorded focus trace");
+    g_option_context_add_main_entries(context, entries, nullptr);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || (argc != 2)) {
+        g_printerr("%s\n", error ? error->message : "Give one trace file, see --help");
+        g_clear_error(&error);
+        g_option_context_free(context);
+        return 2;
+    }
+    g_option_context_free(context);
+
+    if ((FocusTrace::read(argv[1], &header, &records, &error)) == -1) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 2;
+    }
+
+    CDAFTuning recorded = FocusTrace::headerTuning(header);
+    GDateTime* started = g_date_time_new_from_unix_local(header.start_time / G_USEC_PER_SEC);
+    gchar* started_text = g_date_time_format(started, "%F %T");
+    gint holds = std::count_if(records.begin(), records.end(),
+        [](const FocusTraceRecord& record) { return record.event == FOCUS_TRACE_HOLD; });
+    const FocusTraceRecord* warm_start = ((!records.empty()) && (records.front().event == FOCUS_TRACE_WARM_START)) ?
+        &records.front() : nullptr;
+
+    g_print("%s: recorded %s, %" G_GSIZE_FORMAT " focus frames (%d held), %.1f s\n", argv[1], started_text,
+        records.size() - (warm_start ? 1 : 0), holds,
+        records.empty() ? 0.0 : (records.back().timestamp - records.front().timestamp) / 1e6);
+    if (warm_start)
+        g_print("Warm started at %u, focus value %.2f, +/- %u\n", warm_start->frame_index, warm_start->focus_value,
+            warm_start->next_index);
+    g_free(started_text);
+    g_date_time_unref(started);
+
+    if (records.empty())
+        return 0;
+
+    std::vector<Acquisition> acquisitions = findAcquisitions(records);
+    gdouble overhead = frameOverhead(records);
+
+    g_print("\n%4s %9s %7s %9s %5s %7s %6s %10s\n", "acq", "start s", "frames", "time ms", "full", "detail",
+        "locked", "lock value");
+    for (gsize a = 0; a < acquisitions.size(); ++a) {
+        const Acquisition& acquisition = acquisitions[a];
+        const FocusTraceRecord& first = records[acquisition.first];
+        gdouble start = (first.timestamp - records.front().timestamp) / 1e6;
+
+        if (acquisition.lock == records.size()) {
+            g_print("%4" G_GSIZE_FORMAT " %9.1f %7" G_GSIZE_FORMAT " %9s\n", a, start,
+                records.size() - acquisition.first, "no lock");
+            continue;
+        }
+        const FocusTraceRecord& lock = records[acquisition.lock];
+        g_print("%4" G_GSIZE_FORMAT " %9.1f %7" G_GSIZE_FORMAT " %9.0f %5d %7d %6u %10.2f\n", a, start,
+            acquisition.lock - acquisition.first + 1, (lock.timestamp - first.timestamp) / 1000.0 + overhead,
+            acquisition.full_scans, acquisition.detail_scans, lock.next_index, lock.focus_value);
+    }
+    g_print("\n");
+
+    CDAFTuning tuning = recorded;
+    if (transit_step >= 0) tuning.transitStep = transit_step;
+    if (coarse_step > 0) tuning.coarseStep = coarse_step;
+    if (detail_step > 0) tuning.detailStep = detail_step;
+    if (drift_step > 0) tuning.driftStep = drift_step;
+    if (coarse_timeout >= 0) tuning.coarseTimeout = coarse_timeout;
+    if (detail_timeout >= 0) tuning.detailTimeout = detail_timeout;
+    if (transit_timeout >= 0) tuning.transitTimeout = transit_timeout;
+    if (settle_timeout >= 0) tuning.settleTimeout = settle_timeout;
+    if (drift_timeout >= 0) tuning.driftTimeout = drift_timeout;
+    if (search_mode >= 0) tuning.searchMode = search_mode;
+    if (confirm_step > 0) tuning.confirmStep = confirm_step;
+    if ((scan_mode >= 0) && (scan_mode < FOCUS_SCAN_COUNT)) tuning.scanMode = scan_mode;
+    if (sweep_rate > 0) tuning.sweepRate = sweep_rate;
+    if (sweep_lag >= 0) tuning.sweepLag = sweep_lag;
+    if (bracket_step > 0) tuning.bracketStep = bracket_step;
+    if (noise_tolerance >= 0) tuning.noiseTolerance = noise_tolerance;
+
+    //The state machine talks a lot, so it only gets through when asked for
+    GString* report = g_string_new(nullptr);
+    GPrintFunc print_handler = verbose ? nullptr : g_set_print_handler(quietPrint);
+    gint mismatches = replay(records, recorded, verbose, report);
+
+    if (!acquisitions.empty())
+        whatIf(records, acquisitions.front(), warm_start, tuning, overhead, MAX(frame_interval, 1.0), report);
+    if (!verbose)
+        g_set_print_handler(print_handler);
+
+    g_print("%s", report->str);
+    g_string_free(report, TRUE);
+    return (mismatches == 0) ? 0 : 1;
+}
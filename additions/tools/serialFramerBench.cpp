@@ -0,0 +1,282 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Stress benchmark for the serial port line framer.
+ *
+ * Usage: serialFramerBench [seconds [line_length]]
+ *
+ * Opens a pseudo terminal and sets up a SerialPort on its slave side,
+ * exactly as the AS7265x port is set up on the camera. A writer thread
+ * sends AS7265x style data lines into the master side, paced at 115200,
+ * 460800, 921600 and 2000000 baud (8N1) and then as fast as it can, in
+ * random sized chunks so lines split across reads and several arrive in
+ * one. Every line carries a sequence number and a checksum, and every
+ * 500th line is longer than the framer holds. For each rate it reports
+ * the throughput reached, the reader CPU time, and any line that came
+ * through out of order, corrupt, or not dropped when it should have been.
+ *****************************************************/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <random>
+
+#include "SerialIO.h"
+#include "ErrorHandler.h"
+
+#define BENCH_OVERLONG_EVERY 500
+#define BENCH_OVERLONG_LENGTH (LINE_FRAMER_CAPACITY + 150)
+#define BENCH_CHUNK_MAX 96
+
+struct BenchRun {
+    gint master_fd;
+    guint baud; //0 to write as fast as possible
+    gdouble seconds;
+    gint line_length;
+    SerialPort* port;
+    GMainLoop* loop;
+    gint64 start_time;
+    gint64 deadline;
+    volatile gint writer_done;
+    volatile gint writer_stop; //Set when the run ends early, so the writer does not wait on a full terminal
+    gboolean port_closed; //The port gave up on the terminal, a failure
+    guint64 bytes_written; //Only read once writer_done is set
+    guint64 lines_written;
+    guint64 overlong_written;
+    guint64 expected_seq;
+    guint64 good_lines;
+    guint64 bad_lines;
+};
+
+/**
+* Builds line number seq. It is "seq,v1,...,v18,*CC" padded with more values to about
+* line_length, where CC is the sum of the bytes before the '*' in hex.
+*/
+static gint buildLine(gchar* out, gsize out_size, guint64 seq, gint line_length)
+{
+    guint sum = 0;
+    gint len = g_snprintf(out, out_size, "%" G_GUINT64_FORMAT, seq);
+
+    for (gint channel = 0; (channel < 18) || (len < line_length - 4); ++channel)
+        len += g_snprintf(out + len, out_size - len, ",%.2f", (seq % 997) * 0.37 + channel * 11.5);
+    for (gint i = 0; i < len; ++i)
+        sum += (guint8)out[i];
+    len += g_snprintf(out + len, out_size - len, ",*%02X\n", sum & 0xFF);
+    return len;
+}
+
+/**
+* Checks a received line has the next sequence number and a good checksum.
+*/
+static void benchLine(LineView line, gpointer user_data)
+{
+    BenchRun* run = static_cast<BenchRun*>(user_data);
+    gsize star = line.rfind('*');
+    guint sum = 0;
+    guint64 seq = 0;
+    gsize i = 0;
+
+    if ((star == LineView::npos) || (star + 3 != line.size())) {
+        run->bad_lines++;
+        return;
+    }
+    for (gsize j = 0; j < star - 1; ++j)
+        sum += (guint8)line[j];
+    while ((i < line.size()) && g_ascii_isdigit(line[i]))
+        seq = seq * 10 + (line[i++] - '0');
+
+    if ((g_ascii_xdigit_value(line[star + 1]) * 16 + g_ascii_xdigit_value(line[star + 2]) != (gint)(sum & 0xFF))
+        || (seq != run->expected_seq))
+        run->bad_lines++;
+    else
+        run->good_lines++;
+    run->expected_seq = seq + 1;
+}
+
+/**
+* Writer thread. Sends lines into the master side in random chunks, sleeping to hold the baud rate.
+*/
+static gpointer writerThread(gpointer data)
+{
+    BenchRun* run = static_cast<BenchRun*>(data);
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<gint> chunk_size(1, BENCH_CHUNK_MAX);
+    std::vector<gchar> line(BENCH_OVERLONG_LENGTH + run->line_length + 64);
+    gint64 end_time = run->start_time + (gint64)(run->seconds * G_USEC_PER_SEC);
+    guint64 seq = 0;
+
+    while ((g_get_monotonic_time() < end_time) && !g_atomic_int_get(&run->writer_stop)) {
+        gint len;
+
+        if ((run->lines_written + 1) % BENCH_OVERLONG_EVERY == 0) {
+            memset(line.data(), 'X', BENCH_OVERLONG_LENGTH);
+            line[BENCH_OVERLONG_LENGTH] = LINE_FEED;
+            len = BENCH_OVERLONG_LENGTH + 1;
+            run->overlong_written++;
+        }
+        else
+            len = buildLine(line.data(), line.size(), seq++, run->line_length);
+
+        for (gint pos = 0; pos < len;) {
+            gint chunk = chunk_size(rng);
+            chunk = MIN(chunk, len - pos);
+            ssize_t written = write(run->master_fd, line.data() + pos, chunk);
+
+            if ((written < 0) && (errno == EAGAIN)) { //Terminal full, wait for the reader
+                struct pollfd out = { run->master_fd, POLLOUT, 0 };
+
+                if (g_atomic_int_get(&run->writer_stop))
+                    break;
+                poll(&out, 1, 50);
+                continue;
+            }
+            if (written <= 0) {
+                g_printerr("Write to the pseudo terminal failed: %s\n", g_strerror(errno));
+                g_atomic_int_set(&run->writer_done, 1);
+                return nullptr;
+            }
+            pos += written;
+            run->bytes_written += written;
+
+            if (run->baud > 0) { //10 bit times a byte
+                gint64 due = run->start_time + (gint64)(run->bytes_written * 10 * G_USEC_PER_SEC / run->baud);
+                gint64 now = g_get_monotonic_time();
+                if (due > now)
+                    g_usleep(due - now);
+            }
+        }
+        run->lines_written++;
+    }
+    g_atomic_int_set(&run->writer_done, 1);
+    return nullptr;
+}
+
+/**
+* Quits the main loop once everything written has been framed, or at the deadline.
+*/
+static gboolean checkDone(gpointer data)
+{
+    BenchRun* run = static_cast<BenchRun*>(data);
+
+    run->port_closed = !run->port->isOpen();
+    if ((g_atomic_int_get(&run->writer_done) && (run->port->getStats().bytes == run->bytes_written))
+        || run->port_closed || (g_get_monotonic_time() > run->deadline)) {
+        g_main_loop_quit(run->loop);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gdouble threadCpuSeconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+* Runs one rate and prints its row. Returns FALSE if any line was lost or corrupt.
+*/
+static gboolean runRate(guint baud, gdouble seconds, gint line_length, ErrorHandler* error_handler)
+{
+    GError* error = nullptr;
+    BenchRun run = {};
+    gint master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ((master_fd == -1) || (grantpt(master_fd) == -1) || (unlockpt(master_fd) == -1)
+        || (fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK) == -1)) {
+        g_printerr("Can not open a pseudo terminal: %s\n", g_strerror(errno));
+        return FALSE;
+    }
+
+    //The baud setting has no effect on a pseudo terminal, the writer does the pacing
+    SerialPort port(ptsname(master_fd), (baud > 0) ? baud : 2000000, 8, 1, 0, 0, error_handler);
+    if (port.setup(&error) == -1) {
+        error_handler->errorHandler(&error);
+        close(master_fd);
+        return FALSE;
+    }
+
+    run.master_fd = master_fd;
+    run.baud = baud;
+    run.seconds = seconds;
+    run.line_length = line_length;
+    run.port = &port;
+    run.loop = g_main_loop_new(nullptr, FALSE);
+    port.setWriteFunc(benchLine, &run);
+
+    gdouble cpu_start = threadCpuSeconds();
+    run.start_time = g_get_monotonic_time();
+    run.deadline = run.start_time + (gint64)((seconds + 5.0) * G_USEC_PER_SEC);
+    GThread* writer = g_thread_new("bench-writer", writerThread, &run);
+    g_timeout_add(5, checkDone, &run);
+    g_main_loop_run(run.loop);
+    gdouble elapsed = (g_get_monotonic_time() - run.start_time) / (gdouble)G_USEC_PER_SEC;
+    gdouble cpu = threadCpuSeconds() - cpu_start;
+    g_atomic_int_set(&run.writer_stop, 1);
+    g_thread_join(writer);
+    g_main_loop_unref(run.loop);
+
+    LineFramerStats stats = port.getStats();
+    guint64 lost = run.lines_written - run.overlong_written - run.good_lines - run.bad_lines;
+    gboolean passed = !run.port_closed && (run.bad_lines == 0) && (lost == 0) && (stats.overflows == run.overlong_written)
+        && (stats.bytes == run.bytes_written);
+
+    if (baud > 0)
+        g_print("%8u %10.0f", baud, baud / 10.0);
+    else
+        g_print("%8s %10s", "max", "-");
+    g_print(" %10.0f %9.0f %8" G_GUINT64_FORMAT " %6" G_GUINT64_FORMAT "/%-6" G_GUINT64_FORMAT " %6" G_GUINT64_FORMAT
+        " %6" G_GUINT64_FORMAT " %5.1f%%  %s\n",
+        stats.bytes / elapsed, stats.lines / elapsed, stats.lines, stats.overflows, run.overlong_written,
+        run.bad_lines, lost, 100.0 * cpu / elapsed, passed ? "ok" : "FAIL");
+
+    port.unsetWriteFunc();
+    close(master_fd);
+    return passed;
+}
+
+gint main(gint argc, gchar* argv[])
+{
+    gdouble seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    gint line_length = (argc > 2) ? atoi(argv[2]) : 110;
+    const guint bauds[] = { 115200, 460800, 921600, 2000000, 0 };
+    ErrorHandler error_handler(nullptr);
+    gboolean passed = TRUE;
+
+    if ((seconds <= 0.0) || (line_length < 8) || (line_length >= LINE_FRAMER_CAPACITY)) {
+        g_printerr("Usage: serialFramerBench [seconds [line_length]], line_length 8 to %d\n",
+            LINE_FRAMER_CAPACITY - 1);
+        return 1;
+    }
+
+    g_print("Line framer, %d byte ring, %d byte lines, %.1f s a rate, %d byte overlong line every %d\n\n",
+        LINE_FRAMER_CAPACITY, line_length, seconds, BENCH_OVERLONG_LENGTH, BENCH_OVERLONG_EVERY);
+    g_print("%8s %10s %10s %9s %8s %13s %6s %6s %6s\n", "baud", "target B/s", "B/s", "lines/s", "lines",
+        "overlong", "bad", "lost", "cpu");
+    for (guint baud : bauds)
+        passed = runRate(baud, seconds, line_length, &error_handler) && passed;
+
+    return passed ? 0 : 1;
+}
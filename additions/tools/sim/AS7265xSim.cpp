@@ -0,0 +1,352 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Pseudo terminal emulation of the AS7265x board, for running the serial
+ * path with no board attached. See AS7265xSim.h.
+ *****************************************************/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cmath>
+
+#include "AS7265xSim.h"
+#include "AS7265xParse.h"
+
+#define SIM_READ_POLL_MS 50 //How often the command reader checks it should stop
+#define SIM_SPLIT_MAX 16
+
+static const gdouble gain_factor[] = { 1.0, 3.7, 16.0, 64.0 };
+
+AS7265xSim::AS7265xSim(guint baud) : baud_(baud), master_fd_(-1), slave_fd_(-1), thread_(nullptr),
+    running_(0), faults_(), stats_(), gain_(0), integration_(255), mode_(AS7265X_SIM_MODE_ONE_SHOT),
+    cycle_start_(0), raw_(), calibrated_() {
+}
+
+AS7265xSim::~AS7265xSim() {
+    stop();
+    if (master_fd_ != -1)
+        close(master_fd_);
+    if (slave_fd_ != -1)
+        close(slave_fd_);
+}
+
+/**
+ * Creates the pseudo terminal. Both sides are put in raw mode, as the host sets up the board's port.
+ *
+ * @param error : Set if the pseudo terminal can not be made.
+ *
+ * @return : -1 on error, otherwise 0.
+ */
+gint AS7265xSim::open(GError** error) {
+    struct termios termios_p;
+    const gchar* name;
+
+    master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master_fd_ == -1) || (grantpt(master_fd_) == -1) || (unlockpt(master_fd_) == -1)
+        || ((name = ptsname(master_fd_)) == nullptr)) {
+        g_set_error(error, g_quark_from_static_string("AS7265x sim"), 1, "Can not make a pseudo terminal: %s",
+            g_strerror(errno));
+        return -1;
+    }
+    slave_path_ = name;
+    slave_fd_ = ::open(name, O_RDWR | O_NOCTTY);
+    if (slave_fd_ == -1) {
+        g_set_error(error, g_quark_from_static_string("AS7265x sim"), 1, "Can not open '%s': %s", name,
+            g_strerror(errno));
+        return -1;
+    }
+
+    tcgetattr(master_fd_, &termios_p);
+    cfmakeraw(&termios_p);
+    tcsetattr(master_fd_, TCSANOW, &termios_p);
+    tcgetattr(slave_fd_, &termios_p);
+    cfmakeraw(&termios_p);
+    tcsetattr(slave_fd_, TCSANOW, &termios_p);
+    return 0;
+}
+
+const std::string& AS7265xSim::slavePath() const {
+    return slave_path_;
+}
+
+void AS7265xSim::setFaults(const AS7265xSimFaults& faults) {
+    faults_ = faults;
+    rng_.seed(faults.seed);
+}
+
+/**
+ * Starts answering commands on a thread of its own, so the board's measuring and sending time
+ * never holds up the host.
+ */
+void AS7265xSim::start() {
+    if (thread_ || (master_fd_ == -1))
+        return;
+    g_atomic_int_set(&running_, 1);
+    thread_ = g_thread_new("as7265x-sim", threadWrapper, this);
+}
+
+void AS7265xSim::stop() {
+    g_atomic_int_set(&running_, 0);
+    if (thread_) {
+        g_thread_join(thread_);
+        thread_ = nullptr;
+    }
+}
+
+/**
+ * The counts so far. Only steady once stop has returned.
+ */
+AS7265xSimStats AS7265xSim::getStats() const {
+    return stats_;
+}
+
+gpointer AS7265xSim::threadWrapper(gpointer user_data) {
+    static_cast<AS7265xSim*>(user_data)->run();
+    return nullptr;
+}
+
+void AS7265xSim::run() {
+    gchar buffer[256];
+    std::string line;
+
+    while (g_atomic_int_get(&running_)) {
+        struct pollfd in = { master_fd_, POLLIN, 0 };
+        ssize_t len;
+
+        if (poll(&in, 1, SIM_READ_POLL_MS) != 1)
+            continue;
+        len = read(master_fd_, buffer, sizeof(buffer));
+        if (len <= 0)
+            break;
+
+        for (ssize_t i = 0; (i < len) && (master_fd_ != -1); ++i) {
+            if ((buffer[i] == '\n') || (buffer[i] == '\r')) {
+                if (!line.empty())
+                    command(line);
+                line.clear();
+            }
+            else
+                line += buffer[i];
+        }
+        if (master_fd_ == -1) //Hung up
+            break;
+    }
+}
+
+/**
+ * Answers one command the way the board does.
+ */
+void AS7265xSim::command(const std::string& line) {
+    gchar text[256];
+    gsize equals = line.find('=');
+    std::string name = line.substr(0, equals);
+    gboolean set = (equals != std::string::npos);
+    gint value = set ? atoi(line.c_str() + equals + 1) : 0;
+
+    stats_.commands++;
+    if ((faults_.disconnect_after > 0) && (stats_.commands > faults_.disconnect_after)) {
+        close(master_fd_);
+        master_fd_ = -1;
+        stats_.disconnected = TRUE;
+        return;
+    }
+    if (chance(faults_.drop)) {
+        stats_.dropped++;
+        return;
+    }
+
+    if (line == "AT")
+        reply("OK");
+    else if (line == "ATVERHW")
+        reply("0x41 OK");
+    else if (line == "ATVERSW")
+        reply("12.0.0 OK");
+    else if (line == "ATPRES")
+        reply("7 OK");
+    else if (line == "ATTEMP") {
+        std::uniform_int_distribution<gint> jitter(0, 1);
+        g_snprintf(text, sizeof(text), "%d,%d,%d OK", 28 + jitter(rng_), 30 + jitter(rng_), 29 + jitter(rng_));
+        reply(text);
+    }
+    else if ((name == "ATGAIN") && (!set || ((value >= 0) && (value <= 3)))) {
+        if (set)
+            gain_ = value;
+        g_snprintf(text, sizeof(text), set ? "OK" : "%u OK", gain_);
+        reply(text);
+    }
+    else if ((name == "ATINTTIME") && (!set || ((value >= 1) && (value <= 255)))) {
+        if (set) {
+            integration_ = value;
+            cycle_start_ = g_get_monotonic_time(); //Continuous measurement starts again
+        }
+        g_snprintf(text, sizeof(text), set ? "OK" : "%u OK", integration_);
+        reply(text);
+    }
+    else if ((name == "ATTCSMD") && (!set || ((value >= 0) && (value <= 3)))) {
+        if (set) {
+            mode_ = value;
+            cycle_start_ = g_get_monotonic_time();
+        }
+        g_snprintf(text, sizeof(text), set ? "OK" : "%u OK", mode_);
+        reply(text);
+    }
+    else if ((line == "ATDATA") || (line == "ATCDATA")) {
+        gint len = 0;
+
+        //A one shot ATDATA measures first. In continuous mode both answer with the last reading
+        if (mode_ == AS7265X_SIM_MODE_CONTINUOUS)
+            waitForReading(cycle_start_ + readingTime()); //Only waits for the first
+        if ((line == "ATDATA") || (stats_.readings == 0)) {
+            if (mode_ != AS7265X_SIM_MODE_CONTINUOUS)
+                waitForReading(g_get_monotonic_time() + readingTime());
+            measure();
+        }
+        for (gint field = 0; field < AS7265X_CHANNELS; ++field) {
+            if (line == "ATDATA")
+                len += g_snprintf(text + len, sizeof(text) - len, "%u,", raw_[field]);
+            else
+                len += g_snprintf(text + len, sizeof(text) - len, "%.2f,", calibrated_[field]);
+        }
+        g_snprintf(text + len - 1, sizeof(text) - len + 1, " OK");
+        reply(text);
+    }
+    else if ((name == "ATBURST") && set && (value >= 1) && (value <= 255) && (mode_ == AS7265X_SIM_MODE_CONTINUOUS)) {
+        for (gint i = 0; (i < value) && (master_fd_ != -1); ++i) {
+            gint len = 0;
+
+            waitForReading(nextCycleEnd(g_get_monotonic_time()));
+            measure();
+            for (gint field = 0; field < AS7265X_CHANNELS; ++field)
+                len += g_snprintf(text + len, sizeof(text) - len, "%.2f,", calibrated_[field]);
+            text[len - 1] = '\0';
+            reply(text);
+        }
+        reply("OK");
+    }
+    else {
+        stats_.errors++;
+        reply("ERROR");
+    }
+}
+
+/**
+ * Sends a line ending in CR LF, with any faults that come up.
+ */
+void AS7265xSim::reply(const std::string& line) {
+    std::string out = line + "\r\n";
+
+    if (master_fd_ == -1)
+        return;
+    if (chance(faults_.garble)) {
+        std::uniform_int_distribution<gsize> position(0, line.size() - 1);
+        std::uniform_int_distribution<gint> kind(0, 2);
+        gsize pos = position(rng_);
+
+        switch (kind(rng_)) {
+            case 0: out[pos] = (out[pos] == ',') ? '.' : ','; break;
+            case 1: out.erase(pos, 1); break;
+            default: out.insert(pos, 1, out[pos]); break;
+        }
+        stats_.garbled++;
+    }
+    if (chance(faults_.stall)) {
+        g_usleep(faults_.stall_ms * 1000);
+        stats_.stalled++;
+    }
+
+    stats_.replies++;
+    writePaced(out.data(), out.size());
+}
+
+/**
+ * Writes at the baud rate, 10 bits a byte. Each piece is written once it would have finished
+ * going out, so the host never sees a byte early.
+ */
+void AS7265xSim::writePaced(const gchar* data, gsize len) {
+    std::uniform_int_distribution<gsize> piece(1, SIM_SPLIT_MAX);
+
+    while ((len > 0) && (master_fd_ != -1)) {
+        gsize count = faults_.split ? piece(rng_) : len;
+        ssize_t written;
+
+        count = MIN(count, len);
+        g_usleep(count * 10 * G_USEC_PER_SEC / baud_);
+        written = write(master_fd_, data, count);
+        if (written <= 0)
+            return;
+        data += written;
+        len -= written;
+    }
+}
+
+/**
+ * Time for one reading of all channels, one integration for each bank.
+ */
+gint64 AS7265xSim::readingTime() const {
+    return 2 * (gint64)integration_ * AS7265X_SIM_STEP_US;
+}
+
+void AS7265xSim::waitForReading(gint64 ready_time) {
+    gint64 wait = ready_time - g_get_monotonic_time();
+
+    if (wait > 0)
+        g_usleep(wait);
+}
+
+/**
+ * The end of the first continuous measurement cycle after a time.
+ */
+gint64 AS7265xSim::nextCycleEnd(gint64 after) const {
+    gint64 cycles = (after - cycle_start_) / readingTime() + 1;
+
+    return cycle_start_ + cycles * readingTime();
+}
+
+/**
+ * Takes a reading of a steady broadband light. The counts grow with the integration time and
+ * gain and clip at 16 bits, with shot noise. The calibrated values take the integration time
+ * and gain back out, so they only change with the light, until the counts clip.
+ */
+void AS7265xSim::measure() {
+    gdouble integration_ms = integration_ * AS7265X_SIM_STEP_US / 1000.0;
+    std::normal_distribution<gdouble> noise(0.0, 1.0);
+
+    for (gint field = 0; field < AS7265X_CHANNELS; ++field) {
+        gdouble wavelength = AS7265xParse::field_wavelength[field];
+        gdouble light = 4.0 + 16.0 * std::exp(-std::pow((wavelength - 580.0) / 150.0, 2.0)); //Counts a ms at 1x
+        gdouble counts = light * integration_ms * gain_factor[gain_];
+
+        counts += noise(rng_) * std::sqrt(counts + 1.0);
+        raw_[field] = (guint16)CLAMP(std::lround(counts), 0, G_MAXUINT16);
+        calibrated_[field] = (gfloat)(raw_[field] / (integration_ms * gain_factor[gain_]) * (0.9 + 0.01 * field));
+    }
+    stats_.readings++;
+}
+
+gboolean AS7265xSim::chance(gdouble share) {
+    std::uniform_real_distribution<gdouble> draw(0.0, 1.0);
+
+    return (share > 0.0) && (draw(rng_) < share);
+}
@@ -0,0 +1,105 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef AS7265XSIM_H
+#define AS7265XSIM_H
+
+#include <glib.h>
+#include <random>
+#include <string>
+
+#define AS7265X_SIM_STEP_US 2800 //ATINTTIME counts in 2.8 ms steps
+#define AS7265X_SIM_MODE_CONTINUOUS 2
+#define AS7265X_SIM_MODE_ONE_SHOT 3
+
+/* Faults to inject. Shares are from 0 to 1 and are drawn for each reply line. */
+struct AS7265xSimFaults {
+    gdouble garble; //Lines with a byte changed, dropped or doubled
+    gdouble drop; //Commands never answered
+    gdouble stall; //Lines held back for stall_ms before they are sent
+    guint stall_ms;
+    gboolean split; //Send every line in pieces of 1 to 16 bytes, so the host reads parts of lines
+    guint disconnect_after; //Hang up after this many commands, 0 to stay connected
+    guint seed;
+};
+
+struct AS7265xSimStats {
+    guint64 commands; //Lines received
+    guint64 replies; //Lines sent, streamed readings included
+    guint64 readings; //Measurements taken
+    guint64 errors; //Commands answered ERROR
+    guint64 garbled;
+    guint64 dropped;
+    guint64 stalled;
+    gboolean disconnected;
+};
+
+/* An AS7265x board on the AT command firmware, behind a pseudo terminal. The host opens
+* slavePath() as it would /dev/ttyUSB0. Every command in commands.h is answered, one line each
+* in the order they arrive, paced at the baud rate. A reading takes two integration times, one
+* for each bank of channels, and the gain scales the counts up to the 16 bit limit, so both
+* change what the host sees the way they do on the board. ATDATA in one shot mode measures and
+* then answers. In continuous mode the board measures all the time, ATDATA answers with the last
+* reading, and ATBURST=N streams the next N calibrated readings as they finish, then OK.
+*/
+class AS7265xSim {
+public:
+    AS7265xSim(guint baud = 115200);
+    ~AS7265xSim();
+
+    gint open(GError** error);
+    const std::string& slavePath() const;
+    void setFaults(const AS7265xSimFaults& faults);
+    void start();
+    void stop();
+    AS7265xSimStats getStats() const;
+
+private:
+    guint baud_;
+    gint master_fd_;
+    gint slave_fd_; //Held open so the master does not read end of file before the host opens the port
+    std::string slave_path_;
+    GThread* thread_;
+    volatile gint running_;
+    AS7265xSimFaults faults_;
+    AS7265xSimStats stats_;
+    std::mt19937 rng_;
+
+    //The board
+    guint gain_; //0 to 3, for 1x, 3.7x, 16x and 64x
+    guint integration_; //Steps of AS7265X_SIM_STEP_US
+    guint mode_;
+    gint64 cycle_start_; //When continuous measurement started
+    guint16 raw_[18]; //Last reading, in the order the board sends the fields
+    gfloat calibrated_[18];
+
+    static gpointer threadWrapper(gpointer user_data);
+    void run();
+    void command(const std::string& line);
+    void reply(const std::string& line);
+    void writePaced(const gchar* data, gsize len);
+    gint64 readingTime() const;
+    void waitForReading(gint64 ready_time);
+    void measure();
+    gint64 nextCycleEnd(gint64 after) const;
+    gboolean chance(gdouble share);
+};
+
+#endif //AS7265XSIM_H
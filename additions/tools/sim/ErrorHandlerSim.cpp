@@ -0,0 +1,40 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Desktop build of ErrorHandler for the simulators. There is no
+ * nvgstcapture-1.0 to shut down, so errors are printed and cleared.
+ *****************************************************/
+
+#include "ErrorHandler.h"
+
+ErrorHandler::ErrorHandler(AdditionsParent* additions_parent) : additions_parent_(additions_parent),
+    error_during_setup_(FALSE) {
+}
+
+ErrorHandler::~ErrorHandler() {
+}
+
+void ErrorHandler::errorHandler(GError** error) {
+    if (error && *error) {
+        g_printerr("Error: %s\n", (*error)->message);
+        g_clear_error(error);
+    }
+}
@@ -0,0 +1,107 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Desktop build of CameraI2CDevice for the simulators. There is no I2C bus,
+ * focus moves go to whatever LensSim handler the tool has installed.
+ *****************************************************/
+
+#include "I2CsetFocus.h"
+#include "LensSim.h"
+
+static LensMoveHandler move_handler = nullptr;
+static gpointer move_user_data = nullptr;
+static LensRampHandler ramp_handler = nullptr;
+static gpointer ramp_user_data = nullptr;
+
+void LensSim::setMoveHandler(LensMoveHandler handler, gpointer user_data)
+{
+    move_handler = handler;
+    move_user_data = user_data;
+}
+
+void LensSim::setRampHandler(LensRampHandler handler, gpointer user_data)
+{
+    ramp_handler = handler;
+    ramp_user_data = user_data;
+}
+
+CameraI2CDevice::CameraI2CDevice(const std::string& camera_id) : camera_i2c_fd_(-1),
+    camera_id_(camera_id), thread_(nullptr), running_(FALSE), request_(FOCUS_REQUEST_NONE),
+    worker_error_(nullptr), requested_(-1), position_(-1), requests_(0), coalesced_(0), writes_(0),
+    ramps_(0), ramps_cut_(0), failures_(0), total_time_(0), max_time_(0) {
+}
+
+CameraI2CDevice::~CameraI2CDevice() {
+}
+
+void CameraI2CDevice::setCameraId(const std::string& camera_id) {
+    camera_id_ = camera_id;
+}
+
+gint CameraI2CDevice::setup(GError**) {
+    return 0;
+}
+
+gint CameraI2CDevice::setFocus(gint range, GError**) {
+    requested_ = range;
+    if (move_handler)
+        move_handler(range, move_user_data);
+    return 0;
+}
+
+//The simulated lens moves as soon as it is asked, so there is never a request to coalesce
+gint CameraI2CDevice::requestFocus(gint range, GError**) {
+    requested_ = range;
+    ++requests_;
+    ++writes_;
+    if (move_handler)
+        move_handler(range, move_user_data);
+    return 0;
+}
+
+gint CameraI2CDevice::requestRamp(gint range, guint* ramp_time, GError**) {
+    gint points[LENS_RAMP_MAX_POINTS];
+    guint count = LensRamp::rampProfile(requested_, range, points, LENS_RAMP_MAX_POINTS);
+
+    *ramp_time = LensRamp::rampTime(requested_, range);
+    requested_ = range;
+    ++requests_;
+    ++ramps_;
+    writes_ += count;
+    if (ramp_handler)
+        ramp_handler(points, count, ramp_user_data);
+    else if (move_handler)
+        move_handler(range, move_user_data);
+    return 0;
+}
+
+I2CWriteStats CameraI2CDevice::getStats() const {
+    I2CWriteStats stats;
+    stats.requests = requests_.load();
+    stats.coalesced = coalesced_.load();
+    stats.writes = writes_.load();
+    stats.ramps = ramps_.load();
+    stats.ramps_cut = ramps_cut_.load();
+    stats.failures = failures_.load();
+    stats.total_time = total_time_.load();
+    stats.max_time = max_time_.load();
+    return stats;
+}
@@ -0,0 +1,46 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LENSSIM_H
+#define LENSSIM_H
+
+#include <glib.h>
+
+/* The simulated lens behind the desktop build of CameraI2CDevice. Tools that link
+* tools/sim/I2CsetFocusSim.cpp in place of src/I2CsetFocus.cpp get every focus
+* index CDAF writes through this handler instead of over I2C.
+*/
+typedef void (*LensMoveHandler)(gint focus_index, gpointer user_data);
+
+/* A ramp from CameraI2CDevice::requestRamp, one position every LENS_RAMP_TICK_MS from now. */
+typedef void (*LensRampHandler)(const gint* points, guint count, gpointer user_data);
+
+namespace LensSim {
+
+    /* Route CameraI2CDevice::setFocus and requestFocus to handler. Pass nullptr to drop the moves. */
+    void setMoveHandler(LensMoveHandler handler, gpointer user_data);
+
+    /* Route CameraI2CDevice::requestRamp to handler. Without one a ramp goes to the move handler
+    * as a jump to its end.
+    */
+    void setRampHandler(LensRampHandler handler, gpointer user_data);
+}
+
+#endif //LENSSIM_H
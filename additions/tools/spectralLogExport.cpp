@@ -0,0 +1,190 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Converts a binary spectral log back to text.
+ *
+ * Usage: spectralLogExport [--csv] [--from=N] [--count=N] LOG
+ *
+ * Maps an AS7265x_data_NN.bin log, as saved with --spectral-log=1 or 2,
+ * and writes it to stdout in the layout of the AS7265x_data_NN.txt file:
+ * the device versions and working sensors, then for each capture the time, temperatures, gain,
+ * integration time and the channel table, or the burst table for a burst.
+ * With --csv it writes one row a capture instead, with every field of the
+ * record, for spreadsheets and scripts. The records are read in place from
+ * the mapping, so a log can be exported while the camera is still adding
+ * to it, up to the last whole record.
+ *****************************************************/
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+#include "SpectralLog.h"
+
+/**
+* A capture in the layout the AS7265x unit writes to the text file.
+*/
+static void writeText(const SpectralRecord& record)
+{
+    printf("%s\n", record.image_id);
+    if (record.flags & SPECTRAL_HAS_TEMPERATURE)
+        for (gint i = 0; i < SPECTRAL_LOG_DEVICES; i++)
+            printf("Temp Sensor %d,%g\n", i + 1, record.temperature[i]);
+    if (record.flags & SPECTRAL_HAS_SETTINGS) {
+        printf("Sensor Gain,%u\n", record.gain);
+        printf("Sensor Integration Time,%u\n", record.integration);
+    }
+
+    if (record.flags & SPECTRAL_HAS_BURST) {
+        printf("Burst Readings,%u\n", record.burst_samples);
+        printf("Burst Rate,%g\n", record.burst_rate);
+        printf("Channel, Calibrated Mean, Calibrated SD, Standard Error\n");
+        for (gint i = 0; i < AS7265X_CHANNELS; i++) {
+            gdouble standard_error = (record.burst_samples > 1)
+                ? record.calibrated_sd[i] / std::sqrt((gdouble)record.burst_samples) : 0.0;
+            printf("%u,%g,%g,%g\n", AS7265xParse::wavelength[i], record.calibrated[i], record.calibrated_sd[i],
+                standard_error);
+        }
+    }
+    else if (record.flags & SPECTRAL_HAS_CALIBRATED) {
+        printf("Channel, Raw Data, Calibrated Data\n");
+        for (gint i = 0; i < AS7265X_CHANNELS; i++)
+            printf("%u,%u,%.7g\n", AS7265xParse::wavelength[i], record.raw[i], record.calibrated[i]);
+    }
+    printf("\n");
+}
+
+static void writeCsvHeader()
+{
+    printf("Sequence,Capture Time,Image,Reading ms,Temp Sensor 1,Temp Sensor 2,Temp Sensor 3,Sensor Gain,"
+        "Sensor Integration Time,Focus Index,Focus Value,Burst Readings,Burst Rate");
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        printf(",Raw %u", AS7265xParse::wavelength[i]);
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        printf(",Calibrated %u", AS7265xParse::wavelength[i]);
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        printf(",SD %u", AS7265xParse::wavelength[i]);
+    printf("\n");
+}
+
+/**
+* One row a capture. Fields the capture did not fill in are left empty.
+*/
+static void writeCsv(const SpectralRecord& record)
+{
+    time_t seconds = (time_t)(record.capture_time / G_USEC_PER_SEC);
+    struct tm tm;
+    gchar when[32];
+
+    localtime_r(&seconds, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%u,%s.%03d,%s,%u", record.sequence, when, (gint)(record.capture_time % G_USEC_PER_SEC / 1000),
+        record.image_id, record.reading_ms);
+
+    for (gint i = 0; i < SPECTRAL_LOG_DEVICES; i++)
+        if (record.flags & SPECTRAL_HAS_TEMPERATURE)
+            printf(",%g", record.temperature[i]);
+        else
+            printf(",");
+    if (record.flags & SPECTRAL_HAS_SETTINGS)
+        printf(",%u,%u", record.gain, record.integration);
+    else
+        printf(",,");
+    if (record.flags & SPECTRAL_HAS_FOCUS)
+        printf(",%d,%g", record.focus_index, record.focus_value);
+    else
+        printf(",,");
+    if (record.flags & SPECTRAL_HAS_BURST)
+        printf(",%u,%g", record.burst_samples, record.burst_rate);
+    else
+        printf(",,");
+
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        if (record.flags & SPECTRAL_HAS_RAW)
+            printf(",%u", record.raw[i]);
+        else
+            printf(",");
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        if (record.flags & SPECTRAL_HAS_CALIBRATED)
+            printf(",%.7g", record.calibrated[i]);
+        else
+            printf(",");
+    for (gint i = 0; i < AS7265X_CHANNELS; i++)
+        if (record.flags & SPECTRAL_HAS_BURST)
+            printf(",%g", record.calibrated_sd[i]);
+        else
+            printf(",");
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    gboolean csv = FALSE;
+    gint from = 0, count = -1;
+    GError* error = nullptr;
+    SpectralLogView log;
+
+    GOptionEntry entries[] = {
+        {"csv", 0, 0, G_OPTION_ARG_NONE, &csv, "One comma separated row a capture, with a header row", nullptr},
+        {"from", 0, 0, G_OPTION_ARG_INT, &from, "First record to export", "N"},
+        {"count", 0, 0, G_OPTION_ARG_INT, &count, "Records to export, all that are left by default", "N"},
+        {nullptr, 0, 0, G_OPTION_ARG_NONE, nullptr, nullptr, nullptr}
+    };
+
+    GOptionContext* context = g_option_context_new("LOG - export a binary spectral log as text");
+    g_option_context_add_main_entries(context, entries, nullptr);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || (argc != 2)) {
+        g_printerr("%s\n", error ? error->message : "Give one spectral log, see --help");
+        g_clear_error(&error);
+        g_option_context_free(context);
+        return 2;
+    }
+    g_option_context_free(context);
+
+    if (log.open(argv[1], &error) == -1) {
+        g_printerr("%s\n", error->message);
+        g_clear_error(&error);
+        return 1;
+    }
+
+    gsize first = (gsize)MAX(from, 0);
+    gsize last = (count < 0) ? log.count() : MIN(log.count(), first + (gsize)count);
+
+    if (csv)
+        writeCsvHeader();
+    else {
+        printf("AS7265x Hardware Version,%s\n", log.header().hardware_version);
+        printf("AS7265x Sofware Version,%s\n", log.header().software_version);
+        printf("Sensors working,%s\n", log.header().sensors);
+        printf("\n\n");
+    }
+
+    for (gsize i = first; i < last; i++) {
+        if (csv)
+            writeCsv(log.record(i));
+        else
+            writeText(log.record(i));
+    }
+
+    g_printerr("%" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " records exported from '%s'\n",
+        (last > first) ? last - first : 0, log.count(), argv[1]);
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Benchmark for the AS7265x reading parser.
+ *
+ * Usage: spectralParseBench [readings [corruptions]]
+ *
+ * Builds random ATDATA and ATCDATA reply pairs and times turning each pair
+ * into the 18 "nm,raw,cal" file lines, first the way the AS7265x unit used
+ * to (stringstream split into strings, reordered and joined back through an
+ * ostringstream) and then with AS7265xParse, and the parse alone without
+ * formatting the lines. Every parsed value is checked
+ * against strtoul and strtod. It then feeds the parser a list of malformed
+ * lines it must reject, and random corruptions of good lines (cut short,
+ * bytes changed, inserted or removed) which it must either reject or parse
+ * to sensible values, to catch anything the serial port might throw at it.
+ *****************************************************/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AS7265xParse.h"
+
+struct ReplyPair {
+    std::string raw;
+    std::string calibrated;
+};
+
+//The map the AS7265x unit used before, reply field to written position
+static const std::vector<int> old_order = { 8, 10, 12, 13, 14, 15, 6, 7, 9, 11, 16, 17, 0, 1, 2, 3, 4, 5 };
+
+static std::vector<std::string> split(const std::string& s, char delimiter)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(s);
+    while (std::getline(tokenStream, token, delimiter))
+        tokens.push_back(token);
+    return tokens;
+}
+
+/**
+* The old path. Returns the bytes written so the work cannot be optimised away.
+*/
+static gsize oldPath(const ReplyPair& reply)
+{
+    std::vector<std::string> raw_tokens = split(reply.raw, ',');
+    std::vector<std::string> calibrated_tokens = split(reply.calibrated, ',');
+    gsize bytes = 0;
+
+    for (gint index : old_order) {
+        std::ostringstream temp_data;
+        temp_data << AS7265xParse::field_wavelength[index] << "," << raw_tokens[index] << ","
+            << calibrated_tokens[index];
+        bytes += temp_data.str().size();
+    }
+    return bytes;
+}
+
+static gsize newPath(const ReplyPair& reply)
+{
+    AS7265xRaw raw;
+    AS7265xCalibrated calibrated;
+    gchar line[64];
+    gsize bytes = 0;
+
+    if (!AS7265xParse::parseRaw(reply.raw, &raw) || !AS7265xParse::parseCalibrated(reply.calibrated, &calibrated))
+        return 0;
+    for (gsize i = 0; i < AS7265X_CHANNELS; ++i)
+        bytes += g_snprintf(line, sizeof(line), "%u,%u,%.7g", AS7265xParse::wavelength[i], raw[i], calibrated[i]);
+    return bytes;
+}
+
+static gsize parseOnly(const ReplyPair& reply)
+{
+    AS7265xRaw raw;
+    AS7265xCalibrated calibrated;
+
+    if (!AS7265xParse::parseRaw(reply.raw, &raw) || !AS7265xParse::parseCalibrated(reply.calibrated, &calibrated))
+        return 0;
+    return raw[0] + (gsize)calibrated[0];
+}
+
+static std::vector<ReplyPair> makeReplies(gint count, std::mt19937& rng)
+{
+    std::uniform_int_distribution<guint> counts(0, G_MAXUINT16);
+    std::uniform_int_distribution<gint> hundredths(-5000, 2000000);
+    std::vector<ReplyPair> replies(count);
+
+    for (ReplyPair& reply : replies) {
+        for (gint field = 0; field < AS7265X_CHANNELS; ++field) {
+            const gchar* separator = (field < AS7265X_CHANNELS - 1) ? "," : " OK";
+            reply.raw += std::to_string(counts(rng)) + separator;
+            gint value = hundredths(rng);
+            gchar number[32];
+            g_snprintf(number, sizeof(number), "%s%d.%02d", (value < 0) ? "-" : "", ABS(value) / 100, ABS(value) % 100);
+            reply.calibrated += std::string(number) + separator;
+        }
+    }
+    return replies;
+}
+
+/**
+* Parses a line with strtoul and strtod and compares, field by field in wavelength order.
+*/
+static gboolean checkReply(const ReplyPair& reply)
+{
+    AS7265xRaw raw;
+    AS7265xCalibrated calibrated;
+    const gchar* raw_pos = reply.raw.c_str();
+    const gchar* calibrated_pos = reply.calibrated.c_str();
+
+    if (!AS7265xParse::parseRaw(reply.raw, &raw) || !AS7265xParse::parseCalibrated(reply.calibrated, &calibrated))
+        return FALSE;
+    for (gsize field = 0; field < AS7265X_CHANNELS; ++field) {
+        gchar* end;
+        gsize rank = AS7265xParse::field_rank[field];
+        gulong raw_value = strtoul(raw_pos, &end, 10);
+        raw_pos = end + 1;
+        gfloat calibrated_value = (gfloat)strtod(calibrated_pos, &end);
+        calibrated_pos = end + 1;
+
+        if ((raw[rank] != raw_value) || (calibrated[rank] != calibrated_value))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+template<typename Func>
+static gdouble timePath(const std::vector<ReplyPair>& replies, Func path, gsize* bytes)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (const ReplyPair& reply : replies)
+        *bytes += path(reply);
+    auto stop = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<gdouble, std::nano>(stop - start).count() / replies.size();
+}
+
+static gboolean checkMalformed()
+{
+    const std::string good = "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18";
+    const std::vector<std::string> bad = { "", "OK", "ERROR", good.substr(0, good.size() - 3), good + ",19",
+        good + ",", "," + good, good + " OKK", good + " OK x", "1,,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18",
+        "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,1x", "1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16;17;18",
+        "0x1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18", std::string("1,2,3\0,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18", 46) };
+    const std::vector<std::string> bad_raw = { "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,65536",
+        "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,-1", "1.5,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18" };
+    const std::vector<std::string> bad_calibrated = { "nan,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18",
+        "inf,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18", "1e99,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18",
+        ".,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18", "-,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18",
+        "1.2.3,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18" };
+    AS7265xRaw raw;
+    AS7265xCalibrated calibrated;
+    gint accepted = 0;
+
+    for (const std::string& line : bad) {
+        if (AS7265xParse::parseRaw(line, &raw) || AS7265xParse::parseCalibrated(line, &calibrated)) {
+            g_print("  accepted \"%s\"\n", line.c_str());
+            accepted++;
+        }
+    }
+    for (const std::string& line : bad_raw) {
+        if (AS7265xParse::parseRaw(line, &raw)) {
+            g_print("  accepted \"%s\"\n", line.c_str());
+            accepted++;
+        }
+    }
+    for (const std::string& line : bad_calibrated) {
+        if (AS7265xParse::parseCalibrated(line, &calibrated)) {
+            g_print("  accepted \"%s\"\n", line.c_str());
+            accepted++;
+        }
+    }
+
+    g_print("Malformed lines: %zu rejected, %d accepted %s\n", bad.size() + bad_raw.size() + bad_calibrated.size() - accepted,
+        accepted, accepted ? "FAIL" : "ok");
+    return accepted == 0;
+}
+
+static gboolean checkMutations(const std::vector<ReplyPair>& replies, gint mutations, std::mt19937& rng)
+{
+    const gchar alphabet[] = "0123456789,.-+eE OK\r\n\x01\xff";
+    std::uniform_int_distribution<gint> kind(0, 3);
+    std::uniform_int_distribution<gint> pick(0, sizeof(alphabet) - 2);
+    gint rejected = 0;
+    gint accepted = 0;
+    gint wrong = 0;
+
+    for (gint i = 0; i < mutations; ++i) {
+        const ReplyPair& reply = replies[i % replies.size()];
+        std::string line = (i & 1) ? reply.calibrated : reply.raw;
+        std::uniform_int_distribution<gsize> position(0, line.size() - 1);
+        AS7265xRaw raw;
+        AS7265xCalibrated calibrated;
+
+        switch (kind(rng)) {
+            case 0: line.resize(position(rng)); break;
+            case 1: line[position(rng)] = alphabet[pick(rng)]; break;
+            case 2: line.insert(position(rng), 1, alphabet[pick(rng)]); break;
+            default: line.erase(position(rng), 1); break;
+        }
+
+        //Work on a copy of just the line so reading past the end shows up under a sanitiser
+        std::vector<gchar> exact(line.begin(), line.end());
+        LineView view(exact.data(), exact.size());
+        gboolean parsed = (i & 1) ? AS7265xParse::parseCalibrated(view, &calibrated) : AS7265xParse::parseRaw(view, &raw);
+
+        if (!parsed) {
+            rejected++;
+            continue;
+        }
+        accepted++;
+        if (i & 1)
+            for (gfloat value : calibrated)
+                wrong += (value != value) || (value > G_MAXFLOAT) || (value < -G_MAXFLOAT);
+    }
+
+    g_print("Corrupted lines: %d rejected, %d still well formed, %d parsed to bad values %s\n", rejected,
+        accepted, wrong, wrong ? "FAIL" : "ok");
+    return wrong == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    gint count = (argc > 1) ? atoi(argv[1]) : 20000;
+    gint mutations = (argc > 2) ? atoi(argv[2]) : 1000000;
+    std::mt19937 rng(1234);
+    gboolean passed = TRUE;
+    gint mismatches = 0;
+    gsize old_bytes = 0;
+    gsize new_bytes = 0;
+    gsize parse_sink = 0;
+
+    if (count < 1) {
+        g_printerr("Usage: spectralParseBench [readings [corruptions]]\n");
+        return 1;
+    }
+
+    std::vector<ReplyPair> replies = makeReplies(count, rng);
+
+    g_print("Channels in wavelength order:");
+    for (gsize i = 0; i < AS7265X_CHANNELS; ++i) {
+        g_print(" %u", AS7265xParse::wavelength[i]);
+        passed = passed && ((i == 0) || (AS7265xParse::wavelength[i - 1] < AS7265xParse::wavelength[i]));
+    }
+    g_print("\n%d readings of ATDATA and ATCDATA, %zu and %zu bytes on average\n\n", count,
+        replies[0].raw.size(), replies[0].calibrated.size());
+
+    for (const ReplyPair& reply : replies)
+        mismatches += checkReply(reply) ? 0 : 1;
+
+    gdouble old_ns = timePath(replies, oldPath, &old_bytes);
+    gdouble new_ns = timePath(replies, newPath, &new_bytes);
+    gdouble parse_ns = timePath(replies, parseOnly, &parse_sink);
+    g_print("  %-12s %9.0f ns/reading %10.0f readings/s\n", "stringstream", old_ns, 1e9 / old_ns);
+    g_print("  %-12s %9.0f ns/reading %10.0f readings/s  %.1fx\n", "AS7265xParse", new_ns, 1e9 / new_ns, old_ns / new_ns);
+    g_print("  %-12s %9.0f ns/reading %10.0f readings/s  %.1fx, parsing alone\n", "AS7265xParse", parse_ns,
+        1e9 / parse_ns, old_ns / parse_ns);
+    g_print("Parsed values differing from strtoul/strtod: %d %s\n\n", mismatches, mismatches ? "FAIL" : "ok");
+    passed = passed && (mismatches == 0) && (new_bytes > 0) && (old_bytes > 0) && (parse_sink > 0);
+
+    passed = checkMalformed() && passed;
+    if (mutations > 0)
+        passed = checkMutations(replies, mutations, rng) && passed;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+/*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files(the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and /or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions :
+*
+*The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+*THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/****************************************************
+ * Checks the bytes the focus motor is sent.
+ *
+ * Usage: vcmWriteCheck
+ *
+ * Drives the real CameraI2CDevice, built for the VCM_CHIP it was
+ * compiled with, against a temporary file in place of the I2C device.
+ * The I2C_SLAVE ioctl is answered here, as a file has no slave address,
+ * and everything else goes through the real open and write calls. The
+ * file then holds exactly what the chip would have been sent: the set up
+ * write, a setFocus, queued moves clamped to the lens travel, and a ramp.
+ * Each is checked against the chip's datasheet message layout, written
+ * out again here rather than taken from VcmDriver.h. Last, /dev/full is
+ * used as the device to check a failed write is reported.
+ *
+ * Build it once per chip with -DVCM_CHIP=VcmDW9714, VcmDW9718S or
+ * VcmAK7375, as the tasks file does.
+ *****************************************************/
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/i2c-dev.h>
+#include <vector>
+
+#include "I2CsetFocus.h"
+
+#define CHECK_WAIT_MS 1000 //Longest wait for the write worker
+
+typedef std::vector<guint8> Message;
+
+static gint bind_count = 0;
+static glong bound_address = -1;
+
+/**
+* The I2C_SLAVE ioctl, answered for any file so the device can be a plain file. Every other
+* ioctl goes to the kernel as normal.
+*/
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list args;
+    va_start(args, request);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+
+    if (request == I2C_SLAVE) {
+        ++bind_count;
+        bound_address = (glong)arg;
+        return 0;
+    }
+    return (int)syscall(SYS_ioctl, fd, request, arg);
+}
+
+/* What each chip should be sent, from its datasheet. */
+struct ChipLayout {
+    const gchar* name;
+    guint8 address;
+    Message init; //Empty when the chip needs no set up
+    guint code_bits;
+};
+
+static const ChipLayout chip_layouts[] = {
+    { "DW9714", 0x0C, {}, 10 },            //Two bytes, PD=0 FLAG=0 D9..D4, then D3..D0 S3..S0
+    { "DW9718S", 0x0C, { 0x00, 0x00 }, 10 }, //CONTROL=0 to power up, then VCM_CURRENT from register 0x02
+    { "AK7375", 0x0C, { 0x02, 0x00 }, 12 },  //CONT=0 for active mode, then POSITION from register 0x00
+};
+
+/**
+* The move message for a focus index. Indices are clamped to the lens module travel, 50 to 900,
+* and chips with 12 bit positions are sent the index times 4.
+*/
+static Message moveMessage(const ChipLayout& chip, gint index)
+{
+    guint code = (guint)CLAMP(index, 50, 900) << (chip.code_bits - 10);
+
+    if (strcmp(chip.name, "DW9714") == 0)
+        return { (guint8)((code >> 4) & 0x3f), (guint8)((code & 0x0f) << 4) };
+    if (strcmp(chip.name, "DW9718S") == 0)
+        return { 0x02, (guint8)(code >> 8), (guint8)(code & 0xff) };
+    return { 0x00, (guint8)(code >> 4), (guint8)((code & 0x0f) << 4) };
+}
+
+static Message readDevice(const gchar* path)
+{
+    gchar* contents = nullptr;
+    gsize length = 0;
+    Message bytes;
+
+    if (g_file_get_contents(path, &contents, &length, nullptr))
+        bytes.assign((guint8*)contents, (guint8*)contents + length);
+    g_free(contents);
+    return bytes;
+}
+
+static void printBytes(const Message& bytes, gsize from)
+{
+    for (gsize i = from; (i < bytes.size()) && (i < from + 24); ++i)
+        g_print(" %02x", bytes[i]);
+    if (bytes.size() > from + 24)
+        g_print(" ...");
+}
+
+/**
+* Check what has been written to the device since the last check, and move the checked
+* position on past it.
+*
+* @return : TRUE when the new bytes are exactly expected.
+*/
+static gboolean checkWritten(const gchar* what, const gchar* path, const Message& expected, gsize* checked)
+{
+    Message written = readDevice(path);
+    gboolean ok = (written.size() == *checked + expected.size()) &&
+        (memcmp(written.data() + *checked, expected.data(), expected.size()) == 0);
+
+    g_print("  %-28s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) {
+        g_print("    expected");
+        printBytes(expected, 0);
+        g_print("\n    written ");
+        printBytes(written, *checked);
+        g_print("\n");
+    }
+    *checked = written.size();
+    return ok;
+}
+
+/**
+* Wait until the write worker has made writes bus transactions in all.
+*/
+static gboolean waitForWrites(const CameraI2CDevice& device, guint64 writes)
+{
+    for (gint waited = 0; waited < CHECK_WAIT_MS; ++waited) {
+        if (device.getStats().writes >= writes)
+            return TRUE;
+        g_usleep(1000);
+    }
+    return FALSE;
+}
+
+/**
+* Drive the device through a set up, a setFocus, queued moves and a ramp.
+*/
+static gboolean checkChip(const ChipLayout& chip, const gchar* path)
+{
+    CameraI2CDevice device(path);
+    GError* error = nullptr;
+    gsize checked = 0;
+    gboolean passed = TRUE;
+    Message expected;
+
+    if ((device.setup(&error)) == -1) {
+        g_print("  setup failed: %s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    passed = checkWritten("set up", path, chip.init, &checked) && passed;
+    g_print("  %-28s %s\n", "slave address bound once", ((bind_count == 1) && (bound_address == chip.address)) ?
+        "ok" : "FAIL");
+    passed = passed && (bind_count == 1) && (bound_address == chip.address);
+
+    passed = ((device.setFocus(280, &error)) == 0) && passed;
+    passed = checkWritten("setFocus 280", path, moveMessage(chip, 280), &checked) && passed;
+
+    //Queued moves, each written out by the worker before the next is asked for
+    const gint moves[] = { 600, 0, 1023, 280 };
+    guint64 writes = device.getStats().writes;
+    for (gint index : moves) {
+        gchar* what = g_strdup_printf("requestFocus %d", index);
+        passed = ((device.requestFocus(index, &error)) == 0) && waitForWrites(device, ++writes) && passed;
+        passed = checkWritten(what, path, moveMessage(chip, index), &checked) && passed;
+        g_free(what);
+    }
+
+    //A ramp, one message for each point of the profile
+    gint points[LENS_RAMP_MAX_POINTS];
+    guint ramp_time, count = LensRamp::rampProfile(280, 600, points, LENS_RAMP_MAX_POINTS);
+    expected.clear();
+    for (guint i = 0; i < count; ++i) {
+        Message move = moveMessage(chip, points[i]);
+        expected.insert(expected.end(), move.begin(), move.end());
+    }
+    passed = ((device.requestRamp(600, &ramp_time, &error)) == 0) &&
+        waitForWrites(device, writes + count) && passed;
+    gchar* what = g_strdup_printf("requestRamp 280 to 600, %u", count);
+    passed = checkWritten(what, path, expected, &checked) && passed;
+    g_free(what);
+
+    I2CWriteStats stats = device.getStats();
+    passed = passed && (stats.failures == 0) && (stats.writes == 1 + G_N_ELEMENTS(moves) + count);
+    if (error) {
+        g_print("  %s\n", error->message);
+        g_error_free(error);
+    }
+    return passed;
+}
+
+/**
+* A device that takes no bytes, so every write fails. Chips with a set up write fail setup,
+* the others fail the first move.
+*/
+static gboolean checkFailure(const ChipLayout& chip)
+{
+    CameraI2CDevice device("/dev/full");
+    GError* error = nullptr;
+    gboolean reported;
+
+    if (chip.init.empty())
+        reported = ((device.setup(&error)) == 0) && ((device.setFocus(280, &error)) == -1) &&
+            (device.getStats().failures == 1);
+    else
+        reported = ((device.setup(&error)) == -1);
+    reported = reported && (error != nullptr);
+
+    g_print("  %-28s %s%s%s\n", "write failure reported", reported ? "ok" : "FAIL", error ? ", " : "",
+        error ? error->message : "");
+    if (error)
+        g_error_free(error);
+    return reported;
+}
+
+gint main(gint argc, gchar* argv[])
+{
+    const ChipLayout* chip = nullptr;
+    gchar* path = nullptr;
+    gboolean passed;
+    gint fd;
+
+    if (argc > 1) {
+        g_printerr("Usage: %s\n", argv[0]);
+        return 1;
+    }
+    for (const ChipLayout& layout : chip_layouts)
+        if (strcmp(layout.name, FocusVcm::name) == 0)
+            chip = &layout;
+    if (!chip) {
+        g_printerr("No datasheet layout for the %s focus motor\n", FocusVcm::name);
+        return 1;
+    }
+
+    fd = g_file_open_tmp("vcmWriteCheck-XXXXXX", &path, nullptr);
+    if (fd < 0) {
+        g_printerr("Could not make a file to stand in for the I2C device\n");
+        return 1;
+    }
+    close(fd);
+
+    g_print("%s focus motor at 0x%02x, writing to %s\n", FocusVcm::name, FocusVcm::address, path);
+    passed = checkChip(*chip, path);
+    passed = checkFailure(*chip) && passed;
+    g_print("%s\n", passed ? "All writes match the datasheet" : "Writes differ from the datasheet");
+
+    unlink(path);
+    g_free(path);
+    return passed ? 0 : 1;
+}
@@ -575,7 +575,6 @@ typedef struct
   GstElement *focusValve;
   GstElement *focus_bin;
   GstElement *focus_enc;
-  GstElement *focus_enc_conv;
   GstElement *focus_enc_cap_filter;
   GstElement *focus_sink;  
   GstElement *svc_focusbin;
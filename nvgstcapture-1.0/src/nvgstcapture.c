@@ -136,6 +136,7 @@ typedef struct AuxBufferData {
 } AuxData;
 
 AdditionsParent* additions_parent;
+AdditionsSettings additions_settings;
 
 void focus_valve_open(void){
 
@@ -149,6 +150,14 @@ void focus_valve_close(void){
   g_object_set(app->ele.focusValve, "drop", TRUE, NULL);
 }
 
+void focus_crop_set(gint left, gint top, gint right, gint bottom){
+
+  //nvvidconv copies out [left, right) x [top, bottom), the output size never changes
+  if (app->ele.svc_focusvconv)
+    g_object_set(app->ele.svc_focusvconv, "left", left, "top", top,
+        "right", right, "bottom", bottom, NULL);
+}
+
 
 /**
   * a GOptionArgFunc callback function
@@ -2990,7 +2999,7 @@ static gboolean create_focus_scaling_bin (void)
   GstPad *sinkpad = NULL;
   GstPad *srcpad = NULL;
   GstCaps *caps = NULL;
-  GstCapsFeatures *feature = NULL;
+  gint focus_width, focus_height, focus_left, focus_top;
 
     /*'nvarguscamerasrc ! ' 
     'video/x-raw(memory:NVMM), '
@@ -3018,23 +3027,32 @@ static gboolean create_focus_scaling_bin (void)
   // Create the capsfilter element
   app->ele.svc_focusvconv_out_filter =
       gst_element_factory_make (NVGST_DEFAULT_CAPTURE_FILTER, NULL); //"capsfilter"
-  if (!app->ele.svc_imgvconv_out_filter) {
-    NVGST_ERROR_MESSAGE_V ("svc_img_bin Element %s creation failed \n",
+  if (!app->ele.svc_focusvconv_out_filter) {
+    NVGST_ERROR_MESSAGE_V ("svc_focus_bin Element %s creation failed \n",
         NVGST_DEFAULT_CAPTURE_FILTER);
     goto fail;
   }
 
+  /* Only the focus ROI and a small margin are copied out, unless a focus map needs the
+   * whole frame. The AF additions move the window with focus_crop_set, which changes
+   * nvvidconv's crop but not the output size, so nothing has to renegotiate.
+   */
+  additions_focus_crop_size (&additions_settings, app->capres.image_cap_width,
+      app->capres.image_cap_height, &focus_width, &focus_height);
+  focus_left = ((app->capres.image_cap_width - focus_width) / 2) & ~1;
+  focus_top = ((app->capres.image_cap_height - focus_height) / 2) & ~1;
+  focus_crop_set (focus_left, focus_top, focus_left + focus_width, focus_top + focus_height);
+
+  /* NV12 in system memory, so the focus metric can read the Y plane in place.
+   * This nvvidconv is the only copy out of NVMM, there is no colour conversion.
+   */
   caps = gst_caps_new_simple ("video/x-raw",
       "format", G_TYPE_STRING, "NV12",
-      "width", G_TYPE_INT, app->capres.image_cap_width,
-      "height", G_TYPE_INT, app->capres.image_cap_height, NULL);
-
-  //The two lines below may not be required
-  feature = gst_caps_features_new ("memory:NVMM", NULL);
-  gst_caps_set_features (caps, 0, feature);
+      "width", G_TYPE_INT, focus_width,
+      "height", G_TYPE_INT, focus_height, NULL);
 
   // Set capture caps on capture filter 
-  g_object_set (app->ele.svc_imgvconv_out_filter, "caps", caps, NULL);
+  g_object_set (app->ele.svc_focusvconv_out_filter, "caps", caps, NULL);
   gst_caps_unref (caps);
 
   gst_bin_add_many (GST_BIN (app->ele.svc_focusbin),
@@ -3635,27 +3653,22 @@ static gboolean
 create_focus_enc_bin (void)
 {
   GstPad *pad = NULL;
-  GstCapsFeatures *feature = NULL;
   GstCaps *caps = NULL;
 
   app->ele.focus_bin = gst_bin_new ("focus_bin");
 
-  /* Create image encode chain elements */
-  //app->ele.focus_enc_conv = gst_element_factory_make (NVGST_DEFAULT_VIDEO_CONVERTER, NULL);
-  app->ele.focus_enc_conv = gst_element_factory_make ("nvvidconv", NULL);
-  if (!app->ele.focus_enc_conv) {
-    NVGST_ERROR_MESSAGE ("videoconvert element could not be created for focus encode.\n");
-    goto fail;
-  }
-  gst_element_set_state (app->ele.focus_enc_conv, GST_STATE_NULL);
-
+  /* No converter here. The svc_focus_bin already hands over NV12 in system memory and
+   * the AF additions read its Y plane directly, with the stride from the GstVideoMeta.
+   * The capsfilter only pins the format so negotiation cannot pick something else.
+   */
   app->ele.focus_enc_cap_filter =
       gst_element_factory_make (NVGST_DEFAULT_CAPTURE_FILTER, NULL);
+  if (!app->ele.focus_enc_cap_filter) {
+    NVGST_ERROR_MESSAGE ("Focus capsfilter element could not be created.\n");
+    goto fail;
+  }
   caps =
-    gst_caps_new_simple ("video/x-raw","format", G_TYPE_STRING, "GRAY8", NULL);
-
-  //feature = gst_caps_features_new ("memory:NVMM", NULL);
-  //gst_caps_set_features (caps, 0, feature);
+    gst_caps_new_simple ("video/x-raw","format", G_TYPE_STRING, "NV12", NULL);
 
   g_object_set (G_OBJECT (app->ele.focus_enc_cap_filter), "caps", caps, NULL);
   gst_caps_unref (caps);
@@ -3688,22 +3701,17 @@ create_focus_enc_bin (void)
      g_signal_connect (G_OBJECT (app->ele.focus_sink), "handoff",
       G_CALLBACK (focusImageCaptured_C), additions_parent);
 
-  gst_bin_add_many (GST_BIN (app->ele.focus_bin), app->ele.focus_enc_conv,
+  gst_bin_add_many (GST_BIN (app->ele.focus_bin),
       app->ele.focus_enc_cap_filter, app->ele.focus_sink, NULL);
 
-  if ((gst_element_link (app->ele.focus_enc_conv, app->ele.focus_enc_cap_filter)) != TRUE) {
-    NVGST_ERROR_MESSAGE ("Elements could not link iconverter & iencoder\n");
-    goto fail;
-  }
-
   if ((gst_element_link (app->ele.focus_enc_cap_filter, app->ele.focus_sink)) != TRUE) {
-    NVGST_ERROR_MESSAGE ("Elements could not link iencoder & focus_sink\n");
+    NVGST_ERROR_MESSAGE ("Elements could not link focus capsfilter & focus_sink\n");
     goto fail;
   }
   
-  pad = gst_element_get_static_pad (app->ele.focus_enc_conv, "sink");
+  pad = gst_element_get_static_pad (app->ele.focus_enc_cap_filter, "sink");
   if (!pad) {
-    NVGST_ERROR_MESSAGE ("can't get static sink pad of iconverter\n");
+    NVGST_ERROR_MESSAGE ("can't get static sink pad of focus capsfilter\n");
     goto fail;
   }
   gst_element_add_pad (app->ele.focus_bin, gst_ghost_pad_new ("sink", pad));
@@ -4793,6 +4801,7 @@ main (int argc, char *argv[])
 
   /* Initialize capture params */
   capture_init_params ();
+  additions_settings_init (&additions_settings);
   GOptionEntry options_argus[] = {
     {"prev-res", 0, 0, G_OPTION_ARG_CALLBACK, parse_spec,
           "Preview width & height."
@@ -5005,6 +5014,118 @@ main (int argc, char *argv[])
           "Enumerate saturation value through 0 to 2 by a step of 0.1 for count number of times (use with --automate or -A only)",
         NULL}
     ,
+    {"focus-metric", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_metric,
+          "Autofocus sharpness metric. Range: 0 to 4 (0): Laplacian mean [Default] (1): Tenengrad "
+          "(2): Brenner (3): Variance of Laplacian (4): Normalized variance",
+        NULL}
+    ,
+    {"focus-roi-size", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_roi_size,
+          "Width and height of the autofocus window in pixels, cropped out by nvvidconv. Default = 200",
+        NULL}
+    ,
+    {"focus-map-cols", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_map_columns,
+          "Autofocus over a grid of tiles covering the whole frame, this many tiles across. "
+          "Default = 0 (single 200x200 centre window)",
+        NULL}
+    ,
+    {"focus-map-rows", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_map_rows,
+          "Number of focus map tiles down the frame (use with --focus-map-cols)",
+        NULL}
+    ,
+    {"focus-map-score", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_map_score,
+          "How focus map tiles are combined. (0): Sharpest tile [Default] (1): Centre weighted mean",
+        NULL}
+    ,
+    {"focus-search", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_search,
+          "How autofocus finds the peak after the coarse scans. (0): Fine detail scan [Default] "
+          "(1): Curve fit to the coarse scan, checked with a frame either side",
+        NULL}
+    ,
+    {"focus-scan", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_scan,
+          "How autofocus searches the full focus range. (0): Step the lens once per frame, in then out [Default] "
+          "(1): Sweep the lens in continuously, tagging every frame with its lens position "
+          "(2): Adaptive step bracket scan, then a golden section search of the peak",
+        NULL}
+    ,
+    {"focus-sweep-rate", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_sweep_rate,
+          "Focus indices per second the lens sweeps at with --focus-scan=1 [Default 300]",
+        NULL}
+    ,
+    {"focus-sweep-lag", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_sweep_lag,
+          "ms the lens lags the sweep, less half the exposure, when tagging frames [Default 0]",
+        NULL}
+    ,
+    {"focus-trace", 0, 0, G_OPTION_ARG_FILENAME, &additions_settings.focus_trace_file,
+          "Record every autofocus frame to this binary trace file, for replay with focusTraceReplay",
+        NULL}
+    ,
+    {"focus-settle", 0, 0, G_OPTION_ARG_FILENAME, &additions_settings.focus_settle_file,
+          "Lens settle model to time autofocus frames from, instead of fixed timeouts. "
+          "Written by --focus-settle-calibrate",
+        NULL}
+    ,
+    {"focus-settle-calibrate", 0, 0, G_OPTION_ARG_NONE, &additions_settings.focus_settle_calibrate,
+          "Measure how long the lens takes to settle after the first focus lock, and save it to the "
+          "--focus-settle file. Point the camera at a still, textured subject",
+        NULL}
+    ,
+    {"focus-memory", 0, 0, G_OPTION_ARG_FILENAME, &additions_settings.focus_memory_file,
+          "Remember where autofocus locks in this file, and start the next run's search from there "
+          "instead of scanning the full range",
+        NULL}
+    ,
+    {"focus-drift-threshold", 0, 0, G_OPTION_ARG_DOUBLE, &additions_settings.focus_drift_threshold,
+          "How much sustained change in the focus value, in noise sigmas summed over the held focus "
+          "checks, loses focus and starts a new search. Lower reacts sooner [Default 8]",
+        NULL}
+    ,
+    {"focus-drift-slack", 0, 0, G_OPTION_ARG_DOUBLE, &additions_settings.focus_drift_slack,
+          "Noise sigmas a held focus check has to be off before it adds to the drift sum [Default 1]",
+        NULL}
+    ,
+    {"focus-drift-noise-floor", 0, 0, G_OPTION_ARG_DOUBLE, &additions_settings.focus_drift_noise_floor,
+          "Smallest focus value noise the drift check assumes, in % of the focussed value [Default 2]",
+        NULL}
+    ,
+    {"focus-bracket", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_bracket_frames,
+          "On the GPIO button, capture this many images at focus positions around the locked focus, "
+          "and merge them into one image that is in focus throughout. They have to fit in the flash "
+          "window. Range: 2 to 16, Default = 0 (one image)",
+        NULL}
+    ,
+    {"focus-bracket-step", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_bracket_step,
+          "Focus indices between the focus bracket images [Default 10]",
+        NULL}
+    ,
+    {"focus-i2c-device", 0, 0, G_OPTION_ARG_STRING, &additions_settings.focus_i2c_device,
+          "I2C bus of the focus motor, camera-0, camera-1 or a device such as /dev/i2c-8 [Default camera-0]",
+        NULL}
+    ,
+    {"focus-stats", 0, 0, G_OPTION_ARG_INT, &additions_settings.focus_stats_interval,
+          "Seconds between logs of the autofocus queue, drift and state counters, 0 to only log them at exit [Default 0]",
+        NULL}
+    ,
+    {"spectral-integration", 0, 0, G_OPTION_ARG_INT, &additions_settings.spectral_integration,
+          "AS7265x integration time in 2.8 ms steps. Range: 1 to 255, Default = 255",
+        NULL}
+    ,
+    {"spectral-burst", 0, 0, G_OPTION_ARG_INT, &additions_settings.spectral_burst_samples,
+          "On the GPIO button, stream this many AS7265x readings and save their mean and spread "
+          "instead of a single reading. They have to fit in the flash window. "
+          "Range: 0 to 255, Default = 0 (one reading)",
+        NULL}
+    ,
+    {"spectral-device", 0, 0, G_OPTION_ARG_STRING, &additions_settings.spectral_device,
+          "Serial port of the AS7265x, USB0, UART1 and so on, or a device such as the pseudo "
+          "terminal of as7265xEmulator [Default USB0]",
+        NULL}
+    ,
+    {"spectral-log", 0, 0, G_OPTION_ARG_INT, &additions_settings.spectral_log,
+          "Where spectral data is saved. 0 = AS7265x_data_NN.txt, 1 = the text file and the "
+          "fixed record AS7265x_data_NN.bin log, 2 = AS7265x_data_NN.bin only. "
+          "spectralLogExport turns a .bin log back into text. Default = 0",
+        NULL}
+    ,
     {NULL}};
 
   ctx = g_option_context_new ("Nvidia GStreamer Camera Model Test");
@@ -5164,7 +5285,7 @@ main (int argc, char *argv[])
       &app->capres.image_cap_width,
       &app->capres.image_cap_height,
       trigger_image_capture, additions_exit_capture, 
-      focus_valve_open, focus_valve_close, &error);
+      focus_valve_open, focus_valve_close, focus_crop_set, &additions_settings, &error);
       //There's a GError* error=NULL; declared here at the start of main.
       //We'll pass that in and then use it for our error handling. We'll need a GError** error to
       //pass it through. Also, let's create a short exit function to call from the errorhandler.